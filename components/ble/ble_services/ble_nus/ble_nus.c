@@ -42,6 +42,7 @@
 #include "ble.h"
 #include "ble_nus.h"
 #include "ble_srv_common.h"
+#include "app_util_platform.h"
 
 #define NRF_LOG_MODULE_NAME ble_nus
 #if BLE_NUS_CONFIG_LOG_ENABLED
@@ -63,6 +64,101 @@ NRF_LOG_MODULE_REGISTER();
 
 #define NUS_BASE_UUID                  {{0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 0x93, 0xF3, 0xA3, 0xB5, 0x00, 0x00, 0x40, 0x6E}} /**< Used vendor specific UUID. */
 
+#define NUS_TX_CREDITS_UNKNOWN         UINT8_MAX            /**< The SoftDevice has not run out of room for notifications yet. */
+
+#if (BLE_NUS_TX_QUEUE_SIZE > 0)
+STATIC_ASSERT(BLE_NUS_TX_QUEUE_SIZE < UINT8_MAX);
+
+
+/**@brief Function for resetting the transmit queue of a link.
+ *
+ * @param[in] p_client Client context of the link.
+ */
+static void tx_queue_reset(ble_nus_client_context_t * p_client)
+{
+    memset(&p_client->tx_queue, 0, sizeof(p_client->tx_queue));
+    p_client->tx_queue.credits       = NUS_TX_CREDITS_UNKNOWN;
+    p_client->tx_queue.stats.max_len = BLE_GATT_ATT_MTU_DEFAULT - OPCODE_LENGTH - HANDLE_LENGTH;
+}
+
+
+/**@brief Function for handing queued notifications to the SoftDevice while it has room for them.
+ *
+ * @details Called from the contexts which queue data and from the BLE event handler. Only one
+ *          of them hands notifications over at a time, so that they are sent in order. One which
+ *          finds another busy leaves the work to it.
+ *
+ * @param[in] p_nus       Nordic UART Service structure.
+ * @param[in] p_client    Client context of the link.
+ * @param[in] conn_handle Connection handle of the link.
+ */
+static void tx_queue_process(ble_nus_t                * p_nus,
+                             ble_nus_client_context_t * p_client,
+                             uint16_t                   conn_handle)
+{
+    ble_nus_tx_queue_t * p_queue = &p_client->tx_queue;
+    bool                 process;
+
+    CRITICAL_REGION_ENTER();
+    p_queue->pending = true;
+    process          = !p_queue->busy;
+    p_queue->busy    = true;
+    CRITICAL_REGION_EXIT();
+
+    while (process)
+    {
+        p_queue->pending = false;
+
+        while ((p_queue->count > 0) && (p_queue->credits > 0))
+        {
+            // The notification at the head is no longer joined to, see ble_nus_data_queue.
+            uint16_t   length   = p_queue->buf[p_queue->head].length;
+            ret_code_t err_code = ble_nus_data_send(p_nus,
+                                                    p_queue->buf[p_queue->head].data,
+                                                    &length,
+                                                    conn_handle);
+
+            if (err_code == NRF_ERROR_RESOURCES)
+            {
+                // Wait for BLE_GATTS_EVT_HVN_TX_COMPLETE.
+                CRITICAL_REGION_ENTER();
+                p_queue->credits = 0;
+                CRITICAL_REGION_EXIT();
+                break;
+            }
+
+            CRITICAL_REGION_ENTER();
+            if (err_code == NRF_SUCCESS)
+            {
+                if (p_queue->credits != NUS_TX_CREDITS_UNKNOWN)
+                {
+                    p_queue->credits--;
+                }
+                p_queue->stats.bytes += length;
+                p_queue->stats.notifications++;
+                p_queue->stats.in_flight++;
+            }
+            else
+            {
+                NRF_LOG_DEBUG("Notification dropped, error 0x%x.", err_code);
+                p_queue->stats.dropped++;
+            }
+            p_queue->head = (p_queue->head + 1) % BLE_NUS_TX_QUEUE_SIZE;
+            p_queue->count--;
+            CRITICAL_REGION_EXIT();
+        }
+
+        CRITICAL_REGION_ENTER();
+        process = p_queue->pending;
+        if (!process)
+        {
+            p_queue->busy = false;
+        }
+        CRITICAL_REGION_EXIT();
+    }
+}
+#endif // (BLE_NUS_TX_QUEUE_SIZE > 0)
+
 
 /**@brief Function for handling the @ref BLE_GAP_EVT_CONNECTED event from the SoftDevice.
  *
@@ -86,6 +182,13 @@ static void on_connect(ble_nus_t * p_nus, ble_evt_t const * p_ble_evt)
                       p_ble_evt->evt.gap_evt.conn_handle);
     }
 
+#if (BLE_NUS_TX_QUEUE_SIZE > 0)
+    if (p_client != NULL)
+    {
+        tx_queue_reset(p_client);
+    }
+#endif
+
     /* Check the hosts CCCD value to inform of readiness to send data using the RX characteristic */
     memset(&gatts_val, 0, sizeof(ble_gatts_value_t));
     gatts_val.p_value = cccd_value;
@@ -202,6 +305,22 @@ static void on_hvx_tx_complete(ble_nus_t * p_nus, ble_evt_t const * p_ble_evt)
         return;
     }
 
+#if (BLE_NUS_TX_QUEUE_SIZE > 0)
+    ble_nus_tx_queue_t * p_queue = &p_client->tx_queue;
+    uint8_t const        count   = p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count;
+
+    // The count includes notifications of other services, each of them made room as well.
+    CRITICAL_REGION_ENTER();
+    p_queue->stats.in_flight -= MIN(p_queue->stats.in_flight, count);
+    if (p_queue->credits != NUS_TX_CREDITS_UNKNOWN)
+    {
+        p_queue->credits = MIN(p_queue->credits + count, NUS_TX_CREDITS_UNKNOWN - 1);
+    }
+    CRITICAL_REGION_EXIT();
+
+    tx_queue_process(p_nus, p_client, p_ble_evt->evt.gatts_evt.conn_handle);
+#endif
+
     if ((p_client->is_notification_enabled) && (p_nus->data_handler != NULL))
     {
         memset(&evt, 0, sizeof(ble_nus_evt_t));
@@ -351,4 +470,139 @@ uint32_t ble_nus_data_send(ble_nus_t * p_nus,
 }
 
 
+#if (BLE_NUS_TX_QUEUE_SIZE > 0)
+uint32_t ble_nus_data_queue(ble_nus_t     * p_nus,
+                            uint8_t const * p_data,
+                            uint16_t        length,
+                            uint8_t         join_len,
+                            uint16_t        conn_handle)
+{
+    ret_code_t                 err_code;
+    ble_nus_client_context_t * p_client;
+    ble_nus_tx_queue_t       * p_queue;
+
+    VERIFY_PARAM_NOT_NULL(p_nus);
+    VERIFY_PARAM_NOT_NULL(p_data);
+
+    err_code = blcm_link_ctx_get(p_nus->p_link_ctx_storage, conn_handle, (void *) &p_client);
+    VERIFY_SUCCESS(err_code);
+
+    if ((conn_handle == BLE_CONN_HANDLE_INVALID) || (p_client == NULL))
+    {
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    if (!p_client->is_notification_enabled)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    p_queue = &p_client->tx_queue;
+
+    if ((length == 0) || (length > p_queue->stats.max_len) ||
+        ((join_len != BLE_NUS_JOIN_NEVER) && (join_len > length)))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    CRITICAL_REGION_ENTER();
+
+    uint8_t const last = (p_queue->head + p_queue->count - 1) % BLE_NUS_TX_QUEUE_SIZE;
+
+    // The head may be in the hands of the SoftDevice while the queue is busy.
+    if ((join_len != BLE_NUS_JOIN_NEVER)                                          &&
+        (p_queue->count > 0)                                                      &&
+        !(p_queue->busy && (last == p_queue->head))                               &&
+        (p_queue->buf[last].join_len == join_len)                                 &&
+        (p_queue->buf[last].length + length - join_len <= p_queue->stats.max_len) &&
+        (memcmp(p_queue->buf[last].data, p_data, join_len) == 0))
+    {
+        memcpy(&p_queue->buf[last].data[p_queue->buf[last].length],
+               &p_data[join_len],
+               length - join_len);
+        p_queue->buf[last].length += length - join_len;
+        p_queue->stats.joined++;
+    }
+    else if (p_queue->count < BLE_NUS_TX_QUEUE_SIZE)
+    {
+        uint8_t const next = (p_queue->head + p_queue->count) % BLE_NUS_TX_QUEUE_SIZE;
+
+        memcpy(p_queue->buf[next].data, p_data, length);
+        p_queue->buf[next].length   = length;
+        p_queue->buf[next].join_len = join_len;
+        p_queue->count++;
+        p_queue->stats.high_water = MAX(p_queue->stats.high_water, p_queue->count);
+    }
+    else
+    {
+        p_queue->stats.full++;
+        err_code = NRF_ERROR_NO_MEM;
+    }
+
+    CRITICAL_REGION_EXIT();
+
+    if (err_code == NRF_SUCCESS)
+    {
+        tx_queue_process(p_nus, p_client, conn_handle);
+    }
+
+    return err_code;
+}
+
+
+uint32_t ble_nus_tx_stats_get(ble_nus_t          * p_nus,
+                              uint16_t             conn_handle,
+                              ble_nus_tx_stats_t * p_stats)
+{
+    ret_code_t                 err_code;
+    ble_nus_client_context_t * p_client;
+
+    VERIFY_PARAM_NOT_NULL(p_nus);
+    VERIFY_PARAM_NOT_NULL(p_stats);
+
+    err_code = blcm_link_ctx_get(p_nus->p_link_ctx_storage, conn_handle, (void *) &p_client);
+    VERIFY_SUCCESS(err_code);
+
+    if ((conn_handle == BLE_CONN_HANDLE_INVALID) || (p_client == NULL))
+    {
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    CRITICAL_REGION_ENTER();
+    *p_stats        = p_client->tx_queue.stats;
+    p_stats->queued = p_client->tx_queue.count;
+    CRITICAL_REGION_EXIT();
+
+    return NRF_SUCCESS;
+}
+#endif // (BLE_NUS_TX_QUEUE_SIZE > 0)
+
+
+void ble_nus_on_gatt_evt(ble_nus_t * p_nus, nrf_ble_gatt_evt_t const * p_gatt_evt)
+{
+#if (BLE_NUS_TX_QUEUE_SIZE > 0)
+    ble_nus_client_context_t * p_client;
+
+    if ((p_nus == NULL) || (p_gatt_evt->evt_id != NRF_BLE_GATT_EVT_ATT_MTU_UPDATED))
+    {
+        return;
+    }
+
+    if ((blcm_link_ctx_get(p_nus->p_link_ctx_storage,
+                           p_gatt_evt->conn_handle,
+                           (void *) &p_client) == NRF_SUCCESS) &&
+        (p_client != NULL))
+    {
+        uint16_t const max_len =
+            p_gatt_evt->params.att_mtu_effective - OPCODE_LENGTH - HANDLE_LENGTH;
+
+        p_client->tx_queue.stats.max_len = MIN(max_len, BLE_NUS_MAX_DATA_LEN);
+    }
+#else
+    UNUSED_PARAMETER(p_nus);
+    UNUSED_PARAMETER(p_gatt_evt);
+#endif
+}
+
+
 #endif // NRF_MODULE_ENABLED(BLE_NUS)
@@ -69,6 +69,7 @@
 #include "ble.h"
 #include "ble_srv_common.h"
 #include "nrf_sdh_ble.h"
+#include "nrf_ble_gatt.h"
 #include "ble_link_ctx_manager.h"
 
 #ifdef __cplusplus
@@ -107,6 +108,14 @@ extern "C" {
     #warning NRF_SDH_BLE_GATT_MAX_MTU_SIZE is not defined.
 #endif
 
+#ifndef BLE_NUS_TX_QUEUE_SIZE
+#define BLE_NUS_TX_QUEUE_SIZE 0
+#endif
+
+/**@brief   Value of the join_len parameter of @ref ble_nus_data_queue for data which must be sent
+ *          in a notification of its own. */
+#define BLE_NUS_JOIN_NEVER   0xFF
+
 
 /**@brief   Nordic UART Service event types. */
 typedef enum
@@ -133,6 +142,49 @@ typedef struct
 } ble_nus_evt_rx_data_t;
 
 
+/**@brief   Nordic UART Service transmit counters of a link, see @ref ble_nus_tx_stats_get.
+ *
+ * @details The counters start from zero when the link is connected.
+ */
+typedef struct
+{
+    uint32_t bytes;         /**< Bytes handed to the SoftDevice in notifications. */
+    uint32_t notifications; /**< Notifications handed to the SoftDevice. */
+    uint32_t joined;        /**< Data queued by joining it to a notification already queued. */
+    uint32_t dropped;       /**< Queued notifications dropped because the SoftDevice refused them, for example after notification was disabled. */
+    uint32_t full;          /**< Calls to @ref ble_nus_data_queue refused because the queue was full. */
+    uint16_t max_len;       /**< Largest notification, from the ATT MTU of the link. */
+    uint8_t  queued;        /**< Notifications waiting in the queue. */
+    uint8_t  high_water;    /**< Most notifications waiting in the queue. */
+    uint8_t  in_flight;     /**< Notifications handed to the SoftDevice and not yet sent. */
+} ble_nus_tx_stats_t;
+
+
+#if (BLE_NUS_TX_QUEUE_SIZE > 0)
+/**@brief   Nordic UART Service transmit queue of a link.
+ *
+ * @details Notifications are built in the queue and handed to the SoftDevice as long as it
+ *          has room for them. When it runs out, the queue waits for
+ *          @ref BLE_GATTS_EVT_HVN_TX_COMPLETE and hands over as many notifications as were sent.
+ */
+typedef struct
+{
+    struct
+    {
+        uint16_t length;                     /**< Length of the notification. */
+        uint8_t  join_len;                   /**< join_len of the data in the notification. */
+        uint8_t  data[BLE_NUS_MAX_DATA_LEN]; /**< Notification data. */
+    } buf[BLE_NUS_TX_QUEUE_SIZE];
+    uint8_t            head;                 /**< Next notification to hand to the SoftDevice. */
+    uint8_t            count;                /**< Notifications in the queue. */
+    uint8_t            credits;              /**< Notifications the SoftDevice has room for, UINT8_MAX until it first runs out. */
+    volatile bool      busy;                 /**< A context is handing notifications to the SoftDevice. */
+    volatile bool      pending;              /**< Notifications were queued or room was made while busy. */
+    ble_nus_tx_stats_t stats;                /**< Transmit counters. */
+} ble_nus_tx_queue_t;
+#endif
+
+
 /**@brief Nordic UART Service client context structure.
  *
  * @details This structure contains state context related to hosts.
@@ -140,6 +192,9 @@ typedef struct
 typedef struct
 {
     bool is_notification_enabled; /**< Variable to indicate if the peer has enabled notification of the RX characteristic.*/
+#if (BLE_NUS_TX_QUEUE_SIZE > 0)
+    ble_nus_tx_queue_t tx_queue;  /**< Transmit queue. */
+#endif
 } ble_nus_client_context_t;
 
 
@@ -235,6 +290,69 @@ uint32_t ble_nus_data_send(ble_nus_t * p_nus,
                            uint16_t    conn_handle);
 
 
+#if (BLE_NUS_TX_QUEUE_SIZE > 0)
+/**@brief   Function for queuing data to be sent to the peer.
+ *
+ * @details The data is copied to the transmit queue of the link and sent as a notification as
+ *          soon as the SoftDevice has room for it. The function does not wait.
+ *
+ *          Small pieces of data are sent together: data is joined to the last notification
+ *          in the queue, if that has not been handed to the SoftDevice yet, was queued with the
+ *          same join_len, starts with the same join_len bytes and has room for the rest. The
+ *          first join_len bytes of the data are then left out. A join_len of 0 joins
+ *          any such data, as for a byte stream. @ref BLE_NUS_JOIN_NEVER sends the data in
+ *          a notification of its own.
+ *
+ *          Data sent with @ref ble_nus_data_send on the same link may overtake queued data.
+ *
+ * @param[in] p_nus       Pointer to the Nordic UART Service structure.
+ * @param[in] p_data      Data to be sent.
+ * @param[in] length      Length of the data. At most the length allowed by the ATT MTU of
+ *                        the link, see @ref ble_nus_on_gatt_evt.
+ * @param[in] join_len    Length of the header which data joined to the same notification must
+ *                        share, or @ref BLE_NUS_JOIN_NEVER.
+ * @param[in] conn_handle Connection Handle of the destination client.
+ *
+ * @retval NRF_SUCCESS             If the data was queued.
+ * @retval NRF_ERROR_NOT_FOUND     If there is no such client.
+ * @retval NRF_ERROR_INVALID_STATE If the client has not enabled notification.
+ * @retval NRF_ERROR_INVALID_PARAM If the data does not fit in a notification.
+ * @retval NRF_ERROR_NO_MEM        If the queue is full. @ref BLE_NUS_EVT_TX_RDY follows when
+ *                                 there is room again.
+ */
+uint32_t ble_nus_data_queue(ble_nus_t     * p_nus,
+                            uint8_t const * p_data,
+                            uint16_t        length,
+                            uint8_t         join_len,
+                            uint16_t        conn_handle);
+
+
+/**@brief   Function for getting the transmit counters of a link.
+ *
+ * @param[in]  p_nus       Pointer to the Nordic UART Service structure.
+ * @param[in]  conn_handle Connection Handle of the client.
+ * @param[out] p_stats     Transmit counters.
+ *
+ * @retval NRF_SUCCESS         If the counters were read.
+ * @retval NRF_ERROR_NOT_FOUND If there is no such client.
+ */
+uint32_t ble_nus_tx_stats_get(ble_nus_t          * p_nus,
+                              uint16_t             conn_handle,
+                              ble_nus_tx_stats_t * p_stats);
+#endif
+
+
+/**@brief   Function for handling the GATT module's events.
+ *
+ * @details Sets the largest notification the transmit queue of the link builds from the
+ *          ATT MTU.
+ *
+ * @param[in] p_nus      Pointer to the Nordic UART Service structure.
+ * @param[in] p_gatt_evt Event received from the GATT module.
+ */
+void ble_nus_on_gatt_evt(ble_nus_t * p_nus, nrf_ble_gatt_evt_t const * p_gatt_evt);
+
+
 #ifdef __cplusplus
 }
 #endif
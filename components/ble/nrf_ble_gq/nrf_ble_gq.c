@@ -42,11 +42,23 @@
 #if NRF_MODULE_ENABLED(NRF_BLE_GQ)
 
 #include "nrf_ble_gq.h"
+#include "app_util_platform.h"
+#if NRF_BLE_GQ_LATENCY_ENABLED
+#include "app_timer.h"
+#endif
 
 #define NRF_LOG_MODULE_NAME nrf_ble_gq
 #include "nrf_log.h"
 NRF_LOG_MODULE_REGISTER();
 
+#define RES_PROC             0x01 /**< GATTC procedure, one at a time per connection. */
+#define RES_IND              0x02 /**< Indication, one at a time per connection. */
+#define RES_HVN              0x04 /**< Notification, up to hvn_tx_queue_size per connection. */
+#define RES_WCMD             0x08 /**< Write command, up to write_cmd_tx_queue_size per connection. */
+
+#define ATT_HEADER_LEN       3    /**< Opcode and handle, added to the payload in the request cost. */
+#define ATT_HANDLE_RANGE_LEN 4    /**< Cost of the requests without payload, over the header. */
+
 /**@brief Pointer used to describe memory allocator for GATT request. */
 typedef ret_code_t (* req_data_alloc_t) (nrf_memobj_pool_t const * p_data_pool, 
                                          nrf_ble_gq_req_t  * const p_req);
@@ -170,21 +182,239 @@ __STATIC_INLINE void request_err_code_handle(nrf_ble_gq_req_t const * const p_re
 }
 
 
-/**@brief Function processes subsequent requests from the BGQ instance queue.
+/**@brief Function finds the SoftDevice resource a GATT request takes.
+ *
+ * @param[in] p_req  Pointer to GATT request.
+ *
+ * @return    One of the RES_ bits.
+ */
+static uint8_t req_res_get(nrf_ble_gq_req_t const * const p_req)
+{
+    switch (p_req->type)
+    {
+        case NRF_BLE_GQ_REQ_GATTC_WRITE:
+            return (p_req->params.gattc_write.write_op == BLE_GATT_OP_WRITE_CMD) ? RES_WCMD : RES_PROC;
+
+        case NRF_BLE_GQ_REQ_GATTS_HVX:
+            return (p_req->params.gatts_hvx.type == BLE_GATT_HVX_NOTIFICATION) ? RES_HVN : RES_IND;
+
+        default:
+            return RES_PROC;
+    }
+}
+
+
+/**@brief Function computes the cost of a queued GATT request for the scheduler.
+ *
+ * @param[in] p_req  Pointer to GATT request, as stored in the queue.
+ *
+ * @return    Bytes the request puts on air, about.
+ */
+static uint32_t queued_req_cost_get(nrf_ble_gq_req_t const * const p_req)
+{
+    uint16_t len;
+
+    switch (p_req->type)
+    {
+        case NRF_BLE_GQ_REQ_GATTC_WRITE:
+            return p_req->params.gattc_write.len + ATT_HEADER_LEN;
+
+        case NRF_BLE_GQ_REQ_GATTS_HVX:
+            // The length is stored in front of the data.
+            nrf_memobj_read(p_req->p_mem_obj, (void *) &len, sizeof(uint16_t), 0);
+            return len + ATT_HEADER_LEN;
+
+        default:
+            return ATT_HEADER_LEN + ATT_HANDLE_RANGE_LEN;
+    }
+}
+
+
+/**@brief Function checks if the SoftDevice can take a request of a connection.
+ *
+ * @param[in] p_link  Pointer to the scheduler state of the connection.
+ * @param[in] res     Resource the request takes, one of the RES_ bits.
+ *
+ * @retval    true   The resource is free, as far as the module knows.
+ * @retval    false  The resource is busy, full or out of credits.
+ */
+static bool res_free(nrf_ble_gq_link_t const * const p_link, uint8_t res)
+{
+    if (((p_link->busy | p_link->full) & res) != 0)
+    {
+        return false;
+    }
+    if ((res == RES_HVN) &&
+        (p_link->cfg.hvn_tx_queue_size != 0) &&
+        (p_link->hvn_in_flight >= p_link->cfg.hvn_tx_queue_size))
+    {
+        return false;
+    }
+    if ((res == RES_WCMD) &&
+        (p_link->cfg.write_cmd_tx_queue_size != 0) &&
+        (p_link->wcmd_in_flight >= p_link->cfg.write_cmd_tx_queue_size))
+    {
+        return false;
+    }
+    return true;
+}
+
+
+/**@brief Function takes the SoftDevice resource of a connection for a request about to be handed
+ *        to it.
+ *
+ * @details Notifications and write commands take their credit before the call, so a TX complete
+ *          event coming during the call cannot return it before it was taken.
+ *
+ * @param[in]  p_link  Pointer to the scheduler state of the connection.
+ * @param[in]  res     Resource the request takes, one of the RES_ bits.
+ * @param[out] p_evts  GATT events of the connection counted so far.
+ *
+ * @retval    true   The resource was free and is taken.
+ * @retval    false  The resource is busy, full or out of credits.
+ */
+static bool res_take(nrf_ble_gq_link_t * const p_link, uint8_t res, uint8_t * const p_evts)
+{
+    bool taken;
+
+    CRITICAL_REGION_ENTER();
+    taken = res_free(p_link, res);
+    if (taken)
+    {
+        if ((res == RES_HVN) && (p_link->hvn_in_flight < UINT8_MAX))
+        {
+            p_link->hvn_in_flight++;
+        }
+        else if ((res == RES_WCMD) && (p_link->wcmd_in_flight < UINT8_MAX))
+        {
+            p_link->wcmd_in_flight++;
+        }
+        *p_evts = p_link->evts;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return taken;
+}
+
+
+/**@brief Function updates the scheduler state of a connection after a request was handed to the
+ *        SoftDevice.
+ *
+ * @details A resource is marked busy or full only if no GATT event of the connection came during
+ *          the call. One that did may have freed it already, the request is attempted again.
+ *
+ * @param[in] p_link    Pointer to the scheduler state of the connection.
+ * @param[in] res       Resource the request takes, one of the RES_ bits.
+ * @param[in] evts      GATT events of the connection counted by @ref res_take.
+ * @param[in] err_code  Error code returned by SoftDevice.
+ *
+ * @retval    true   The request is done with, accepted or failed.
+ * @retval    false  The resource is held, the request should be attempted again later.
+ */
+static bool request_outcome_handle(nrf_ble_gq_link_t * const p_link,
+                                   uint8_t                   res,
+                                   uint8_t                   evts,
+                                   ret_code_t                err_code)
+{
+    bool done = true;
+
+    CRITICAL_REGION_ENTER();
+    if (err_code != NRF_SUCCESS)
+    {
+        // The SoftDevice did not take the packet, give the credit back.
+        if ((res == RES_HVN) && (p_link->hvn_in_flight > 0))
+        {
+            p_link->hvn_in_flight--;
+        }
+        else if ((res == RES_WCMD) && (p_link->wcmd_in_flight > 0))
+        {
+            p_link->wcmd_in_flight--;
+        }
+    }
+    if (err_code == NRF_ERROR_BUSY) // Softdevice is processing another GATT request.
+    {
+        if (p_link->evts == evts)
+        {
+            p_link->busy |= res;
+        }
+        done = false;
+    }
+    else if ((err_code == NRF_ERROR_RESOURCES) && ((res & (RES_HVN | RES_WCMD)) != 0))
+    {
+        // No buffers left for this connection, they are freed as packets go out.
+        if (p_link->evts == evts)
+        {
+            p_link->full |= res;
+        }
+        done = false;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return done;
+}
+
+
+/**@brief Function returns credits of a connection on a TX complete event.
+ *
+ * @param[in,out] p_in_flight  Pointer to the number of packets in the SoftDevice.
+ * @param[in]     count        Packets sent. It includes the ones sent around the module.
+ */
+static void credits_return(uint8_t * const p_in_flight, uint8_t count)
+{
+    *p_in_flight = (count < *p_in_flight) ? (uint8_t)(*p_in_flight - count) : 0;
+}
+
+
+/**@brief Function adds a dispatched request to the counters of its queue.
+ *
+ * @param[in] p_stats  Pointer to the counters.
+ * @param[in] wait     Time the request spent queued, in app_timer ticks.
+ */
+static void stats_record(nrf_ble_gq_stats_t * const p_stats, uint32_t wait)
+{
+    CRITICAL_REGION_ENTER();
+    p_stats->dispatched++;
+    p_stats->wait_total += wait;
+    if (wait > p_stats->wait_max)
+    {
+        p_stats->wait_max = wait;
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+
+/**@brief Function processes the request at the head of a BGQ instance queue.
  *
  * @param[in] p_queue      Pointer to the queue instance.
  * @param[in] conn_handle  Connection handle.
+ * @param[in] p_link       Pointer to the scheduler state of the connection.
+ * @param[in] p_stats      Pointer to the counters of the queue.
+ *
+ * @retval    true   The request is done with, accepted by the SoftDevice or failed.
+ * @retval    false  The queue is empty or the request waits for the SoftDevice.
  */
-static void queue_process(nrf_queue_t const * const p_queue, uint16_t conn_handle)
+static bool queue_process(nrf_queue_t        const * const p_queue,
+                          uint16_t                         conn_handle,
+                          nrf_ble_gq_link_t        * const p_link,
+                          nrf_ble_gq_stats_t       * const p_stats)
 {
     ret_code_t       err_code;
     nrf_ble_gq_req_t ble_req;
+    uint8_t          res;
+    uint8_t          evts;
+    bool             done = false;
 
     NRF_LOG_DEBUG("Processing the request queue...");
 
     err_code = nrf_queue_peek(p_queue, &ble_req);
     if (err_code == NRF_SUCCESS) // Queue is not empty
     {
+        res = req_res_get(&ble_req);
+        if (!res_take(p_link, res, &evts))
+        {
+            return false;
+        }
+
         switch (ble_req.type)
         {
             case NRF_BLE_GQ_REQ_GATTC_READ:
@@ -267,13 +497,22 @@ static void queue_process(nrf_queue_t const * const p_queue, uint16_t conn_handl
                 break;
         }
 
-        if (err_code == NRF_ERROR_BUSY) // Softdevice is processing another GATT request.
+        if (!request_outcome_handle(p_link, res, evts, err_code))
         {
             NRF_LOG_DEBUG("SD is currently busy. The GATT request procedure will be attempted \
                           again later.");
         }
         else
         {
+            if (err_code == NRF_SUCCESS)
+            {
+                uint32_t wait = 0;
+#if NRF_BLE_GQ_LATENCY_ENABLED
+                wait = app_timer_cnt_diff_compute(app_timer_cnt_get(), ble_req.timestamp);
+#endif
+                stats_record(p_stats, wait);
+            }
+
             // Remove last request descriptor from the queue and free data associated with it.
             if (m_req_data_alloc[ble_req.type] != NULL)
             {
@@ -283,6 +522,152 @@ static void queue_process(nrf_queue_t const * const p_queue, uint16_t conn_handl
             UNUSED_RETURN_VALUE(nrf_queue_pop(p_queue, &ble_req));
 
             request_err_code_handle(&ble_req, conn_handle, err_code);
+            done = true;
+        }
+    }
+    return done;
+}
+
+
+/**@brief Function finds the queue of a connection for a priority level.
+ *
+ * @param[in] p_gatt_queue  Pointer to the BGQ instance.
+ * @param[in] conn_id       Connection ID.
+ * @param[in] level         Priority level.
+ *
+ * @return    Pointer to the queue instance, NULL if the BGQ instance has no queues of that level.
+ */
+static nrf_queue_t const * level_queue_get(nrf_ble_gq_t const * const p_gatt_queue,
+                                           uint16_t                   conn_id,
+                                           uint8_t                    level)
+{
+    if (level == NRF_BLE_GQ_PRIO_HIGH)
+    {
+        return (p_gatt_queue->p_high_queue != NULL) ? &p_gatt_queue->p_high_queue[conn_id] : NULL;
+    }
+    return &p_gatt_queue->p_req_queue[conn_id];
+}
+
+
+/**@brief Function finds the priority level of a request.
+ *
+ * @param[in] p_gatt_queue  Pointer to the BGQ instance.
+ * @param[in] conn_id       Connection ID.
+ * @param[in] type          Request type.
+ *
+ * @return    High if the connection or the request type is high priority, normal otherwise.
+ */
+static uint8_t req_level_get(nrf_ble_gq_t const * const p_gatt_queue,
+                             uint16_t                   conn_id,
+                             nrf_ble_gq_req_type_t      type)
+{
+    if ((p_gatt_queue->p_links[conn_id].cfg.prio == NRF_BLE_GQ_PRIO_HIGH) ||
+        (p_gatt_queue->p_sched->type_prio[type] == NRF_BLE_GQ_PRIO_HIGH))
+    {
+        return NRF_BLE_GQ_PRIO_HIGH;
+    }
+    return NRF_BLE_GQ_PRIO_NORMAL;
+}
+
+
+/**@brief Function checks if nothing of a priority level or higher waits for a connection.
+ *
+ * @param[in] p_gatt_queue  Pointer to the BGQ instance.
+ * @param[in] conn_id       Connection ID.
+ * @param[in] level         Priority level.
+ *
+ * @retval    true   The queues of the level and the ones above are empty.
+ * @retval    false  There is a request queued.
+ */
+static bool queues_empty(nrf_ble_gq_t const * const p_gatt_queue, uint16_t conn_id, uint8_t level)
+{
+    for (uint8_t l = level; l < NRF_BLE_GQ_PRIO_NUM; l++)
+    {
+        nrf_queue_t const * p_queue = level_queue_get(p_gatt_queue, conn_id, l);
+
+        if ((p_queue != NULL) && !nrf_queue_is_empty(p_queue))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**@brief Function resets the scheduler state of a connection.
+ *
+ * @param[in] p_link  Pointer to the scheduler state of the connection.
+ */
+static void link_reset(nrf_ble_gq_link_t * const p_link)
+{
+    memset(p_link, 0, sizeof(nrf_ble_gq_link_t));
+    p_link->cfg.weight = 1;
+}
+
+
+/**@brief Function serves a connection for one scheduler round.
+ *
+ * @details The connection gets its quantum and sends from the queue of the level while the
+ *          cost of the head request fits in what it has, the rest is kept for the next round.
+ *          A connection with nothing to send keeps nothing.
+ *
+ * @param[in] p_gatt_queue  Pointer to the BGQ instance.
+ * @param[in] conn_id       Connection ID.
+ * @param[in] level         Priority level.
+ *
+ * @retval    true   The connection has requests the SoftDevice can take in the next round.
+ * @retval    false  The queue is empty or the resource its head request takes is held.
+ */
+static bool link_serve(nrf_ble_gq_t const * const p_gatt_queue, uint16_t conn_id, uint8_t level)
+{
+    nrf_queue_t const * p_queue     = level_queue_get(p_gatt_queue, conn_id, level);
+    nrf_ble_gq_link_t * p_link      = &p_gatt_queue->p_links[conn_id];
+    uint16_t            conn_handle = p_gatt_queue->p_conn_handles[conn_id];
+    uint32_t            quantum     = NRF_BLE_GQ_DRR_QUANTUM * p_link->cfg.weight;
+    nrf_ble_gq_req_t    ble_req;
+
+    if ((p_queue == NULL) || (conn_handle == BLE_CONN_HANDLE_INVALID))
+    {
+        return false;
+    }
+
+    if (nrf_queue_peek(p_queue, &ble_req) != NRF_SUCCESS)
+    {
+        p_link->deficit[level] = 0;
+        return false;
+    }
+    if (!res_free(p_link, req_res_get(&ble_req)))
+    {
+        return false;
+    }
+
+    p_link->deficit[level] += quantum;
+
+    for (;;)
+    {
+        uint32_t cost = queued_req_cost_get(&ble_req);
+
+        if (cost > p_link->deficit[level])
+        {
+            return true;
+        }
+
+        if (!queue_process(p_queue, conn_handle, p_link, &p_link->stats[level]))
+        {
+            // Held by the SoftDevice, do not let the share pile up meanwhile.
+            p_link->deficit[level] = MIN(p_link->deficit[level], quantum);
+            return false;
+        }
+        p_link->deficit[level] -= cost;
+
+        if (nrf_queue_peek(p_queue, &ble_req) != NRF_SUCCESS)
+        {
+            p_link->deficit[level] = 0;
+            return false;
+        }
+        if (!res_free(p_link, req_res_get(&ble_req)))
+        {
+            return false;
         }
     }
 }
@@ -291,6 +676,8 @@ static void queue_process(nrf_queue_t const * const p_queue, uint16_t conn_handl
 /**@brief Function purges all requests from BGQ instance queues that are
  *        no longer used by any connection.
  *
+ * @details Called with the scheduler lock held, the queues are not served meanwhile.
+ *
  * @param[in] p_gatt_queue Pointer to the BGQ instance.
  */
 static void queues_purge(nrf_ble_gq_t const * const p_gatt_queue)
@@ -302,40 +689,133 @@ static void queues_purge(nrf_ble_gq_t const * const p_gatt_queue)
 
     while (err_code == NRF_SUCCESS)
     {
-        nrf_ble_gq_req_t    ble_req;
-        nrf_queue_t const * p_queue;
-
         NRF_LOG_DEBUG("Purging request queue with id: %d", conn_id);
 
-        p_queue  = &p_gatt_queue->p_req_queue[conn_id];
-        err_code = nrf_queue_pop(p_queue, &ble_req);
-
-        while (err_code == NRF_SUCCESS)
+        for (uint8_t level = 0; level < NRF_BLE_GQ_PRIO_NUM; level++)
         {
-            // Free data associated with this request if there is any.
-            if (m_req_data_alloc[ble_req.type] != NULL)
+            nrf_ble_gq_req_t    ble_req;
+            nrf_queue_t const * p_queue;
+
+            p_queue = level_queue_get(p_gatt_queue, conn_id, level);
+            if (p_queue == NULL)
             {
-                nrf_memobj_free(ble_req.p_mem_obj);
-                NRF_LOG_DEBUG("Pointer to freed memory block: %p.", ble_req.p_mem_obj);
+                continue;
             }
 
             err_code = nrf_queue_pop(p_queue, &ble_req);
+
+            while (err_code == NRF_SUCCESS)
+            {
+                // Free data associated with this request if there is any.
+                if (m_req_data_alloc[ble_req.type] != NULL)
+                {
+                    nrf_memobj_free(ble_req.p_mem_obj);
+                    NRF_LOG_DEBUG("Pointer to freed memory block: %p.", ble_req.p_mem_obj);
+                }
+
+                err_code = nrf_queue_pop(p_queue, &ble_req);
+            }
         }
 
+        // The ID can be registered again.
+        p_gatt_queue->p_links[conn_id].purge = 0;
+
         err_code = nrf_queue_pop(p_gatt_queue->p_purge_queue, &conn_id);
     }
 }
 
 
+/**@brief Function takes the scheduler lock of a BGQ instance.
+ *
+ * @details The holder is the only one handing requests to the SoftDevice, taking them out of the
+ *          queues and using the deficits of the connections.
+ *
+ * @param[in] p_sched  Pointer to scheduler state of the instance.
+ *
+ * @retval    true   The lock was taken.
+ * @retval    false  Another caller holds it, possibly one this call interrupted.
+ */
+static bool sched_lock(nrf_ble_gq_sched_t * const p_sched)
+{
+    return nrf_atomic_flag_set_fetch(&p_sched->running) == 0;
+}
+
+
+/**@brief Function hands queued requests of all connections to the SoftDevice.
+ *
+ * @details High priority queues are served before normal ones. Within a level, connections are
+ *          served by deficit round-robin, starting from a different one on every call, until
+ *          none of them has a request the SoftDevice can take. A call made while the scheduler
+ *          lock is held, from an error handler, an event or an interrupt, only asks the holder
+ *          to run another pass. The holder checks for that after letting go of the lock too, so
+ *          no call is lost.
+ *
+ * @param[in] p_gatt_queue  Pointer to the BGQ instance.
+ */
+static void queues_schedule(nrf_ble_gq_t const * const p_gatt_queue)
+{
+    nrf_ble_gq_sched_t * p_sched = p_gatt_queue->p_sched;
+
+    UNUSED_RETURN_VALUE(nrf_atomic_flag_set(&p_sched->again));
+
+    while ((p_sched->again != 0) && sched_lock(p_sched))
+    {
+        while (nrf_atomic_flag_clear_fetch(&p_sched->again) != 0)
+        {
+            // Purge queues that are no longer used by any connection.
+            queues_purge(p_gatt_queue);
+
+            for (int8_t level = NRF_BLE_GQ_PRIO_NUM - 1; level >= 0; level--)
+            {
+                bool active;
+
+                do
+                {
+                    active = false;
+                    for (uint16_t i = 0; i < p_gatt_queue->max_conns; i++)
+                    {
+                        uint16_t conn_id = (p_sched->next + i) % p_gatt_queue->max_conns;
+
+                        if (link_serve(p_gatt_queue, conn_id, (uint8_t) level))
+                        {
+                            active = true;
+                        }
+                    }
+                } while (active);
+            }
+
+            p_sched->next = (p_sched->next + 1) % p_gatt_queue->max_conns;
+        }
+
+        UNUSED_RETURN_VALUE(nrf_atomic_flag_clear(&p_sched->running));
+    }
+}
+
+
+/**@brief Function releases the scheduler lock of a BGQ instance, and runs the scheduler if it was
+ *        asked to while the lock was held.
+ *
+ * @param[in] p_gatt_queue  Pointer to the BGQ instance.
+ */
+static void sched_unlock(nrf_ble_gq_t const * const p_gatt_queue)
+{
+    UNUSED_RETURN_VALUE(nrf_atomic_flag_clear(&p_gatt_queue->p_sched->running));
+
+    if (p_gatt_queue->p_sched->again != 0)
+    {
+        queues_schedule(p_gatt_queue);
+    }
+}
+
+
 /**@brief Function processes single GATT request without queue.
  *
  * @param[in] p_req        Pointer to GATT request.
  * @param[in] conn_handle  Connection handle.
  *
- * @retval  true   If request is accepted by Softdevice.
- * @retval  false  If Softdevice is busy and the request should be queued.
+ * @return    Error code returned by SoftDevice.
  */
-static bool request_process(nrf_ble_gq_req_t const * const p_req, uint16_t conn_handle)
+static ret_code_t request_process(nrf_ble_gq_req_t const * const p_req, uint16_t conn_handle)
 {
     ret_code_t err_code = NRF_SUCCESS;
 
@@ -395,17 +875,7 @@ static bool request_process(nrf_ble_gq_req_t const * const p_req, uint16_t conn_
             break;
     }
 
-    if (err_code == NRF_ERROR_BUSY) // Softdevice is processing another GATT request.
-    {
-        NRF_LOG_DEBUG("SD is currently busy. The GATT request procedure will be attempted \
-                      again later.");
-        return false;
-    }
-    else
-    {
-        request_err_code_handle(p_req, conn_handle, err_code);
-        return true;
-    }
+    return err_code;
 }
 
 
@@ -438,18 +908,41 @@ static uint16_t conn_handle_id_find(nrf_ble_gq_t const * const p_gatt_queue, uin
  *
  * @retval    NRF_SUCCESS       If the registration was successful.
  * @retval    NRF_ERROR_NO_MEM  If there was no space for another connection handle.
+ * @retval    NRF_ERROR_BUSY    If the only free IDs wait for their queues to be purged.
  */
 static ret_code_t conn_handle_register(nrf_ble_gq_t const * const p_gatt_queue, uint16_t conn_handle)
 {
+    ret_code_t err_code = NRF_ERROR_NO_MEM;
+
     for (uint16_t id = 0; id < p_gatt_queue->max_conns; id++)
     {
-        if (p_gatt_queue->p_conn_handles[id] == BLE_CONN_HANDLE_INVALID)
+        if (p_gatt_queue->p_conn_handles[id] != BLE_CONN_HANDLE_INVALID)
         {
-            p_gatt_queue->p_conn_handles[id] = conn_handle;
-            return NRF_SUCCESS;
+            continue;
         }
+        if (p_gatt_queue->p_links[id].purge != 0)
+        {
+            // Requests of the previous connection are still queued.
+            err_code = NRF_ERROR_BUSY;
+            continue;
+        }
+
+        link_reset(&p_gatt_queue->p_links[id]);
+        for (uint8_t level = 0; level < NRF_BLE_GQ_PRIO_NUM; level++)
+        {
+            nrf_queue_t const * p_queue = level_queue_get(p_gatt_queue, id, level);
+
+            if (p_queue != NULL)
+            {
+                nrf_queue_max_utilization_reset(p_queue);
+            }
+        }
+
+        // The scheduler serves the connection from here on, the state is ready for it.
+        p_gatt_queue->p_conn_handles[id] = conn_handle;
+        return NRF_SUCCESS;
     }
-    return NRF_ERROR_NO_MEM;
+    return err_code;
 }
 
 
@@ -457,14 +950,16 @@ static ret_code_t conn_handle_register(nrf_ble_gq_t const * const p_gatt_queue,
  *
  * @param[in] p_gatt_queue Pointer to the nrf_ble_gq_t instance.
  *
- * @retval    true   There is at least one registered connection handle.
+ * @retval    true   There is at least one registered connection handle, or one whose requests
+ *                   are not purged yet.
  * @retval    false  Connection handle registry is empty.
  */
 static bool is_any_conn_handle_registered(nrf_ble_gq_t const * const p_gatt_queue)
 {
     for (uint16_t id = 0; id < p_gatt_queue->max_conns; id++)
     {
-        if (p_gatt_queue->p_conn_handles[id] != BLE_CONN_HANDLE_INVALID)
+        if ((p_gatt_queue->p_conn_handles[id] != BLE_CONN_HANDLE_INVALID) ||
+            (p_gatt_queue->p_links[id].purge != 0))
         {
             return true;
         }
@@ -477,17 +972,18 @@ ret_code_t nrf_ble_gq_item_add(nrf_ble_gq_t const * const p_gatt_queue,
                                nrf_ble_gq_req_t   * const p_req,
                                uint16_t                   conn_handle)
 {
-    ret_code_t err_code = NRF_SUCCESS;
-    uint16_t   conn_id;
+    ret_code_t          err_code = NRF_SUCCESS;
+    uint16_t            conn_id;
+    uint8_t             level;
+    uint8_t             res;
+    nrf_queue_t const * p_queue;
+    nrf_ble_gq_link_t * p_link;
 
     NRF_LOG_DEBUG("Adding item to the request queue");
 
     VERIFY_PARAM_NOT_NULL(p_gatt_queue);
     VERIFY_PARAM_NOT_NULL(p_req);
 
-    // Purge queues that are no longer used by any connection.
-    queues_purge(p_gatt_queue);
-
     // Check if connection handle is registered and if GATT request is valid.
     conn_id = conn_handle_id_find(p_gatt_queue, conn_handle);
     if ((p_req->type >= NRF_BLE_GQ_REQ_NUM) || (conn_id == p_gatt_queue->max_conns))
@@ -495,14 +991,39 @@ ret_code_t nrf_ble_gq_item_add(nrf_ble_gq_t const * const p_gatt_queue,
         return NRF_ERROR_INVALID_PARAM;
     }
 
-    // Try processing a request without buffering.
-    if (nrf_queue_is_empty(&p_gatt_queue->p_req_queue[conn_id]))
+    level   = req_level_get(p_gatt_queue, conn_id, p_req->type);
+    p_queue = level_queue_get(p_gatt_queue, conn_id, level);
+    p_link  = &p_gatt_queue->p_links[conn_id];
+    res     = req_res_get(p_req);
+
+    // Try processing a request without buffering, if nothing waits to go before it. The queues
+    // are not served meanwhile, by an interrupted call or one interrupting this one.
+    if (sched_lock(p_gatt_queue->p_sched))
     {
-        bool req_processed = request_process(p_req, conn_handle);
-        if (req_processed)
+        ret_code_t sd_err_code = NRF_SUCCESS;
+        uint8_t    evts;
+        bool       done = false;
+
+        if (queues_empty(p_gatt_queue, conn_id, level) && res_take(p_link, res, &evts))
+        {
+            sd_err_code = request_process(p_req, conn_handle);
+            done        = request_outcome_handle(p_link, res, evts, sd_err_code);
+
+            if (done && (sd_err_code == NRF_SUCCESS))
+            {
+                stats_record(&p_link->stats[level], 0);
+            }
+        }
+        sched_unlock(p_gatt_queue);
+
+        if (done)
         {
+            request_err_code_handle(p_req, conn_handle, sd_err_code);
             return err_code;
         }
+
+        NRF_LOG_DEBUG("SD is currently busy. The GATT request procedure will be attempted \
+                      again later.");
     }
 
     // Prepare request for buffering and add it to the queue.
@@ -514,7 +1035,11 @@ ret_code_t nrf_ble_gq_item_add(nrf_ble_gq_t const * const p_gatt_queue,
         VERIFY_SUCCESS(err_code);
     }
 
-    err_code = nrf_queue_push(&p_gatt_queue->p_req_queue[conn_id], p_req);
+#if NRF_BLE_GQ_LATENCY_ENABLED
+    p_req->timestamp = app_timer_cnt_get();
+#endif
+
+    err_code = nrf_queue_push(p_queue, p_req);
     if ((err_code != NRF_SUCCESS) && (m_req_data_alloc[p_req->type] != NULL))
     {
         nrf_memobj_free(p_req->p_mem_obj);
@@ -522,7 +1047,7 @@ ret_code_t nrf_ble_gq_item_add(nrf_ble_gq_t const * const p_gatt_queue,
     }
 
     // Check if Softdevice is still busy.
-    queue_process(&p_gatt_queue->p_req_queue[conn_id], conn_handle);
+    queues_schedule(p_gatt_queue);
     return err_code;
 }
 
@@ -534,8 +1059,13 @@ ret_code_t nrf_ble_gq_conn_handle_register(nrf_ble_gq_t * const p_gatt_queue, ui
 
     VERIFY_PARAM_NOT_NULL(p_gatt_queue);
 
-    // Purge queues that are no longer used by any connection.
-    queues_purge(p_gatt_queue);
+    // Purge queues that are no longer used by any connection. If the lock is held, the holder
+    // does it.
+    if (sched_lock(p_gatt_queue->p_sched))
+    {
+        queues_purge(p_gatt_queue);
+        sched_unlock(p_gatt_queue);
+    }
 
     // Allow instance to claim connection handle only if it has not been claimed already.
     conn_id = conn_handle_id_find(p_gatt_queue, conn_handle);
@@ -556,6 +1086,152 @@ ret_code_t nrf_ble_gq_conn_handle_register(nrf_ble_gq_t * const p_gatt_queue, ui
 }
 
 
+ret_code_t nrf_ble_gq_conn_cfg_set(nrf_ble_gq_t          const * const p_gatt_queue,
+                                   uint16_t                            conn_handle,
+                                   nrf_ble_gq_conn_cfg_t const * const p_cfg)
+{
+    uint16_t conn_id;
+
+    VERIFY_PARAM_NOT_NULL(p_gatt_queue);
+    VERIFY_PARAM_NOT_NULL(p_cfg);
+
+    conn_id = conn_handle_id_find(p_gatt_queue, conn_handle);
+    if ((conn_id == p_gatt_queue->max_conns) ||
+        (p_cfg->weight == 0) ||
+        (p_cfg->prio >= NRF_BLE_GQ_PRIO_NUM))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if ((p_cfg->prio == NRF_BLE_GQ_PRIO_HIGH) && (p_gatt_queue->p_high_queue == NULL))
+    {
+        return NRF_ERROR_NOT_SUPPORTED;
+    }
+
+    CRITICAL_REGION_ENTER();
+    p_gatt_queue->p_links[conn_id].cfg = *p_cfg;
+    CRITICAL_REGION_EXIT();
+
+    // The credit limits may have been raised.
+    queues_schedule(p_gatt_queue);
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t nrf_ble_gq_type_prio_set(nrf_ble_gq_t    const * const p_gatt_queue,
+                                    nrf_ble_gq_req_type_t         type,
+                                    nrf_ble_gq_prio_t             prio)
+{
+    VERIFY_PARAM_NOT_NULL(p_gatt_queue);
+
+    if ((type >= NRF_BLE_GQ_REQ_NUM) || (prio >= NRF_BLE_GQ_PRIO_NUM))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if ((prio == NRF_BLE_GQ_PRIO_HIGH) && (p_gatt_queue->p_high_queue == NULL))
+    {
+        return NRF_ERROR_NOT_SUPPORTED;
+    }
+
+    p_gatt_queue->p_sched->type_prio[type] = (uint8_t) prio;
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t nrf_ble_gq_conn_purge(nrf_ble_gq_t const * const p_gatt_queue,
+                                 uint16_t                   conn_handle,
+                                 uint32_t                   type_mask,
+                                 uint16_t           * const p_purged)
+{
+    uint16_t conn_id;
+    uint16_t purged = 0;
+
+    VERIFY_PARAM_NOT_NULL(p_gatt_queue);
+
+    conn_id = conn_handle_id_find(p_gatt_queue, conn_handle);
+    if (conn_id == p_gatt_queue->max_conns)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (!sched_lock(p_gatt_queue->p_sched))
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    for (uint8_t level = 0; level < NRF_BLE_GQ_PRIO_NUM; level++)
+    {
+        nrf_queue_t const * p_queue = level_queue_get(p_gatt_queue, conn_id, level);
+        size_t              count;
+
+        if (p_queue == NULL)
+        {
+            continue;
+        }
+
+        // Take every request out once and put back the ones that stay, so they keep their order.
+        count = nrf_queue_utilization_get(p_queue);
+        while (count-- > 0)
+        {
+            nrf_ble_gq_req_t ble_req;
+
+            UNUSED_RETURN_VALUE(nrf_queue_pop(p_queue, &ble_req));
+            if ((type_mask & NRF_BLE_GQ_REQ_MASK(ble_req.type)) != 0)
+            {
+                if (m_req_data_alloc[ble_req.type] != NULL)
+                {
+                    nrf_memobj_free(ble_req.p_mem_obj);
+                    NRF_LOG_DEBUG("Pointer to freed memory block: %p.", ble_req.p_mem_obj);
+                }
+                purged++;
+            }
+            else
+            {
+                UNUSED_RETURN_VALUE(nrf_queue_push(p_queue, &ble_req));
+            }
+        }
+    }
+
+    NRF_LOG_DEBUG("Purged %d requests of connection handle: 0x%04X", purged, conn_handle);
+
+    if (p_purged != NULL)
+    {
+        *p_purged = purged;
+    }
+
+    // Requests behind the removed ones may be free to go.
+    UNUSED_RETURN_VALUE(nrf_atomic_flag_set(&p_gatt_queue->p_sched->again));
+    sched_unlock(p_gatt_queue);
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t nrf_ble_gq_stats_get(nrf_ble_gq_t const * const p_gatt_queue,
+                                uint16_t                   conn_handle,
+                                nrf_ble_gq_prio_t          prio,
+                                nrf_ble_gq_stats_t * const p_stats)
+{
+    uint16_t            conn_id;
+    nrf_queue_t const * p_queue;
+
+    VERIFY_PARAM_NOT_NULL(p_gatt_queue);
+    VERIFY_PARAM_NOT_NULL(p_stats);
+
+    conn_id = conn_handle_id_find(p_gatt_queue, conn_handle);
+    if ((conn_id == p_gatt_queue->max_conns) || (prio >= NRF_BLE_GQ_PRIO_NUM))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    p_queue  = level_queue_get(p_gatt_queue, conn_id, prio);
+
+    CRITICAL_REGION_ENTER();
+    *p_stats = p_gatt_queue->p_links[conn_id].stats[prio];
+    CRITICAL_REGION_EXIT();
+
+    p_stats->high_water = (p_queue != NULL) ? (uint16_t) nrf_queue_max_utilization_get(p_queue) : 0;
+    return NRF_SUCCESS;
+}
+
+
 void nrf_ble_gq_on_ble_evt(ble_evt_t const * p_ble_evt, void * p_context)
 {
     nrf_ble_gq_t * p_gatt_queue = (nrf_ble_gq_t *) p_context;
@@ -598,12 +1274,38 @@ void nrf_ble_gq_on_ble_evt(ble_evt_t const * p_ble_evt, void * p_context)
     // Perform operations on the queue.
     if (p_ble_evt->header.evt_id == BLE_GAP_EVT_DISCONNECTED)
     {
+        // The scheduler state is reset when the ID is registered again, after the purge.
         p_gatt_queue->p_conn_handles[conn_id] = BLE_CONN_HANDLE_INVALID;
+        p_gatt_queue->p_links[conn_id].purge  = 1;
         UNUSED_RETURN_VALUE(nrf_queue_push(p_gatt_queue->p_purge_queue, &conn_id));
+
+        queues_schedule(p_gatt_queue);
     }
     else
     {
-        queue_process(&p_gatt_queue->p_req_queue[conn_id], conn_handle);
+        nrf_ble_gq_link_t * p_link = &p_gatt_queue->p_links[conn_id];
+
+        CRITICAL_REGION_ENTER();
+        p_link->evts++;
+
+        // Any GATT event of the connection may end the procedure the SoftDevice was busy with.
+        p_link->busy = 0;
+
+        if (p_ble_evt->header.evt_id == BLE_GATTS_EVT_HVN_TX_COMPLETE)
+        {
+            credits_return(&p_link->hvn_in_flight,
+                           p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count);
+            p_link->full &= (uint8_t) ~RES_HVN;
+        }
+        else if (p_ble_evt->header.evt_id == BLE_GATTC_EVT_WRITE_CMD_TX_COMPLETE)
+        {
+            credits_return(&p_link->wcmd_in_flight,
+                           p_ble_evt->evt.gattc_evt.params.write_cmd_tx_complete.count);
+            p_link->full &= (uint8_t) ~RES_WCMD;
+        }
+        CRITICAL_REGION_EXIT();
+
+        queues_schedule(p_gatt_queue);
     }
 }
 
@@ -50,6 +50,22 @@
  *          free, the request is retried. For conceptual documentation of this module, see
  *          @ref lib_ble_gatt_queue.
  *
+ *          Requests of all registered connections are handed to the SoftDevice by a deficit
+ *          round-robin scheduler. Each connection gets a share of about
+ *          @ref NRF_BLE_GQ_DRR_QUANTUM bytes times its weight per round, so one busy peer cannot
+ *          starve the others. An instance defined with @ref NRF_BLE_GQ_PRIO_DEF has a second,
+ *          high priority queue per connection, served before the normal ones. Requests go there
+ *          by type (@ref nrf_ble_gq_type_prio_set) or by connection (@ref nrf_ble_gq_conn_cfg_set).
+ *          Notifications and write commands are credit based: a connection has at most
+ *          hvn_tx_queue_size and write_cmd_tx_queue_size of them in the SoftDevice, the rest wait
+ *          in the queue for the TX complete events.
+ *
+ *          @ref nrf_ble_gq_on_ble_evt and @ref nrf_ble_gq_conn_handle_register must be called
+ *          from the context the BLE events are dispatched in. The other functions can be called
+ *          from any context, also one that interrupts a call of the module: requests are handed
+ *          to the SoftDevice by one caller at a time, and a caller that finds another one doing
+ *          it leaves the work to it.
+ *
  */
 #ifndef NRF_BLE_GQ_H__
 #define NRF_BLE_GQ_H__
@@ -58,12 +74,24 @@
 #include "sdk_common.h"
 #include "nrf_memobj.h"
 #include "nrf_queue.h"
+#include "nrf_atomic.h"
 #include "nrf_sdh_ble.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**@brief Bytes a connection with weight 1 may send per scheduler round. Requests cost their
+ *        payload plus the ATT header. */
+#ifndef NRF_BLE_GQ_DRR_QUANTUM
+#define NRF_BLE_GQ_DRR_QUANTUM (NRF_BLE_GQ_GATTS_HVX_MAX_DATA_LEN + 3)
+#endif
+
+/**@brief Time spent in the queue is measured with app_timer_cnt_get when set to 1. */
+#ifndef NRF_BLE_GQ_LATENCY_ENABLED
+#define NRF_BLE_GQ_LATENCY_ENABLED 0
+#endif
+
 /**@brief   Macro for defining a nrf_ble_gq_t instance with default parameters.
  *
  * @param   _name            Name of the instance.
@@ -90,6 +118,33 @@ extern "C" {
  * @hideinitializer
  */
 #define NRF_BLE_GQ_CUSTOM_DEF(_name, _max_connections, _queue_size, _pool_elem_size, _pool_elem_count) \
+    NRF_BLE_GQ_INSTANCE_DEF(_name, _max_connections, _queue_size, _pool_elem_size, _pool_elem_count,   \
+                            NULL)
+
+/**@brief   Macro for defining a nrf_ble_gq_t instance with a high priority queue per connection.
+ *
+ * @param   _name            Name of the instance.
+ * @param   _max_connections The maximal number of connection handles that can be registered.
+ * @param   _queue_size      The maximal number of nrf_ble_gq_req_t instances that the normal
+ *                           queue of a connection can hold.
+ * @param   _high_queue_size The maximal number of nrf_ble_gq_req_t instances that the high
+ *                           priority queue of a connection can hold.
+ * @param   _pool_elem_size  Size of a single element in the pool of memory objects.
+ * @param   _pool_elem_count Number of elements in the pool of memory objects.
+ * @hideinitializer
+ */
+#define NRF_BLE_GQ_PRIO_DEF(_name, _max_connections, _queue_size, _high_queue_size,                 \
+                            _pool_elem_size, _pool_elem_count)                                      \
+    NRF_QUEUE_ARRAY_DEF(nrf_ble_gq_req_t, CONCAT_2(_name, high_queue), _high_queue_size,            \
+                        NRF_QUEUE_MODE_NO_OVERFLOW, _max_connections);                              \
+    NRF_BLE_GQ_INSTANCE_DEF(_name, _max_connections, _queue_size, _pool_elem_size, _pool_elem_count, \
+                            CONCAT_2(_name, high_queue))
+
+/**@brief Helping macro used to define nrf_ble_gq_t instance and its data.
+ *        Used in @ref NRF_BLE_GQ_CUSTOM_DEF and @ref NRF_BLE_GQ_PRIO_DEF.
+ */
+#define NRF_BLE_GQ_INSTANCE_DEF(_name, _max_connections, _queue_size, _pool_elem_size,              \
+                                _pool_elem_count, _p_high_queue)                                    \
     static uint16_t CONCAT_2(_name, conn_handles_arr)[] =                                              \
     {                                                                                                  \
         MACRO_REPEAT(_max_connections, NRF_BLE_GQ_CONN_HANDLE_INIT)                                    \
@@ -100,13 +155,18 @@ extern "C" {
     NRF_QUEUE_DEF(uint16_t, CONCAT_2(_name, purge_queue), _max_connections,                            \
                   NRF_QUEUE_MODE_NO_OVERFLOW);                                                         \
     NRF_MEMOBJ_POOL_DEF(CONCAT_2(_name, pool), _pool_elem_size, _pool_elem_count);                     \
+    static nrf_ble_gq_link_t  CONCAT_2(_name, links)[_max_connections];                                \
+    static nrf_ble_gq_sched_t CONCAT_2(_name, sched);                                                  \
     static nrf_ble_gq_t _name =                                                                        \
     {                                                                                                  \
         .max_conns      = (_max_connections),                                                          \
         .p_conn_handles = CONCAT_2(_name, conn_handles_arr),                                           \
         .p_req_queue    = CONCAT_2(_name, req_queue),                                                  \
+        .p_high_queue   = (_p_high_queue),                                                             \
         .p_purge_queue  = &CONCAT_2(_name, purge_queue),                                               \
-        .p_data_pool    = &CONCAT_2(_name, pool)                                                       \
+        .p_data_pool    = &CONCAT_2(_name, pool),                                                      \
+        .p_links        = CONCAT_2(_name, links),                                                      \
+        .p_sched        = &CONCAT_2(_name, sched)                                                      \
     };                                                                                                 \
     NRF_SDH_BLE_OBSERVER(_name ## _obs,                                                                \
                          NRF_BLE_GQ_BLE_OBSERVER_PRIO,                                                 \
@@ -114,6 +174,9 @@ extern "C" {
 #else
 #define NRF_BLE_GQ_CUSTOM_DEF(_name, _max_connections, _queue_size, _pool_elem_size, _pool_elem_count) \
     static nrf_ble_gq_t _name;
+#define NRF_BLE_GQ_PRIO_DEF(_name, _max_connections, _queue_size, _high_queue_size,                 \
+                            _pool_elem_size, _pool_elem_count)                                      \
+    static nrf_ble_gq_t _name;
 #endif // !(defined(__LINT__))
 
 /**@brief Helping macro used to properly initialize connection handle array for nrf_ble_gq_t instance.
@@ -133,6 +196,17 @@ typedef enum
     NRF_BLE_GQ_REQ_NUM             /**< Total number of different GATT Request types */
 } nrf_ble_gq_req_type_t;
 
+/**@brief Mask of a request type, for @ref nrf_ble_gq_conn_purge. */
+#define NRF_BLE_GQ_REQ_MASK(_type) (1UL << (_type))
+
+/**@brief Priority levels of the queues. */
+typedef enum
+{
+    NRF_BLE_GQ_PRIO_NORMAL,        /**< Normal queue, the one every instance has. Default for all requests. */
+    NRF_BLE_GQ_PRIO_HIGH,          /**< High priority queue, served first. Only with @ref NRF_BLE_GQ_PRIO_DEF. */
+    NRF_BLE_GQ_PRIO_NUM            /**< Total number of priority levels. */
+} nrf_ble_gq_prio_t;
+
 /**@brief Pointer used to describe error handler for GATTC request. */
 typedef void (* nrf_ble_gq_req_error_cb_t) (uint32_t   nrf_error,
                                             void     * p_context,
@@ -187,25 +261,73 @@ typedef struct
         nrf_ble_gq_gattc_desc_disc_t     gattc_desc_disc; /**< GATTC characteristic descriptor discovery parameters. Filled when nrf_ble_gq_req_t::type is NRF_BLE_GQ_REQ_DESC_DISCOVERY. */
         nrf_ble_gq_gatts_hvx_t           gatts_hvx;       /**< GATTS Handle Value Notification or Indication Parameters. Filled when nrf_ble_gq_req_t::type is @ref NRF_BLE_GQ_REQ_GATTS_HVX. */
     } params;
+#if NRF_BLE_GQ_LATENCY_ENABLED
+    uint32_t                         timestamp;     /**< app_timer ticks when the request was queued. Set by the module. */
+#endif
 } nrf_ble_gq_req_t;
 
+/**@brief Counters of one queue of a connection, see @ref nrf_ble_gq_stats_get. */
+typedef struct
+{
+    uint32_t dispatched; /**< Requests the SoftDevice accepted, from the queue or without queueing. */
+    uint32_t wait_total; /**< Sum of the time the dispatched requests spent queued, in app_timer ticks. */
+    uint32_t wait_max;   /**< Longest time a dispatched request spent queued, in app_timer ticks. */
+    uint16_t high_water; /**< Most requests queued at once. */
+} nrf_ble_gq_stats_t;
+
+/**@brief Scheduling parameters of a connection, see @ref nrf_ble_gq_conn_cfg_set. */
+typedef struct
+{
+    uint8_t weight;                  /**< Share of the connection in a scheduler round, 1 or more. */
+    uint8_t prio;                    /**< @ref NRF_BLE_GQ_PRIO_HIGH to queue all requests of the connection as high priority ones. */
+    uint8_t hvn_tx_queue_size;       /**< Notifications the connection may have in the SoftDevice, 0 for no limit. */
+    uint8_t write_cmd_tx_queue_size; /**< Write commands the connection may have in the SoftDevice, 0 for no limit. */
+} nrf_ble_gq_conn_cfg_t;
+
+/**@brief Scheduler state of a connection. */
+typedef struct
+{
+    nrf_ble_gq_conn_cfg_t cfg;                           /**< Scheduling parameters. */
+    uint32_t              deficit[NRF_BLE_GQ_PRIO_NUM];  /**< Bytes the connection may still send in this round, per level. */
+    nrf_ble_gq_stats_t    stats[NRF_BLE_GQ_PRIO_NUM];    /**< Counters per level. */
+    uint8_t               hvn_in_flight;                 /**< Notifications in the SoftDevice. */
+    uint8_t               wcmd_in_flight;                /**< Write commands in the SoftDevice. */
+    uint8_t               busy;                          /**< Resources the SoftDevice reported busy, until the next GATT event of the connection. */
+    uint8_t               full;                          /**< Resources the SoftDevice has no buffers for, until the next TX complete event. */
+    uint8_t               evts;                          /**< GATT events of the connection, wraps. Tells if one came during a SoftDevice call. */
+    uint8_t               purge;                         /**< The connection is gone and its queues wait to be purged. */
+} nrf_ble_gq_link_t;
+
+/**@brief Scheduler state of the instance. */
+typedef struct
+{
+    uint8_t           type_prio[NRF_BLE_GQ_REQ_NUM]; /**< Priority level of each request type. */
+    uint16_t          next;                          /**< Connection served first in the next round. */
+    nrf_atomic_flag_t running;                       /**< A caller is dispatching requests, the others leave it to it. */
+    nrf_atomic_flag_t again;                         /**< Requests were added or freed to go while it did. */
+} nrf_ble_gq_sched_t;
+
 /**@brief Descriptor for the BLE GATT Queue instance. */
 typedef struct
 {
     uint16_t            const max_conns;      /**< Maximal number of connection handles that can be registered. */
     uint16_t                * p_conn_handles; /**< Pointer to array with registered connection handles.*/
     nrf_queue_t const * const p_req_queue;    /**< Pointer to array of queue instances used to hold nrf_ble_gq_req_t instances.*/
+    nrf_queue_t const * const p_high_queue;   /**< Pointer to array of high priority queue instances, NULL if the instance has none.*/
     nrf_queue_t const * const p_purge_queue;  /**< Pointer to the queue instance used to hold indexes of queues to purge.*/
     nrf_memobj_pool_t const * p_data_pool;    /**< Memory pool used to obtain nrf_memobj_t instances.*/
+    nrf_ble_gq_link_t * const p_links;        /**< Pointer to array with scheduler state of the connections.*/
+    nrf_ble_gq_sched_t * const p_sched;       /**< Pointer to scheduler state of the instance.*/
 } nrf_ble_gq_t;
 
 
 /**@brief Function for adding a GATT request to the BGQ instance.
  *
  * @details This function adds a request to the BGQ instance and allocates necessary memory
- *          for data that can be held within the request descriptor. If the SoftDevice is free,
- *          this request will be processed immediately. Otherwise, the request remains in
- *          in the queue and is processed later.
+ *          for data that can be held within the request descriptor. If the SoftDevice is free
+ *          and nothing of the same or higher priority waits for the connection, this request
+ *          will be processed immediately. Otherwise, the request remains in the queue and is
+ *          processed later, in the order the scheduler picks.
  *
  * @param[in] p_gatt_queue  Pointer to the BGQ instance.
  * @param[in] p_req         Pointer to the request.
@@ -235,10 +357,97 @@ ret_code_t nrf_ble_gq_item_add(nrf_ble_gq_t const * const p_gatt_queue,
  * @retval    NRF_SUCCESS      If the registration was successful.
  * @retval    NRF_ERROR_NULL   If \p p_gatt_queue was NULL.
  * @retval    NRF_ERROR_NO_MEM If there was no space for another connection handle.
+ * @retval    NRF_ERROR_BUSY   If the only free space still holds requests of a disconnected
+ *                             connection, because requests are dispatched from an interrupted
+ *                             context. They are removed when it is done, try again later.
  */
 ret_code_t nrf_ble_gq_conn_handle_register(nrf_ble_gq_t * const p_gatt_queue, uint16_t conn_handle);
 
 
+/**@brief Function for setting the scheduling parameters of a connection.
+ *
+ * @details The parameters are reset to weight 1, normal priority and no credit limits when the
+ *          connection handle is registered. Set hvn_tx_queue_size and write_cmd_tx_queue_size
+ *          to the values of the connection configuration given to the SoftDevice to keep
+ *          notifications and write commands of the connection in the queue, where the
+ *          scheduler orders them, rather than in the SoftDevice.
+ *
+ * @param[in] p_gatt_queue  Pointer to the BGQ instance.
+ * @param[in] conn_handle   Connection handle.
+ * @param[in] p_cfg         Scheduling parameters.
+ *
+ * @retval    NRF_SUCCESS             If the parameters were set.
+ * @retval    NRF_ERROR_NULL          Any parameter was NULL.
+ * @retval    NRF_ERROR_INVALID_PARAM If \p conn_handle is not registered or the weight is 0.
+ * @retval    NRF_ERROR_NOT_SUPPORTED If high priority was asked of an instance without high
+ *                                    priority queues.
+ */
+ret_code_t nrf_ble_gq_conn_cfg_set(nrf_ble_gq_t          const * const p_gatt_queue,
+                                   uint16_t                            conn_handle,
+                                   nrf_ble_gq_conn_cfg_t const * const p_cfg);
+
+
+/**@brief Function for setting the priority level of a request type, for all connections.
+ *
+ * @details Requests already queued stay where they are.
+ *
+ * @param[in] p_gatt_queue  Pointer to the BGQ instance.
+ * @param[in] type          Request type.
+ * @param[in] prio          Priority level, see @ref nrf_ble_gq_prio_t.
+ *
+ * @retval    NRF_SUCCESS             If the level was set.
+ * @retval    NRF_ERROR_NULL          If \p p_gatt_queue was NULL.
+ * @retval    NRF_ERROR_INVALID_PARAM If \p type or \p prio is not valid.
+ * @retval    NRF_ERROR_NOT_SUPPORTED If high priority was asked of an instance without high
+ *                                    priority queues.
+ */
+ret_code_t nrf_ble_gq_type_prio_set(nrf_ble_gq_t    const * const p_gatt_queue,
+                                    nrf_ble_gq_req_type_t         type,
+                                    nrf_ble_gq_prio_t             prio);
+
+
+/**@brief Function for removing queued requests of some types from a connection.
+ *
+ * @details The requests are freed without calling their error handlers, the others keep their
+ *          order.
+ *
+ * @param[in]  p_gatt_queue  Pointer to the BGQ instance.
+ * @param[in]  conn_handle   Connection handle.
+ * @param[in]  type_mask     Request types to remove, @ref NRF_BLE_GQ_REQ_MASK of each.
+ * @param[out] p_purged      Number of requests removed. Can be NULL.
+ *
+ * @retval    NRF_SUCCESS             If the requests were removed.
+ * @retval    NRF_ERROR_NULL          If \p p_gatt_queue was NULL.
+ * @retval    NRF_ERROR_INVALID_PARAM If \p conn_handle is not registered.
+ * @retval    NRF_ERROR_BUSY          If called from an error handler, or from any context, while
+ *                                    requests are dispatched.
+ */
+ret_code_t nrf_ble_gq_conn_purge(nrf_ble_gq_t const * const p_gatt_queue,
+                                 uint16_t                   conn_handle,
+                                 uint32_t                   type_mask,
+                                 uint16_t           * const p_purged);
+
+
+/**@brief Function for reading the counters of a queue of a connection.
+ *
+ * @details The counters start from zero when the connection handle is registered. wait_total
+ *          and wait_max stay zero unless @ref NRF_BLE_GQ_LATENCY_ENABLED is set.
+ *
+ * @param[in]  p_gatt_queue  Pointer to the BGQ instance.
+ * @param[in]  conn_handle   Connection handle.
+ * @param[in]  prio          Priority level of the queue.
+ * @param[out] p_stats       Counters.
+ *
+ * @retval    NRF_SUCCESS             If the counters were read.
+ * @retval    NRF_ERROR_NULL          Any parameter was NULL.
+ * @retval    NRF_ERROR_INVALID_PARAM If \p conn_handle is not registered or \p prio is not valid.
+ */
+ret_code_t nrf_ble_gq_stats_get(nrf_ble_gq_t const * const p_gatt_queue,
+                                uint16_t                   conn_handle,
+                                nrf_ble_gq_prio_t          prio,
+                                nrf_ble_gq_stats_t * const p_stats);
+
+
 /**@brief     Function for handling BLE events from the SoftDevice.
  *
  * @details   This function handles the BLE events received from the SoftDevice. If a BLE
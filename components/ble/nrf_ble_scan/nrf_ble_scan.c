@@ -114,33 +114,169 @@ static void nrf_ble_scan_connect_with_target(nrf_ble_scan_t           const * co
 
 
 #if (NRF_BLE_SCAN_FILTER_ENABLE == 1)
-#if (NRF_BLE_SCAN_ADDRESS_CNT > 0)
 
-/**@brief Function for searching for the provided address in the advertisement packets.
+/**@brief Advertising data fields which the filters look at.
+ */
+typedef enum
+{
+    AD_FIELD_UUID16_MORE,       /**< @ref BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE, the first of the consecutive types below. */
+    AD_FIELD_UUID16_COMPLETE,   /**< @ref BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE. */
+    AD_FIELD_UUID32_MORE,       /**< @ref BLE_GAP_AD_TYPE_32BIT_SERVICE_UUID_MORE_AVAILABLE. */
+    AD_FIELD_UUID32_COMPLETE,   /**< @ref BLE_GAP_AD_TYPE_32BIT_SERVICE_UUID_COMPLETE. */
+    AD_FIELD_UUID128_MORE,      /**< @ref BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE. */
+    AD_FIELD_UUID128_COMPLETE,  /**< @ref BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE. */
+    AD_FIELD_SHORT_NAME,        /**< @ref BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME. */
+    AD_FIELD_NAME,              /**< @ref BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME. */
+    AD_FIELD_APPEARANCE,        /**< @ref BLE_GAP_AD_TYPE_APPEARANCE. */
+    AD_FIELD_CNT
+} ad_field_t;
+
+
+/**@brief Where the fields of an advertising report are, found in one pass over its data.
+ */
+typedef struct
+{
+    uint8_t const * p_data;                 /**< Advertising data. */
+    uint16_t        offset[AD_FIELD_CNT];   /**< Offset of the field data. */
+    uint8_t         len[AD_FIELD_CNT];      /**< Length of the field data, 0 if there is no such field or it is malformed. */
+} adv_fields_t;
+
+
+/**@brief Function for finding the advertising data fields which the filters look at.
+ *
+ * @details Only the first field of each type is used, as @ref ble_advdata_search does.
+ *
+ * @param[in]  p_adv_report Advertising report to parse.
+ * @param[out] p_fields     Fields found.
+ */
+static void adv_fields_parse(ble_gap_evt_adv_report_t const * const p_adv_report,
+                             adv_fields_t                   * const p_fields)
+{
+    uint8_t const * p_data   = p_adv_report->data.p_data;
+    uint16_t const  data_len = p_adv_report->data.len;
+    uint16_t        seen     = 0;
+    uint16_t        i        = 0;
+
+    memset(p_fields, 0, sizeof(adv_fields_t));
+    p_fields->p_data = p_data;
+
+    while (i + 1 < data_len)
+    {
+        uint8_t const len   = p_data[i];
+        uint8_t const type  = p_data[i + 1];
+        uint8_t       field = AD_FIELD_CNT;
+
+        if ((type >= BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE) &&
+            (type <= BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME))
+        {
+            field = type - BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE;
+        }
+        else if (type == BLE_GAP_AD_TYPE_APPEARANCE)
+        {
+            field = AD_FIELD_APPEARANCE;
+        }
+
+        if ((field != AD_FIELD_CNT) && !(seen & (1 << field)))
+        {
+            seen |= (1 << field);
+
+            // Skip fields which are empty or extend beyond the data.
+            if ((len > 1) && (i + 1 + len <= data_len))
+            {
+                p_fields->offset[field] = i + 2;
+                p_fields->len[field]    = len - 1;
+            }
+        }
+
+        i += len + 1;
+    }
+}
+
+
+/**@brief Function for hashing filter data.
  *
- * @details Use this function to parse the received advertising data for the provided address.
- *        
+ * @param[in] p_data Data to hash.
+ * @param[in] len    Length of the data.
  *
- * @param[in]   p_adv_report   Advertising data to parse.
- * @param[in]   p_addr         Address to search for. The address length must correspond to @ref BLE_GAP_ADDR_LEN.
+ * @return Hash of the data (32-bit FNV-1a).
+ */
+static uint32_t scan_hash(uint8_t const * p_data, uint16_t len)
+{
+    uint32_t hash = 2166136261UL;
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+        hash ^= p_data[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+
+/**@brief Function for adding a filter to a hash table.
  *
- * @return   True if the provided address was found, false otherwise.
+ * @param[in,out] p_slots  Hash table. It must have an empty slot.
+ * @param[in]     slot_cnt Number of slots.
+ * @param[in]     hash     Hash of the filter data.
+ * @param[in]     index    Index of the filter.
+ * @param[in]     aux      Additional data to keep with the index.
  */
-static bool find_peer_addr(ble_gap_evt_adv_report_t const * const p_adv_report,
-                           ble_gap_addr_t const                 * p_addr)
+static void scan_hash_add(uint16_t * p_slots, uint16_t slot_cnt, uint32_t hash,
+                          uint8_t index, uint8_t aux)
 {
-    // Compare addresses.
-    if (memcmp(p_addr->addr,
-               p_adv_report->peer_addr.addr,
-               sizeof(p_adv_report->peer_addr.addr)) == 0)
+    uint16_t slot = hash % slot_cnt;
+
+    while (p_slots[slot] != 0)
     {
-        return true;
+        slot = (slot + 1) % slot_cnt;
     }
 
-    return false;
+    p_slots[slot] = (uint16_t)((aux << 8) | (index + 1));
 }
 
 
+/**@brief Function for walking the filters which may match the given hash.
+ *
+ * @details Start with *p_probe set to 0. The filter data must be compared, since different data
+ *          can have the same hash.
+ *
+ * @param[in]     p_slots  Hash table.
+ * @param[in]     slot_cnt Number of slots.
+ * @param[in]     hash     Hash of the advertised data.
+ * @param[in,out] p_probe  Slots walked so far.
+ * @param[out]    p_index  Index of the filter.
+ * @param[out]    p_aux    Additional data kept with the index.
+ *
+ * @return True if a filter was found, false if there are none left.
+ */
+static bool scan_hash_next(uint16_t const * p_slots, uint16_t slot_cnt, uint32_t hash,
+                           uint16_t * p_probe, uint8_t * p_index, uint8_t * p_aux)
+{
+    uint16_t value;
+
+    if (*p_probe >= slot_cnt)
+    {
+        return false;
+    }
+
+    value = p_slots[((hash % slot_cnt) + *p_probe) % slot_cnt];
+    (*p_probe)++;
+
+    if (value == 0)
+    {
+        return false;
+    }
+
+    *p_index = (uint8_t)(value & 0xFF) - 1;
+    *p_aux   = (uint8_t)(value >> 8);
+
+    return true;
+}
+
+
+#if (NRF_BLE_SCAN_ADDRESS_CNT > 0)
+
 /** @brief Function for comparing the provided address with the addresses of the advertising devices.
  *
  * @param[in] p_adv_report    Advertising data to parse.
@@ -151,13 +287,17 @@ static bool find_peer_addr(ble_gap_evt_adv_report_t const * const p_adv_report,
 static bool adv_addr_compare(ble_gap_evt_adv_report_t const * const p_adv_report,
                              nrf_ble_scan_t const * const           p_scan_ctx)
 {
-    ble_gap_addr_t const * p_addr  = p_scan_ctx->scan_filters.addr_filter.target_addr;
-    uint8_t                counter = p_scan_ctx->scan_filters.addr_filter.addr_cnt;
-
-    for (uint8_t index = 0; index < counter; index++)
+    nrf_ble_scan_addr_filter_t const * p_addr_filter = &p_scan_ctx->scan_filters.addr_filter;
+    uint8_t const                    * p_addr        = p_adv_report->peer_addr.addr;
+    uint32_t const                     hash          = scan_hash(p_addr, BLE_GAP_ADDR_LEN);
+    uint16_t                           probe         = 0;
+    uint8_t                            index;
+    uint8_t                            aux;
+
+    while (scan_hash_next(p_addr_filter->addr_hash, ARRAY_SIZE(p_addr_filter->addr_hash), hash,
+                          &probe, &index, &aux))
     {
-        // Search for address.
-        if (find_peer_addr(p_adv_report, &p_addr[index]))
+        if (memcmp(p_addr_filter->target_addr[index].addr, p_addr, BLE_GAP_ADDR_LEN) == 0)
         {
             return true;
         }
@@ -206,6 +346,12 @@ static ret_code_t nrf_ble_scan_addr_filter_add(nrf_ble_scan_t * const p_scan_ctx
     // Address type is not used so set it to 0.
     p_addr_filter[*p_counter].addr_type = 0;
 
+    scan_hash_add(p_scan_ctx->scan_filters.addr_filter.addr_hash,
+                  ARRAY_SIZE(p_scan_ctx->scan_filters.addr_filter.addr_hash),
+                  scan_hash(p_addr, BLE_GAP_ADDR_LEN),
+                  *p_counter,
+                  0);
+
     NRF_LOG_DEBUG("Filter set on address 0x");
     NRF_LOG_HEXDUMP_DEBUG(p_addr_filter[*p_counter].addr, BLE_GAP_ADDR_LEN);
 
@@ -222,28 +368,34 @@ static ret_code_t nrf_ble_scan_addr_filter_add(nrf_ble_scan_t * const p_scan_ctx
 #if (NRF_BLE_SCAN_NAME_CNT > 0)
 /** @brief Function for comparing the provided name with the advertised name.
  *
- * @param[in] p_adv_report    Advertising data to parse.
+ * @param[in] p_fields        Fields of the advertising data.
  * @param[in] p_scan_ctx      Pointer to the Scanning Module instance.
  *
  * @retval True when the names match. False otherwise.
  */
-static bool adv_name_compare(ble_gap_evt_adv_report_t const * p_adv_report,
-                             nrf_ble_scan_t     const * const p_scan_ctx)
+static bool adv_name_compare(adv_fields_t   const * const p_fields,
+                             nrf_ble_scan_t const * const p_scan_ctx)
 {
     nrf_ble_scan_name_filter_t const * p_name_filter = &p_scan_ctx->scan_filters.name_filter;
-    uint8_t                            counter       =
-        p_scan_ctx->scan_filters.name_filter.name_cnt;
-    uint8_t  index;
-    uint16_t data_len;
+    uint8_t const                      len           = p_fields->len[AD_FIELD_NAME];
+    uint8_t const                    * p_name        = &p_fields->p_data[p_fields->offset[AD_FIELD_NAME]];
+    uint16_t                           probe         = 0;
+    uint32_t                           hash;
+    uint8_t                            index;
+    uint8_t                            name_len;
+
+    if (len == 0)
+    {
+        return false;
+    }
 
-    data_len = p_adv_report->data.len;
+    hash = scan_hash(p_name, len);
 
-    // Compare the name found with the name filter.
-    for (index = 0; index < counter; index++)
+    // The length of each name is kept with its index.
+    while (scan_hash_next(p_name_filter->name_hash, ARRAY_SIZE(p_name_filter->name_hash), hash,
+                          &probe, &index, &name_len))
     {
-        if (ble_advdata_name_find(p_adv_report->data.p_data,
-                                  data_len,
-                                  p_name_filter->target_name[index]))
+        if ((name_len == len) && (memcmp(p_name_filter->target_name[index], p_name, len) == 0))
         {
             return true;
         }
@@ -291,6 +443,12 @@ static ret_code_t nrf_ble_scan_name_filter_add(nrf_ble_scan_t * const p_scan_ctx
         }
     }
 
+    scan_hash_add(p_scan_ctx->scan_filters.name_filter.name_hash,
+                  ARRAY_SIZE(p_scan_ctx->scan_filters.name_filter.name_hash),
+                  scan_hash((uint8_t const *)p_name, name_len),
+                  *counter,
+                  name_len);
+
     // Add name to filter.
     memcpy(p_scan_ctx->scan_filters.name_filter.target_name[(*counter)++],
            p_name,
@@ -308,29 +466,39 @@ static ret_code_t nrf_ble_scan_name_filter_add(nrf_ble_scan_t * const p_scan_ctx
 #if (NRF_BLE_SCAN_SHORT_NAME_CNT > 0)
 /** @brief Function for comparing the provided short name with the advertised short name.
  *
- * @param[in] p_adv_report    Advertising data to parse.
+ * @details The advertised short name matches a filter if it is a prefix of the filter name, shorter
+ *          than the filter name and at least as long as the minimum length of the filter. Each
+ *          such prefix is in the hash table.
+ *
+ * @param[in] p_fields        Fields of the advertising data.
  * @param[in] p_scan_ctx      Pointer to the Scanning Module instance.
  *
  * @retval True when the names match. False otherwise.
  */
-static bool adv_short_name_compare(ble_gap_evt_adv_report_t const * const p_adv_report,
-                                   nrf_ble_scan_t           const * const p_scan_ctx)
+static bool adv_short_name_compare(adv_fields_t   const * const p_fields,
+                                   nrf_ble_scan_t const * const p_scan_ctx)
 {
     nrf_ble_scan_short_name_filter_t const * p_name_filter =
         &p_scan_ctx->scan_filters.short_name_filter;
-    uint8_t  counter = p_scan_ctx->scan_filters.short_name_filter.name_cnt;
-    uint8_t  index;
-    uint16_t data_len;
+    uint8_t const   len    = p_fields->len[AD_FIELD_SHORT_NAME];
+    uint8_t const * p_name = &p_fields->p_data[p_fields->offset[AD_FIELD_SHORT_NAME]];
+    uint16_t        probe  = 0;
+    uint32_t        hash;
+    uint8_t         index;
+    uint8_t         prefix_len;
+
+    if (len == 0)
+    {
+        return false;
+    }
 
-    data_len = p_adv_report->data.len;
+    hash = scan_hash(p_name, len);
 
-    // Compare the name found with the name filters.
-    for (index = 0; index < counter; index++)
+    while (scan_hash_next(p_name_filter->prefix_hash, ARRAY_SIZE(p_name_filter->prefix_hash),
+                          hash, &probe, &index, &prefix_len))
     {
-        if (ble_advdata_short_name_find(p_adv_report->data.p_data,
-                                        data_len,
-                                        p_name_filter->short_name[index].short_target_name,
-                                        p_name_filter->short_name[index].short_name_min_len))
+        if ((prefix_len == len) &&
+            (memcmp(p_name_filter->short_name[index].short_target_name, p_name, len) == 0))
         {
             return true;
         }
@@ -382,6 +550,18 @@ static ret_code_t nrf_ble_scan_short_name_filter_add(nrf_ble_scan_t            *
         }
     }
 
+    // Add the prefixes of the name which can match to the hash table.
+    for (uint8_t prefix_len = MAX(p_short_name->short_name_min_len, 1);
+         prefix_len < name_len;
+         prefix_len++)
+    {
+        scan_hash_add(p_short_name_filter->prefix_hash,
+                      ARRAY_SIZE(p_short_name_filter->prefix_hash),
+                      scan_hash((uint8_t const *)p_short_name->p_short_name, prefix_len),
+                      *p_counter,
+                      prefix_len);
+    }
+
     // Add name to the filter.
     p_short_name_filter->short_name[(*p_counter)].short_name_min_len =
         p_short_name->short_name_min_len;
@@ -399,59 +579,71 @@ static ret_code_t nrf_ble_scan_short_name_filter_add(nrf_ble_scan_t            *
 
 
 #if (NRF_BLE_SCAN_UUID_CNT > 0)
+// Matched UUID filters are kept in a bit mask.
+STATIC_ASSERT(NRF_BLE_SCAN_UUID_CNT <= 32);
+
 /**@brief Function for comparing the provided UUID with the UUID in the advertisement packets.
  *
- * @param[in]   p_adv_report   Advertising data to parse.
+ * @param[in]   p_fields       Fields of the advertising data.
  * @param[in]   p_scan_ctx     Pointer to the Scanning Module instance.
  *
  * @return      True if the UUIDs match. False otherwise.
  */
-static bool adv_uuid_compare(ble_gap_evt_adv_report_t const * const p_adv_report,
-                             nrf_ble_scan_t           const * const p_scan_ctx)
+static bool adv_uuid_compare(adv_fields_t   const * const p_fields,
+                             nrf_ble_scan_t const * const p_scan_ctx)
 {
     nrf_ble_scan_uuid_filter_t const * p_uuid_filter    = &p_scan_ctx->scan_filters.uuid_filter;
     bool const                         all_filters_mode = p_scan_ctx->scan_filters.all_filters_mode;
     uint8_t const                      counter          =
         p_scan_ctx->scan_filters.uuid_filter.uuid_cnt;
-    uint8_t  index;
-    uint16_t data_len;
-    uint8_t  uuid_match_cnt = 0;
+    uint32_t const                     all_matched      = (counter == 32) ? UINT32_MAX
+                                                                          : ((1UL << counter) - 1);
+    uint32_t                           matched          = 0;
 
-    data_len = p_adv_report->data.len;
+    static uint8_t const uuid_sizes[] = {2, 4, 16};
 
-    for (index = 0; index < counter; index++)
+    // Filter UUIDs are only looked for in the lists of UUIDs of their size. The list of all the
+    // UUIDs of a size is used if there is one, otherwise the list of some of them.
+    for (uint8_t i = 0; i < ARRAY_SIZE(uuid_sizes); i++)
     {
+        uint8_t const   size  = uuid_sizes[i];
+        ad_field_t      field = (ad_field_t)(AD_FIELD_UUID16_COMPLETE + 2 * i);
+        uint8_t const * p_list;
 
-        if (ble_advdata_uuid_find(p_adv_report->data.p_data,
-                                  data_len,
-                                  &p_uuid_filter->uuid[index]))
+        if (p_fields->len[field] == 0)
         {
-            uuid_match_cnt++;
+            field = (ad_field_t)(AD_FIELD_UUID16_MORE + 2 * i);
+        }
+
+        p_list = &p_fields->p_data[p_fields->offset[field]];
+
+        for (uint8_t offset = 0; offset + size <= p_fields->len[field]; offset += size)
+        {
+            uint32_t const hash  = scan_hash(&p_list[offset], size);
+            uint16_t       probe = 0;
+            uint8_t        index;
+            uint8_t        uuid_len;
+
+            while (scan_hash_next(p_uuid_filter->uuid_hash, ARRAY_SIZE(p_uuid_filter->uuid_hash),
+                                  hash, &probe, &index, &uuid_len))
+            {
+                if ((uuid_len == size) &&
+                    (memcmp(p_uuid_filter->uuid_raw[index], &p_list[offset], size) == 0))
+                {
+                    matched |= (1UL << index);
+                }
+            }
 
             // In the normal filter mode, only one UUID is needed to match.
-            if (!all_filters_mode)
+            if ((matched != 0) && !all_filters_mode)
             {
-                break;
+                return true;
             }
         }
-        else if (all_filters_mode)
-        {
-            break;
-        }
-        else
-        {
-            // Do nothing.
-        }
     }
 
     // In the multifilter mode, all UUIDs must be found in the advertisement packets.
-    if ((all_filters_mode && (uuid_match_cnt == counter)) ||
-        ((!all_filters_mode) && (uuid_match_cnt > 0)))
-    {
-        return true;
-    }
-
-    return false;
+    return all_filters_mode && (matched == all_matched);
 }
 
 
@@ -485,6 +677,25 @@ static ret_code_t nrf_ble_scan_uuid_filter_add(nrf_ble_scan_t * const p_scan_ctx
         }
     }
 
+    // Encode the UUID the way it is advertised. A UUID which cannot be encoded,
+    // for example because its vendor-specific base is unknown, never matches.
+    uint8_t * p_raw     = p_scan_ctx->scan_filters.uuid_filter.uuid_raw[*p_counter];
+    uint8_t * p_raw_len = &p_scan_ctx->scan_filters.uuid_filter.uuid_raw_len[*p_counter];
+
+    *p_raw_len = sizeof(p_scan_ctx->scan_filters.uuid_filter.uuid_raw[0]);
+    if (sd_ble_uuid_encode(p_uuid, p_raw_len, p_raw) == NRF_SUCCESS)
+    {
+        scan_hash_add(p_scan_ctx->scan_filters.uuid_filter.uuid_hash,
+                      ARRAY_SIZE(p_scan_ctx->scan_filters.uuid_filter.uuid_hash),
+                      scan_hash(p_raw, *p_raw_len),
+                      *p_counter,
+                      *p_raw_len);
+    }
+    else
+    {
+        *p_raw_len = 0;
+    }
+
     // Add UUID to the filter.
     p_uuid_filter[(*p_counter)++] = *p_uuid;
     NRF_LOG_DEBUG("Added filter on UUID %x", p_uuid->uuid);
@@ -499,29 +710,36 @@ static ret_code_t nrf_ble_scan_uuid_filter_add(nrf_ble_scan_t * const p_scan_ctx
 #if (NRF_BLE_SCAN_APPEARANCE_CNT)
 /**@brief Function for comparing the provided appearance with the appearance in the advertisement packets.
  *
- * @param[in]     p_adv_report Advertising data to parse.
+ * @param[in]     p_fields     Fields of the advertising data.
  * @param[in,out] p_scan_ctx   Pointer to the Scanning Module instance.
  *
  * @return      True if the appearances match. False otherwise.
  */
-static bool adv_appearance_compare(ble_gap_evt_adv_report_t const * const p_adv_report,
-                                   nrf_ble_scan_t           const * const p_scan_ctx)
+static bool adv_appearance_compare(adv_fields_t   const * const p_fields,
+                                   nrf_ble_scan_t const * const p_scan_ctx)
 {
     nrf_ble_scan_appearance_filter_t const * p_appearance_filter =
         &p_scan_ctx->scan_filters.appearance_filter;
-    uint8_t const counter =
-        p_scan_ctx->scan_filters.appearance_filter.appearance_cnt;
+    uint16_t probe = 0;
+    uint16_t appearance;
+    uint32_t hash;
     uint8_t  index;
-    uint16_t data_len;
+    uint8_t  aux;
 
-    data_len = p_adv_report->data.len;
+    if (p_fields->len[AD_FIELD_APPEARANCE] < sizeof(uint16_t))
+    {
+        return false;
+    }
+
+    appearance = uint16_decode(&p_fields->p_data[p_fields->offset[AD_FIELD_APPEARANCE]]);
+    hash       = scan_hash((uint8_t const *)&appearance, sizeof(appearance));
 
     // Verify if the advertised appearance matches the provided appearance.
-    for (index = 0; index < counter; index++)
+    while (scan_hash_next(p_appearance_filter->appearance_hash,
+                          ARRAY_SIZE(p_appearance_filter->appearance_hash),
+                          hash, &probe, &index, &aux))
     {
-        if (ble_advdata_appearance_find(p_adv_report->data.p_data,
-                                        data_len,
-                                        &p_appearance_filter->appearance[index]))
+        if (p_appearance_filter->appearance[index] == appearance)
         {
             return true;
         }
@@ -561,6 +779,12 @@ static ret_code_t nrf_ble_scan_appearance_filter_add(nrf_ble_scan_t * const p_sc
         }
     }
 
+    scan_hash_add(p_scan_ctx->scan_filters.appearance_filter.appearance_hash,
+                  ARRAY_SIZE(p_scan_ctx->scan_filters.appearance_filter.appearance_hash),
+                  scan_hash((uint8_t const *)&appearance, sizeof(appearance)),
+                  *p_counter,
+                  0);
+
     // Add appearance to the filter.
     p_appearance_filter[(*p_counter)++] = appearance;
     NRF_LOG_DEBUG("Added filter on appearance %x", appearance);
@@ -631,6 +855,7 @@ ret_code_t nrf_ble_scan_all_filter_remove(nrf_ble_scan_t * const p_scan_ctx)
 #if (NRF_BLE_SCAN_NAME_CNT > 0)
     nrf_ble_scan_name_filter_t * p_name_filter = &p_scan_ctx->scan_filters.name_filter;
     memset(p_name_filter->target_name, 0, sizeof(p_name_filter->target_name));
+    memset(p_name_filter->name_hash, 0, sizeof(p_name_filter->name_hash));
     p_name_filter->name_cnt = 0;
 #endif
 
@@ -638,18 +863,22 @@ ret_code_t nrf_ble_scan_all_filter_remove(nrf_ble_scan_t * const p_scan_ctx)
     nrf_ble_scan_short_name_filter_t * p_short_name_filter =
         &p_scan_ctx->scan_filters.short_name_filter;
     memset(p_short_name_filter->short_name, 0, sizeof(p_short_name_filter->short_name));
+    memset(p_short_name_filter->prefix_hash, 0, sizeof(p_short_name_filter->prefix_hash));
     p_short_name_filter->name_cnt = 0;
 #endif
 
 #if (NRF_BLE_SCAN_ADDRESS_CNT > 0)
     nrf_ble_scan_addr_filter_t * p_addr_filter = &p_scan_ctx->scan_filters.addr_filter;
     memset(p_addr_filter->target_addr, 0, sizeof(p_addr_filter->target_addr));
+    memset(p_addr_filter->addr_hash, 0, sizeof(p_addr_filter->addr_hash));
     p_addr_filter->addr_cnt = 0;
 #endif
 
 #if (NRF_BLE_SCAN_UUID_CNT > 0)
     nrf_ble_scan_uuid_filter_t * p_uuid_filter = &p_scan_ctx->scan_filters.uuid_filter;
     memset(p_uuid_filter->uuid, 0, sizeof(p_uuid_filter->uuid));
+    memset(p_uuid_filter->uuid_raw_len, 0, sizeof(p_uuid_filter->uuid_raw_len));
+    memset(p_uuid_filter->uuid_hash, 0, sizeof(p_uuid_filter->uuid_hash));
     p_uuid_filter->uuid_cnt = 0;
 #endif
 
@@ -657,6 +886,7 @@ ret_code_t nrf_ble_scan_all_filter_remove(nrf_ble_scan_t * const p_scan_ctx)
     nrf_ble_scan_appearance_filter_t * p_appearance_filter =
         &p_scan_ctx->scan_filters.appearance_filter;
     memset(p_appearance_filter->appearance, 0, sizeof(p_appearance_filter->appearance));
+    memset(p_appearance_filter->appearance_hash, 0, sizeof(p_appearance_filter->appearance_hash));
     p_appearance_filter->appearance_cnt = 0;
 #endif
 
@@ -741,6 +971,12 @@ ret_code_t nrf_ble_scan_filters_disable(nrf_ble_scan_t * const p_scan_ctx)
     *p_name_filter_enabled = false;
 #endif
 
+#if (NRF_BLE_SCAN_SHORT_NAME_CNT > 0)
+    bool * p_short_name_filter_enabled =
+        &p_scan_ctx->scan_filters.short_name_filter.short_name_filter_enabled;
+    *p_short_name_filter_enabled = false;
+#endif
+
 #if (NRF_BLE_SCAN_ADDRESS_CNT > 0)
     bool * p_addr_filter_enabled = &p_scan_ctx->scan_filters.addr_filter.addr_filter_enabled;
     *p_addr_filter_enabled = false;
@@ -809,8 +1045,12 @@ static void nrf_ble_scan_on_adv_report(nrf_ble_scan_t           const * const p_
     }
 
 #if (NRF_BLE_SCAN_FILTER_ENABLE == 1)
-    bool const all_filter_mode   = p_scan_ctx->scan_filters.all_filters_mode;
-    bool       is_filter_matched = false;
+    bool const   all_filter_mode   = p_scan_ctx->scan_filters.all_filters_mode;
+    bool         is_filter_matched = false;
+    adv_fields_t fields;
+
+    // Find the fields the filters look at once, instead of once per filter.
+    adv_fields_parse(p_adv_report, &fields);
 
 #if (NRF_BLE_SCAN_ADDRESS_CNT > 0)
     bool const addr_filter_enabled = p_scan_ctx->scan_filters.addr_filter.addr_filter_enabled;
@@ -857,7 +1097,7 @@ static void nrf_ble_scan_on_adv_report(nrf_ble_scan_t           const * const p_
     if (name_filter_enabled)
     {
         filter_cnt++;
-        if (adv_name_compare(p_adv_report, p_scan_ctx))
+        if (adv_name_compare(&fields, p_scan_ctx))
         {
             filter_match_cnt++;
 
@@ -872,7 +1112,7 @@ static void nrf_ble_scan_on_adv_report(nrf_ble_scan_t           const * const p_
     if (short_name_filter_enabled)
     {
         filter_cnt++;
-        if (adv_short_name_compare(p_adv_report, p_scan_ctx))
+        if (adv_short_name_compare(&fields, p_scan_ctx))
         {
             filter_match_cnt++;
 
@@ -888,7 +1128,7 @@ static void nrf_ble_scan_on_adv_report(nrf_ble_scan_t           const * const p_
     if (uuid_filter_enabled)
     {
         filter_cnt++;
-        if (adv_uuid_compare(p_adv_report, p_scan_ctx))
+        if (adv_uuid_compare(&fields, p_scan_ctx))
         {
             filter_match_cnt++;
             // Information about the filters matched.
@@ -903,7 +1143,7 @@ static void nrf_ble_scan_on_adv_report(nrf_ble_scan_t           const * const p_
     if (appearance_filter_enabled)
     {
         filter_cnt++;
-        if (adv_appearance_compare(p_adv_report, p_scan_ctx))
+        if (adv_appearance_compare(&fields, p_scan_ctx))
         {
             filter_match_cnt++;
             // Information about the filters matched.
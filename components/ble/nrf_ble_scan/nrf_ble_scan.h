@@ -208,12 +208,21 @@ typedef void (*nrf_ble_scan_evt_handler_t)(scan_evt_t const * p_scan_evt);
 
 #if (NRF_BLE_SCAN_FILTER_ENABLE == 1)
 
+/**@brief Number of hash table slots for a filter type of up to @p _cnt entries.
+ *
+ * @details Filters are added to a hash table of their type when they are set, so that an
+ *          advertising report is matched in one pass over its data, whatever the number of filters.
+ *          The tables are at most half full.
+ */
+#define NRF_BLE_SCAN_HASH_SLOTS(_cnt) (2 * (_cnt) + 1)
+
 #if (NRF_BLE_SCAN_NAME_CNT > 0)
 typedef struct
 {
-    char    target_name[NRF_BLE_SCAN_NAME_CNT][NRF_BLE_SCAN_NAME_MAX_LEN]; /**< Names that the main application will scan for, and that will be advertised by the peripherals. */
-    uint8_t name_cnt;                                                      /**< Name filter counter. */
-    bool    name_filter_enabled;                                           /**< Flag to inform about enabling or disabling this filter. */
+    char     target_name[NRF_BLE_SCAN_NAME_CNT][NRF_BLE_SCAN_NAME_MAX_LEN];     /**< Names that the main application will scan for, and that will be advertised by the peripherals. */
+    uint8_t  name_cnt;                                                          /**< Name filter counter. */
+    bool     name_filter_enabled;                                               /**< Flag to inform about enabling or disabling this filter. */
+    uint16_t name_hash[NRF_BLE_SCAN_HASH_SLOTS(NRF_BLE_SCAN_NAME_CNT)];         /**< Hash table of the names. */
 } nrf_ble_scan_name_filter_t;
 #endif
 
@@ -227,33 +236,41 @@ typedef struct
     } short_name[NRF_BLE_SCAN_SHORT_NAME_CNT];
     uint8_t name_cnt;                                               /**< Short name filter counter. */
     bool    short_name_filter_enabled;                              /**< Flag to inform about enabling or disabling this filter. */
+
+    /**@brief Hash table of the prefixes of the short names that are long enough to match. */
+    uint16_t prefix_hash[NRF_BLE_SCAN_HASH_SLOTS(NRF_BLE_SCAN_SHORT_NAME_CNT * NRF_BLE_SCAN_SHORT_NAME_MAX_LEN)];
 } nrf_ble_scan_short_name_filter_t;
 #endif
 
 #if (NRF_BLE_SCAN_ADDRESS_CNT > 0)
 typedef struct
 {
-    ble_gap_addr_t target_addr[NRF_BLE_SCAN_ADDRESS_CNT]; /**< Addresses in the same format as the format used by the SoftDevice that the main application will scan for, and that will be advertised by the peripherals. */
-    uint8_t        addr_cnt;                              /**< Address filter counter. */
-    bool           addr_filter_enabled;                   /**< Flag to inform about enabling or disabling this filter. */
+    ble_gap_addr_t target_addr[NRF_BLE_SCAN_ADDRESS_CNT];                      /**< Addresses in the same format as the format used by the SoftDevice that the main application will scan for, and that will be advertised by the peripherals. */
+    uint8_t        addr_cnt;                                                   /**< Address filter counter. */
+    bool           addr_filter_enabled;                                        /**< Flag to inform about enabling or disabling this filter. */
+    uint16_t       addr_hash[NRF_BLE_SCAN_HASH_SLOTS(NRF_BLE_SCAN_ADDRESS_CNT)]; /**< Hash table of the addresses. */
 } nrf_ble_scan_addr_filter_t;
 #endif
 
 #if (NRF_BLE_SCAN_UUID_CNT > 0)
 typedef struct
 {
-    ble_uuid_t uuid[NRF_BLE_SCAN_UUID_CNT]; /**< UUIDs that the main application will scan for, and that will be advertised by the peripherals. */
-    uint8_t    uuid_cnt;                    /**< UUID filter counter. */
-    bool       uuid_filter_enabled;         /**< Flag to inform about enabling or disabling this filter. */
+    ble_uuid_t uuid[NRF_BLE_SCAN_UUID_CNT];                            /**< UUIDs that the main application will scan for, and that will be advertised by the peripherals. */
+    uint8_t    uuid_cnt;                                               /**< UUID filter counter. */
+    bool       uuid_filter_enabled;                                    /**< Flag to inform about enabling or disabling this filter. */
+    uint8_t    uuid_raw[NRF_BLE_SCAN_UUID_CNT][16];                    /**< UUIDs as they are advertised, encoded when the filter is added. */
+    uint8_t    uuid_raw_len[NRF_BLE_SCAN_UUID_CNT];                    /**< Length of the encoded UUIDs, 0 if the UUID could not be encoded. */
+    uint16_t   uuid_hash[NRF_BLE_SCAN_HASH_SLOTS(NRF_BLE_SCAN_UUID_CNT)]; /**< Hash table of the encoded UUIDs. */
 } nrf_ble_scan_uuid_filter_t;
 #endif
 
 #if (NRF_BLE_SCAN_APPEARANCE_CNT > 0)
 typedef struct
 {
-    uint16_t appearance[NRF_BLE_SCAN_APPEARANCE_CNT]; /**< Apperances that the main application will scan for, and that will be advertised by the peripherals. */
-    uint8_t  appearance_cnt;                          /**< Appearance filter counter. */
-    bool     appearance_filter_enabled;               /**< Flag to inform about enabling or disabling this filter. */
+    uint16_t appearance[NRF_BLE_SCAN_APPEARANCE_CNT];                            /**< Apperances that the main application will scan for, and that will be advertised by the peripherals. */
+    uint8_t  appearance_cnt;                                                     /**< Appearance filter counter. */
+    bool     appearance_filter_enabled;                                          /**< Flag to inform about enabling or disabling this filter. */
+    uint16_t appearance_hash[NRF_BLE_SCAN_HASH_SLOTS(NRF_BLE_SCAN_APPEARANCE_CNT)]; /**< Hash table of the appearances. */
 } nrf_ble_scan_appearance_filter_t;
 #endif
 
@@ -56,6 +56,14 @@
 extern "C" {
 #endif
 
+/**@brief Implementations of @ref crc16_compute, selected with CRC16_CONFIG_IMPL.
+ *
+ * They trade flash used by tables for speed and give the same results.
+ */
+#define CRC16_IMPL_SHIFT    0   /**< No table, shifts and xors per byte. */
+#define CRC16_IMPL_NIBBLE   1   /**< 32 byte table, 2 lookups per byte. */
+#define CRC16_IMPL_TABLE    2   /**< 512 byte table, 1 lookup per byte. */
+
 /**@brief Function for calculating CRC-16 in blocks.
  *
  * Feed each consecutive data block into this function, along with the current value of p_crc as
@@ -55,6 +55,17 @@
 extern "C" {
 #endif
 
+/**@brief Implementations of @ref crc32_compute, selected with CRC32_CONFIG_IMPL.
+ *
+ * They trade flash used by tables for speed and give the same results.
+ * CRC32_IMPL_TABLE is used if sdk_config.h does not set one.
+ */
+#define CRC32_IMPL_BITWISE  0   /**< No table, 8 steps per byte. */
+#define CRC32_IMPL_NIBBLE   1   /**< 64 byte table, 2 lookups per byte. */
+#define CRC32_IMPL_TABLE    2   /**< 1 kB table, 1 lookup per byte. */
+#define CRC32_IMPL_SLICE4   3   /**< 4 kB table, 4 bytes per step. */
+#define CRC32_IMPL_SLICE8   4   /**< 8 kB table, 8 bytes per step. */
+
 /**@brief Function for calculating CRC-32 in blocks.
  *
  * Feed each consecutive data block into this function, along with the current value of p_crc as
@@ -99,6 +99,33 @@ static fds_swap_page_t      m_swap_page;
 // Garbage collection data.
 static fds_gc_data_t        m_gc;
 
+// Garbage collection statistics, see fds_gc_stat().
+static struct
+{
+    uint32_t words_written;
+    uint32_t words_copied;
+    uint32_t words_freed;
+    uint16_t runs;
+    uint16_t yields;
+    uint16_t restarts;
+} m_gc_stat;
+
+// The number of times each virtual page has been erased, in address order.
+static uint32_t             m_page_erases[FDS_VIRTUAL_PAGES];
+
+#if (FDS_INDEX_SIZE > 0)
+// RAM index of the valid records on data pages, sorted by file ID, record key and then by
+// position in flash, which is the order record_find() returns them in. The index is only used
+// while it is valid: it is dropped when it runs out of entries, when an operation times out and
+// while garbage collection moves records around, and rebuilt when garbage collection completes.
+static struct
+{
+    fds_index_entry_t entries[FDS_INDEX_SIZE];
+    uint16_t          count;
+    bool volatile     valid;
+} m_index;
+#endif
+
 
 static void event_send(fds_evt_t const * const p_evt)
 {
@@ -355,7 +382,9 @@ static void page_offsets_update(fds_page_t * const p_page, fds_op_t const * p_op
     // operation. Incomplete records will be deleted the next time garbage collection is run.
     // If we failed at the very beginning of the write operation, restore the offset
     // to the previous value so that no holes will be left in the flash.
-    if (p_op->write.step > FDS_OP_WRITE_RECORD_ID)
+    // The steps are not declared in the order they run in, so compare them one by one.
+    if ((p_op->write.step != FDS_OP_WRITE_HEADER_BEGIN) &&
+        (p_op->write.step != FDS_OP_WRITE_RECORD_ID))
     {
         p_page->write_offset += (FDS_HEADER_SIZE + p_op->write.header.length_words);
     }
@@ -364,6 +393,21 @@ static void page_offsets_update(fds_page_t * const p_page, fds_op_t const * p_op
 }
 
 
+// Erase a virtual page and count the erase.
+static ret_code_t flash_page_erase(uint32_t const * const p_page_addr)
+{
+    ret_code_t const ret = nrf_fstorage_erase(&m_fs, (uint32_t)p_page_addr,
+                                              FDS_PHY_PAGES_IN_VPAGE, NULL);
+
+    if (ret == NRF_SUCCESS)
+    {
+        m_page_erases[(p_page_addr - (uint32_t*)m_fs.start_addr) / FDS_PAGE_SIZE]++;
+    }
+
+    return ret;
+}
+
+
 // Tags a page as swap, i.e., reserved for GC.
 static ret_code_t page_tag_write_swap(void)
 {
@@ -477,6 +521,277 @@ static bool record_find_next(uint16_t page, uint32_t const ** p_record)
 }
 
 
+#if (FDS_INDEX_SIZE > 0)
+// The sort key of an index entry.
+static uint64_t index_key(uint16_t file_id, uint16_t record_key, uint16_t page, uint16_t offset)
+{
+    return ((uint64_t)file_id << 48) | ((uint64_t)record_key << 32) | ((uint32_t)page << 16) | offset;
+}
+
+
+// Returns the position of the first entry whose key is not less than the given key.
+static uint16_t index_lower_bound(uint64_t key)
+{
+    uint16_t lo = 0;
+    uint16_t hi = m_index.count;
+
+    while (lo < hi)
+    {
+        uint16_t          const mid     = (uint16_t)((lo + hi) / 2);
+        fds_index_entry_t const * p_entry = &m_index.entries[mid];
+
+        if (index_key(p_entry->file_id, p_entry->record_key, p_entry->page, p_entry->offset) < key)
+        {
+            lo = (uint16_t)(mid + 1);
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+static uint32_t const * index_entry_addr(fds_index_entry_t const * p_entry)
+{
+    return m_pages[p_entry->page].p_addr + p_entry->offset;
+}
+
+
+// Insert a record in the index, in order. Returns false if the index is full.
+static bool index_entry_add(uint16_t page, uint32_t const * p_record)
+{
+    fds_header_t const * const p_header = (fds_header_t*)p_record;
+    uint16_t             const offset   = (uint16_t)(p_record - m_pages[page].p_addr);
+
+    if (m_index.count == FDS_INDEX_SIZE)
+    {
+        return false;
+    }
+
+    uint16_t const pos = index_lower_bound(index_key(p_header->file_id, p_header->record_key,
+                                                     page, offset));
+
+    memmove(&m_index.entries[pos + 1], &m_index.entries[pos],
+            (m_index.count - pos) * sizeof(fds_index_entry_t));
+
+    m_index.entries[pos].file_id    = p_header->file_id;
+    m_index.entries[pos].record_key = p_header->record_key;
+    m_index.entries[pos].page       = page;
+    m_index.entries[pos].offset     = offset;
+    m_index.count++;
+
+    return true;
+}
+
+
+// Add a newly written record to the index. If the index is full, drop it; GC rebuilds it.
+static void index_insert(uint16_t page, uint32_t const * p_record)
+{
+    CRITICAL_SECTION_ENTER();
+    if (m_index.valid && !index_entry_add(page, p_record))
+    {
+        m_index.valid = false;
+    }
+    CRITICAL_SECTION_EXIT();
+}
+
+
+// Remove a record from the index, if it is there.
+static void index_remove(uint16_t page, uint32_t const * p_record)
+{
+    fds_header_t const * const p_header = (fds_header_t*)p_record;
+    uint16_t             const offset   = (uint16_t)(p_record - m_pages[page].p_addr);
+    uint64_t             const key      = index_key(p_header->file_id, p_header->record_key,
+                                                    page, offset);
+
+    CRITICAL_SECTION_ENTER();
+
+    uint16_t const pos = index_lower_bound(key);
+
+    if (m_index.valid && (pos < m_index.count))
+    {
+        fds_index_entry_t const * p_entry = &m_index.entries[pos];
+
+        if (index_key(p_entry->file_id, p_entry->record_key, p_entry->page, p_entry->offset) == key)
+        {
+            m_index.count--;
+            memmove(&m_index.entries[pos], &m_index.entries[pos + 1],
+                    (m_index.count - pos) * sizeof(fds_index_entry_t));
+        }
+    }
+
+    CRITICAL_SECTION_EXIT();
+}
+
+
+// Scan all data pages and fill the index. The index is left invalid if the records don't fit.
+// Lookups don't read the entries while the index is invalid, so the scan runs unlocked.
+static void index_build(void)
+{
+    m_index.valid = false;
+    m_index.count = 0;
+
+    for (uint16_t page = 0; page < FDS_DATA_PAGES; page++)
+    {
+        uint32_t const * p_record = NULL;
+
+        if (m_pages[page].page_type != FDS_PAGE_DATA)
+        {
+            continue;
+        }
+
+        while (record_find_next(page, &p_record))
+        {
+            if (!index_entry_add(page, p_record))
+            {
+                return;
+            }
+        }
+    }
+
+    m_index.valid = true;
+}
+
+
+static void index_invalidate(void)
+{
+    m_index.valid = false;
+}
+
+
+// Look up a record by file ID and record key, resuming after the position in the token.
+// Returns false if the index can't be used, in which case flash must be scanned.
+static bool index_record_find(uint16_t            file_id,
+                              uint16_t            record_key,
+                              fds_record_desc_t * p_desc,
+                              fds_find_token_t  * p_token,
+                              ret_code_t        * p_ret)
+{
+    bool     found = false;
+    bool     used  = false;
+    uint16_t page  = p_token->page;
+
+    if (page >= FDS_DATA_PAGES)
+    {
+        *p_ret = FDS_ERR_NOT_FOUND;
+        return true;
+    }
+
+    // Resume after the record in the token, or from the beginning of the page.
+    uint16_t const offset = (p_token->p_addr == NULL) ? 0 :
+                            (uint16_t)(p_token->p_addr - m_pages[page].p_addr + 1);
+
+    CRITICAL_SECTION_ENTER();
+
+    if (m_index.valid)
+    {
+        uint16_t const pos = index_lower_bound(index_key(file_id, record_key, page, offset));
+
+        used = true;
+
+        if ((pos < m_index.count)                           &&
+            (m_index.entries[pos].file_id    == file_id)    &&
+            (m_index.entries[pos].record_key == record_key))
+        {
+            fds_index_entry_t    const * p_entry  = &m_index.entries[pos];
+            uint32_t             const * p_record = index_entry_addr(p_entry);
+            fds_header_t         const * p_header = (fds_header_t*)p_record;
+            uint32_t             const * p_end    = m_pages[p_entry->page].p_addr + FDS_PAGE_SIZE;
+
+            if ((header_check(p_header, p_end) == FDS_HEADER_VALID) &&
+                (p_header->file_id    == file_id)                   &&
+                (p_header->record_key == record_key))
+            {
+                p_desc->record_id    = p_header->record_id;
+                p_desc->p_record     = p_record;
+                p_desc->gc_run_count = m_gc.run_count;
+
+                p_token->page        = p_entry->page;
+                p_token->p_addr      = p_record;
+
+                found = true;
+            }
+            else
+            {
+                // The index is out of sync with flash. Stop using it until it is rebuilt.
+                m_index.valid = false;
+                used          = false;
+            }
+        }
+    }
+
+    CRITICAL_SECTION_EXIT();
+
+    if (used && !found)
+    {
+        // Leave the token past the last page, as a scan would.
+        p_token->page   = FDS_DATA_PAGES;
+        p_token->p_addr = NULL;
+    }
+
+    *p_ret = found ? NRF_SUCCESS : FDS_ERR_NOT_FOUND;
+    return used;
+}
+
+
+// Look up a record by its ID among the records in the index.
+// Returns false if the index can't be used, in which case flash must be scanned.
+static bool index_record_find_by_id(uint32_t record_id, fds_record_desc_t * p_desc,
+                                    uint16_t * p_page, bool * p_found)
+{
+    bool used;
+
+    *p_found = false;
+
+    CRITICAL_SECTION_ENTER();
+
+    used = m_index.valid;
+
+    for (uint16_t i = 0; used && (i < m_index.count); i++)
+    {
+        uint32_t     const * p_record = index_entry_addr(&m_index.entries[i]);
+        fds_header_t const * p_header = (fds_header_t*)p_record;
+
+        if (p_header->record_id == record_id)
+        {
+            p_desc->p_record     = p_record;
+            p_desc->gc_run_count = m_gc.run_count;
+            *p_page              = m_index.entries[i].page;
+            *p_found             = true;
+            break;
+        }
+    }
+
+    CRITICAL_SECTION_EXIT();
+
+    return used;
+}
+#else
+static void index_insert(uint16_t page, uint32_t const * p_record)
+{
+    UNUSED_PARAMETER(page);
+    UNUSED_PARAMETER(p_record);
+}
+
+static void index_remove(uint16_t page, uint32_t const * p_record)
+{
+    UNUSED_PARAMETER(page);
+    UNUSED_PARAMETER(p_record);
+}
+
+static void index_build(void)
+{
+}
+
+static void index_invalidate(void)
+{
+}
+#endif // FDS_INDEX_SIZE > 0
+
+
 // Find a record given its descriptor and retrive the page in which the record is stored.
 // NOTE: Do not pass NULL as an argument for p_page.
 static bool record_find_by_desc(fds_record_desc_t * const p_desc, uint16_t * const p_page)
@@ -492,6 +807,15 @@ static bool record_find_by_desc(fds_record_desc_t * const p_desc, uint16_t * con
         return (page_from_record(p_page, p_desc->p_record) == NRF_SUCCESS);
     }
 
+#if (FDS_INDEX_SIZE > 0)
+    // Otherwise, look it up among the indexed records, if the index is valid.
+    bool found;
+    if (index_record_find_by_id(p_desc->record_id, p_desc, p_page, &found))
+    {
+        return found;
+    }
+#endif
+
     // Otherwise, find the record in flash.
     for (*p_page = 0; *p_page < FDS_DATA_PAGES; (*p_page)++)
     {
@@ -533,6 +857,18 @@ static ret_code_t record_find(uint16_t          const * p_file_id,
         return FDS_ERR_NULL_ARG;
     }
 
+#if (FDS_INDEX_SIZE > 0)
+    // Lookups by both file ID and record key can use the index.
+    if ((p_file_id != NULL) && (p_record_key != NULL))
+    {
+        ret_code_t ret;
+        if (index_record_find(*p_file_id, *p_record_key, p_desc, p_token, &ret))
+        {
+            return ret;
+        }
+    }
+#endif
+
     // Begin (or resume) searching for a record.
     for (; p_token->page < FDS_DATA_PAGES; p_token->page++)
     {
@@ -623,7 +959,10 @@ static fds_op_t * queue_buf_get(nrf_atfifo_item_put_t * p_iput_ctx)
 {
     fds_op_t * const p_op = (fds_op_t*) nrf_atfifo_item_alloc(m_queue, p_iput_ctx);
 
-    memset(p_op, 0x00, sizeof(fds_op_t));
+    if (p_op != NULL)
+    {
+        memset(p_op, 0x00, sizeof(fds_op_t));
+    }
     return p_op;
 }
 
@@ -650,6 +989,29 @@ static void queue_free(nrf_atfifo_item_get_t * p_iget_ctx)
 }
 
 
+// Queue the currently loaded operation again and free it.
+// Returns false, and keeps the operation loaded, if the queue is full.
+static bool queue_requeue(nrf_atfifo_item_get_t * p_iget_ctx, fds_op_code_t op_code)
+{
+    nrf_atfifo_item_put_t iput_ctx;
+
+    // Allocate before freeing: an operation queued from a higher priority context
+    // could take the freed element in between.
+    fds_op_t * const p_op = queue_buf_get(&iput_ctx);
+    if (p_op == NULL)
+    {
+        return false;
+    }
+
+    p_op->op_code = op_code;
+
+    queue_buf_store(&iput_ctx);
+    queue_free(p_iget_ctx);
+
+    return true;
+}
+
+
 static bool queue_has_next(void)
 {
     // Decrement the number of queued operations.
@@ -819,16 +1181,34 @@ static ret_code_t record_header_flag_dirty(uint32_t * const p_record, uint16_t p
     // Flag the record as dirty.
     ret_code_t ret;
 
+    // Remove the record from the index while its header can still be read; the write
+    // may complete synchronously.
+    index_remove(page_to_gc, p_record);
+
     ret = nrf_fstorage_write(&m_fs, (uint32_t)p_record,
         &dirty_header, FDS_HEADER_SIZE_TL * sizeof(uint32_t), NULL);
 
     if (ret != NRF_SUCCESS)
     {
+        // The record is still valid, but no longer in the index.
+        index_invalidate();
         return FDS_ERR_BUSY;
     }
 
     m_pages[page_to_gc].can_gc = true;
 
+#if (FDS_GC_RECORDS_PER_STEP > 0)
+    // Garbage collection is paused half-way through this page. If the record has already been
+    // copied to swap, the copy must not be promoted: start the page over.
+    if (((m_gc.state == GC_FIND_NEXT_RECORD) || (m_gc.state == GC_COPY_RECORD)) &&
+        (m_gc.cur_page == page_to_gc) &&
+        (m_gc.p_record_src != NULL)   &&
+        (p_record <= m_gc.p_record_src))
+    {
+        m_gc.restart = true;
+    }
+#endif
+
     return NRF_SUCCESS;
 }
 
@@ -872,21 +1252,15 @@ static ret_code_t file_find_and_delete(fds_op_t * const p_op)
     ret_code_t        ret;
     fds_record_desc_t desc;
 
-    // This token must persist across calls.
-    static fds_find_token_t tok = {0};
-
+    // The token is kept in the operation, so that an operation which failed half-way
+    // does not leave a stale token to the next one.
     // Pass NULL to ignore the record key.
-    ret = record_find(&p_op->del.file_id, NULL, &desc, &tok);
+    ret = record_find(&p_op->del.file_id, NULL, &desc, &p_op->del.tok);
 
     if (ret == NRF_SUCCESS)
     {
          // A record was found: flag it as dirty.
-        ret = record_header_flag_dirty((uint32_t*)desc.p_record, tok.page);
-    }
-    else // FDS_ERR_NOT_FOUND
-    {
-        // No more records were found. Zero the token, so that it can be reused.
-        memset(&tok, 0x00, sizeof(fds_find_token_t));
+        ret = record_header_flag_dirty((uint32_t*)desc.p_record, p_op->del.tok.page);
     }
 
     return ret;
@@ -928,9 +1302,14 @@ static bool crc_verify_success(uint16_t crc, uint16_t len_words, uint32_t const
 
 static void gc_init(void)
 {
+    // Records are about to move. The index is rebuilt when GC completes.
+    index_invalidate();
+
     m_gc.run_count++;
     m_gc.cur_page = 0;
     m_gc.resume   = false;
+    m_gc.restart  = false;
+    m_gc.copies   = 0;
 
     // Setup which pages to GC. Defer checking for open records and the can_gc flag,
     // as other operations might change those while GC is running.
@@ -941,29 +1320,79 @@ static void gc_init(void)
 }
 
 
-// Obtain the next page to be garbage collected.
+// The share of the used part of a page, in percent, which garbage collection would free.
+static uint16_t page_dirty_percent(uint16_t page)
+{
+    uint16_t valid_records  = 0;
+    uint16_t dirty_records  = 0;
+    uint16_t freeable_words = 0;
+    bool     corruption     = false;
+
+    uint16_t const words_used = m_pages[page].write_offset - FDS_PAGE_TAG_SIZE;
+
+    if (words_used == 0)
+    {
+        return 0;
+    }
+
+    records_stat(page, &valid_records, &dirty_records, &freeable_words, &corruption);
+
+    // A corrupted page is freeable from the corruption to its end, which can be past write_offset.
+    return (freeable_words >= words_used) ? 100 : (uint16_t)((freeable_words * 100UL) / words_used);
+}
+
+
+// Obtain the next page to be garbage collected: the one with the largest share of dirty words.
 // Returns true if there are pages left to garbage collect, returns false otherwise.
 static bool gc_page_next(uint16_t * const p_next_page)
 {
-    bool ret = false;
+    bool     ret  = false;
+    uint16_t best = 0;
 
     for (uint16_t i = 0; i < FDS_DATA_PAGES; i++)
     {
-        if (m_gc.do_gc_page[i])
+        if (!m_gc.do_gc_page[i])
+        {
+            continue;
+        }
+
+        // Only GC pages with no open records and with some records which have been deleted.
+        if ((m_pages[i].records_open != 0) || (m_pages[i].can_gc == false))
         {
             // Do not attempt to GC this page again.
             m_gc.do_gc_page[i] = false;
+            continue;
+        }
 
-            // Only GC pages with no open records and with some records which have been deleted.
-            if ((m_pages[i].records_open == 0) && (m_pages[i].can_gc == true))
-            {
-                *p_next_page = i;
-                ret = true;
-                break;
-            }
+        uint16_t const dirty = page_dirty_percent(i);
+
+#if (FDS_GC_MIN_DIRTY_PERCENT > 0)
+        if (dirty < FDS_GC_MIN_DIRTY_PERCENT)
+        {
+            m_gc.do_gc_page[i] = false;
+            continue;
+        }
+#endif
+
+        if (dirty == 0)
+        {
+            m_gc.do_gc_page[i] = false;
+            continue;
+        }
+
+        if (!ret || (dirty > best))
+        {
+            *p_next_page = i;
+            best         = dirty;
+            ret          = true;
         }
     }
 
+    if (ret)
+    {
+        m_gc.do_gc_page[*p_next_page] = false;
+    }
+
     return ret;
 }
 
@@ -973,7 +1402,7 @@ static ret_code_t gc_swap_erase(void)
     m_gc.state               = GC_DISCARD_SWAP;
     m_swap_page.write_offset = FDS_PAGE_TAG_SIZE;
 
-    return nrf_fstorage_erase(&m_fs, (uint32_t)m_swap_page.p_addr, FDS_PHY_PAGES_IN_VPAGE, NULL);
+    return flash_page_erase(m_swap_page.p_addr);
 }
 
 
@@ -988,7 +1417,7 @@ static ret_code_t gc_page_erase(void)
     {
         m_gc.state = GC_ERASE_PAGE;
 
-        ret = nrf_fstorage_erase(&m_fs, (uint32_t)m_pages[gc].p_addr, FDS_PHY_PAGES_IN_VPAGE, NULL);
+        ret = flash_page_erase(m_pages[gc].p_addr);
     }
     else
     {
@@ -1063,6 +1492,9 @@ static ret_code_t gc_next_page(void)
         m_gc.cur_page     = 0;
         m_gc.p_record_src = NULL;
 
+        index_build();
+        m_gc_stat.runs++;
+
         return FDS_OP_COMPLETED;
     }
 
@@ -1077,6 +1509,7 @@ static void gc_update_swap_offset(void)
     uint16_t     const         record_len = FDS_HEADER_SIZE + p_header->length_words;
 
     m_swap_page.write_offset += record_len;
+    m_gc_stat.words_copied   += record_len;
 }
 
 
@@ -1089,6 +1522,8 @@ static void gc_swap_pages(void)
     m_swap_page.p_addr            = m_pages[m_gc.cur_page].p_addr;
     m_pages[m_gc.cur_page].p_addr = p_addr;
 
+    m_gc_stat.words_freed += m_pages[m_gc.cur_page].write_offset - m_swap_page.write_offset;
+
     // Keep the offset for this page, but reset it for the swap.
     m_pages[m_gc.cur_page].write_offset = m_swap_page.write_offset;
     m_swap_page.write_offset            = FDS_PAGE_TAG_SIZE;
@@ -1098,6 +1533,20 @@ static void gc_swap_pages(void)
 }
 
 
+#if (FDS_GC_RECORDS_PER_STEP > 0)
+// A record already copied to swap was deleted while garbage collection was paused.
+// Discard the swap and garbage collect the page again.
+static ret_code_t gc_page_restart(void)
+{
+    m_gc.restart                   = false;
+    m_gc.do_gc_page[m_gc.cur_page] = true;
+    m_gc_stat.restarts++;
+
+    return gc_swap_erase();
+}
+#endif
+
+
 static void gc_state_advance(void)
 {
     switch (m_gc.state)
@@ -1175,6 +1624,7 @@ static ret_code_t init_execute(uint32_t prev_ret, fds_op_t * const p_op)
             }
             if (!write_reqd)
             {
+                index_build();
                 m_flags.initialized  = true;
                 m_flags.initializing = false;
                 return FDS_OP_COMPLETED;
@@ -1187,7 +1637,7 @@ static ret_code_t init_execute(uint32_t prev_ret, fds_op_t * const p_op)
             p_op->init.step          = FDS_OP_INIT_TAG_SWAP;
             m_swap_page.write_offset = FDS_PAGE_TAG_SIZE;
 
-            ret = nrf_fstorage_erase(&m_fs, (uint32_t)m_swap_page.p_addr, FDS_PHY_PAGES_IN_VPAGE, NULL);
+            ret = flash_page_erase(m_swap_page.p_addr);
         } break;
 
         case FDS_OP_INIT_PROMOTE_SWAP:
@@ -1246,7 +1696,9 @@ static ret_code_t write_execute(uint32_t prev_ret, fds_op_t * const p_op)
     if (prev_ret != NRF_SUCCESS)
     {
         // The previous operation has timed out, update offsets.
+        // It is unknown which records were written or flagged dirty, so drop the index.
         page_offsets_update(p_page, p_op);
+        index_invalidate();
         return FDS_ERR_OPERATION_TIMEOUT;
     }
 
@@ -1289,6 +1741,9 @@ static ret_code_t write_execute(uint32_t prev_ret, fds_op_t * const p_op)
             break;
 
         case FDS_OP_WRITE_FLAG_DIRTY:
+            // The new copy is valid now, index it before the old copy is removed.
+            index_insert(p_op->write.page, p_write_addr);
+            m_gc_stat.words_written += FDS_HEADER_SIZE + p_op->write.header.length_words;
             p_op->write.step = FDS_OP_WRITE_DONE;
             ret = record_header_flag_dirty((uint32_t*)desc.p_record, page);
             break;
@@ -1296,6 +1751,13 @@ static ret_code_t write_execute(uint32_t prev_ret, fds_op_t * const p_op)
         case FDS_OP_WRITE_DONE:
             ret = FDS_OP_COMPLETED;
 
+            if (p_op->op_code == FDS_OP_WRITE)
+            {
+                // Updates have indexed the new copy already.
+                index_insert(p_op->write.page, p_write_addr);
+                m_gc_stat.words_written += FDS_HEADER_SIZE + p_op->write.header.length_words;
+            }
+
 #if (FDS_CRC_CHECK_ON_WRITE)
             if (!crc_verify_success(p_op->write.header.crc16,
                                     p_op->write.header.length_words,
@@ -1329,6 +1791,8 @@ static ret_code_t delete_execute(uint32_t prev_ret, fds_op_t * const p_op)
 
     if (prev_ret != NRF_SUCCESS)
     {
+        // The record may or may not have been flagged dirty.
+        index_invalidate();
         return FDS_ERR_OPERATION_TIMEOUT;
     }
 
@@ -1377,9 +1841,32 @@ static ret_code_t gc_execute(uint32_t prev_ret)
     }
     else
     {
+#if (FDS_GC_RECORDS_PER_STEP > 0)
+        fds_gc_state_t const prev_state = m_gc.state;
+
+        gc_state_advance();
+
+        // Let other operations run after a number of records have been copied,
+        // and between pages. GC is queued again and continues from the current state.
+        if ((prev_state == GC_TAG_NEW_SWAP) ||
+            ((prev_state == GC_COPY_RECORD) && (++m_gc.copies >= FDS_GC_RECORDS_PER_STEP)))
+        {
+            m_gc.copies = 0;
+            m_gc.resume = true;
+            return FDS_OP_YIELD;
+        }
+#else
         gc_state_advance();
+#endif
     }
 
+#if (FDS_GC_RECORDS_PER_STEP > 0)
+    if (m_gc.restart)
+    {
+        return gc_page_restart();
+    }
+#endif
+
     switch (m_gc.state)
     {
         case GC_NEXT_PAGE:
@@ -1398,6 +1885,10 @@ static ret_code_t gc_execute(uint32_t prev_ret)
             ret = gc_page_erase();
             break;
 
+        case GC_DISCARD_SWAP:
+            ret = gc_swap_erase();
+            break;
+
         case GC_PROMOTE_SWAP:
             ret = gc_swap_promote();
             break;
@@ -1412,7 +1903,7 @@ static ret_code_t gc_execute(uint32_t prev_ret)
             break;
     }
 
-    // Either FDS_OP_EXECUTING, FDS_OP_COMPLETED, FDS_ERR_BUSY or FDS_ERR_INTERNAL.
+    // Either FDS_OP_EXECUTING, FDS_OP_COMPLETED, FDS_OP_YIELD, FDS_ERR_BUSY or FDS_ERR_INTERNAL.
     return ret;
 }
 
@@ -1470,6 +1961,26 @@ static void queue_process(ret_code_t result)
             break;
         }
 
+        if (result == FDS_OP_YIELD)
+        {
+            // The operation is paused. Queue it again behind the operations queued meanwhile,
+            // and execute those. The number of queued operations does not change.
+            // If the queue is full, the operation goes on without yielding.
+            if (queue_requeue(&m_iget_ctx, m_p_cur_op->op_code))
+            {
+                m_gc_stat.yields++;
+                m_p_cur_op = NULL;
+            }
+            result = NRF_SUCCESS;
+            continue;
+        }
+
+        if (m_p_cur_op->op_code == FDS_OP_GC)
+        {
+            // Let the event handler queue garbage collection again.
+            m_gc.pending = false;
+        }
+
         // The operation has completed (either successfully or with an error).
         // - send an event to the user
         // - free the operation buffer
@@ -1752,6 +2263,7 @@ ret_code_t fds_init(void)
         case ALREADY_INSTALLED:
         {
             // No initialization is necessary. Notify the application immediately.
+            index_build();
             m_flags.initialized  = true;
             m_flags.initializing = false;
             event_send(&evt_success);
@@ -2048,6 +2560,8 @@ ret_code_t fds_file_delete(uint16_t file_id)
     p_op->del.step     = FDS_OP_DEL_FILE_FLAG_DIRTY;
     p_op->del.file_id  = file_id;
 
+    memset(&p_op->del.tok, 0x00, sizeof(fds_find_token_t));
+
     queue_buf_store(&iput_ctx);
     queue_start();
 
@@ -2059,15 +2573,28 @@ ret_code_t fds_gc(void)
 {
     fds_op_t * p_op;
     nrf_atfifo_item_put_t iput_ctx;
+    bool pending;
 
     if (!m_flags.initialized)
     {
         return FDS_ERR_NOT_INITIALIZED;
     }
 
+    // Garbage collection which is already queued will collect any pages this call would.
+    CRITICAL_SECTION_ENTER();
+    pending      = m_gc.pending;
+    m_gc.pending = true;
+    CRITICAL_SECTION_EXIT();
+
+    if (pending)
+    {
+        return NRF_SUCCESS;
+    }
+
     p_op = queue_buf_get(&iput_ctx);
     if (p_op == NULL)
     {
+        m_gc.pending = false;
         return FDS_ERR_NO_SPACE_IN_QUEUES;
     }
 
@@ -2198,4 +2725,38 @@ ret_code_t fds_stat(fds_stat_t * const p_stat)
     return NRF_SUCCESS;
 }
 
+
+ret_code_t fds_gc_stat(fds_gc_stat_t * const p_stat)
+{
+    if (!m_flags.initialized)
+    {
+        return FDS_ERR_NOT_INITIALIZED;
+    }
+
+    if (p_stat == NULL)
+    {
+        return FDS_ERR_NULL_ARG;
+    }
+
+    memset(p_stat, 0x00, sizeof(fds_gc_stat_t));
+
+    p_stat->words_written = m_gc_stat.words_written;
+    p_stat->words_copied  = m_gc_stat.words_copied;
+    p_stat->words_freed   = m_gc_stat.words_freed;
+    p_stat->gc_runs       = m_gc_stat.runs;
+    p_stat->gc_yields     = m_gc_stat.yields;
+    p_stat->gc_restarts   = m_gc_stat.restarts;
+    p_stat->pages         = FDS_VIRTUAL_PAGES;
+    p_stat->p_erase_count = m_page_erases;
+
+    p_stat->write_amp_pct = 100;
+    if (m_gc_stat.words_written != 0)
+    {
+        uint64_t const total = (uint64_t)m_gc_stat.words_written + m_gc_stat.words_copied;
+        p_stat->write_amp_pct = (uint32_t)((total * 100) / m_gc_stat.words_written);
+    }
+
+    return NRF_SUCCESS;
+}
+
 #endif //NRF_MODULE_ENABLED(FDS)
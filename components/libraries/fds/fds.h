@@ -260,6 +260,34 @@ typedef struct
 } fds_stat_t;
 
 
+/**@brief   Garbage collection statistics, counted since the file system was initialized. */
+typedef struct
+{
+    uint32_t         words_written;     //!< The number of words of records written by the application, headers included.
+    uint32_t         words_copied;      //!< The number of words of valid records copied by garbage collection.
+    uint32_t         words_freed;       //!< The number of words reclaimed by garbage collection.
+
+    /**@brief Words written to flash per 100 words written by the application.
+     *
+     * This is 100 until garbage collection has copied any records.
+     */
+    uint32_t         write_amp_pct;
+
+    uint16_t         gc_runs;           //!< The number of completed garbage collections.
+    uint16_t         gc_yields;         //!< The number of times garbage collection let other operations run.
+
+    /**@brief The number of times garbage collection started a page over.
+     *
+     * This happens when a record that garbage collection already copied to swap is deleted or
+     * updated before the page is erased.
+     */
+    uint16_t         gc_restarts;
+
+    uint16_t         pages;             //!< The number of entries in @p p_erase_count.
+    uint32_t const * p_erase_count;     //!< The number of erases of each virtual page, in address order.
+} fds_gc_stat_t;
+
+
 /**@brief   FDS event handler function prototype.
  *
  * @param   p_evt   The event.
@@ -632,6 +660,13 @@ ret_code_t fds_record_close(fds_record_desc_t * p_desc);
  * This function is asynchronous. Completion is reported through the @ref FDS_EVT_GC event that
  * is sent to the registered event handler function.
  *
+ * If @c FDS_GC_RECORDS_PER_STEP is not zero, garbage collection copies that many records at a time
+ * and then lets other queued operations run before it continues. If garbage collection is already
+ * queued, this function returns @ref NRF_SUCCESS and only one @ref FDS_EVT_GC event is sent.
+ *
+ * Pages are garbage collected starting with the page with the largest share of deleted records.
+ * Pages where that share is below @c FDS_GC_MIN_DIRTY_PERCENT are skipped.
+ *
  * @retval  NRF_SUCCESS                 If the operation was queued successfully.
  * @retval  FDS_ERR_NOT_INITIALIZED     If the module is not initialized.
  * @retval  FDS_ERR_NO_SPACE_IN_QUEUES  If the operation queue is full.
@@ -693,6 +728,17 @@ ret_code_t fds_record_id_from_desc(fds_record_desc_t const * p_desc,
 ret_code_t fds_stat(fds_stat_t * p_stat);
 
 
+/**@brief   Function for retrieving garbage collection statistics.
+ *
+ * @param[out]  p_stat      Garbage collection statistics.
+ *
+ * @retval  NRF_SUCCESS                 If the statistics were returned successfully.
+ * @retval  FDS_ERR_NOT_INITIALIZED     If the module is not initialized.
+ * @retval  FDS_ERR_NULL_ARG            If @p p_stat is NULL.
+ */
+ret_code_t fds_gc_stat(fds_gc_stat_t * p_stat);
+
+
 /** @} */
 
 
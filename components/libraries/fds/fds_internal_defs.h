@@ -75,6 +75,7 @@ extern "C" {
 
 #define FDS_OP_EXECUTING        (NRF_SUCCESS)
 #define FDS_OP_COMPLETED        (0x1D1D)
+#define FDS_OP_YIELD            (0x1D1E)    // The operation is paused and queued again.
 
 #define NRF_FSTORAGE_NVMC       1
 #define NRF_FSTORAGE_SD         2
@@ -95,6 +96,22 @@ extern "C" {
 // The size of a virtual page, in number of physical pages.
 #define FDS_PHY_PAGES_IN_VPAGE      (FDS_VIRTUAL_PAGE_SIZE / FDS_PHY_PAGE_SIZE)
 
+// The number of records the RAM index can hold. Zero disables the index.
+#ifndef FDS_INDEX_SIZE
+    #define FDS_INDEX_SIZE          (0)
+#endif
+
+// The number of records garbage collection copies before letting other operations run.
+// Zero runs garbage collection as one operation.
+#ifndef FDS_GC_RECORDS_PER_STEP
+    #define FDS_GC_RECORDS_PER_STEP (0)
+#endif
+
+// Pages with a smaller share of dirty words are not garbage collected.
+#ifndef FDS_GC_MIN_DIRTY_PERCENT
+    #define FDS_GC_MIN_DIRTY_PERCENT (0)
+#endif
+
 // The number of pages available to store data; which is the total minus one (the swap).
 #define FDS_DATA_PAGES              (FDS_VIRTUAL_PAGES - 1)
 
@@ -146,6 +163,16 @@ typedef struct
 } fds_swap_page_t;
 
 
+// An entry of the RAM index: a valid record on a data page.
+typedef struct
+{
+    uint16_t file_id;
+    uint16_t record_key;
+    uint16_t page;          // The index of the page in m_pages.
+    uint16_t offset;        // The offset of the record header from the page address, in 4-byte words.
+} fds_index_entry_t;
+
+
 // FDS op-codes.
 typedef enum
 {
@@ -220,6 +247,7 @@ typedef struct
             uint16_t          file_id;
             uint16_t          record_key;
             uint32_t          record_to_delete;
+            fds_find_token_t  tok;              // Where to resume searching the file being deleted.
         } del;
     };
 } fds_op_t;
@@ -305,6 +333,9 @@ typedef struct
     uint16_t         run_count;                  // Total number of times GC was run.
     bool             do_gc_page[FDS_DATA_PAGES]; // Controls which pages to garbage collect.
     bool             resume;                     // Whether or not GC should be resumed.
+    bool             pending;                    // Whether a GC operation is queued.
+    bool             restart;                    // A record already copied to swap was deleted.
+    uint16_t         copies;                     // Records copied since GC last yielded.
 } fds_gc_data_t;
 
 
@@ -0,0 +1,76 @@
+/**@file
+ *
+ * @defgroup nrf_log_backend_bin Log binary backend
+ * @{
+ * @ingroup  nrf_log
+ * @brief Log backend sending entries as binary records, not rendered text.
+ *
+ * Format strings and module names stay in flash and are sent as their
+ * addresses, arguments are sent raw. The host resolves the addresses from
+ * the ELF file of the application and does the formatting. Nothing is
+ * formatted on the device.
+ *
+ * Records are written to RTT up channel @ref NRF_LOG_BACKEND_BIN_RTT_CHANNEL
+ * in skip mode, so a record is either written whole or dropped (and counted
+ * in the next record that is written).
+ *
+ * Record layout, little endian:
+ * @code
+ * uint8_t  flags      NRF_LOG_BIN_FLAG_* | severity
+ * uint8_t  length     number of arguments, or of data bytes for hexdump
+ * uint32_t module     address of module name
+ * uint32_t timestamp  if NRF_LOG_BIN_FLAG_TIMESTAMP
+ * uint16_t dropped    if NRF_LOG_BIN_FLAG_DROPPED, entries lost before this one
+ * std:
+ * uint32_t string     address of format string
+ * uint32_t args[length]
+ * char     strings[]  each %s argument pointing to RAM, null terminated, in argument order
+ * hexdump:
+ * uint8_t  data[length]
+ * @endcode
+ */
+
+#ifndef NRF_LOG_BACKEND_BIN_H
+#define NRF_LOG_BACKEND_BIN_H
+
+#include "nrf_log_backend_interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NRF_LOG_BIN_FLAG_MARK       0x80    /**< Set in every record. */
+#define NRF_LOG_BIN_FLAG_MARK_MASK  0xC0
+#define NRF_LOG_BIN_FLAG_DROPPED    0x20
+#define NRF_LOG_BIN_FLAG_TIMESTAMP  0x10
+#define NRF_LOG_BIN_FLAG_HEXDUMP    0x08
+#define NRF_LOG_BIN_SEVERITY_MASK   0x07
+
+#define NRF_LOG_BIN_HEXDUMP_CHUNK   64      /**< Longer hexdumps are sent as more records. */
+
+extern const nrf_log_backend_api_t nrf_log_backend_bin_api;
+
+typedef struct {
+    nrf_log_backend_t               backend;
+} nrf_log_backend_bin_t;
+
+/**
+ * @brief Binary backend definition
+ *
+ * @param _name Name of the instance.
+ */
+#define NRF_LOG_BACKEND_BIN_DEF(_name)  \
+    NRF_LOG_BACKEND_DEF(_name, nrf_log_backend_bin_api, NULL)
+
+/**
+ * @brief Function for initializing the binary backend, sets up its RTT up channel.
+ */
+void nrf_log_backend_bin_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //NRF_LOG_BACKEND_BIN_H
+
+/** @} */
@@ -160,6 +160,26 @@ void nrf_log_panic(void);
  */
 bool nrf_log_frontend_dequeue(void);
 
+/**
+ * @brief Logger buffer statistics.
+ */
+typedef struct
+{
+    uint32_t dropped;        //!< Entries lost since initialization, because the buffer was full.
+    uint32_t buf_size;       //!< Size of the buffer in 32-bit words.
+    uint32_t buf_used;       //!< Words currently in use.
+    uint32_t buf_high_water; //!< Maximum number of words in use since initialization.
+} nrf_log_stats_t;
+
+/**
+ * @brief Function for getting logger buffer statistics.
+ *
+ * Unlike the dropped count carried in log entries, the counters are never reset.
+ *
+ * @param[out] p_stats Statistics.
+ */
+void nrf_log_stats_get(nrf_log_stats_t * p_stats);
+
 /**
  * @brief Function for getting number of independent log modules registered into the logger.
  *
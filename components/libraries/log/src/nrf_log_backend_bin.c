@@ -0,0 +1,236 @@
+#include "sdk_common.h"
+#if NRF_MODULE_ENABLED(NRF_LOG) && NRF_MODULE_ENABLED(NRF_LOG_BACKEND_BIN)
+#include "nrf_log_backend_bin.h"
+#include "nrf_log_ctrl.h"
+#include "nrf_log_internal.h"
+#include <SEGGER_RTT_Conf.h>
+#include <SEGGER_RTT.h>
+#include <string.h>
+
+#define BIN_RECORD_HEADER_MAX   (1 + 1 + 4 + 4 + 2)
+#define BIN_RECORD_MAX          (BIN_RECORD_HEADER_MAX + 4 + 4 * NRF_LOG_MAX_NUM_OF_ARGS + \
+                                 NRF_LOG_MAX_NUM_OF_ARGS * NRF_LOG_BACKEND_BIN_STR_MAX)
+
+STATIC_ASSERT(NRF_LOG_BACKEND_BIN_RTT_CHANNEL < SEGGER_RTT_MAX_NUM_UP_BUFFERS);
+STATIC_ASSERT(NRF_LOG_BIN_HEXDUMP_CHUNK <= 4 * NRF_LOG_MAX_NUM_OF_ARGS + NRF_LOG_MAX_NUM_OF_ARGS * NRF_LOG_BACKEND_BIN_STR_MAX);
+
+static uint8_t  m_rtt_buffer[NRF_LOG_BACKEND_BIN_RTT_BUFFER_SIZE];
+static uint8_t  m_record[BIN_RECORD_MAX];
+static uint32_t m_dropped;  // records RTT had no room for, sent with the next one
+
+void nrf_log_backend_bin_init(void)
+{
+    // initializes the control block only if not done yet, SEGGER_RTT_Init
+    // would reset the channels configured by other users
+    UNUSED_RETURN_VALUE(SEGGER_RTT_ConfigUpBuffer(NRF_LOG_BACKEND_BIN_RTT_CHANNEL,
+                                                  "nrf_log_bin",
+                                                  m_rtt_buffer,
+                                                  sizeof(m_rtt_buffer),
+                                                  SEGGER_RTT_MODE_NO_BLOCK_SKIP));
+}
+
+static uint8_t * u16_put(uint8_t * p, uint16_t v)
+{
+    *p++ = (uint8_t)(v);
+    *p++ = (uint8_t)(v >> 8);
+    return p;
+}
+
+static uint8_t * u32_put(uint8_t * p, uint32_t v)
+{
+    p = u16_put(p, (uint16_t)(v));
+    return u16_put(p, (uint16_t)(v >> 16));
+}
+
+/**
+ * @brief Function for finding the arguments consumed by %s conversions.
+ *
+ * Only what the host needs to know is parsed: flags, width, precision and
+ * length are skipped, '*' consumes an argument.
+ *
+ * @return Bit mask of argument indexes.
+ */
+static uint32_t str_args_get(char const * p_fmt, uint32_t nargs)
+{
+    uint32_t mask = 0;
+    uint32_t arg  = 0;
+
+    while (*p_fmt != '\0' && arg < nargs)
+    {
+        if (*p_fmt++ != '%')
+        {
+            continue;
+        }
+
+        while (*p_fmt != '\0' && strchr("-+ #0123456789.*hlLqjzt", *p_fmt) != NULL)
+        {
+            if (*p_fmt == '*')
+            {
+                arg++;
+            }
+            p_fmt++;
+        }
+
+        if (*p_fmt == '\0')
+        {
+            break;
+        }
+
+        if (*p_fmt == 's' && arg < nargs)
+        {
+            mask |= (1UL << arg);
+        }
+
+        if (*p_fmt != '%')
+        {
+            arg++;
+        }
+        p_fmt++;
+    }
+
+    return mask;
+}
+
+static bool addr_is_ram(uint32_t addr)
+{
+    return (addr & 0xE0000000) == 0x20000000;
+}
+
+/**
+ * @brief Function for writing a record, all or nothing.
+ */
+static void record_write(uint8_t const * p_start, uint8_t const * p_end)
+{
+    if (SEGGER_RTT_WriteNoLock(NRF_LOG_BACKEND_BIN_RTT_CHANNEL, p_start, (unsigned)(p_end - p_start)) == 0)
+    {
+        m_dropped++;
+    }
+    else
+    {
+        m_dropped = 0;
+    }
+}
+
+static uint8_t * record_header_put(uint8_t *                p,
+                                   nrf_log_header_t const * p_header,
+                                   uint8_t                  flags,
+                                   uint8_t                  length)
+{
+    uint32_t dropped = m_dropped + p_header->dropped;
+
+    flags |= NRF_LOG_BIN_FLAG_MARK;
+    flags |= NRF_LOG_USES_TIMESTAMP ? NRF_LOG_BIN_FLAG_TIMESTAMP : 0;
+    flags |= (dropped != 0) ? NRF_LOG_BIN_FLAG_DROPPED : 0;
+
+    *p++ = flags;
+    *p++ = length;
+    p = u32_put(p, (uint32_t)nrf_log_module_name_get(p_header->module_id, false));
+
+    if (NRF_LOG_USES_TIMESTAMP)
+    {
+        p = u32_put(p, p_header->timestamp);
+    }
+
+    if (dropped != 0)
+    {
+        p = u16_put(p, (uint16_t)MIN(dropped, UINT16_MAX));
+    }
+
+    return p;
+}
+
+static void std_put(nrf_log_entry_t * p_msg, nrf_log_header_t const * p_header, size_t offset)
+{
+    uint32_t args[NRF_LOG_MAX_NUM_OF_ARGS];
+    uint32_t nargs = p_header->base.std.nargs;
+    char const * p_fmt = (char const *)((uint32_t)p_header->base.std.addr);
+    uint32_t strs;
+    uint8_t * p;
+
+    nrf_memobj_read(p_msg, args, nargs * sizeof(uint32_t), offset);
+
+    p = record_header_put(m_record, p_header, (uint8_t)p_header->base.std.severity, (uint8_t)nargs);
+    p = u32_put(p, (uint32_t)p_fmt);
+
+    for (uint32_t i = 0; i < nargs; i++)
+    {
+        p = u32_put(p, args[i]);
+    }
+
+    // strings in flash are resolved by the host, strings in ram are gone by then
+    strs = str_args_get(p_fmt, nargs);
+    for (uint32_t i = 0; i < nargs; i++)
+    {
+        if ((strs & (1UL << i)) && addr_is_ram(args[i]))
+        {
+            size_t len = strnlen((char const *)args[i], NRF_LOG_BACKEND_BIN_STR_MAX - 1);
+
+            memcpy(p, (char const *)args[i], len);
+            p += len;
+            *p++ = '\0';
+        }
+    }
+
+    record_write(m_record, p);
+}
+
+static void hexdump_put(nrf_log_entry_t * p_msg, nrf_log_header_t const * p_header, size_t offset)
+{
+    uint32_t data_len = p_header->base.hexdump.len;
+    nrf_log_header_t header = *p_header;
+
+    do
+    {
+        uint32_t chunk_len = MIN(data_len, NRF_LOG_BIN_HEXDUMP_CHUNK);
+        uint8_t * p = record_header_put(m_record,
+                                        &header,
+                                        (uint8_t)(NRF_LOG_BIN_FLAG_HEXDUMP | p_header->base.hexdump.severity),
+                                        (uint8_t)chunk_len);
+
+        nrf_memobj_read(p_msg, p, chunk_len, offset);
+        offset   += chunk_len;
+        data_len -= chunk_len;
+        header.dropped = 0;
+
+        record_write(m_record, p + chunk_len);
+    } while (data_len > 0);
+}
+
+static void nrf_log_backend_bin_put(nrf_log_backend_t const * p_backend,
+                                    nrf_log_entry_t * p_msg)
+{
+    nrf_log_header_t header;
+    size_t           memobj_offset = HEADER_SIZE * sizeof(uint32_t);
+
+    nrf_memobj_get(p_msg);
+
+    nrf_memobj_read(p_msg, &header, HEADER_SIZE * sizeof(uint32_t), 0);
+
+    if (header.base.generic.type == HEADER_TYPE_STD)
+    {
+        std_put(p_msg, &header, memobj_offset);
+    }
+    else if (header.base.generic.type == HEADER_TYPE_HEXDUMP)
+    {
+        hexdump_put(p_msg, &header, memobj_offset);
+    }
+
+    nrf_memobj_put(p_msg);
+}
+
+static void nrf_log_backend_bin_flush(nrf_log_backend_t const * p_backend)
+{
+    // nothing buffered here, put copies each record into the RTT buffer before it returns
+}
+
+static void nrf_log_backend_bin_panic_set(nrf_log_backend_t const * p_backend)
+{
+    // RTT writes are synchronous and need no interrupt, put works as it is in panic mode
+}
+
+const nrf_log_backend_api_t nrf_log_backend_bin_api = {
+        .put       = nrf_log_backend_bin_put,
+        .flush     = nrf_log_backend_bin_flush,
+        .panic_set = nrf_log_backend_bin_panic_set,
+};
+#endif //NRF_MODULE_ENABLED(NRF_LOG) && NRF_MODULE_ENABLED(NRF_LOG_BACKEND_BIN)
@@ -57,6 +57,15 @@ STATIC_ASSERT(IS_POWER_OF_TWO(NRF_LOG_BUFSIZE));
 
 #define NRF_LOG_BUF_WORDS (NRF_LOG_BUFSIZE/4)
 
+#ifndef NRF_LOG_BUF_RESERVED
+#define NRF_LOG_BUF_RESERVED 0
+#endif
+
+STATIC_ASSERT((NRF_LOG_BUF_RESERVED % 4) == 0);
+STATIC_ASSERT(NRF_LOG_BUF_RESERVED < NRF_LOG_BUFSIZE);
+
+#define NRF_LOG_BUF_RESERVED_WORDS (NRF_LOG_BUF_RESERVED/4)
+
 #if NRF_MODULE_ENABLED(FDS) && NRF_LOG_FILTERS_ENABLED
 #define LOG_CONFIG_LOAD_STORE_ENABLED 1
 #else
@@ -90,11 +99,18 @@ static uint32_t m_buffer_mask =  NRF_LOG_BUF_WORDS - 1; // Size of buffer (must
  * that logger may break when indexes overflows. However, it is quite unlikely.
  * With rate of 1000 log entries with 2 parameters per second such situation
  * would happen after 12 days.
+ *
+ * Producers reserve space by moving wr_idx with compare and exchange and
+ * write the entry in place. The first header word is written last, with
+ * in_progress cleared, which commits the entry. Words are cleared when they
+ * are freed, so an entry that is reserved but not written yet has a header
+ * of type 0. The reader and log_skip stop at the oldest entry that is not
+ * committed, producers may finish in any order.
  */
 typedef struct
 {
     bool                      autoflush;
-    uint32_t                  wr_idx;          // Current write index (never reset)
+    nrf_atomic_u32_t          wr_idx;          // Current write index, reserved up to here (never reset)
     uint32_t                  rd_idx;          // Current read index  (never_reset)
     uint32_t                  buffer[NRF_LOG_BUF_WORDS];
     nrf_log_timestamp_func_t  timestamp_func;  // A pointer to function that returns timestamp
@@ -102,6 +118,8 @@ typedef struct
     nrf_atomic_flag_t         log_skipping;
     nrf_atomic_flag_t         log_skipped;
     nrf_atomic_u32_t          log_dropped_cnt;
+    nrf_atomic_u32_t          log_dropped_total; // Entries lost since init (never reset)
+    uint32_t                  buf_high_water;    // Maximum words in use
 } log_data_t;
 
 static log_data_t   m_log_data;
@@ -316,84 +334,72 @@ nrf_log_severity_t nrf_log_module_filter_get(uint32_t backend_id,
     return severity;
 }
 /**
- * Function examines current header and omits packets which are in progress.
+ * Function returns the length in words of the entry at rd_idx, 0 if it is not
+ * committed yet (header still cleared, or in progress).
  */
-static bool invalid_packets_omit(nrf_log_header_t const * p_header, uint32_t * p_rd_idx)
+static uint32_t entry_len(uint32_t rd_idx)
 {
-    bool ret = false;
-    if (p_header->base.generic.in_progress == 1)
+    nrf_log_main_header_t header;
+
+    header.raw = *(volatile uint32_t *)&m_log_data.buffer[rd_idx & m_buffer_mask];
+
+    if (header.generic.in_progress == 1)
+    {
+        return 0;
+    }
+
+    switch (header.generic.type)
     {
-        switch (p_header->base.generic.type)
-        {
         case HEADER_TYPE_STD:
-            *p_rd_idx += (HEADER_SIZE + p_header->base.std.nargs);
-            break;
+            return HEADER_SIZE + header.std.nargs;
         case HEADER_TYPE_HEXDUMP:
-            *p_rd_idx += (HEADER_SIZE + p_header->base.hexdump.len);
-            break;
+            return HEADER_SIZE + CEIL_DIV(header.hexdump.len, sizeof(uint32_t));
         default:
-            break;
-        }
-        ret = true;
+            return 0;
     }
-    return ret;
 }
+
+/**
+ * @brief Frees the entries from read index up to rd_idx.
+ * @details Freed words are cleared before the space is given back, so the
+ *          header of the next entry written there reads as not committed
+ *          until its producer is done, see @ref entry_len.
+ */
+static void buf_free(uint32_t rd_idx)
+{
+    uint32_t i;
+    for (i = m_log_data.rd_idx; i != rd_idx; i++)
+    {
+        m_log_data.buffer[i & m_buffer_mask] = 0;
+    }
+    __DMB();
+    m_log_data.rd_idx = rd_idx;
+}
+
 /**
  * @brief Skips the oldest, not processed logs to make space for new logs.
  * @details This function moves forward read index to prepare space for new logs.
+ *          The oldest entry must be committed, see @ref entry_len.
  */
 
 static uint32_t log_skip(void)
 {
-    uint16_t dropped = 0;
-
     (void)nrf_atomic_flag_set(&m_log_data.log_skipped);
     (void)nrf_atomic_flag_set(&m_log_data.log_skipping);
 
-    uint32_t           rd_idx = m_log_data.rd_idx;
-    uint32_t           mask   = m_buffer_mask;
-    nrf_log_header_t * p_header = (nrf_log_header_t *)&m_log_data.buffer[rd_idx & mask];
-    nrf_log_header_t   header;
+    uint32_t rd_idx = m_log_data.rd_idx;
+    uint32_t len    = entry_len(rd_idx);
+    uint16_t dropped;
 
-    // Skip packets that may be invalid (interrupted while being in progress)
-    do {
-        if (invalid_packets_omit(p_header, &rd_idx))
-        {
-            //something was omitted. Point to new header and try again.
-            p_header = (nrf_log_header_t *)&m_log_data.buffer[rd_idx & mask];
-        }
-        else
-        {
-            break;
-        }
-    } while (true);
-
-    uint32_t i;
-    for (i = 0; i < HEADER_SIZE; i++)
-    {
-        ((uint32_t*)&header)[i] = m_log_data.buffer[rd_idx++ & mask];
-    }
-
-    switch (header.base.generic.type)
-    {
-        case HEADER_TYPE_HEXDUMP:
-            dropped = header.dropped;
-            rd_idx += CEIL_DIV(header.base.hexdump.len, sizeof(uint32_t));
-            break;
-        case HEADER_TYPE_STD:
-            dropped = header.dropped;
-            rd_idx += header.base.std.nargs;
-            break;
-        default:
-            ASSERT(false);
-            break;
-    }
+    ASSERT(len != 0);
+    // Second header word is module_id | (dropped << 16).
+    dropped = (uint16_t)(m_log_data.buffer[(rd_idx + 1) & m_buffer_mask] >> 16);
 
     uint32_t log_skipping_tmp = nrf_atomic_flag_clear_fetch(&m_log_data.log_skipping);
     //update read index only if log_skip was not interrupted by another log skip
     if (log_skipping_tmp)
     {
-        m_log_data.rd_idx = rd_idx;
+        buf_free(rd_idx + len);
     }
 
     return (uint32_t)dropped;
@@ -419,7 +425,7 @@ static inline void std_header_set(uint32_t severity_mid,
 {
 
 
-    //Prepare header - in reverse order to ensure that packet type is validated (set to STD as last action)
+    //Prepare header - in reverse order, the first word commits the entry and is written last in one go
     uint32_t module_id = severity_mid >> NRF_LOG_MODULE_ID_POS;
     uint32_t dropped   = dropped_sat16_get();
     ASSERT(module_id < nrf_log_module_cnt_get());
@@ -430,12 +436,16 @@ static inline void std_header_set(uint32_t severity_mid,
         m_log_data.buffer[(wr_idx + 2) & mask] = m_log_data.timestamp_func();
     }
 
-    nrf_log_header_t * p_header    = (nrf_log_header_t *)&m_log_data.buffer[wr_idx & mask];
-    p_header->base.std.severity    = severity_mid & NRF_LOG_LEVEL_MASK;
-    p_header->base.std.nargs       = nargs;
-    p_header->base.std.addr        = ((uint32_t)(p_str) & STD_ADDR_MASK);
-    p_header->base.std.type        = HEADER_TYPE_STD;
-    p_header->base.std.in_progress = 0;
+    nrf_log_main_header_t header;
+    header.raw             = 0;
+    header.std.severity    = severity_mid & NRF_LOG_LEVEL_MASK;
+    header.std.nargs       = nargs;
+    header.std.addr        = ((uint32_t)(p_str) & STD_ADDR_MASK);
+    header.std.type        = HEADER_TYPE_STD;
+    header.std.in_progress = 0;
+
+    __DMB();
+    m_log_data.buffer[wr_idx & mask] = header.raw;
 }
 
 #if NRF_LOG_DEFERRED
@@ -448,67 +458,91 @@ __WEAK void log_pending_hook( void )
 }
 #endif
 
+/**
+ * @brief Reserves space for one entry, lock-free.
+ *
+ * The space reads as an entry not committed yet until the producer writes
+ * the first header word, see @ref entry_len.
+ *
+ * @param req_len   Number of words for the entry.
+ * @param reserved  Number of words that must be left free after it.
+ * @param p_wr_idx  Pointer to write index of the entry.
+ *
+ * @return True if successful allocation, false if there is no room.
+ */
+static inline bool buf_reserve(uint32_t req_len, uint32_t reserved, uint32_t * p_wr_idx)
+{
+    uint32_t wr_idx = m_log_data.wr_idx;
+    uint32_t used;
+
+    do
+    {
+        used = wr_idx - m_log_data.rd_idx;
+        if (req_len + reserved > (m_buffer_mask + 1) - used)
+        {
+            return false;
+        }
+    } while (!nrf_atomic_u32_cmp_exch(&m_log_data.wr_idx, &wr_idx, wr_idx + req_len));
+
+    *p_wr_idx = wr_idx;
+
+    // A race may only lose a high water mark update, it is a statistic.
+    if (used + req_len > m_log_data.buf_high_water)
+    {
+        m_log_data.buf_high_water = used + req_len;
+    }
+
+    return true;
+}
+
 /**
  * @brief Allocates chunk in a buffer for one entry and injects overflow if
  * there is no room for requested entry.
  *
+ * Entries less severe than WARNING may not use the last NRF_LOG_BUF_RESERVED
+ * bytes and they never skip older entries, they are dropped when there is
+ * no room. A flood of them cannot push out warnings and errors. WARNING and
+ * ERROR entries skip the oldest entries if NRF_LOG_ALLOW_OVERFLOW is set, in
+ * a critical region. That is the only case where interrupts are disabled.
+ * Skipping stops at an entry that is not committed, its producer was
+ * interrupted or preempted and still writes to it.
+ *
  * @param content_len   Number of 32bit arguments. In case of allocating for hex dump it
  *                      is the size of the buffer in 32bit words (ceiled).
+ * @param severity      Severity of the entry.
  * @param p_wr_idx      Pointer to write index.
  *
  * @return True if successful allocation, false otherwise.
  *
  */
-static inline bool buf_prealloc(uint32_t content_len, uint32_t * p_wr_idx, bool std)
+static inline bool buf_prealloc(uint32_t content_len, uint32_t severity, uint32_t * p_wr_idx)
 {
-    uint32_t req_len = content_len + HEADER_SIZE;
-    bool     ret            = true;
-    CRITICAL_REGION_ENTER();
-    *p_wr_idx = m_log_data.wr_idx;
-    uint32_t available_words = (m_buffer_mask + 1) - (m_log_data.wr_idx - m_log_data.rd_idx);
-    while (req_len > available_words)
+    uint32_t req_len  = content_len + HEADER_SIZE;
+    bool     critical = (severity <= NRF_LOG_SEVERITY_WARNING);
+    bool     ret;
+
+    ret = buf_reserve(req_len, critical ? 0 : NRF_LOG_BUF_RESERVED_WORDS, p_wr_idx);
+
+    if (!ret && critical && NRF_LOG_ALLOW_OVERFLOW)
     {
-        UNUSED_RETURN_VALUE(nrf_atomic_u32_add(&m_log_data.log_dropped_cnt, 1));
-        if (NRF_LOG_ALLOW_OVERFLOW)
+        CRITICAL_REGION_ENTER();
+        // Entries being written by interrupted contexts cannot be skipped.
+        while (!(ret = buf_reserve(req_len, 0, p_wr_idx)) &&
+               (entry_len(m_log_data.rd_idx) != 0))
         {
             uint32_t dropped_in_skip = log_skip();
-            UNUSED_RETURN_VALUE(nrf_atomic_u32_add(&m_log_data.log_dropped_cnt, dropped_in_skip));
-            available_words = (m_buffer_mask + 1) - (m_log_data.wr_idx - m_log_data.rd_idx);
-        }
-        else
-        {
-            ret = false;
-            break;
+            UNUSED_RETURN_VALUE(nrf_atomic_u32_add(&m_log_data.log_dropped_cnt, dropped_in_skip + 1));
+            UNUSED_RETURN_VALUE(nrf_atomic_u32_add(&m_log_data.log_dropped_total, 1));
         }
+        CRITICAL_REGION_EXIT();
     }
 
-    if (ret)
+    if (!ret)
     {
-        nrf_log_main_header_t invalid_header;
-        invalid_header.raw = 0;
-
-        if (std)
-        {
-            invalid_header.std.type        = HEADER_TYPE_STD;
-            invalid_header.std.in_progress = 1;
-            invalid_header.std.nargs       = content_len;
-        }
-        else
-        {
-            invalid_header.hexdump.type = HEADER_TYPE_HEXDUMP;
-            invalid_header.hexdump.in_progress = 1;
-            invalid_header.hexdump.len = content_len;
-        }
-
-        nrf_log_main_header_t * p_header =
-                   (nrf_log_main_header_t *)&m_log_data.buffer[m_log_data.wr_idx & m_buffer_mask];
-
-        p_header->raw = invalid_header.raw;
-
-        m_log_data.wr_idx += req_len;
+        UNUSED_RETURN_VALUE(nrf_atomic_u32_add(&m_log_data.log_dropped_cnt, 1));
+        UNUSED_RETURN_VALUE(nrf_atomic_u32_add(&m_log_data.log_dropped_total, 1));
     }
 
-    CRITICAL_REGION_EXIT();
     return ret;
 }
 
@@ -557,7 +591,7 @@ static inline void std_n(uint32_t           severity_mid,
     uint32_t mask   = m_buffer_mask;
     uint32_t wr_idx;
 
-    if (buf_prealloc(nargs, &wr_idx, true))
+    if (buf_prealloc(nargs, severity_mid & NRF_LOG_LEVEL_MASK, &wr_idx))
     {
         // Proceed only if buffer was successfully preallocated.
 
@@ -671,7 +705,7 @@ void nrf_log_frontend_hexdump(uint32_t           severity_mid,
     uint32_t mask   = m_buffer_mask;
 
     uint32_t wr_idx;
-    if (buf_prealloc(CEIL_DIV(length, sizeof(uint32_t)), &wr_idx, false))
+    if (buf_prealloc(CEIL_DIV(length, sizeof(uint32_t)), severity_mid & NRF_LOG_LEVEL_MASK, &wr_idx))
     {
         uint32_t header_wr_idx = wr_idx;
         wr_idx += HEADER_SIZE;
@@ -687,7 +721,7 @@ void nrf_log_frontend_hexdump(uint32_t           severity_mid,
             memcpy(&m_log_data.buffer[0], &((uint8_t *)p_data)[space0], length - space0);
         }
 
-        //Prepare header - in reverse order to ensure that packet type is validated (set to HEXDUMP as last action)
+        //Prepare header - in reverse order, the first word commits the entry and is written last in one go
         if (NRF_LOG_USES_TIMESTAMP)
         {
            m_log_data.buffer[(header_wr_idx + 2) & mask] = m_log_data.timestamp_func();
@@ -697,12 +731,16 @@ void nrf_log_frontend_hexdump(uint32_t           severity_mid,
         uint32_t dropped   = dropped_sat16_get();
         m_log_data.buffer[(header_wr_idx + 1) & mask] = module_id | (dropped << 16);
         //Header prepare
-        nrf_log_header_t * p_header = (nrf_log_header_t *)&m_log_data.buffer[header_wr_idx & mask];
-        p_header->base.hexdump.severity    = severity_mid & NRF_LOG_LEVEL_MASK;
-        p_header->base.hexdump.offset      = 0;
-        p_header->base.hexdump.len         = length;
-        p_header->base.hexdump.type        = HEADER_TYPE_HEXDUMP;
-        p_header->base.hexdump.in_progress = 0;
+        nrf_log_main_header_t header;
+        header.raw                 = 0;
+        header.hexdump.severity    = severity_mid & NRF_LOG_LEVEL_MASK;
+        header.hexdump.offset      = 0;
+        header.hexdump.len         = length;
+        header.hexdump.type        = HEADER_TYPE_HEXDUMP;
+        header.hexdump.in_progress = 0;
+
+        __DMB();
+        m_log_data.buffer[header_wr_idx & mask] = header.raw;
     }
 
     if (m_log_data.autoflush)
@@ -729,6 +767,16 @@ bool buffer_is_empty(void)
     return (m_log_data.rd_idx == m_log_data.wr_idx);
 }
 
+void nrf_log_stats_get(nrf_log_stats_t * p_stats)
+{
+    CRITICAL_REGION_ENTER();
+    p_stats->dropped        = m_log_data.log_dropped_total;
+    p_stats->buf_size       = m_buffer_mask + 1;
+    p_stats->buf_used       = m_log_data.wr_idx - m_log_data.rd_idx;
+    p_stats->buf_high_water = m_log_data.buf_high_water;
+    CRITICAL_REGION_EXIT();
+}
+
 bool nrf_log_frontend_dequeue(void)
 {
 
@@ -741,30 +789,18 @@ bool nrf_log_frontend_dequeue(void)
     __DSB();
     uint32_t           rd_idx   = m_log_data.rd_idx;
     uint32_t           mask     = m_buffer_mask;
-    nrf_log_header_t * p_header = (nrf_log_header_t *)&m_log_data.buffer[rd_idx & mask];
     nrf_log_header_t   header;
     nrf_memobj_t *     p_msg_buf = NULL;
     size_t             memobj_offset = 0;
     uint32_t           severity = 0;
 
-    // Skip any in progress packets.
-    do {
-        if (invalid_packets_omit(p_header, &rd_idx) && (m_log_data.log_skipped == 0))
-        {
-            //Check if end of data is not reached.
-            if (rd_idx >= m_log_data.wr_idx)
-            {
-                m_log_data.rd_idx     = m_log_data.wr_idx;
-                return false;
-            }
-            //something was omitted. Point to new header and try again.
-            p_header = (nrf_log_header_t *)&m_log_data.buffer[rd_idx & mask];
-        }
-        else
-        {
-            break;
-        }
-    } while (true);
+    // The oldest entry is not committed yet, its producer calls
+    // log_pending_hook when it is done.
+    if (entry_len(rd_idx) == 0)
+    {
+        return false;
+    }
+    __DMB();
 
     uint32_t i;
     for (i = 0; i < HEADER_SIZE; i++)
@@ -897,13 +933,13 @@ bool nrf_log_frontend_dequeue(void)
                 CRITICAL_REGION_ENTER();
                 if (m_log_data.log_skipped == 0)
                 {
-                    m_log_data.rd_idx = rd_idx;
+                    buf_free(rd_idx);
                 }
                 CRITICAL_REGION_EXIT();
             }
             else
             {
-                m_log_data.rd_idx = rd_idx;
+                buf_free(rd_idx);
             }
         }
     }
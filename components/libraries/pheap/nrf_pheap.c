@@ -0,0 +1,158 @@
+#include "sdk_common.h"
+#if NRF_MODULE_ENABLED(NRF_PHEAP)
+#include "nrf_pheap.h"
+#include "nrf_assert.h"
+
+static void item_clear(nrf_pheap_item_t * p_item)
+{
+    p_item->p_child = NULL;
+    p_item->p_next  = NULL;
+    p_item->p_prev  = NULL;
+}
+
+/**
+ * @brief Function for joining two heaps, the lower root becomes the first child of the higher one.
+ *
+ * @return Root of the joined heap.
+ */
+static nrf_pheap_item_t * meld(nrf_pheap_t const * p_heap, nrf_pheap_item_t * p_a, nrf_pheap_item_t * p_b)
+{
+    if (p_a == NULL)
+    {
+        return p_b;
+    }
+    if (p_b == NULL)
+    {
+        return p_a;
+    }
+
+    if (!p_heap->compare_func(p_a, p_b))
+    {
+        nrf_pheap_item_t * p_tmp = p_a;
+        p_a = p_b;
+        p_b = p_tmp;
+    }
+
+    p_b->p_prev = p_a;
+    p_b->p_next = p_a->p_child;
+    if (p_a->p_child != NULL)
+    {
+        p_a->p_child->p_prev = p_b;
+    }
+    p_a->p_child = p_b;
+
+    return p_a;
+}
+
+/**
+ * @brief Function for joining a list of siblings into one heap, in two passes.
+ *
+ * Siblings are melded in pairs from left to right, then the pairs from right to left. This is
+ * what keeps the amortized cost of removal logarithmic.
+ *
+ * @return Root of the joined heap.
+ */
+static nrf_pheap_item_t * siblings_meld(nrf_pheap_t const * p_heap, nrf_pheap_item_t * p_first)
+{
+    nrf_pheap_item_t * p_pairs = NULL;
+    nrf_pheap_item_t * p_root  = NULL;
+
+    while (p_first != NULL)
+    {
+        nrf_pheap_item_t * p_a = p_first;
+        nrf_pheap_item_t * p_b = p_a->p_next;
+
+        p_first = (p_b != NULL) ? p_b->p_next : NULL;
+        p_a->p_next = NULL;
+        if (p_b != NULL)
+        {
+            p_b->p_next = NULL;
+        }
+
+        p_a = meld(p_heap, p_a, p_b);
+        p_a->p_next = p_pairs;
+        p_pairs = p_a;
+    }
+
+    while (p_pairs != NULL)
+    {
+        nrf_pheap_item_t * p_item = p_pairs;
+
+        p_pairs = p_item->p_next;
+        p_item->p_next = NULL;
+        p_root = meld(p_heap, p_root, p_item);
+    }
+
+    if (p_root != NULL)
+    {
+        p_root->p_prev = NULL;
+    }
+    return p_root;
+}
+
+void nrf_pheap_add(nrf_pheap_t const * p_heap, nrf_pheap_item_t * p_item)
+{
+    ASSERT(p_heap);
+    ASSERT(p_item);
+
+    item_clear(p_item);
+    p_heap->p_cb->p_root = meld(p_heap, p_heap->p_cb->p_root, p_item);
+    p_heap->p_cb->p_root->p_prev = NULL;
+}
+
+nrf_pheap_item_t * nrf_pheap_pop(nrf_pheap_t const * p_heap)
+{
+    ASSERT(p_heap);
+    nrf_pheap_item_t * ret = p_heap->p_cb->p_root;
+
+    if (ret != NULL)
+    {
+        p_heap->p_cb->p_root = siblings_meld(p_heap, ret->p_child);
+        item_clear(ret);
+    }
+    return ret;
+}
+
+nrf_pheap_item_t const * nrf_pheap_peek(nrf_pheap_t const * p_heap)
+{
+    ASSERT(p_heap);
+    return p_heap->p_cb->p_root;
+}
+
+bool nrf_pheap_remove(nrf_pheap_t const * p_heap, nrf_pheap_item_t * p_item)
+{
+    ASSERT(p_heap);
+    ASSERT(p_item);
+
+    if (p_item == p_heap->p_cb->p_root)
+    {
+        UNUSED_RETURN_VALUE(nrf_pheap_pop(p_heap));
+        return true;
+    }
+
+    if (p_item->p_prev == NULL)
+    {
+        return false;
+    }
+
+    // p_prev is the parent if this is its first child, the left sibling otherwise
+    if (p_item->p_prev->p_child == p_item)
+    {
+        p_item->p_prev->p_child = p_item->p_next;
+    }
+    else
+    {
+        p_item->p_prev->p_next = p_item->p_next;
+    }
+    if (p_item->p_next != NULL)
+    {
+        p_item->p_next->p_prev = p_item->p_prev;
+    }
+
+    p_heap->p_cb->p_root = meld(p_heap, p_heap->p_cb->p_root, siblings_meld(p_heap, p_item->p_child));
+    p_heap->p_cb->p_root->p_prev = NULL;
+    item_clear(p_item);
+
+    return true;
+}
+#endif //NRF_PHEAP_ENABLED
@@ -0,0 +1,129 @@
+#ifndef NRF_PHEAP_H
+#define NRF_PHEAP_H
+
+#include "sdk_config.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * @defgroup nrf_pheap Pairing heap
+ * @{
+ * @ingroup app_common
+ * @brief Module for storing items in a priority queue with the interface of @ref nrf_sortlist.
+ *
+ * Adding and peeking is O(1), removing the head or any other item is O(log n) amortized,
+ * where the sorted list is O(n) for adding and removing. Items with equal keys are not
+ * guaranteed to come out in the order they were added.
+ */
+
+/**
+ * @brief Forward declaration of heap item.
+ */
+typedef struct nrf_pheap_item_s nrf_pheap_item_t;
+
+/** @brief Prototype of a function which compares two elements.
+ *
+ * @param p_item0 Item 0.
+ * @param p_item1 Item 1.
+ *
+ * @return True if Item 0 should be higher than Item 1 and false otherwise.
+ *
+ */
+typedef bool (*nrf_pheap_compare_func_t)(nrf_pheap_item_t * p_item0, nrf_pheap_item_t * p_item1);
+
+/**
+ * @brief A structure for item in the heap.
+ */
+struct nrf_pheap_item_s
+{
+    nrf_pheap_item_t * p_child;               /* Pointer to the first child. */
+    nrf_pheap_item_t * p_next;                /* Pointer to the next sibling. */
+    nrf_pheap_item_t * p_prev;                /* Pointer to the previous sibling, the parent of the first child,
+                                                 NULL for the root and for items not in the heap. */
+};
+
+/**
+ * @brief Heap instance control block.
+ *
+ * Control block contains instance data which must be located in read/write memory.
+ */
+typedef struct
+{
+    nrf_pheap_item_t *       p_root;          /* Heap root, the highest item. */
+} nrf_pheap_cb_t;
+
+/**
+ * @brief Structure for heap instance.
+ *
+ * Instance can be placed in read only memory.
+ */
+typedef struct
+{
+    nrf_pheap_cb_t *         p_cb;            /* Heap root. */
+    nrf_pheap_compare_func_t compare_func;    /* Function used for comparison. */
+} nrf_pheap_t;
+
+/**
+ * @brief Macro for defining a heap instance.
+ *
+ * @param _name         Instance name.
+ * @param _compare_func Pointer to a compare function.
+ */
+#define NRF_PHEAP_DEF(_name, _compare_func)                      \
+    static nrf_pheap_cb_t CONCAT_2(_name,_pheap_cb) = {          \
+        .p_root = NULL                                           \
+    };                                                           \
+    static const nrf_pheap_t _name = {                           \
+        .p_cb = &CONCAT_2(_name,_pheap_cb),                      \
+        .compare_func = _compare_func,                           \
+    }
+
+/**
+ * @brief Function for adding an element into a heap.
+ *
+ * @param p_heap   Heap instance.
+ * @param p_item   Item, must not be in the heap.
+ */
+void nrf_pheap_add(nrf_pheap_t const * p_heap, nrf_pheap_item_t * p_item);
+
+/**
+ * @brief Function for removing the highest item from the heap.
+ *
+ * @param p_heap   Heap instance.
+ *
+ * @return Pointer to the item which was the highest, NULL if the heap is empty.
+ */
+nrf_pheap_item_t * nrf_pheap_pop(nrf_pheap_t const * p_heap);
+
+/**
+ * @brief Function for getting (without removing) the highest item from the heap.
+ *
+ * @param p_heap   Heap instance.
+ *
+ * @return Pointer to the highest item, NULL if the heap is empty.
+ */
+nrf_pheap_item_t const * nrf_pheap_peek(nrf_pheap_t const * p_heap);
+
+/**
+ * @brief Function for removing an item from the heap.
+ *
+ * The item is unlinked without comparing it, so its key may have changed since it was added.
+ *
+ * @param p_heap   Heap instance.
+ * @param p_item   Item.
+ *
+ * @retval true  Item was found and removed.
+ * @retval false Item not in the heap.
+ */
+bool nrf_pheap_remove(nrf_pheap_t const * p_heap, nrf_pheap_item_t * p_item);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //NRF_PHEAP_H
@@ -73,8 +73,12 @@
 #include "nordic_common.h"
 #ifdef APP_TIMER_V2
 #include "nrf_log_instance.h"
+#if APP_TIMER_CONFIG_USE_HEAP
+#include "nrf_pheap.h"
+#else
 #include "nrf_sortlist.h"
 #endif
+#endif
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -138,9 +142,14 @@ typedef void (*app_timer_timeout_handler_t)(void * p_context);
  */
 typedef struct
 {
+#if APP_TIMER_CONFIG_USE_HEAP
+    nrf_pheap_item_t            list_item;     /**< Token used by the timer heap. */
+#else
     nrf_sortlist_item_t         list_item;     /**< Token used by sortlist. */
+#endif
     uint64_t                    end_val;       /**< RTC counter value when timer expires or @ref APP_TIMER_IDLE_VAL. */
     uint32_t                    repeat_period; /**< Repeat period (0 if single shot mode). */
+    uint32_t                    slack;         /**< Ticks the expiry may be delayed by to share an RTC wake-up with other timers. */
     app_timer_timeout_handler_t handler;       /**< User handler. */
     void *                      p_context;     /**< User context. */
     NRF_LOG_INSTANCE_PTR_DECLARE(p_log)        /**< Pointer to instance of the logger object (Conditionally compiled). */
@@ -242,6 +251,24 @@ ret_code_t app_timer_create(app_timer_id_t const *      p_timer_id,
  */
 ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context);
 
+/**@brief Function for allowing a timer to expire late, to share a wake-up with other timers.
+ *
+ * A timer with slack expires anywhere from its time-out to time-out + slack_ticks. When another
+ * timer wakes the CPU in that window, this one expires in the same RTC interrupt instead of
+ * waking it again. Repeated timers keep their period, the slack does not accumulate.
+ *
+ * @param[in]  timer_id                  Timer identifier.
+ * @param[in]  slack_ticks               Maximum delay in ticks (of RTC1, including prescaling),
+ *                                       0 (the default) to expire on time.
+ *
+ * @retval     NRF_SUCCESS               If the slack was set.
+ * @retval     NRF_ERROR_INVALID_STATE   If the timer is running.
+ *
+ * @note Only implemented by app_timer2. Call it after @ref app_timer_create, which resets the
+ *       slack to 0. It should be shorter than the period of a repeated timer.
+ */
+ret_code_t app_timer_slack_set(app_timer_id_t timer_id, uint32_t slack_ticks);
+
 /**@brief Function for stopping the specified timer.
  *
  * @note If stop is called from the thread context or interrupt context with priority
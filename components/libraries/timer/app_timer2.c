@@ -39,7 +39,11 @@
  */
 #include "app_timer.h"
 #include "nrf_atfifo.h"
+#if APP_TIMER_CONFIG_USE_HEAP
+#include "nrf_pheap.h"
+#else
 #include "nrf_sortlist.h"
+#endif
 #include "nrf_delay.h"
 #if APP_TIMER_WITH_PROFILER
 #include "app_util_platform.h"
@@ -106,9 +110,19 @@ static uint64_t m_stamp64;
 /* Request FIFO instance. */
 NRF_ATFIFO_DEF(m_req_fifo, timer_req_t, APP_TIMER_CONFIG_OP_QUEUE_SIZE);
 
+#if APP_TIMER_CONFIG_USE_HEAP
+typedef nrf_pheap_item_t    queue_item_t;
+
+/* Pairing heap instance. */
+static bool compare_func(queue_item_t * p_item0, queue_item_t *p_item1);
+NRF_PHEAP_DEF(m_app_timer_heap, compare_func); /**< Pairing heap used for storing queued timers. */
+#else
+typedef nrf_sortlist_item_t queue_item_t;
+
 /* Sortlist instance. */
-static bool compare_func(nrf_sortlist_item_t * p_item0, nrf_sortlist_item_t *p_item1);
+static bool compare_func(queue_item_t * p_item0, queue_item_t *p_item1);
 NRF_SORTLIST_DEF(m_app_timer_sortlist, compare_func); /**< Sortlist used for storing queued timers. */
+#endif
 
 /**
  * @brief Return current 64 bit timestamp
@@ -127,19 +141,78 @@ static uint64_t get_now(void)
 
     return now;
 }
+/**
+ * @brief Return the latest RTC counter value at which timer may expire, end value plus slack.
+ */
+static inline uint64_t deadline_get(app_timer_t const * p_timer)
+{
+    uint64_t end_val = p_timer->end_val;
+
+    return (end_val == APP_TIMER_IDLE_VAL) ? APP_TIMER_IDLE_VAL : (end_val + p_timer->slack);
+}
+
 /**
  * @brief Function used for comparing items in sorted list.
+ *
+ * Timers are ordered by deadline, so that the RTC is always set for the first one that cannot
+ * wait any longer.
  */
-static inline bool compare_func(nrf_sortlist_item_t * p_item0, nrf_sortlist_item_t *p_item1)
+static inline bool compare_func(queue_item_t * p_item0, queue_item_t *p_item1)
 {
     app_timer_t * p0 = CONTAINER_OF(p_item0, app_timer_t, list_item);
     app_timer_t * p1 = CONTAINER_OF(p_item1, app_timer_t, list_item);
 
-    uint64_t p0_end = p0->end_val;
-    uint64_t p1_end = p1->end_val;
+    uint64_t p0_end = deadline_get(p0);
+    uint64_t p1_end = deadline_get(p1);
     return (p0_end <= p1_end) ? true : false;
 }
 
+#if APP_TIMER_CONFIG_USE_HEAP
+static inline void queue_add(app_timer_t * p_timer)
+{
+    nrf_pheap_add(&m_app_timer_heap, &p_timer->list_item);
+}
+
+static inline bool queue_remove(app_timer_t * p_timer)
+{
+    return nrf_pheap_remove(&m_app_timer_heap, &p_timer->list_item);
+}
+
+static inline app_timer_t * queue_pop(void)
+{
+    nrf_pheap_item_t * p_next_item = nrf_pheap_pop(&m_app_timer_heap);
+    return p_next_item ? CONTAINER_OF(p_next_item, app_timer_t, list_item) : NULL;
+}
+
+static inline app_timer_t * queue_peek(void)
+{
+    nrf_pheap_item_t const * p_next_item = nrf_pheap_peek(&m_app_timer_heap);
+    return p_next_item ? CONTAINER_OF(p_next_item, app_timer_t, list_item) : NULL;
+}
+#else
+static inline void queue_add(app_timer_t * p_timer)
+{
+    nrf_sortlist_add(&m_app_timer_sortlist, &p_timer->list_item);
+}
+
+static inline bool queue_remove(app_timer_t * p_timer)
+{
+    return nrf_sortlist_remove(&m_app_timer_sortlist, &p_timer->list_item);
+}
+
+static inline app_timer_t * queue_pop(void)
+{
+    nrf_sortlist_item_t * p_next_item = nrf_sortlist_pop(&m_app_timer_sortlist);
+    return p_next_item ? CONTAINER_OF(p_next_item, app_timer_t, list_item) : NULL;
+}
+
+static inline app_timer_t * queue_peek(void)
+{
+    nrf_sortlist_item_t const * p_next_item = nrf_sortlist_peek(&m_app_timer_sortlist);
+    return p_next_item ? CONTAINER_OF(p_next_item, app_timer_t, list_item) : NULL;
+}
+#endif
+
 #if APP_TIMER_CONFIG_USE_SCHEDULER
 static void scheduled_timeout_handler(void * p_event_data, uint16_t event_size)
 {
@@ -206,13 +279,13 @@ static bool timer_expire(app_timer_t * p_timer)
 
             if (cont)
             {
-                nrf_sortlist_add(&m_app_timer_sortlist, &p_timer->list_item);
+                queue_add(p_timer);
                 ret = true;
             }
         }
         else if (!APP_TIMER_IS_IDLE(p_timer))
         {
-            nrf_sortlist_add(&m_app_timer_sortlist, &p_timer->list_item);
+            queue_add(p_timer);
             ret = true;
         }
     }
@@ -222,8 +295,10 @@ static bool timer_expire(app_timer_t * p_timer)
 /**
  * @brief Function is configuring RTC driver to trigger timeout interrupt for given timer.
  *
- * It is possible that RTC driver will indicate that timeout already occured. In that case timer
- * expires and function indicates that RTC was not configured.
+ * RTC is set to the deadline of the timer. If the timer has already reached its end value (it is
+ * within its slack) it expires right away, in the same interrupt as the timer that expired before
+ * it. It is also possible that RTC driver will indicate that timeout already occured. In both
+ * cases timer expires and function indicates that RTC was not configured.
  *
  * @param          p_timer Timer instance.
  * @param [in,out] p_rerun Flag indicating that sortlist reevaluation is required.
@@ -239,10 +314,11 @@ static bool rtc_schedule(app_timer_t * p_timer, bool * p_rerun)
     /* In case timer got stopped in between, end_val will be very far in the
      * future. RTC will be reconfigured on the next iteration.
      */
-    uint64_t end_val = p_timer->end_val;
-    int64_t remaining = (int64_t)(end_val - get_now());
+    uint64_t now = get_now();
+    uint64_t end_val = deadline_get(p_timer);
+    int64_t remaining = (int64_t)(end_val - now);
 
-    if (remaining > 0) {
+    if ((remaining > 0) && (p_timer->end_val > now)) {
         uint32_t cc_val = ((uint32_t)remaining > APP_TIMER_RTC_MAX_VALUE) ?
                 (app_timer_cnt_get() + APP_TIMER_RTC_MAX_VALUE) : end_val;
 
@@ -271,18 +347,6 @@ static bool rtc_schedule(app_timer_t * p_timer, bool * p_rerun)
     return false;
 }
 
-static inline app_timer_t * sortlist_pop(void)
-{
-    nrf_sortlist_item_t * p_next_item = nrf_sortlist_pop(&m_app_timer_sortlist);
-    return p_next_item ? CONTAINER_OF(p_next_item, app_timer_t, list_item) : NULL;
-}
-
-static inline app_timer_t * sortlist_peek(void)
-{
-    nrf_sortlist_item_t const * p_next_item = nrf_sortlist_peek(&m_app_timer_sortlist);
-    return p_next_item ? CONTAINER_OF(p_next_item, app_timer_t, list_item) : NULL;
-}
-
 /**
  * @brief Function for deactivating all timers which are in the sorted list (active timers).
  */
@@ -291,7 +355,7 @@ static void sorted_list_stop_all(void)
     app_timer_t * p_next;
     do
     {
-        p_next = sortlist_pop();
+        p_next = queue_pop();
         if (p_next)
         {
             p_next->end_val = APP_TIMER_IDLE_VAL;
@@ -351,7 +415,7 @@ static void rtc_update(drv_rtc_t const * const  p_instance)
 {
     while(1)
     {
-        app_timer_t * p_next = sortlist_peek();
+        app_timer_t * p_next = queue_peek();
         bool rtc_reconf = false;
         if (p_next) //Candidate for active timer
         {
@@ -361,10 +425,11 @@ static void rtc_update(drv_rtc_t const * const  p_instance)
              * that case end_val was first set to invalid value and then to the
              * new timeout in the future. In that case, timer location in sortlist
              * is invalid. However, it will all be sorted out when stop and start
-             * requests are handled.
+             * requests are handled. The heap removes an item without looking at
+             * its key, so it is sorted out the same way.
              */
             if (APP_TIMER_IS_IDLE(p_next)) {
-                (void)sortlist_pop();
+                (void)queue_pop();
                 continue;
             }
             else if (mp_active_timer == NULL)
@@ -372,7 +437,7 @@ static void rtc_update(drv_rtc_t const * const  p_instance)
                 //There is no active timer so candidate will become active timer.
                 rtc_reconf = true;
             }
-            else if (p_next->end_val < mp_active_timer->end_val)
+            else if (deadline_get(p_next) < deadline_get(mp_active_timer))
             {
                 //Candidate has shorter timeout than current active timer. Candidate will replace active timer.
                 //Active timer is put back into sorted list.
@@ -380,14 +445,14 @@ static void rtc_update(drv_rtc_t const * const  p_instance)
                 if (!APP_TIMER_IS_IDLE(mp_active_timer))
                 {
                     NRF_LOG_INST_DEBUG(mp_active_timer->p_log, "Timer preempted.");
-                    nrf_sortlist_add(&m_app_timer_sortlist, &mp_active_timer->list_item);
+                    queue_add(mp_active_timer);
                 }
             }
 
             if (rtc_reconf)
             {
                 bool rerun;
-                p_next = sortlist_pop();
+                p_next = queue_pop();
                 NRF_LOG_INST_DEBUG(p_next->p_log, "Activating timer (CC:%d/%08x).", p_next->end_val, p_next->end_val);
                 if (rtc_schedule(p_next, &rerun))
                 {
@@ -454,7 +519,7 @@ static void timer_req_process(drv_rtc_t const * const  p_instance)
                  */
                 if (!APP_TIMER_IS_IDLE(p_req->p_timer))
                 {
-                    nrf_sortlist_add(&m_app_timer_sortlist, &(p_req->p_timer->list_item));
+                    queue_add(p_req->p_timer);
                     NRF_LOG_INST_DEBUG(p_req->p_timer->p_log,"Start request (expiring at %d/0x%08x).",
                                                   p_req->p_timer->end_val, p_req->p_timer->end_val);
                 }
@@ -466,7 +531,7 @@ static void timer_req_process(drv_rtc_t const * const  p_instance)
                 }
                 else
                 {
-                    bool found = nrf_sortlist_remove(&m_app_timer_sortlist, &(p_req->p_timer->list_item));
+                    bool found = queue_remove(p_req->p_timer);
                     if (!found)
                     {
                          NRF_LOG_INFO("Timer not found on sortlist (stopping expired timer).");
@@ -611,9 +676,34 @@ ret_code_t app_timer_create(app_timer_id_t const *      p_timer_id,
     p_t->end_val = APP_TIMER_IDLE_VAL;
     p_t->handler = timeout_handler;
     p_t->repeat_period = (mode == APP_TIMER_MODE_REPEATED) ? 1 : 0;
+    p_t->slack = 0;
     return NRF_SUCCESS;
 }
 
+ret_code_t app_timer_slack_set(app_timer_t * p_timer, uint32_t slack_ticks)
+{
+    ASSERT(p_timer);
+    app_timer_t * p_t = (app_timer_t *) p_timer;
+    ret_code_t ret;
+
+    /* Slack is part of the queue key, it can only change while timer is idle. Idle timer which is
+     * still queued (stop request pending) has the idle key whatever its slack is.
+     */
+    CRITICAL_REGION_ENTER();
+    if (APP_TIMER_IS_IDLE(p_t))
+    {
+        p_t->slack = slack_ticks;
+        ret = NRF_SUCCESS;
+    }
+    else
+    {
+        ret = NRF_ERROR_INVALID_STATE;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return ret;
+}
+
 ret_code_t app_timer_start(app_timer_t * p_timer, uint32_t timeout_ticks, void * p_context)
 {
     ASSERT(p_timer);
@@ -0,0 +1,390 @@
+#include <string.h>
+
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_sdh_ble.h"
+
+#include "nrf_log.h"
+
+#include "howland.h"
+#include "conn_policy.h"
+
+#define LL_DATA_LENGTH_DEFAULT              27      // payload octets before a data length update
+#define LL_HEADERS_LEN                      7       // l2cap and att headers in front of the payload
+
+APP_TIMER_DEF(m_sample_timer);
+
+static nrf_ble_gatt_t * mp_gatt                 = NULL;
+static conn_policy_tx_get_t m_tx_get            = NULL;
+
+/*
+ * link, written by ble events (softdevice task)
+ */
+static volatile uint16_t m_conn_handle          = BLE_CONN_HANDLE_INVALID;
+static volatile uint16_t m_interval             = 0;
+static volatile uint16_t m_latency              = 0;
+static volatile uint8_t m_phy                   = BLE_GAP_PHY_1MBPS;
+static volatile uint8_t m_data_len              = LL_DATA_LENGTH_DEFAULT;
+static volatile uint32_t m_rx_bytes             = 0;        // gatt writes, since connected
+static volatile uint32_t m_rx_packets           = 0;
+static volatile uint32_t m_tx_packets           = 0;        // notifications sent, all services
+static volatile bool m_restart                  = false;    // connected, sample state to be reset
+
+static volatile bool m_hint                     = false;
+
+/*
+ * sample state, app_timer task
+ */
+static uint8_t m_profile                        = PROTO_LINK_DEFAULT;
+static uint32_t m_quiet_ms                      = 0;
+static uint32_t m_last_tx_bytes                 = 0;
+static uint32_t m_last_rx_bytes                 = 0;
+static uint32_t m_last_packets                  = 0;
+static bool m_phy_asked                         = false;
+static bool m_dle_asked                         = false;
+static uint64_t m_bulk_nj                       = 0;
+static uint64_t m_idle_nj                       = 0;
+static proto_link_stats_t m_stats               = { 0 };    // counters only
+
+static void sample_reset(void)
+{
+    m_profile       = PROTO_LINK_DEFAULT;
+    m_quiet_ms      = 0;
+    m_last_tx_bytes = 0;
+    m_last_rx_bytes = 0;
+    m_last_packets  = 0;
+    m_phy_asked     = false;
+    m_dle_asked     = false;
+
+    CRITICAL_REGION_ENTER();
+    m_bulk_nj = 0;
+    m_idle_nj = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * radio energy of one sample period. the link wakes every interval while
+ * data moves or waits, else every interval x (latency + 1).
+ */
+static void energy_add(uint32_t bytes, uint32_t packets, bool waiting)
+{
+    uint32_t interval_us = (uint32_t)m_interval * 1250;
+    uint32_t data_len = m_data_len;
+    bool phy_2m = (m_phy == BLE_GAP_PHY_2MBPS);
+    uint32_t events;
+    uint32_t air_packets;
+    uint64_t nj;
+
+    if (interval_us == 0)
+    {
+        return;
+    }
+    if ((packets == 0) && !waiting)
+    {
+        interval_us *= 1 + m_latency;
+    }
+    events = (CONN_POLICY_PERIOD_MS * 1000 + interval_us / 2) / interval_us;
+
+    // att pdus longer than the data length go out in fragments
+    air_packets = MAX(packets, (bytes + packets * LL_HEADERS_LEN + data_len - 1) / data_len);
+
+    nj  = (uint64_t)events * CONN_POLICY_EVENT_NJ;
+    nj += (uint64_t)air_packets * (phy_2m ? CONN_POLICY_PACKET_NJ_2M : CONN_POLICY_PACKET_NJ_1M);
+    nj += (uint64_t)(bytes + air_packets * LL_HEADERS_LEN) * (phy_2m ? CONN_POLICY_BYTE_NJ_2M : CONN_POLICY_BYTE_NJ_1M);
+
+    CRITICAL_REGION_ENTER();
+    if (m_profile == PROTO_LINK_BULK)
+    {
+        m_bulk_nj += nj;
+        m_stats.bulk_bytes += bytes;
+    }
+    else
+    {
+        m_idle_nj += nj;
+        m_stats.idle_bytes += bytes;
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/*
+ * 2M phy and the longest data length, asked for once per connection. the
+ * central may settle on less, that is what the link then runs on.
+ */
+static void link_boost(uint16_t conn_handle)
+{
+    ret_code_t err;
+
+    if (!m_phy_asked && (m_phy != BLE_GAP_PHY_2MBPS))
+    {
+        ble_gap_phys_t const phys =
+        {
+            .tx_phys = BLE_GAP_PHY_2MBPS,
+            .rx_phys = BLE_GAP_PHY_2MBPS,
+        };
+
+        err = sd_ble_gap_phy_update(conn_handle, &phys);
+        m_phy_asked = (err == NRF_SUCCESS);
+        if (err != NRF_SUCCESS)
+        {
+            NRF_LOG_DEBUG("phy update not started, err %d", err);
+        }
+    }
+
+    if (!m_dle_asked && (m_data_len < NRF_SDH_BLE_GAP_DATA_LENGTH))
+    {
+        err = nrf_ble_gatt_data_length_set(mp_gatt, conn_handle, NRF_SDH_BLE_GAP_DATA_LENGTH);
+        m_dle_asked = (err == NRF_SUCCESS);
+        if (err != NRF_SUCCESS)
+        {
+            NRF_LOG_DEBUG("data length update not started, err %d", err);
+        }
+    }
+}
+
+/*
+ * a request the central does not follow is retried by ble_conn_params and
+ * counted as refused, the profile is not asked for again until it changes.
+ */
+static void profile_set(uint16_t conn_handle, uint8_t profile)
+{
+    ret_code_t err;
+    ble_gap_conn_params_t params;
+
+    if (profile == PROTO_LINK_BULK)
+    {
+        params.min_conn_interval = CONN_POLICY_BULK_MIN_INTERVAL;
+        params.max_conn_interval = CONN_POLICY_BULK_MAX_INTERVAL;
+        params.slave_latency     = 0;
+    }
+    else
+    {
+        params.min_conn_interval = CONN_POLICY_IDLE_MIN_INTERVAL;
+        params.max_conn_interval = CONN_POLICY_IDLE_MAX_INTERVAL;
+        params.slave_latency     = CONN_POLICY_IDLE_LATENCY;
+    }
+    params.conn_sup_timeout = CONN_POLICY_SUP_TIMEOUT;
+
+    err = ble_conn_params_change_conn_params(conn_handle, &params);
+    if (err != NRF_SUCCESS)
+    {
+        // NRF_ERROR_BUSY while a procedure runs, tried again next sample
+        NRF_LOG_DEBUG("conn params %d not asked for, err %d", profile, err);
+        return;
+    }
+
+    NRF_LOG_INFO("link %s", (profile == PROTO_LINK_BULK) ? "bulk" : "idle");
+    m_profile = profile;
+    m_stats.switches++;
+
+    if (profile == PROTO_LINK_BULK)
+    {
+        link_boost(conn_handle);
+    }
+}
+
+// app_timer task
+static void sample_timeout_handler(void * p_context)
+{
+    uint16_t conn_handle = m_conn_handle;
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;
+    uint32_t all_packets;
+    uint32_t packets;
+    uint32_t bytes;
+    uint32_t rate;
+    uint8_t queued;
+    bool bulk;
+
+    UNUSED_PARAMETER(p_context);
+
+    if (conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return;
+    }
+    if (m_restart)
+    {
+        m_restart = false;
+        sample_reset();
+    }
+
+    m_tx_get(&tx_bytes, &queued);
+    rx_bytes = m_rx_bytes;
+    all_packets = m_tx_packets + m_rx_packets;
+
+    // notified bytes start over with a new connection
+    bytes   = ((tx_bytes >= m_last_tx_bytes) ? tx_bytes - m_last_tx_bytes : tx_bytes) +
+              (rx_bytes - m_last_rx_bytes);
+    packets = all_packets - m_last_packets;
+    m_last_tx_bytes = tx_bytes;
+    m_last_rx_bytes = rx_bytes;
+    m_last_packets  = all_packets;
+
+    energy_add(bytes, packets, queued > 0);
+
+    rate = (uint32_t)(((uint64_t)bytes * 1000) / CONN_POLICY_PERIOD_MS);
+    m_stats.rate = rate;
+    m_stats.peak_rate = MAX(m_stats.peak_rate, rate);
+
+    bulk = m_hint || (rate >= CONN_POLICY_BULK_RATE) || (queued >= CONN_POLICY_BULK_QUEUED);
+    m_hint = false;
+
+    if (bulk)
+    {
+        m_quiet_ms = 0;
+        if (m_profile != PROTO_LINK_BULK)
+        {
+            profile_set(conn_handle, PROTO_LINK_BULK);
+        }
+    }
+    else
+    {
+        m_quiet_ms = MIN(m_quiet_ms + CONN_POLICY_PERIOD_MS, CONN_POLICY_IDLE_MS);
+        if ((m_quiet_ms >= CONN_POLICY_IDLE_MS) && (m_profile != PROTO_LINK_IDLE))
+        {
+            profile_set(conn_handle, PROTO_LINK_IDLE);
+        }
+    }
+}
+
+static void on_connect(ble_gap_evt_t const * p_gap_evt)
+{
+    ret_code_t err;
+
+    if (p_gap_evt->params.connected.role != BLE_GAP_ROLE_PERIPH)
+    {
+        return;
+    }
+
+    m_interval      = p_gap_evt->params.connected.conn_params.max_conn_interval;
+    m_latency       = p_gap_evt->params.connected.conn_params.slave_latency;
+    m_phy           = BLE_GAP_PHY_1MBPS;
+    m_data_len      = LL_DATA_LENGTH_DEFAULT;
+    m_rx_bytes      = 0;
+    m_rx_packets    = 0;
+    m_tx_packets    = 0;
+    m_hint          = false;
+    m_restart       = true;
+    m_conn_handle   = p_gap_evt->conn_handle;
+
+    err = app_timer_start(m_sample_timer, APP_TIMER_TICKS(CONN_POLICY_PERIOD_MS), NULL);
+    APP_ERROR_CHECK(err);
+}
+
+// softdevice task
+static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if (p_ble_evt->header.evt_id == BLE_GAP_EVT_CONNECTED)
+    {
+        on_connect(&p_ble_evt->evt.gap_evt);
+        return;
+    }
+
+    // gap and gatts events both start with the connection handle
+    if ((m_conn_handle == BLE_CONN_HANDLE_INVALID) ||
+        (p_ble_evt->evt.gap_evt.conn_handle != m_conn_handle))
+    {
+        return;
+    }
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_DISCONNECTED:
+            m_conn_handle = BLE_CONN_HANDLE_INVALID;
+            APP_ERROR_CHECK(app_timer_stop(m_sample_timer));
+            break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+            m_interval = p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval;
+            m_latency  = p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.slave_latency;
+            break;
+
+        case BLE_GAP_EVT_PHY_UPDATE:
+            if (p_ble_evt->evt.gap_evt.params.phy_update.status == BLE_HCI_STATUS_CODE_SUCCESS)
+            {
+                m_phy = p_ble_evt->evt.gap_evt.params.phy_update.tx_phy;
+            }
+            break;
+
+        case BLE_GATTS_EVT_WRITE:
+            m_rx_bytes += p_ble_evt->evt.gatts_evt.params.write.len;
+            m_rx_packets++;
+            break;
+
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+            m_tx_packets += p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count;
+            break;
+
+        default:
+            break;
+    }
+}
+
+NRF_SDH_BLE_OBSERVER(m_conn_policy_observer, CONN_POLICY_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
+
+ret_code_t conn_policy_init(nrf_ble_gatt_t * p_gatt, conn_policy_tx_get_t tx_get)
+{
+    ret_code_t err;
+    ble_opt_t opt;
+
+    if ((p_gatt == NULL) || (tx_get == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    mp_gatt  = p_gatt;
+    m_tx_get = tx_get;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = 1;
+    err = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    if (err != NRF_SUCCESS)
+    {
+        return err;
+    }
+
+    return app_timer_create(&m_sample_timer, APP_TIMER_MODE_REPEATED, sample_timeout_handler);
+}
+
+void conn_policy_bulk_hint(void)
+{
+    m_hint = true;
+}
+
+void conn_policy_on_gatt_evt(nrf_ble_gatt_evt_t const * p_evt)
+{
+    if ((p_evt->conn_handle == m_conn_handle) &&
+        (p_evt->evt_id == NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED))
+    {
+        m_data_len = p_evt->params.data_length;
+    }
+}
+
+// app_timer task, like the samples
+void conn_policy_on_conn_params_evt(ble_conn_params_evt_t const * p_evt)
+{
+    if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
+    {
+        m_stats.refused++;
+    }
+}
+
+void conn_policy_stats_get(proto_link_stats_t * p_stats)
+{
+    CRITICAL_REGION_ENTER();
+    *p_stats = m_stats;
+    p_stats->bulk_uj = (uint32_t)(m_bulk_nj / 1000);
+    p_stats->idle_uj = (uint32_t)(m_idle_nj / 1000);
+    CRITICAL_REGION_EXIT();
+
+    if (m_conn_handle != BLE_CONN_HANDLE_INVALID)
+    {
+        p_stats->interval = m_interval;
+        p_stats->latency  = m_latency;
+        p_stats->data_len = m_data_len;
+        p_stats->phy      = m_phy;
+        p_stats->profile  = m_profile;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef __CONN_POLICY_H__
+#define __CONN_POLICY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "ble_conn_params.h"
+#include "nrf_ble_gatt.h"
+
+#include "howland.h"
+
+/**
+ * Link policy, connection parameters for throughput or for power
+ *
+ * Traffic is sampled every CONN_POLICY_PERIOD_MS (app_timer, task context):
+ * notified bytes and queue backlog from the caller, gatt writes from the
+ * ble events. The link is BULK while more than CONN_POLICY_BULK_RATE moves,
+ * CONN_POLICY_BULK_QUEUED notifications wait, or conn_policy_bulk_hint was
+ * called since the last sample, and IDLE after CONN_POLICY_IDLE_MS without.
+ *
+ * BULK asks for a short interval (ble_conn_params_change_conn_params), 2M
+ * phy and the longest data length (nrf_ble_gatt), the last two once per
+ * connection. IDLE asks for a long interval and slave latency, the phy is
+ * left on 2M, empty packets take less air time there too.
+ * Connection event length extension is turned on, a BULK event runs on while
+ * there is data, up to the interval.
+ *
+ * Radio energy is estimated per profile from connection events, packets and
+ * bytes on air, see proto_link_stats_t. the figures below are rough ones for
+ * nRF52832 (dc/dc, 0dBm, 3V), measure a deployment with a power profiler and
+ * override them from the project defines.
+ */
+#ifndef CONN_POLICY_EVENT_NJ
+#define CONN_POLICY_EVENT_NJ                8000    // connection event, wake up and empty packet pair
+#endif
+#ifndef CONN_POLICY_PACKET_NJ_1M
+#define CONN_POLICY_PACKET_NJ_1M            6000    // packet pair over an empty one, headers and ifs
+#endif
+#ifndef CONN_POLICY_PACKET_NJ_2M
+#define CONN_POLICY_PACKET_NJ_2M            4000
+#endif
+#ifndef CONN_POLICY_BYTE_NJ_1M
+#define CONN_POLICY_BYTE_NJ_1M              170     // 8us on air
+#endif
+#ifndef CONN_POLICY_BYTE_NJ_2M
+#define CONN_POLICY_BYTE_NJ_2M              85
+#endif
+
+#define CONN_POLICY_BLE_OBSERVER_PRIO       3       // APP_BLE_OBSERVER_PRIO, after ble_conn_params
+
+/**
+ * bytes notified since connected and notifications waiting on the current
+ * link, called from the app_timer task
+ */
+typedef void (*conn_policy_tx_get_t)(uint32_t * p_bytes, uint8_t * p_queued);
+
+/**
+ * create the sample timer and turn on event length extension, after the
+ * softdevice is enabled. p_gatt is the instance the app initialized.
+ */
+ret_code_t conn_policy_init(nrf_ble_gatt_t * p_gatt, conn_policy_tx_get_t tx_get);
+
+/**
+ * bulk data is waiting or about to come, from task or isr. the link goes
+ * BULK at the next sample.
+ */
+void conn_policy_bulk_hint(void);
+
+/**
+ * to be called from the app gatt and ble_conn_params event handlers
+ */
+void conn_policy_on_gatt_evt(nrf_ble_gatt_evt_t const * p_evt);
+void conn_policy_on_conn_params_evt(ble_conn_params_evt_t const * p_evt);
+
+/**
+ * zeros but the counters if not connected
+ */
+void conn_policy_stats_get(proto_link_stats_t * p_stats);
+
+#endif
@@ -7,66 +7,21 @@
 // #include "nrfx_spim.h"
 
 #include "nrf_log.h"
-#include "nrf_twi_mngr.h"
+#include "nrf_atfifo.h"
+#include "nrf_atomic.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
-#include "queue.h"
 
 #include "howland.h"
+#include "timing.h"
+#include "stim_chain.h"
+#include "waveform.h"
+#include "protocol.h"
+#include "idt.h"
+#include "conn_policy.h"
 #include "test\test.h"
 
-NRF_TWI_MNGR_DEF(m_nrf_twi_mngr, IDT_TWI_MAX_PENDING_TRANSACTIONS, IDT_TWI_INSTANCE);
-
-static uint8_t idt_txbuf[16] = { 0 };
-static uint8_t idt_rxbuf[16] = { 0 };
-
-// TWI (with transaction manager) initialization.
-static void twi_config(void) {
-  uint32_t err_code;
-
-  nrf_drv_twi_config_t const config = {
-      .scl = IDT_SCL_PIN,
-      .sda = IDT_SDA_PIN,
-      .frequency = NRF_DRV_TWI_FREQ_400K,
-      .interrupt_priority = APP_IRQ_PRIORITY_LOWEST,
-      .clear_bus_init = false
-  };
-
-  err_code = nrf_twi_mngr_init(&m_nrf_twi_mngr, &config);
-  APP_ERROR_CHECK(err_code);
-}
-
-static void read_reg(uint8_t addr, uint8_t numOfRegs) 
-{
-    uint32_t err;
-    static nrf_twi_mngr_transfer_t rxfers[] = {
-        NRF_TWI_MNGR_WRITE(IDT_I2C_ADDR, idt_txbuf, 2, NRF_TWI_MNGR_NO_STOP),
-        NRF_TWI_MNGR_READ (IDT_I2C_ADDR, idt_rxbuf, 1, 0)
-    };    
-    
-    idt_txbuf[0] = 0x00;
-    idt_txbuf[1] = 0x3C;
-    idt_txbuf[2] = 0x78;
-    
-    err = nrf_twi_mngr_perform(&m_nrf_twi_mngr, NULL, rxfers, 2, NULL);
-    APP_ERROR_CHECK(err);
-    
-    NRF_LOG_INFO("read 0x3c reg %x", idt_rxbuf[0]);
-    
-    static nrf_twi_mngr_transfer_t txfers[] = {
-        NRF_TWI_MNGR_WRITE(IDT_I2C_ADDR, idt_txbuf, 3, NULL),
-    };  
-
-    err = nrf_twi_mngr_perform(&m_nrf_twi_mngr, NULL, txfers, 3, 0);
-    APP_ERROR_CHECK(err);    
-    
-    err = nrf_twi_mngr_perform(&m_nrf_twi_mngr, NULL, rxfers, 2, NULL);
-    APP_ERROR_CHECK(err);
-    
-    NRF_LOG_INFO("read 0x3c reg %x", idt_rxbuf[0]);    
-}
-
 /**
  * DAC088S085 Commands
  *
@@ -108,28 +63,49 @@ static void read_reg(uint8_t addr, uint8_t numOfRegs)
 static TaskHandle_t m_thread = NULL;
 
 /**
- * freertos queue
+ * rx ring, single producer (nus_data_handler) single consumer (howland task).
+ * frames are written into the ring slot by ble_nus_recv and handled in place,
+ * task is woken with a notification. a frame arriving on full ring is dropped
+ * and counted, if it is a v2 frame, it is answered with a busy ack.
+ * sequence numbers of dropped frames are kept in a bitmap, one bit for each
+ * of the 256, so a burst of drops gets a busy ack for every frame before the
+ * task gets to run. frames dropped twice with the same sequence number get
+ * one ack.
  */
 #define INCOMMING_QUEUE_DEPTH               8
 
-static QueueHandle_t m_incomming_idle       = NULL;
-static QueueHandle_t m_incomming_pending    = NULL;
-static ble_incomming_message_t m_message_pool[INCOMMING_QUEUE_DEPTH] = { 0 };
+#define HOWLAND_EVT_RX                      (1 << 0)
+#define HOWLAND_EVT_DROP                    (1 << 1)
+#define HOWLAND_EVT_IDT                     (1 << 2)
+
+NRF_ATFIFO_DEF(m_rx_fifo, ble_incomming_frame_t, INCOMMING_QUEUE_DEPTH);
+
+static volatile uint32_t m_rx_received     = 0;
+static volatile uint32_t m_rx_handled      = 0;
+static volatile uint32_t m_rx_dropped      = 0;
+static volatile uint8_t m_rx_high_water    = 0;
+static nrf_atomic_u32_t m_rx_drop_seqs[256 / 32];  // seqs of dropped v2 frames not acked yet
+static uint8_t m_rx_drop_next               = 0;    // seq to look at first, after the last one acked
 
 static void incomming_queue_init(void)
 {
-    ble_incomming_message_t * p_msg;
+    ret_code_t err = NRF_ATFIFO_INIT(m_rx_fifo);
+    APP_ERROR_CHECK(err);
+}
 
-    m_incomming_idle = xQueueCreate(INCOMMING_QUEUE_DEPTH, sizeof(ble_incomming_message_t *));
-    APP_ERROR_CHECK_BOOL(m_incomming_idle != NULL);
-    m_incomming_pending = xQueueCreate(INCOMMING_QUEUE_DEPTH, sizeof(ble_incomming_message_t *));
-    APP_ERROR_CHECK_BOOL(m_incomming_idle != NULL);
+static void howland_notify(uint32_t events)
+{
+    if (m_thread == NULL) return;
 
-    for (int i = 0; i < INCOMMING_QUEUE_DEPTH; i++)
+    if (INSIDE_ISR)
+    {
+        BaseType_t yield = pdFALSE;
+        xTaskNotifyFromISR(m_thread, events, eSetBits, &yield);
+        portYIELD_FROM_ISR(yield);
+    }
+    else
     {
-        p_msg = &m_message_pool[i];
-        BaseType_t result = xQueueSend(m_incomming_idle, &p_msg, 0);
-        APP_ERROR_CHECK_BOOL(result == pdTRUE);
+        xTaskNotify(m_thread, events, eSetBits);
     }
 }
 
@@ -599,173 +575,1334 @@ static void test21_run(void)
 #endif
 
 /**
- * Howland
+ * Stimulation engine
+ *
+ * The whole cycle is sequenced by hardware. seg timer starts the spi burst of
+ * each segment through ppi, seg counter counts words and stops the spi timer
+ * at the end of each burst, and the cycle end rewinds seg timer and seg
+ * counter and counts the cycle in cyc counter. The cpu is only woken once per
+ * cycle, after the last burst, to rewind the tx pointer.
+ *
+ * Waveform tables are ping-ponged. Hardware plays m_wave[m_wave_active] while
+ * new parameters are compiled into the other one, which is swapped in by the
+ * same once-per-cycle interrupt. Nothing is stopped, so no pulse is dropped
+ * and the isr does O(1) work.
+ *
+ * cc roles and ppi links are in stim_chain.h.
  */
-#ifdef DAC_USE_SPI_MNGR
-static void howland_task(void * pvParameters)
-{
-    // test3_run();
-    // test6_run();
-    vTaskDelay(portMAX_DELAY);
-//  ret_code_t ret;
+STATIC_ASSERT(WAVEFORM_MAX_SEGS <= 4);
+STATIC_ASSERT(PROTO_MAX_SEGS < WAVEFORM_MAX_SEGS);
+STATIC_ASSERT(PROTO_NUM_OF_CHANNELS == DAC_NUM_OF_CHANNELS);
 
-    ble_incomming_message_t * p_msg;
-    uint16_t msg_length = sizeof(m_msg);
+static waveform_t m_wave[2];
+static volatile uint8_t m_wave_active       = 0;
+static volatile bool m_wave_pending         = false;
+static volatile uint32_t m_wave_swaps       = 0;
 
-    bool stim_started = false;
+static timing_chain_t m_stim_chain;
 
-    incomming_queue_init();
+static waveform_limits_t const m_stim_limits = {
+    .max_amplitude  = STIM_MAX_AMPLITUDE,
+    .max_imbalance  = STIM_MAX_IMBALANCE,
+};
+
+static bool m_stim_prepared                 = false;
+static bool m_stim_started                  = false;
+
+/*
+ * Streaming
+ *
+ * a stream table is a single segment holding one sample for the whole cycle.
+ * the rewind isr takes the next sample from m_stream_fifo and writes it into
+ * the table to be played next, in place, so the burst at next cycle start
+ * sends it. if the ring is empty the table is left as it is, which holds the
+ * last value, and an underrun is counted once streaming has begun.
+ *
+ * net charge of the stream is kept per channel in dac code x cycles, pushed
+ * samples in m_stream_charge by the task and cycles a sample is held for in
+ * m_stream_held by the isr. a push that would take it past
+ * STREAM_MAX_CHARGE is refused, and a sample that would on underrun is not
+ * held, outputs go to VMID instead.
+ */
+STATIC_ASSERT(sizeof(proto_sample_t) == DAC_NUM_OF_CHANNELS);
+
+NRF_ATFIFO_DEF(m_stream_fifo, proto_sample_t, STREAM_RING_DEPTH);
 
-    timer_init();
+static bool m_wave_stream[2]                = { false, false };
+static bool m_stream_fifo_ready             = false;
 
-    nrf_spi_mngr_init(&m_dac_spi_mngr, &m_dac_spi_config);
-    // dac_update_simult(dac_reg_init);
-    dac_update_same(0x80);
+static volatile uint32_t m_stream_queued    = 0;
+static volatile uint32_t m_stream_played    = 0;
+static volatile uint32_t m_stream_underruns = 0;
+static volatile uint32_t m_stream_dropped   = 0;
+static volatile uint32_t m_stream_flushed   = 0;
+static volatile uint16_t m_stream_high_water = 0;
+static int32_t m_stream_charge[DAC_NUM_OF_CHANNELS];
+static volatile int32_t m_stream_held[DAC_NUM_OF_CHANNELS];
+
+static bool stream_charge_ok(int32_t q)
+{
+    return (q < 0 ? -q : q) <= STREAM_MAX_CHARGE;
+}
 
-    nrf_spi_mngr_init(&m_asw_spi_mngr, &m_asw_spi_config);
+static void stream_refill(waveform_t * p_wave)
+{
+    proto_sample_t sample;
 
-    while (xQueueReceive(m_incomming_pending, &p_msg, portMAX_DELAY))
+    if (nrf_atfifo_get_free(m_stream_fifo, &sample, sizeof(sample), NULL) == NRF_SUCCESS)
+    {
+        waveform_stream_set(p_wave, sample.current);
+        m_stream_played++;
+    }
+    else if (m_stream_played != 0)
     {
-        switch (p_msg->c)
+        static int8_t const vmid[DAC_NUM_OF_CHANNELS] = { 0 };
+        bool hold = true;
+
+        m_stream_underruns++;
+
+        for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
         {
-            case 0: // READ
-                NRF_LOG_INFO("read from app");
-                ble_nus_send((uint8_t *)&m_msg, &msg_length);
-                break;
-            case 1: // STOP
-                if (stim_started)
-                {
-                    // stim_stop();
-                    m_msg.c = 0;
-                    stim_started = false;
-                }
-                ble_nus_send((uint8_t *)&m_msg, &msg_length);
-                break;
-            case 2: { // START // TODO check p_msg and reject
-                if (stim_started)
-                {
-                    // stim_stop();
-                }
+            int32_t a = (int32_t)p_wave->seg_codes[0][i] - DAC_CODE_MID;
 
-                // TODO
-//                m_msg = *p_msg;
-//                m_msg.c = 0xffff;
-//                m_msg.timeout = 0xffff;
-//                m_msg.num_of_pulses = 1;
-//
-//                m_msg.pulse_width = (m_msg.pulse_width < 20) ? 20 : m_msg.pulse_width;
-//                m_msg.pulse_width = (m_msg.pulse_width > 50 * 1000) ? 50 * 1000 : m_msg.pulse_width;
-//
-//                m_msg.pulse_interval = 0;
-//                m_msg.mid = 0;
-//                // m_msg.freq = 0;
-//
-//                m_msg.recycle = (m_msg.recycle < m_msg.pulse_width) ? m_msg.pulse_width : m_msg.recycle;
-//                m_msg.recycle = (m_msg.recycle > 10 * m_msg.pulse_width) ? 10 * m_msg.pulse_width : m_msg.recycle;
-
-//                stim_prepare();
-//                stim_start();
-//                stim_started = true;
-                break;
-            }
-            default:
-                break;
+            hold = hold && stream_charge_ok(m_stream_charge[i] + m_stream_held[i] + a);
+        }
+
+        if (!hold)
+        {
+            waveform_stream_set(p_wave, vmid);
+            return;
         }
 
-        xQueueSend(m_incomming_idle, &p_msg, portMAX_DELAY);
-        // TODO LOG error
+        for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+        {
+            m_stream_held[i] += (int32_t)p_wave->seg_codes[0][i] - DAC_CODE_MID;
+        }
     }
 }
 
-#endif
+static uint16_t stream_level(void)
+{
+    return (uint16_t)(m_stream_queued - m_stream_played - m_stream_flushed);
+}
+
+/*
+ * drop what is waiting, isr must not be taking samples
+ */
+static void stream_flush(void)
+{
+    if (!m_stream_fifo_ready) return;
 
+    m_stream_flushed += stream_level();
+    (void)nrf_atfifo_clear(m_stream_fifo);
 
-/******************************************************************************
- *
+    memset(m_stream_charge, 0, sizeof(m_stream_charge));
+    memset((void *)m_stream_held, 0, sizeof(m_stream_held));
+}
+
+static void stream_fifo_init(void)
+{
+    ret_code_t err;
+
+    if (m_stream_fifo_ready) return;
+
+    err = NRF_ATFIFO_INIT(m_stream_fifo);
+    APP_ERROR_CHECK(err);
+    m_stream_fifo_ready = true;
+}
+
+static void stim_spi_xfer(uint16_t offset)
+{
+    uint32_t err;
+
+    static nrf_drv_spi_xfer_desc_t xfer = {
+        .tx_length = 2
+    };
+
+    const uint32_t flags =
+        NRF_DRV_SPI_FLAG_HOLD_XFER |
+        NRF_DRV_SPI_FLAG_TX_POSTINC |
+        NRF_DRV_SPI_FLAG_NO_XFER_EVT_HANDLER |
+        NRF_DRV_SPI_FLAG_REPEATED_XFER;
+
+    xfer.p_tx_buffer = &m_wave[m_wave_active].spi_words[offset];
+    err = nrf_drv_spi_xfer(&m_dac_spi, &xfer, flags);
+    APP_ERROR_CHECK(err);
+}
+
+static void stim_timers_load(waveform_t const * p_wave)
+{
+    uint32_t words = 0;
+
+    for (uint8_t i = 0; i < WAVEFORM_MAX_SEGS; i++)
+    {
+        if (i < p_wave->num_of_segs)
+        {
+            words += p_wave->seg_words[i];
+            nrf_drv_timer_compare(&m_seg_timer, (nrf_timer_cc_channel_t)i, p_wave->seg_time[i], false);
+            nrf_drv_timer_compare(&m_seg_counter, (nrf_timer_cc_channel_t)i, words, false);
+        }
+        else
+        {
+            nrf_drv_timer_compare(&m_seg_timer, (nrf_timer_cc_channel_t)i, STIM_CC_UNUSED, false);
+            nrf_drv_timer_compare(&m_seg_counter, (nrf_timer_cc_channel_t)i, STIM_CC_UNUSED, false);
+        }
+    }
+
+    nrf_drv_timer_compare(&m_seg_timer,
+                          (nrf_timer_cc_channel_t)STIM_SEG_TIMER_CC_REWIND,
+                          waveform_last_burst_end(p_wave),
+                          true);
+
+    nrf_drv_timer_extended_compare(&m_seg_timer,
+                                   (nrf_timer_cc_channel_t)STIM_SEG_TIMER_CC_CYCLE,
+                                   p_wave->cycle_time,
+                                   (nrf_timer_short_mask_t)(NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK << STIM_SEG_TIMER_CC_CYCLE),
+                                   false);
+}
+
+/*
+ * Instrumentation
  *
+ * seg timer has no spare cc, all six are taken by the engine. at the rewind
+ * compare, ppi captures spi timer into its spare c2 and cyc counter into its
+ * spare c1. spi timer is stopped and cleared once a burst is done, so a non
+ * zero c2 means the burst overran WAVEFORM_WORD_US. c1 is the cycle number,
+ * a gap between two isrs means cycles went by without rewind. the isr itself
+ * captures seg timer into c4 on entry and exit (and puts the compare back),
+ * giving latency from the compare and time spent.
+ * everything is O(1) in isr, the last TIMING_RING_DEPTH cycles are kept raw.
  */
+#define TIMING_RING_DEPTH                   16      // power of 2
+
+#define TIMING_FLAG_OVERRUN                 (1 << 0)
+#define TIMING_FLAG_LATE                    (1 << 1)
+#define TIMING_FLAG_CUT                     (1 << 2)
+
+typedef struct timing_record
+{
+    uint32_t    cycle;
+    uint16_t    latency;                    // us
+    uint16_t    duration;                   // us, 0 if cut
+    uint16_t    spi;                        // spi timer at rewind compare, 16MHz ticks
+    uint8_t     flags;
+} timing_record_t;
+
+static timing_record_t m_timing_ring[TIMING_RING_DEPTH];
+static volatile uint32_t m_timing_head      = 0;
+static proto_timing_stats_t m_timing        = { 0 };
+static uint64_t m_timing_latency_sum        = 0;
+static bool m_timing_first                  = true;
+
+static void timing_reset(void)
+{
+    memset(&m_timing, 0, sizeof(m_timing));
+    m_timing.latency_min    = UINT16_MAX;
+    m_timing_latency_sum    = 0;
+    m_timing_head           = 0;
+    m_timing_first          = true;
+}
+
+static uint32_t seg_timer_probe(void)
+{
+    uint32_t sched = nrf_drv_timer_capture_get(&m_seg_timer, (nrf_timer_cc_channel_t)STIM_SEG_TIMER_CC_REWIND);
+    uint32_t now = nrf_drv_timer_capture(&m_seg_timer, (nrf_timer_cc_channel_t)STIM_SEG_TIMER_CC_REWIND);
+
+    // compare is in the past already, writing it back won't fire again this cycle
+    nrf_drv_timer_compare(&m_seg_timer, (nrf_timer_cc_channel_t)STIM_SEG_TIMER_CC_REWIND, sched, true);
+
+    return now;
+}
+
+static uint32_t timing_isr_enter(void)
+{
+    timing_record_t * p_rec = &m_timing_ring[m_timing_head & (TIMING_RING_DEPTH - 1)];
+    uint32_t sched = nrf_drv_timer_capture_get(&m_seg_timer, (nrf_timer_cc_channel_t)STIM_SEG_TIMER_CC_REWIND);
+    uint32_t entry = seg_timer_probe();
+    uint32_t cycle = nrf_drv_timer_capture_get(&m_cyc_counter, (nrf_timer_cc_channel_t)STIM_CYC_COUNTER_CC_PROBE);
+    uint32_t latency = (entry - sched) / WAVEFORM_TICKS_PER_US;
+    uint8_t bin = 0;
+
+    p_rec->latency  = (uint16_t)MIN(latency, UINT16_MAX);
+    p_rec->spi      = (uint16_t)nrf_drv_timer_capture_get(&m_spi_timer, (nrf_timer_cc_channel_t)STIM_SPI_TIMER_CC_PROBE);
+    p_rec->flags    = (p_rec->spi != 0) ? TIMING_FLAG_OVERRUN : 0;
+    p_rec->duration = 0;
+
+    if (!m_timing_first && cycle - m_timing_ring[(m_timing_head - 1) & (TIMING_RING_DEPTH - 1)].cycle > 1)
+    {
+        m_timing.missed += cycle - m_timing_ring[(m_timing_head - 1) & (TIMING_RING_DEPTH - 1)].cycle - 1;
+    }
+    p_rec->cycle    = cycle;
+    m_timing_first  = false;
+
+    while (bin < PROTO_TIMING_HIST_BINS - 1 && (p_rec->latency >> bin) != 0)
+    {
+        bin++;
+    }
+
+    m_timing.cycles++;
+    m_timing.hist[bin]++;
+    m_timing_latency_sum += p_rec->latency;
+    if (p_rec->latency < m_timing.latency_min) m_timing.latency_min = p_rec->latency;
+    if (p_rec->latency > m_timing.latency_max) m_timing.latency_max = p_rec->latency;
+    if (p_rec->flags & TIMING_FLAG_OVERRUN) m_timing.overruns++;
 
+    return entry;
+}
 
 /*
- * configurations;
- * 1. spi timer, channel 0
- *
+ * seg timer is cleared if the isr runs past the cycle end, or if a swap cuts
+ * the cycle short, exit is smaller than entry then.
  */
-static void stim_start(void)
+static void timing_isr_exit(uint32_t entry, bool cut)
 {
-    
+    timing_record_t * p_rec = &m_timing_ring[m_timing_head & (TIMING_RING_DEPTH - 1)];
+    uint32_t exit = seg_timer_probe();
+
+    if (cut)
+    {
+        p_rec->flags |= TIMING_FLAG_CUT;
+    }
+    else if (exit < entry)
+    {
+        p_rec->flags |= TIMING_FLAG_LATE;
+        m_timing.late++;
+    }
+    else
+    {
+        p_rec->duration = (uint16_t)MIN((exit - entry) / WAVEFORM_TICKS_PER_US, UINT16_MAX);
+        if (p_rec->duration > m_timing.duration_max) m_timing.duration_max = p_rec->duration;
+    }
+
+    m_timing_head++;
 }
 
+void howland_timing_stats_get(proto_timing_stats_t * p_stats)
+{
+    CRITICAL_REGION_ENTER();
+    *p_stats = m_timing;
+    p_stats->latency_mean = m_timing.cycles ? (uint16_t)(m_timing_latency_sum / m_timing.cycles) : 0;
+    CRITICAL_REGION_EXIT();
 
-static void howland_task(void * pvParameters)
-{   
-    test6e();
-    vTaskDelay(portMAX_DELAY);
+    if (p_stats->cycles == 0)
+    {
+        p_stats->latency_min = 0;
+    }
 }
 
+void howland_timing_dump(void)
+{
+    uint32_t head = m_timing_head;
+    uint32_t n = MIN(head, TIMING_RING_DEPTH);
 
-void howland_freertos_init(void)
+    for (uint32_t i = head - n; i != head; i++)
+    {
+        timing_record_t rec = m_timing_ring[i & (TIMING_RING_DEPTH - 1)];
+
+        NRF_LOG_INFO("cycle %d latency %dus isr %dus spi %d flags %x",
+                     rec.cycle, rec.latency, rec.duration, rec.spi, rec.flags);
+    }
+}
+
+/*
+ * called in isr at the end of last burst, the rest of cycle is idle for spi.
+ * the new compares are live in the old idle tail, so if the new cycle is
+ * not longer than where the old one is now, or one of its segments starts
+ * past the old last burst (it would fire in the tail), the tail is cut and
+ * the new cycle starts right away, what ppi would do at cycle end is done
+ * by hand.
+ */
+static bool stim_wave_swap(void)
 {
-    BaseType_t xReturned;
+    waveform_t const * p_old = &m_wave[m_wave_active];
+    waveform_t const * p_wave = &m_wave[m_wave_active ^ 1];
+    uint32_t old_end = waveform_last_burst_end(p_old);
 
-    xReturned = xTaskCreate(howland_task,
-                            "howl",
-                            1024,   // stack size in word
-                            NULL,
-                            1,      // priority
-                            &m_thread);
+    m_wave_active ^= 1;
+    m_wave_pending = false;
+    m_wave_swaps++;
 
-    if (xReturned != pdPASS)
+    stim_timers_load(p_wave);
+    stim_spi_xfer(0);
+
+    if (p_wave->cycle_time <= old_end + WAVEFORM_REWIND_US * WAVEFORM_TICKS_PER_US ||
+        p_wave->seg_time[p_wave->num_of_segs - 1] > old_end)
     {
-        NRF_LOG_INFO("no mem for howland task.");
+        nrf_drv_timer_clear(&m_seg_timer);
+        nrf_drv_timer_clear(&m_seg_counter);
+        nrf_drv_timer_increment(&m_cyc_counter);
+        return true;
     }
-    else
+
+    return false;
+}
+
+static void stim_seg_timer_callback(nrf_timer_event_t event_type, void * p_context)
+{
+    if (event_type == NRF_TIMER_EVENT_COMPARE4)
     {
-        NRF_LOG_INFO("howland task ready.");
+        // refill before the swap, which may start the next cycle at once
+        uint8_t next = m_wave_active ^ (m_wave_pending ? 1 : 0);
+        uint32_t entry = timing_isr_enter();
+        bool cut = false;
+        static uint32_t refresh = 0;
+
+        if (m_wave_stream[next])
+        {
+            stream_refill(&m_wave[next]);
+        }
+
+        if (m_wave_pending)
+        {
+            cut = stim_wave_swap();
+        }
+        else
+        {
+            stim_spi_xfer(0);
+        }
+
+        timing_isr_exit(entry, cut);
+
+        // telemetry for compliance compensation, read in twi irq
+        if (++refresh >= COMP_REFRESH_CYCLES)
+        {
+            refresh = 0;
+            (void)idt_refresh();
+        }
     }
 }
 
-ble_incomming_message_t * ble_nus_alloc(void)
+/*
+ * one-time hardware setup.
+ */
+static void stim_prepare(void)
+{
+    uint32_t err;
+
+    static uint8_t pu[2] = { 0xD0, 0x00 };  // clear powerdown on all channels
+    static uint8_t wr[2] = { 0x80, 0x00 };  // set wrm mode
+    static uint8_t mid[2] = { 0xC8, 0x00 }; // all outputs VMID, tables start from there
+
+    if (m_stim_prepared) return;
+
+    ss_pin_init();
+
+    // init dac in blocking mode
+    err = nrf_drv_spi_init(&m_dac_spi, &m_dac_spi_config_noss, NULL, NULL);
+    APP_ERROR_CHECK(err);
+
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+    nrf_drv_spi_transfer(&m_dac_spi, pu, 2, NULL, 0);
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+    nrf_drv_spi_transfer(&m_dac_spi, wr, 2, NULL, 0);
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+    nrf_drv_spi_transfer(&m_dac_spi, mid, 2, NULL, 0);
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+
+    nrf_drv_spi_uninit(&m_dac_spi);
+
+    // spi reinit (non-blocking mode)
+    err = nrf_drv_spi_init(&m_dac_spi, &m_dac_spi_config_noss, NULL, NULL);
+    APP_ERROR_CHECK(err);
+
+    nrf_drv_timer_config_t cycle_cfg = NRF_DRV_TIMER_DEFAULT_CONFIG;
+    err = nrf_drv_timer_init(&m_seg_timer, &cycle_cfg, stim_seg_timer_callback);
+    APP_ERROR_CHECK(err);
+
+    // enable timer in stopped state
+    spi_timer_init(NULL);
+    nrf_drv_timer_enable(&m_spi_timer);
+    nrf_drv_timer_pause(&m_spi_timer);
+    nrf_drv_timer_clear(&m_spi_timer);
+    spi_timer_compare2(STIM_SPI_TIMER_START_TICKS, STIM_SPI_TIMER_SS_TICKS);
+
+    // counters are never stopped
+    count_timer_init(NULL);
+    nrf_drv_timer_enable(&m_seg_counter);
+
+    cycle_counter_init(NULL);
+    nrf_drv_timer_enable(&m_cyc_counter);
+
+    err = timing_chain_apply(&m_stim_chain, m_stim_links, STIM_NUM_OF_LINKS);
+    APP_ERROR_CHECK(err);
+    timing_chain_enable(&m_stim_chain);
+
+    m_stim_prepared = true;
+}
+
+static void stim_start(void)
+{
+    m_wave_active ^= 1;
+    m_wave_pending = false;
+
+    nrf_drv_timer_clear(&m_seg_counter);
+    nrf_drv_timer_clear(&m_cyc_counter);
+    timing_reset();
+
+    stim_timers_load(&m_wave[m_wave_active]);
+    stim_spi_xfer(0);
+
+    nrf_drv_timer_clear(&m_seg_timer);
+    nrf_drv_timer_enable(&m_seg_timer);
+    m_stim_started = true;
+}
+
+/*
+ * validate what is compiled into the idle table and play it. a compiled
+ * table starts from VMID, which a stream does not leave, so a stream is
+ * stopped first.
+ */
+static ret_code_t stim_commit(void)
 {
-    ble_incomming_message_t * p_msg;
+    ret_code_t err;
+    waveform_report_t report;
+
+    err = waveform_validate(&m_wave[m_wave_active ^ 1], &m_stim_limits, STIM_AUTO_BALANCE, &report);
+    if (err != NRF_SUCCESS)
+    {
+        return err;
+    }
+
+    if (m_stim_started && m_wave_stream[m_wave_active] && !m_wave_stream[m_wave_active ^ 1])
+    {
+        howland_stim_stop();
+    }
 
-    NRF_LOG_INFO("idle q has %d messages", uxQueueMessagesWaiting(m_incomming_idle));
+    if (report.corrected)
+    {
+        NRF_LOG_INFO("charge balanced on channels %02x", report.corrected);
+    }
 
-    if (pdTRUE == xQueueReceive(m_incomming_idle, &p_msg, 0))
+    if (m_stim_started)
     {
-        return p_msg;
+        m_wave_pending = true;
     }
     else
     {
-        return NULL;
+        stim_prepare();
+        stim_start();
     }
+
+    return NRF_SUCCESS;
 }
 
-ble_incomming_message_t * ble_nus_alloc_from_isr(void)
+/*
+ * Compliance compensation
+ *
+ * The table compiled by the last START or WAVE is kept unscaled in
+ * m_comp_source, what is played is that table scaled by m_comp.scale. The
+ * rewind isr asks for a telemetry refresh every COMP_REFRESH_CYCLES cycles,
+ * comp_step runs in task on each refresh, off the idt cache. when vout is
+ * short of what the peak amplitude needs, VOUT_SET is raised if vrect has
+ * the headroom, and the table is scaled to what vout can drive meanwhile.
+ * streams are not scaled.
+ */
+#define COMP_VOUT_SETTLE_MS                 20      // between VOUT_SET steps
+
+static waveform_t m_comp_source;
+static bool m_comp_source_valid             = false;
+static uint8_t m_comp_peak                  = 0;    // dac code from VMID, unscaled
+static uint32_t m_comp_seq                  = 0;    // telemetry seq seen
+static int16_t m_comp_vout_nominal          = -1;   // VOUT_SET at first telemetry
+static TickType_t m_comp_vout_tick          = 0;    // last VOUT_SET step
+static proto_comp_stats_t m_comp            = { .scale = WAVEFORM_SCALE_ONE };
+
+static uint8_t comp_peak(waveform_t const * p_wave)
 {
-    ble_incomming_message_t * p_msg;
-    if (pdTRUE == xQueueReceiveFromISR(m_incomming_idle, &p_msg, 0))
+    uint8_t peak = 0;
+
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
     {
-        return p_msg;
+        for (int ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+        {
+            int16_t a = (int16_t)p_wave->seg_codes[seg][ch] - DAC_CODE_MID;
+
+            if (a < 0) a = -a;
+            if (a > peak) peak = (uint8_t)a;
+        }
     }
-    else
+
+    return peak;
+}
+
+/*
+ * scale the table just compiled into the idle one and play it, keep it
+ * unscaled for later rescales.
+ */
+static ret_code_t comp_commit(void)
+{
+    ret_code_t err;
+    static waveform_t source;   // off the task stack
+
+    source = m_wave[m_wave_active ^ 1];
+    if (m_comp.scale != WAVEFORM_SCALE_ONE)
+    {
+        waveform_scale(&m_wave[m_wave_active ^ 1], m_comp.scale);
+    }
+
+    err = stim_commit();
+    if (err == NRF_SUCCESS)
+    {
+        m_comp_source = source;
+        m_comp_peak = comp_peak(&source);
+        m_comp_source_valid = true;
+    }
+
+    return err;
+}
+
+static void comp_rescale(uint16_t scale)
+{
+    ret_code_t err;
+
+    m_wave_pending = false;
+
+    m_wave[m_wave_active ^ 1] = m_comp_source;
+    m_wave_stream[m_wave_active ^ 1] = false;
+    if (scale != WAVEFORM_SCALE_ONE)
+    {
+        waveform_scale(&m_wave[m_wave_active ^ 1], scale);
+    }
+
+    err = stim_commit();
+    if (err != NRF_SUCCESS)
     {
-        return NULL;
+        m_comp.errors++;
+        NRF_LOG_WARNING("compliance: scale %d rejected, err %d", scale, err);
+        return;
     }
+
+    m_comp.scale = scale;
+    m_comp.rescales++;
 }
 
-void ble_nus_recv(ble_incomming_message_t * p_message)
+static void comp_vout_step(idt_telemetry_t const * p_telemetry, int8_t step)
 {
-    if (p_message == NULL) return;
+    if (p_telemetry->timestamp - m_comp_vout_tick < pdMS_TO_TICKS(COMP_VOUT_SETTLE_MS))
+    {
+        return;
+    }
 
-    // TODO log error
-    xQueueSend(m_incomming_pending, &p_message, 0);
+    if (idt_vout_set((uint8_t)(p_telemetry->vout_set + step)) == NRF_SUCCESS)
+    {
+        m_comp_vout_tick = p_telemetry->timestamp;
+        if (step > 0)
+        {
+            m_comp.vout_raises++;
+        }
+    }
 }
 
-void ble_nus_recv_from_isr(ble_incomming_message_t * p_message)
+static void comp_step(void)
 {
-    if (p_message == NULL) return;
+    idt_telemetry_t t;
+    uint16_t need;
+    uint32_t deliverable;
+    uint32_t target;
+    bool saturated;
+
+    idt_telemetry_get(&t);
+    if (t.seq == m_comp_seq) return;
+    m_comp_seq = t.seq;
+
+    m_comp.vrect = IDT_ADC_VRECT_MV(t.vrect);
+    m_comp.vout = IDT_ADC_VOUT_MV(t.vout);
+    m_comp.vout_set = t.vout_set;
 
-    // TODO log error
-    xQueueSendFromISR(m_incomming_pending, &p_message, 0);
+    if (m_comp_vout_nominal < 0)
+    {
+        m_comp_vout_nominal = t.vout_set;
+    }
+
+    if (!m_stim_started || !m_comp_source_valid)
+    {
+        m_comp.saturated = false;
+        return;
+    }
+
+    need = COMP_VOUT_MIN_MV + (uint32_t)(COMP_VOUT_FULL_MV - COMP_VOUT_MIN_MV) * m_comp_peak / STIM_MAX_AMPLITUDE;
+    saturated = m_comp.vout < need;
+    if (saturated && !m_comp.saturated)
+    {
+        m_comp.saturations++;
+        NRF_LOG_WARNING("compliance: vout %d mV, %d mV needed", m_comp.vout, need);
+    }
+    m_comp.saturated = saturated;
+
+    if (saturated)
+    {
+        if (t.vout_set < COMP_VOUT_SET_MAX && m_comp.vrect > m_comp.vout + COMP_DROPOUT_MV)
+        {
+            comp_vout_step(&t, 1);
+        }
+    }
+    else if (t.vout_set > m_comp_vout_nominal && m_comp.vout > need + COMP_VOUT_HYST_MV)
+    {
+        comp_vout_step(&t, -1);
+    }
+
+    // amplitude vout can drive now
+    deliverable = m_comp.vout > COMP_VOUT_MIN_MV ? m_comp.vout - COMP_VOUT_MIN_MV : 0;
+    deliverable = deliverable * STIM_MAX_AMPLITUDE / (COMP_VOUT_FULL_MV - COMP_VOUT_MIN_MV);
+
+    target = WAVEFORM_SCALE_ONE;
+    if (m_comp_peak != 0 && deliverable < m_comp_peak)
+    {
+        target = deliverable * WAVEFORM_SCALE_ONE / m_comp_peak;
+    }
+
+    // down at once, up in steps of COMP_SCALE_HYST or back to full
+    if (target < m_comp.scale ||
+        (target > m_comp.scale && (target >= m_comp.scale + COMP_SCALE_HYST || target == WAVEFORM_SCALE_ONE)))
+    {
+        comp_rescale((uint16_t)target);
+    }
+}
+
+static void comp_refresh_handler(void)
+{
+    howland_notify(HOWLAND_EVT_IDT);
+}
+
+void howland_comp_stats_get(proto_comp_stats_t * p_stats)
+{
+    *p_stats = m_comp;
+}
+
+ret_code_t howland_stim_start(ble_incomming_message_t const * p_msg)
+{
+    ret_code_t err;
+
+    // isr never swaps once m_wave_pending is cleared, the idle table is ours
+    m_wave_pending = false;
+
+    err = waveform_compile(p_msg, &m_wave[m_wave_active ^ 1]);
+    if (err != NRF_SUCCESS)
+    {
+        return err;
+    }
+    m_wave_stream[m_wave_active ^ 1] = false;
+
+    return comp_commit();
+}
+
+ret_code_t howland_stim_wave(proto_wave_t const * p_wave)
+{
+    ret_code_t err;
+    waveform_seg_desc_t segs[PROTO_MAX_SEGS];
+
+    if (p_wave == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    for (uint8_t i = 0; i < p_wave->num_of_segs && i < PROTO_MAX_SEGS; i++)
+    {
+        segs[i].type        = p_wave->segs[i].type;
+        segs[i].duration    = p_wave->segs[i].duration;
+        for (int j = 0; j < DAC_NUM_OF_CHANNELS; j++)
+        {
+            segs[i].current[j] = p_wave->segs[i].current[j];
+        }
+    }
+
+    m_wave_pending = false;
+
+    err = waveform_compile_segments(p_wave->freq, segs, p_wave->num_of_segs, &m_wave[m_wave_active ^ 1]);
+    if (err != NRF_SUCCESS)
+    {
+        return err;
+    }
+    m_wave_stream[m_wave_active ^ 1] = false;
+
+    return comp_commit();
+}
+
+ret_code_t howland_stream_start(uint16_t rate)
+{
+    ret_code_t err;
+
+    stream_fifo_init();
+
+    m_wave_pending = false;
+
+    err = waveform_compile_stream(rate, &m_wave[m_wave_active ^ 1]);
+    if (err != NRF_SUCCESS)
+    {
+        return err;
+    }
+    m_wave_stream[m_wave_active ^ 1] = true;
+
+    err = stim_commit();
+    if (err == NRF_SUCCESS)
+    {
+        m_comp_source_valid = false;
+    }
+
+    return err;
+}
+
+ret_code_t howland_stream_push(proto_sample_t const * p_samples, uint8_t num_of_samples)
+{
+    int32_t q[DAC_NUM_OF_CHANNELS];
+    uint16_t level;
+
+    stream_fifo_init();
+
+    // keep the link on bulk parameters while samples come in
+    conn_policy_bulk_hint();
+
+    for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+    {
+        q[i] = m_stream_charge[i] + m_stream_held[i];
+    }
+
+    // charge is checked after every sample, the stream has to stay in bounds all along
+    for (uint8_t n = 0; n < num_of_samples; n++)
+    {
+        for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+        {
+            int16_t a = p_samples[n].current[i];
+
+            q[i] += a;
+            if ((a < 0 ? -a : a) > STIM_MAX_AMPLITUDE || !stream_charge_ok(q[i]))
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+        }
+    }
+
+    for (uint8_t n = 0; n < num_of_samples; n++)
+    {
+        if (nrf_atfifo_alloc_put(m_stream_fifo, &p_samples[n], sizeof(proto_sample_t), NULL) != NRF_SUCCESS)
+        {
+            m_stream_dropped += num_of_samples - n;
+            return NRF_ERROR_NO_MEM;
+        }
+
+        for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+        {
+            m_stream_charge[i] += p_samples[n].current[i];
+        }
+        m_stream_queued++;
+    }
+
+    level = stream_level();
+    if (level > m_stream_high_water)
+    {
+        m_stream_high_water = level;
+    }
+
+    return NRF_SUCCESS;
+}
+
+void howland_stream_stats_get(proto_stream_stats_t * p_stats)
+{
+    p_stats->queued     = m_stream_queued;
+    p_stats->played     = m_stream_played;
+    p_stats->underruns  = m_stream_underruns;
+    p_stats->dropped    = m_stream_dropped;
+    p_stats->level      = stream_level();
+    p_stats->high_water = m_stream_high_water;
+}
+
+/*
+ * seg timer is stopped first. a burst in flight completes on its own within
+ * WAVEFORM_WORDS_PER_SEG * WAVEFORM_WORD_US. then the park word is sent
+ * alone to bring all outputs back to VMID, wherever the cycle was stopped.
+ */
+void howland_stim_stop(void)
+{
+    waveform_t const * p_wave = &m_wave[m_wave_active];
+
+    if (!m_stim_started)
+    {
+        stream_flush();
+        return;
+    }
+
+    nrf_drv_timer_disable(&m_seg_timer);
+    m_wave_pending = false;
+    m_stim_started = false;
+
+    vTaskDelay(1);
+
+    stream_flush();
+
+    nrf_drv_timer_clear(&m_seg_counter);
+    for (uint8_t i = 1; i < WAVEFORM_MAX_SEGS; i++)
+    {
+        nrf_drv_timer_compare(&m_seg_counter, (nrf_timer_cc_channel_t)i, STIM_CC_UNUSED, false);
+    }
+    nrf_drv_timer_compare(&m_seg_counter, NRF_TIMER_CC_CHANNEL0, 1, false);
+
+    stim_spi_xfer(waveform_park_offset(p_wave));
+    nrf_drv_timer_resume(&m_spi_timer);
+}
+
+void howland_stim_status_get(howland_stim_status_t * p_status)
+{
+    p_status->running   = m_stim_started;
+    p_status->cycles    = m_stim_prepared ? nrf_drv_timer_capture(&m_cyc_counter, NRF_TIMER_CC_CHANNEL0) : 0;
+    p_status->swaps     = m_wave_swaps;
+    p_status->pending   = m_wave_pending;
+}
+
+/**
+ * Howland
+ */
+static void message_handle(ble_incomming_frame_t const * p_frame)
+{
+    ret_code_t err;
+    ble_incomming_message_t msg = { 0 };
+    uint16_t msg_length = sizeof(m_msg);
+
+    memcpy(&msg, p_frame->data, MIN(p_frame->length, sizeof(msg)));
+
+    switch (msg.c)
+    {
+        case 0: // READ
+            NRF_LOG_INFO("read from app");
+            ble_nus_send((uint8_t *)&m_msg, &msg_length);
+            break;
+        case 1: // STOP
+            howland_stim_stop();
+            m_msg.c = 0;
+            ble_nus_send((uint8_t *)&m_msg, &msg_length);
+            break;
+        case 2: // START, or update if started
+            err = howland_stim_start(&msg);
+            if (err == NRF_SUCCESS)
+            {
+                m_msg = msg;
+            }
+            else
+            {
+                NRF_LOG_INFO("start rejected, err %d", err);
+            }
+            ble_nus_send((uint8_t *)&m_msg, &msg_length);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * v2 replies, a notification is sent when the next record doesn't fit in mtu
+ */
+static uint8_t m_reply[PROTO_MAX_FRAME_LEN];
+
+static void reply_flush(proto_writer_t * p_writer)
+{
+    if (!proto_writer_empty(p_writer))
+    {
+        ble_nus_send(p_writer->p_buf, &p_writer->length);
+        proto_writer_init(p_writer, m_reply, ble_nus_max_len(), p_writer->p_buf[1]);
+    }
+}
+
+static bool reply_fits(proto_writer_t const * p_writer, uint8_t length)
+{
+    return p_writer->length + PROTO_RECORD_HEADER_LEN + length <= p_writer->size;
+}
+
+static void reply_ack(proto_writer_t * p_writer, uint8_t type, ret_code_t result)
+{
+    proto_ack_t ack = { .type = type, .result = (uint8_t)result };
+
+    if (!reply_fits(p_writer, PROTO_ACK_LEN))
+    {
+        reply_flush(p_writer);
+    }
+    APP_ERROR_CHECK(proto_put_ack(p_writer, &ack));
+}
+
+/*
+ * make room for a reply record of length to request type. if it can't fit
+ * even in an empty frame (mtu not exchanged yet), type is acked with
+ * NRF_ERROR_DATA_SIZE instead and false is returned.
+ */
+static bool reply_reserve(proto_writer_t * p_writer, uint8_t type, uint8_t length)
+{
+    if (!reply_fits(p_writer, length))
+    {
+        reply_flush(p_writer);
+    }
+
+    if (!reply_fits(p_writer, length))
+    {
+        reply_ack(p_writer, type, NRF_ERROR_DATA_SIZE);
+        return false;
+    }
+
+    return true;
+}
+
+static void reply_state(proto_writer_t * p_writer)
+{
+    proto_state_t state;
+
+    state.running               = m_stim_started;
+    state.start.freq            = m_msg.freq;
+    state.start.pulse_width     = m_msg.pulse_width;
+    state.start.recycle_ratio   = (uint8_t)m_msg.recycle_ratio;
+    memcpy(state.start.current, m_msg.current, PROTO_NUM_OF_CHANNELS);
+
+    if (reply_reserve(p_writer, PROTO_REQ_READ, PROTO_STATE_LEN))
+    {
+        APP_ERROR_CHECK(proto_put_state(p_writer, &state));
+    }
+}
+
+static void reply_status(proto_writer_t * p_writer)
+{
+    howland_stim_status_t status;
+    howland_rx_stats_t rx;
+    proto_status_t s;
+
+    howland_stim_status_get(&status);
+    howland_rx_stats_get(&rx);
+    s.running       = status.running;
+    s.pending       = status.pending;
+    s.cycles        = status.cycles;
+    s.swaps         = status.swaps;
+    s.rx_dropped    = rx.dropped;
+    s.rx_high_water = rx.high_water;
+
+    if (reply_reserve(p_writer, PROTO_REQ_STATUS, PROTO_STATUS_LEN))
+    {
+        APP_ERROR_CHECK(proto_put_status(p_writer, &s));
+    }
+}
+
+static void reply_stream_stats(proto_writer_t * p_writer)
+{
+    proto_stream_stats_t stats;
+
+    howland_stream_stats_get(&stats);
+
+    if (reply_reserve(p_writer, PROTO_REQ_STREAM_STATS, PROTO_STREAM_STATS_LEN))
+    {
+        APP_ERROR_CHECK(proto_put_stream_stats(p_writer, &stats));
+    }
+}
+
+static void reply_timing_stats(proto_writer_t * p_writer)
+{
+    proto_timing_stats_t stats;
+
+    howland_timing_stats_get(&stats);
+    howland_timing_dump();
+
+    if (reply_reserve(p_writer, PROTO_REQ_TIMING_STATS, PROTO_TIMING_STATS_LEN))
+    {
+        APP_ERROR_CHECK(proto_put_timing_stats(p_writer, &stats));
+    }
+}
+
+static void reply_comp_stats(proto_writer_t * p_writer)
+{
+    proto_comp_stats_t stats;
+
+    howland_comp_stats_get(&stats);
+
+    if (reply_reserve(p_writer, PROTO_REQ_COMP_STATS, PROTO_COMP_STATS_LEN))
+    {
+        APP_ERROR_CHECK(proto_put_comp_stats(p_writer, &stats));
+    }
+}
+
+static void reply_log_stats(proto_writer_t * p_writer)
+{
+    proto_log_stats_t stats;
+
+    log_stats_get(&stats);
+
+    if (reply_reserve(p_writer, PROTO_REQ_LOG_STATS, PROTO_LOG_STATS_LEN))
+    {
+        APP_ERROR_CHECK(proto_put_log_stats(p_writer, &stats));
+    }
+}
+
+static void reply_nus_stats(proto_writer_t * p_writer)
+{
+    proto_nus_stats_t stats;
+
+    nus_stats_get(&stats);
+
+    if (reply_reserve(p_writer, PROTO_REQ_NUS_STATS, PROTO_NUS_STATS_LEN))
+    {
+        APP_ERROR_CHECK(proto_put_nus_stats(p_writer, &stats));
+    }
+}
+
+static void reply_link_stats(proto_writer_t * p_writer)
+{
+    proto_link_stats_t stats;
+
+    conn_policy_stats_get(&stats);
+
+    if (reply_reserve(p_writer, PROTO_REQ_LINK_STATS, PROTO_LINK_STATS_LEN))
+    {
+        APP_ERROR_CHECK(proto_put_link_stats(p_writer, &stats));
+    }
+}
+
+static void record_handle(proto_writer_t * p_writer, proto_record_t const * p_record)
+{
+    ret_code_t err;
+    proto_start_t start;
+    proto_wave_t wave;
+    proto_sample_t const * p_samples;
+    uint8_t num_of_samples;
+    uint16_t rate;
+
+    switch (p_record->type)
+    {
+        case PROTO_REQ_READ:
+            reply_state(p_writer);
+            break;
+        case PROTO_REQ_STOP:
+            howland_stim_stop();
+            m_msg.c = 0;
+            reply_ack(p_writer, p_record->type, NRF_SUCCESS);
+            break;
+        case PROTO_REQ_START:
+            err = proto_get_start(p_record, &start);
+            if (err == NRF_SUCCESS)
+            {
+                ble_incomming_message_t msg = {
+                    .c              = 2,
+                    .freq           = start.freq,
+                    .num_of_pulses  = 1,
+                    .pulse_width    = start.pulse_width,
+                    .recycle_ratio  = start.recycle_ratio,
+                };
+                memcpy(msg.current, start.current, sizeof(msg.current));
+
+                err = howland_stim_start(&msg);
+                if (err == NRF_SUCCESS)
+                {
+                    m_msg = msg;
+                }
+            }
+            reply_ack(p_writer, p_record->type, err);
+            break;
+        case PROTO_REQ_WAVE:
+            err = proto_get_wave(p_record, &wave);
+            if (err == NRF_SUCCESS)
+            {
+                err = howland_stim_wave(&wave);
+            }
+            reply_ack(p_writer, p_record->type, err);
+            break;
+        case PROTO_REQ_STATUS:
+            reply_status(p_writer);
+            break;
+        case PROTO_REQ_STREAM_START:
+            err = proto_get_stream_start(p_record, &rate);
+            if (err == NRF_SUCCESS)
+            {
+                err = howland_stream_start(rate);
+            }
+            reply_ack(p_writer, p_record->type, err);
+            break;
+        case PROTO_REQ_STREAM_DATA:
+            err = proto_get_stream_data(p_record, &p_samples, &num_of_samples);
+            if (err == NRF_SUCCESS)
+            {
+                err = howland_stream_push(p_samples, num_of_samples);
+            }
+            reply_ack(p_writer, p_record->type, err);
+            break;
+        case PROTO_REQ_STREAM_STATS:
+            reply_stream_stats(p_writer);
+            break;
+        case PROTO_REQ_TIMING_STATS:
+            reply_timing_stats(p_writer);
+            break;
+        case PROTO_REQ_COMP_STATS:
+            reply_comp_stats(p_writer);
+            break;
+        case PROTO_REQ_LOG_STATS:
+            reply_log_stats(p_writer);
+            break;
+        case PROTO_REQ_NUS_STATS:
+            reply_nus_stats(p_writer);
+            break;
+        case PROTO_REQ_LINK_STATS:
+            reply_link_stats(p_writer);
+            break;
+        default:
+            reply_ack(p_writer, p_record->type, NRF_ERROR_NOT_SUPPORTED);
+            break;
+    }
+}
+
+static void frame_handle(ble_incomming_frame_t const * p_frame)
+{
+    ret_code_t err;
+    proto_reader_t reader;
+    proto_record_t record;
+    proto_writer_t writer;
+
+    proto_writer_init(&writer, m_reply, ble_nus_max_len(), p_frame->data[1]);
+
+    err = proto_reader_init(&reader, p_frame->data, p_frame->length);
+    if (err != NRF_SUCCESS)
+    {
+        NRF_LOG_INFO("frame %d rejected, err %d", p_frame->data[1], err);
+        reply_ack(&writer, PROTO_REQ_NONE, err);
+    }
+    else
+    {
+        while (proto_next(&reader, &record) == NRF_SUCCESS)
+        {
+            record_handle(&writer, &record);
+        }
+    }
+
+    reply_flush(&writer);
+}
+
+/*
+ * tell app each frame not taken, so it can resend. seqs are taken from the
+ * one after the last acked, so for an app numbering its frames in order
+ * acks go out in drop order, also across the wrap from 255 to 0.
+ */
+static void drop_handle(void)
+{
+    uint32_t seqs[ARRAY_SIZE(m_rx_drop_seqs)];
+    proto_writer_t writer;
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(m_rx_drop_seqs); i++)
+    {
+        seqs[i] = nrf_atomic_u32_fetch_store(&m_rx_drop_seqs[i], 0);
+    }
+
+    for (uint32_t n = 0, first = m_rx_drop_next; n < 256; n++)
+    {
+        uint8_t seq = (uint8_t)(first + n);
+
+        if (!(seqs[seq / 32] & (1UL << (seq % 32)))) continue;
+
+        proto_writer_init(&writer, m_reply, ble_nus_max_len(), seq);
+        reply_ack(&writer, PROTO_REQ_NONE, NRF_ERROR_BUSY);
+        reply_flush(&writer);
+        m_rx_drop_next = (uint8_t)(seq + 1);
+    }
+}
+
+static void howland_task(void * pvParameters)
+{
+    uint32_t events;
+    nrf_atfifo_item_get_t context;
+    ble_incomming_frame_t * p_frame;
+
+    for (;;)
+    {
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+
+        if (events & HOWLAND_EVT_DROP)
+        {
+            drop_handle();
+        }
+
+        if (events & HOWLAND_EVT_IDT)
+        {
+            comp_step();
+        }
+
+        while ((p_frame = nrf_atfifo_item_get(m_rx_fifo, &context)) != NULL)
+        {
+            if (proto_is_frame(p_frame->data, p_frame->length))
+            {
+                frame_handle(p_frame);
+            }
+            else
+            {
+                message_handle(p_frame);
+            }
+
+            (void)nrf_atfifo_item_free(m_rx_fifo, &context);
+            m_rx_handled++;
+        }
+    }
+}
+
+
+void howland_freertos_init(void)
+{
+    BaseType_t xReturned;
+    ret_code_t err;
+
+    incomming_queue_init();
+
+    err = idt_init(comp_refresh_handler);
+    APP_ERROR_CHECK(err);
+
+    xReturned = xTaskCreate(howland_task,
+                            "howl",
+                            1024,   // stack size in word
+                            NULL,
+                            1,      // priority
+                            &m_thread);
+
+    if (xReturned != pdPASS)
+    {
+        NRF_LOG_INFO("no mem for howland task.");
+    }
+    else
+    {
+        NRF_LOG_INFO("howland task ready.");
+    }
+}
+
+ret_code_t ble_nus_recv(uint8_t const * p_data, uint16_t length)
+{
+    nrf_atfifo_item_put_t context;
+    ble_incomming_frame_t * p_frame;
+    uint32_t waiting;
+
+    if (p_data == NULL) return NRF_ERROR_NULL;
+    if (length > PROTO_MAX_FRAME_LEN) return NRF_ERROR_INVALID_LENGTH;
+
+    p_frame = nrf_atfifo_item_alloc(m_rx_fifo, &context);
+    if (p_frame == NULL)
+    {
+        m_rx_dropped++;
+        if (proto_is_frame(p_data, length))
+        {
+            (void)nrf_atomic_u32_or(&m_rx_drop_seqs[p_data[1] / 32], 1UL << (p_data[1] % 32));
+            howland_notify(HOWLAND_EVT_DROP);
+        }
+        return NRF_ERROR_NO_MEM;
+    }
+
+    memcpy(p_frame->data, p_data, length);
+    p_frame->length = length;
+    (void)nrf_atfifo_item_put(m_rx_fifo, &context);
+
+    m_rx_received++;
+    waiting = m_rx_received - m_rx_handled;
+    if (waiting > m_rx_high_water)
+    {
+        m_rx_high_water = (uint8_t)waiting;
+    }
+
+    howland_notify(HOWLAND_EVT_RX);
+
+    return NRF_SUCCESS;
+}
+
+void howland_rx_stats_get(howland_rx_stats_t * p_stats)
+{
+    p_stats->received   = m_rx_received;
+    p_stats->handled    = m_rx_handled;
+    p_stats->dropped    = m_rx_dropped;
+    p_stats->high_water = m_rx_high_water;
 }
@@ -6,6 +6,9 @@
 #include "app_util.h"
 #include "nrf_drv_spi.h"
 #include "nrf_drv_timer.h"
+#include "sdk_errors.h"
+
+#include "protocol.h"
 
 #define NOT_INSIDE_ISR          (( SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk ) == 0 )
 #define INSIDE_ISR              (!(NOT_INSIDE_ISR))
@@ -28,6 +31,24 @@
 #define DAC_SPI_CK_PIN                      0
 #define DAC_SPI_SI_PIN                      6
 
+/**
+ * Stimulation safety limits, checked on compiled waveform before it is played.
+ * amplitude in dac code from VMID, imbalance in dac code x us per cycle.
+ * STIM_AUTO_BALANCE lets the recycle phase (or pulse amplitude) be adjusted
+ * to balance charge, instead of rejecting the waveform.
+ */
+#define STIM_MAX_AMPLITUDE                  127
+#define STIM_MAX_IMBALANCE                  0
+#define STIM_AUTO_BALANCE                   true
+
+/**
+ * Streaming, samples waiting for playback. 256 is 256ms at 1kHz.
+ * net charge a stream may build up on any channel, dac code x samples,
+ * counted from stream start (held samples included) till stop.
+ */
+#define STREAM_RING_DEPTH                   256
+#define STREAM_MAX_CHARGE                   (STIM_MAX_AMPLITUDE * 16)
+
 #define IDT_TWI_INSTANCE                    0
 #define IDT_TWI_MAX_PENDING_TRANSACTIONS    5
 
@@ -37,6 +58,8 @@
 #define IDT_INT_PIN                         16
 #define IDT_PDETB_PIN                       15
 
+#define IDT_INT_ENABLE_MASK                 0xFFFF  // all sources pull INT, each one starts a telemetry refresh
+
 #define IDT_REG_CHIP_ID_L                   0x00
 #define IDT_REG_CHIP_ID_H                   0x01
 #define IDT_REG_CHIP_REV                    0x02
@@ -78,6 +101,40 @@
 
 #define IDT_REG_VRECT_MIN_CORRECT           0x96 // 16bit
 
+/**
+ * Compliance compensation, off the idt telemetry cache. the pump needs
+ * COMP_VOUT_FULL_MV to drive STIM_MAX_AMPLITUDE, COMP_VOUT_MIN_MV to drive
+ * nothing, linear in between. below that vout is raised (VOUT_SET) while
+ * vrect has headroom, else the amplitude of the playing table is scaled
+ * down until vout recovers. VOUT_SET codes are part specific, check the
+ * datasheet of the receiver fitted.
+ */
+#define COMP_REFRESH_CYCLES                 1       // telemetry refresh every n cycles
+#define COMP_VOUT_MIN_MV                    3000
+#define COMP_VOUT_FULL_MV                   5000
+#define COMP_VOUT_HYST_MV                   200     // above need before VOUT_SET is stepped back
+#define COMP_DROPOUT_MV                     300     // vrect over vout needed to raise vout
+#define COMP_VOUT_SET_MAX                   0x1E
+#define COMP_SCALE_HYST                     16      // in 1/WAVEFORM_SCALE_ONE, before scale is raised
+
+/**
+ * Link policy (conn_policy.c). BULK connection parameters while data is
+ * waiting to go either way, IDLE ones after CONN_POLICY_IDLE_MS without.
+ * intervals in 1.25ms units. both sets stay inside what iOS centrals take
+ * (min interval 15ms, interval x (latency + 1) up to 2s), a central that
+ * still refuses them keeps the link on what it picked.
+ */
+#define CONN_POLICY_PERIOD_MS               500     // traffic sampled, profile decided
+#define CONN_POLICY_IDLE_MS                 3000    // quiet time before IDLE
+#define CONN_POLICY_BULK_RATE               1000    // bytes/s either way that count as bulk
+#define CONN_POLICY_BULK_QUEUED             2       // notifications waiting that count as bulk
+#define CONN_POLICY_BULK_MIN_INTERVAL       MSEC_TO_UNITS(15, UNIT_1_25_MS)
+#define CONN_POLICY_BULK_MAX_INTERVAL       MSEC_TO_UNITS(30, UNIT_1_25_MS)
+#define CONN_POLICY_IDLE_MIN_INTERVAL       MSEC_TO_UNITS(100, UNIT_1_25_MS)
+#define CONN_POLICY_IDLE_MAX_INTERVAL       MSEC_TO_UNITS(200, UNIT_1_25_MS)
+#define CONN_POLICY_IDLE_LATENCY            4
+#define CONN_POLICY_SUP_TIMEOUT             MSEC_TO_UNITS(4000, UNIT_10_MS)
+
 
 /**
  * 1. timed mode stimulation, timeout non-zero, countdown non-zero, less than 0xf000
@@ -105,6 +162,16 @@ typedef struct /* __attribute__((packed)) */ ble_incoming_message
 
 STATIC_ASSERT(sizeof(ble_incomming_message_t) == 24);
 
+/**
+ * one gatt write as received, a v1 ble_incomming_message_t (1 or 24 bytes)
+ * or a v2 frame (see protocol.h)
+ */
+typedef struct ble_incomming_frame
+{
+    uint16_t length;
+    uint8_t data[PROTO_MAX_FRAME_LEN];
+} ble_incomming_frame_t;
+
 // nrf_drv_spi context
 typedef struct dac_spi_ctx {
     int value;
@@ -113,22 +180,100 @@ typedef struct dac_spi_ctx {
 
 void howland_freertos_init(void);
 
+typedef struct howland_stim_status
+{
+    bool        running;
+    bool        pending;    // an update waits for next cycle boundary
+    uint32_t    cycles;     // cycles delivered since start, counted by hardware
+    uint32_t    swaps;      // updates applied at cycle boundary
+} howland_stim_status_t;
+
+/**
+ * Stimulation API, called from howland task.
+ *
+ * howland_stim_start starts stimulation with p_msg, or if already started,
+ * applies p_msg from the next cycle on without stopping.
+ * howland_stim_wave does the same with a multi-segment description.
+ * returns error from waveform_compile or waveform_validate if p_msg is rejected,
+ * nothing is changed then.
+ * howland_stim_stop stops at once and brings all outputs to VMID.
+ */
+ret_code_t howland_stim_start(ble_incomming_message_t const * p_msg);
+ret_code_t howland_stim_wave(proto_wave_t const * p_wave);
+void howland_stim_stop(void);
+void howland_stim_status_get(howland_stim_status_t * p_status);
+
 /**
- * This is a wrapper for ble_nus_data_send
+ * Streaming API, called from howland task.
+ *
+ * howland_stream_start starts stimulation in streaming mode, one sample per
+ * cycle at rate Hz, or switches to it at the next cycle boundary. samples
+ * queued before are played first, so the ring can be primed.
+ * howland_stream_push queues samples, all or none are checked against
+ * STIM_MAX_AMPLITUDE and STREAM_MAX_CHARGE (NRF_ERROR_INVALID_DATA). returns
+ * NRF_ERROR_NO_MEM if the ring is full, samples not taken are counted as
+ * dropped. on underrun the last sample is held, unless that takes charge
+ * past STREAM_MAX_CHARGE, outputs go to VMID then. howland_stim_stop
+ * flushes the ring and clears the charge count.
+ */
+ret_code_t howland_stream_start(uint16_t rate);
+ret_code_t howland_stream_push(proto_sample_t const * p_samples, uint8_t num_of_samples);
+void howland_stream_stats_get(proto_stream_stats_t * p_stats);
+
+/**
+ * Stimulation chain timing, measured every cycle since start.
+ * howland_timing_dump logs the raw captures of the last cycles.
+ */
+void howland_timing_stats_get(proto_timing_stats_t * p_stats);
+void howland_timing_dump(void);
+
+/**
+ * Compliance compensation state and counters, see COMP_VOUT_MIN_MV.
+ */
+void howland_comp_stats_get(proto_comp_stats_t * p_stats);
+
+/**
+ * This is a wrapper for ble_nus_data_queue
  * main.c should implement this function and 
- * howland uses it to reply
+ * howland uses it to reply. It blocks while the notification queue is full,
+ * call it from a task other than the softdevice one.
  */
 void ble_nus_send(uint8_t * p_data, uint16_t * p_length);
 
 /**
- * These functions are wrappers for message dequeue/enqueue,
- * implemented in howland.c
- * used in main (TODO what is the context?)
- */ 
-ble_incomming_message_t * ble_nus_alloc(void);
-ble_incomming_message_t * ble_nus_alloc_from_isr(void);
-void ble_nus_recv(ble_incomming_message_t * p_message);
-void ble_nus_recv_from_isr(ble_incomming_message_t * p_message);
+ * max length ble_nus_send takes with current mtu, also implemented in main.c
+ */
+uint16_t ble_nus_max_len(void);
+
+/**
+ * deferred logger counters, implemented in main.c (zeros if logging is off)
+ */
+void log_stats_get(proto_log_stats_t * p_stats);
+
+/**
+ * notification queue counters of the current link, implemented in main.c
+ * (zeros if not connected)
+ */
+void nus_stats_get(proto_nus_stats_t * p_stats);
+
+/**
+ * Queue a received gatt write for howland task, implemented in howland.c.
+ * p_data is copied into the rx ring, it can be called from task or isr,
+ * one producer only (nus_data_handler).
+ * returns NRF_ERROR_NO_MEM if the ring is full, the frame is dropped and
+ * counted, a v2 frame is answered with a busy ack.
+ */
+ret_code_t ble_nus_recv(uint8_t const * p_data, uint16_t length);
+
+typedef struct howland_rx_stats
+{
+    uint32_t    received;   // frames queued
+    uint32_t    handled;    // frames done by howland task
+    uint32_t    dropped;    // frames dropped on full ring
+    uint8_t     high_water; // max frames waiting
+} howland_rx_stats_t;
+
+void howland_rx_stats_get(howland_rx_stats_t * p_stats);
 
 
 
@@ -0,0 +1,323 @@
+#include <string.h>
+
+#include "nrf_twi_mngr.h"
+#include "nrfx_gpiote.h"
+#include "nrf_gpio.h"
+#include "app_util_platform.h"
+
+#include "nrf_log.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "howland.h"
+#include "idt.h"
+
+NRF_TWI_MNGR_DEF(m_nrf_twi_mngr, IDT_TWI_MAX_PENDING_TRANSACTIONS, IDT_TWI_INSTANCE);
+
+#define IDT_REG_ADDR(reg)                   (uint8_t)((reg) >> 8), (uint8_t)(reg)
+
+// offsets in block
+#define IDT_OFS(reg)                        ((reg) - IDT_BLOCK_FIRST)
+
+/*
+ * transfer buffers, twim dma reads them from ram
+ */
+static uint8_t m_block_addr[2]              = { IDT_REG_ADDR(IDT_BLOCK_FIRST) };
+static uint8_t m_block[IDT_BLOCK_LEN];
+static uint8_t m_int_enable[4]              = { IDT_REG_ADDR(IDT_REG_INT_ENABLE_L),
+                                                (uint8_t)(IDT_INT_ENABLE_MASK), (uint8_t)(IDT_INT_ENABLE_MASK >> 8) };
+static uint8_t m_int_clear[4]               = { IDT_REG_ADDR(IDT_REG_INT_CLEAR_L), 0, 0 };
+static uint8_t m_command[3]                 = { IDT_REG_ADDR(IDT_REG_COMMAND), IDT_CMD_CLEAR_INT };
+static uint8_t m_vout_set[3]                = { IDT_REG_ADDR(IDT_REG_VOUT_SET), 0 };
+
+/*
+ * INT_ENABLE write is only put in front while m_int_enabled is false
+ */
+static nrf_twi_mngr_transfer_t const m_read_xfers[] = {
+    NRF_TWI_MNGR_WRITE(IDT_I2C_ADDR, m_int_enable, sizeof(m_int_enable), 0),
+    NRF_TWI_MNGR_WRITE(IDT_I2C_ADDR, m_block_addr, sizeof(m_block_addr), NRF_TWI_MNGR_NO_STOP),
+    NRF_TWI_MNGR_READ (IDT_I2C_ADDR, m_block, sizeof(m_block), 0),
+};
+
+static nrf_twi_mngr_transfer_t const m_clear_xfers[] = {
+    NRF_TWI_MNGR_WRITE(IDT_I2C_ADDR, m_int_clear, sizeof(m_int_clear), 0),
+    NRF_TWI_MNGR_WRITE(IDT_I2C_ADDR, m_command, sizeof(m_command), 0),
+};
+
+static nrf_twi_mngr_transfer_t const m_vout_xfers[] = {
+    NRF_TWI_MNGR_WRITE(IDT_I2C_ADDR, m_vout_set, sizeof(m_vout_set), 0),
+};
+
+static void read_done(ret_code_t result, void * p_user_data);
+static void clear_done(ret_code_t result, void * p_user_data);
+static void vout_done(ret_code_t result, void * p_user_data);
+
+static nrf_twi_mngr_transaction_t m_read_transaction = {
+    .callback               = read_done,
+    .p_user_data            = NULL,
+    .p_required_twi_cfg     = NULL,
+};
+
+static nrf_twi_mngr_transaction_t const m_clear_transaction = {
+    .callback               = clear_done,
+    .p_user_data            = NULL,
+    .p_transfers            = m_clear_xfers,
+    .number_of_transfers    = ARRAY_SIZE(m_clear_xfers),
+    .p_required_twi_cfg     = NULL,
+};
+
+static nrf_twi_mngr_transaction_t const m_vout_transaction = {
+    .callback               = vout_done,
+    .p_user_data            = NULL,
+    .p_transfers            = m_vout_xfers,
+    .number_of_transfers    = ARRAY_SIZE(m_vout_xfers),
+    .p_required_twi_cfg     = NULL,
+};
+
+static idt_refresh_handler_t m_handler      = NULL;
+static idt_telemetry_t m_cache              = { 0 };
+static idt_stats_t m_stats                  = { 0 };
+
+static volatile bool m_busy                 = false;    // a refresh is in flight
+static volatile bool m_again                = false;    // requested while in flight
+static bool m_int_enabled                   = false;
+static volatile bool m_vout_busy            = false;
+
+static uint16_t block_u16(uint8_t reg)
+{
+    return (uint16_t)(m_block[IDT_OFS(reg)] | (m_block[IDT_OFS(reg) + 1] << 8));
+}
+
+static ret_code_t read_start(void)
+{
+    ret_code_t err;
+
+    if (m_int_enabled)
+    {
+        m_read_transaction.p_transfers = &m_read_xfers[1];
+        m_read_transaction.number_of_transfers = ARRAY_SIZE(m_read_xfers) - 1;
+    }
+    else
+    {
+        m_read_transaction.p_transfers = m_read_xfers;
+        m_read_transaction.number_of_transfers = ARRAY_SIZE(m_read_xfers);
+    }
+
+    err = nrf_twi_mngr_schedule(&m_nrf_twi_mngr, &m_read_transaction);
+    if (err != NRF_SUCCESS)
+    {
+        m_stats.errors++;
+        m_busy = false;
+    }
+
+    return err;
+}
+
+/*
+ * refresh is done, start the next one if asked for in the mean time
+ */
+static void refresh_end(void)
+{
+    bool again;
+
+    CRITICAL_REGION_ENTER();
+    again = m_again;
+    m_again = false;
+    m_busy = again;
+    CRITICAL_REGION_EXIT();
+
+    if (again)
+    {
+        (void)read_start();
+    }
+}
+
+static void cache_update(void)
+{
+    idt_telemetry_t t;
+
+    t.timestamp     = xTaskGetTickCountFromISR();
+    t.seq           = m_cache.seq + 1;
+    t.status        = block_u16(IDT_REG_STATUS_L);
+    t.int_flags     = block_u16(IDT_REG_INT_L);
+    t.vout_set      = m_block[IDT_OFS(IDT_REG_VOUT_SET)];
+    t.ilim_set      = m_block[IDT_OFS(IDT_REG_ILIM_SET)];
+    t.chg_status    = m_block[IDT_OFS(IDT_REG_CHG_STATUS)];
+    t.ept           = m_block[IDT_OFS(IDT_REG_EPT)];
+    t.vrect         = block_u16(IDT_REG_ADC_VRECT_L);
+    t.vout          = block_u16(IDT_REG_ADC_VOUT_L);
+
+    CRITICAL_REGION_ENTER();
+    m_cache = t;
+    CRITICAL_REGION_EXIT();
+}
+
+// twi irq
+static void read_done(ret_code_t result, void * p_user_data)
+{
+    uint16_t flags;
+
+    if (result != NRF_SUCCESS)
+    {
+        m_stats.errors++;
+        m_int_enabled = false;
+        refresh_end();
+        return;
+    }
+
+    m_int_enabled = true;
+    m_stats.refreshes++;
+    cache_update();
+
+    if (m_handler != NULL)
+    {
+        m_handler();
+    }
+
+    flags = block_u16(IDT_REG_INT_L);
+    if (flags != 0)
+    {
+        m_int_clear[2] = (uint8_t)flags;
+        m_int_clear[3] = (uint8_t)(flags >> 8);
+
+        if (nrf_twi_mngr_schedule(&m_nrf_twi_mngr, &m_clear_transaction) == NRF_SUCCESS)
+        {
+            return;
+        }
+        m_stats.errors++;
+    }
+
+    refresh_end();
+}
+
+/*
+ * twi irq
+ * INT is edge sensed, a flag raised after the read keeps it low through the
+ * clear with no new edge, it is read again here instead.
+ */
+static void clear_done(ret_code_t result, void * p_user_data)
+{
+    if (result != NRF_SUCCESS)
+    {
+        m_stats.errors++;
+        m_int_enabled = false;
+    }
+    else if (nrf_gpio_pin_read(IDT_INT_PIN) == 0)
+    {
+        CRITICAL_REGION_ENTER();
+        m_again = true;
+        CRITICAL_REGION_EXIT();
+    }
+
+    refresh_end();
+}
+
+// twi irq
+static void vout_done(ret_code_t result, void * p_user_data)
+{
+    if (result != NRF_SUCCESS)
+    {
+        m_stats.errors++;
+    }
+
+    m_vout_busy = false;
+}
+
+static void int_pin_handler(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action)
+{
+    m_stats.irqs++;
+    (void)idt_refresh();
+}
+
+ret_code_t idt_refresh(void)
+{
+    bool start = false;
+
+    CRITICAL_REGION_ENTER();
+    if (m_busy)
+    {
+        m_again = true;
+        m_stats.coalesced++;
+    }
+    else
+    {
+        m_busy = true;
+        start = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return start ? read_start() : NRF_SUCCESS;
+}
+
+ret_code_t idt_vout_set(uint8_t code)
+{
+    ret_code_t err;
+
+    if (m_vout_busy)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    m_vout_busy = true;
+    m_vout_set[2] = code;
+
+    err = nrf_twi_mngr_schedule(&m_nrf_twi_mngr, &m_vout_transaction);
+    if (err != NRF_SUCCESS)
+    {
+        m_vout_busy = false;
+    }
+
+    return err;
+}
+
+void idt_telemetry_get(idt_telemetry_t * p_telemetry)
+{
+    CRITICAL_REGION_ENTER();
+    *p_telemetry = m_cache;
+    CRITICAL_REGION_EXIT();
+}
+
+void idt_stats_get(idt_stats_t * p_stats)
+{
+    CRITICAL_REGION_ENTER();
+    *p_stats = m_stats;
+    CRITICAL_REGION_EXIT();
+}
+
+ret_code_t idt_init(idt_refresh_handler_t handler)
+{
+    ret_code_t err;
+
+    nrf_drv_twi_config_t const config = {
+        .scl                = IDT_SCL_PIN,
+        .sda                = IDT_SDA_PIN,
+        .frequency          = NRF_DRV_TWI_FREQ_400K,
+        .interrupt_priority = APP_IRQ_PRIORITY_LOWEST,
+        .clear_bus_init     = false
+    };
+
+    // INT is open drain, active low
+    nrfx_gpiote_in_config_t int_config = NRFX_GPIOTE_CONFIG_IN_SENSE_HITOLO(false);
+    int_config.pull = NRF_GPIO_PIN_PULLUP;
+
+    m_handler = handler;
+
+    err = nrf_twi_mngr_init(&m_nrf_twi_mngr, &config);
+    if (err != NRF_SUCCESS) return err;
+
+    if (!nrfx_gpiote_is_init())
+    {
+        err = nrfx_gpiote_init();
+        if (err != NRF_SUCCESS) return err;
+    }
+
+    err = nrfx_gpiote_in_init(IDT_INT_PIN, &int_config, int_pin_handler);
+    if (err != NRF_SUCCESS) return err;
+
+    nrfx_gpiote_in_event_enable(IDT_INT_PIN, true);
+
+    NRF_LOG_INFO("idt telemetry ready.");
+
+    return idt_refresh();
+}
@@ -0,0 +1,90 @@
+#ifndef __IDT_H__
+#define __IDT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+#include "howland.h"
+
+/**
+ * IDT wireless power receiver telemetry
+ *
+ * The whole STATUS .. ADC_VOUT block (IDT_REG_STATUS_L - IDT_REG_ADC_VOUT_H)
+ * is read in one burst through nrf_twi_mngr_schedule and kept in a shadow
+ * cache, callers read the cache with no bus traffic. A refresh is started by
+ * a falling edge on IDT_INT_PIN (gpiote, no polling) or by idt_refresh.
+ * Interrupt flags seen in a refresh are cleared on the receiver right after,
+ * only those, so a flag raised in between is kept. INT stays low for it,
+ * there is no new edge, so IDT_INT_PIN is read after the clear and another
+ * refresh is run while it is low.
+ *
+ * The receiver is powered from the coil, it NACKs until a transmitter is
+ * in range. IDT_INT_ENABLE_MASK is (re)written by the first refresh after
+ * any bus error.
+ *
+ * registers are 16bit addressed (msb first), values little endian.
+ */
+#define IDT_BLOCK_FIRST                     IDT_REG_STATUS_L
+#define IDT_BLOCK_LEN                       (IDT_REG_ADC_VOUT_H - IDT_REG_STATUS_L + 1)
+
+#define IDT_CMD_CLEAR_INT                   0x20    // IDT_REG_COMMAND, clears flags written to INT_CLEAR
+
+// 12bit adc, full scale 2.1V behind 1/10 (vrect) and 1/6 (vout) dividers
+#define IDT_ADC_VRECT_MV(code)              ((uint16_t)(((uint32_t)(code) * 21000) / 4095))
+#define IDT_ADC_VOUT_MV(code)               ((uint16_t)(((uint32_t)(code) * 12600) / 4095))
+
+typedef struct idt_telemetry
+{
+    uint32_t    timestamp;                  // rtos tick of the refresh
+    uint32_t    seq;                        // refreshes so far, 0 if never read
+    uint16_t    status;                     // IDT_REG_STATUS
+    uint16_t    int_flags;                  // IDT_REG_INT at refresh
+    uint8_t     vout_set;
+    uint8_t     ilim_set;
+    uint8_t     chg_status;
+    uint8_t     ept;
+    uint16_t    vrect;                      // adc code
+    uint16_t    vout;                       // adc code
+} idt_telemetry_t;
+
+typedef struct idt_stats
+{
+    uint32_t    refreshes;                  // block reads done
+    uint32_t    errors;                     // transactions failed (NACK when unpowered)
+    uint32_t    irqs;                       // INT edges
+    uint32_t    coalesced;                  // refresh requests merged into one in flight
+} idt_stats_t;
+
+/**
+ * called in twi irq after each refresh, may be NULL
+ */
+typedef void (*idt_refresh_handler_t)(void);
+
+/**
+ * init twi manager and the INT pin, and start the first refresh.
+ * gpiote is initialized if it is not yet.
+ */
+ret_code_t idt_init(idt_refresh_handler_t handler);
+
+/**
+ * start a refresh, from task or isr. if one is in flight, another one is
+ * done after it (requests in between are merged).
+ * returns error from nrf_twi_mngr_schedule.
+ */
+ret_code_t idt_refresh(void);
+
+/**
+ * write IDT_REG_VOUT_SET, from task. returns NRF_ERROR_BUSY while the last
+ * write is in flight. the new value shows in the cache after next refresh.
+ */
+ret_code_t idt_vout_set(uint8_t code);
+
+/**
+ * copy of the cache, no bus traffic
+ */
+void idt_telemetry_get(idt_telemetry_t * p_telemetry);
+
+void idt_stats_get(idt_stats_t * p_stats);
+
+#endif
@@ -91,6 +91,7 @@
 #include "semphr.h"
 
 #include "howland.h"
+#include "conn_policy.h"
 
 // APP_TIMER_V2, APP_TIMER_V2_RTC1_ENABLED removed from preprocessor
 
@@ -120,15 +121,26 @@
 
 #define NRF_SDH_BLE_GATT_MAX_MTU_SIZE   247
 
+#define LOGGER_FLUSH_BUDGET_MS          2                                           /**< Time a flush batch may take before the logger yields to tasks of its priority. */
+#define LOGGER_FLUSH_BATCH              16                                          /**< Entries processed in one flush batch at most. */
+
+#define NUS_TX_WAIT_MS                  250                                         /**< Time ble_nus_send waits for room in the notification queue before the reply is dropped. */
+
 BLE_NUS_DEF(m_nus, NRF_SDH_BLE_TOTAL_LINK_COUNT);                                   /**< BLE NUS service instance. */
 NRF_BLE_GATT_DEF(m_gatt);                                                           /**< GATT module instance. */
 NRF_BLE_QWR_DEF(m_qwr);                                                             /**< Context for the Queued Write module.*/
 BLE_ADVERTISING_DEF(m_advertising);                                                 /**< Advertising module instance. */
 
 #if NRF_LOG_ENABLED
-static TaskHandle_t m_logger_thread;                                /**< Definition of Logger thread. */
+static TaskHandle_t m_logger_thread = NULL;                         /**< Definition of Logger thread. */
+static uint32_t     m_logger_batches;                               /**< Flush batches run. */
+static uint32_t     m_logger_overruns;                              /**< Batches ended by LOGGER_FLUSH_BUDGET_MS or LOGGER_FLUSH_BATCH with entries left. */
 #endif
 
+static SemaphoreHandle_t m_nus_tx_ready;                            /**< Given on BLE_NUS_EVT_TX_RDY, ble_nus_send waits on it while the notification queue is full. */
+static TickType_t        m_nus_stats_tick;                          /**< Tick of the last nus_stats_get call, for the throughput. */
+static uint32_t          m_nus_stats_bytes;                         /**< Bytes sent at the last nus_stats_get call. */
+
 static uint16_t   m_conn_handle          = BLE_CONN_HANDLE_INVALID;                 /**< Handle of the current connection. */
 static uint16_t   m_ble_nus_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;            /**< Maximum length of data (in bytes) that can be transmitted to the peer by the Nordic UART service module. */
 static ble_uuid_t m_adv_uuids[]          =                                          /**< Universally unique service identifier. */
@@ -250,20 +262,17 @@ static void nus_data_handler(ble_nus_evt_t * p_evt)
         NRF_LOG_INFO("Received data from BLE NUS");
         NRF_LOG_HEXDUMP_INFO(p_data, length);
         
-        if (length != 1 && length != sizeof(ble_incomming_message_t)) return;
-        if (length == 1 && p_data[0] > 1) return;
-        if (length == sizeof(ble_incomming_message_t) && p_data[0] != 2) return;
-        
-        ble_incomming_message_t * p_msg = ble_nus_alloc();
-        if (p_msg) 
+        if (!proto_is_frame(p_data, length))
         {
-            memset(p_msg, 0, sizeof(*p_msg));
-            memcpy(p_msg, p_data, length);
-            ble_nus_recv(p_msg);
+            if (length != 1 && length != sizeof(ble_incomming_message_t)) return;
+            if (length == 1 && p_data[0] > 1) return;
+            if (length == sizeof(ble_incomming_message_t) && p_data[0] != 2) return;
         }
-        else
+        
+        err_code = ble_nus_recv(p_data, length);
+        if (err_code != NRF_SUCCESS)
         {
-            NRF_LOG_INFO("ble_nus_alloc failed");
+            NRF_LOG_INFO("ble_nus_recv failed, err %d", err_code);
         }
 
 //        for (uint32_t i = 0; i < p_evt->params.rx_data.length; i++)
@@ -283,6 +292,10 @@ static void nus_data_handler(ble_nus_evt_t * p_evt)
 //            while (app_uart_put('\n') == NRF_ERROR_BUSY);
 //        }
     }
+    else if (p_evt->type == BLE_NUS_EVT_TX_RDY)
+    {
+        UNUSED_RETURN_VALUE(xSemaphoreGive(m_nus_tx_ready));
+    }
 
 }
 /**@snippet [Handling the data received over BLE] */
@@ -309,6 +322,12 @@ static void services_init(void)
 
     err_code = ble_nus_init(&m_nus, &nus_init);
     APP_ERROR_CHECK(err_code);
+
+    m_nus_tx_ready = xSemaphoreCreateBinary();
+    if (m_nus_tx_ready == NULL)
+    {
+        APP_ERROR_HANDLER(NRF_ERROR_NO_MEM);
+    }
 }
 
 
@@ -317,21 +336,14 @@ static void services_init(void)
  * @details This function will be called for all events in the Connection Parameters Module
  *          which are passed to the application.
  *
- * @note All this function does is to disconnect. This could have been done by simply setting
- *       the disconnect_on_fail config parameter, but instead we use the event handler
- *       mechanism to demonstrate its use.
+ * @note The link policy changes the parameters asked for while connected. A central which
+ *       does not take them keeps the link on its own, the failure is only counted.
  *
  * @param[in] p_evt  Event received from the Connection Parameters Module.
  */
 static void on_conn_params_evt(ble_conn_params_evt_t * p_evt)
 {
-    uint32_t err_code;
-
-    if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
-    {
-        err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
-        APP_ERROR_CHECK(err_code);
-    }
+    conn_policy_on_conn_params_evt(p_evt);
 }
 
 
@@ -345,6 +357,25 @@ static void conn_params_error_handler(uint32_t nrf_error)
 }
 
 
+/**@brief Function for reading the notification queue of the current link for the link policy.
+ *
+ * @param[out] p_bytes   Bytes notified since connected.
+ * @param[out] p_queued  Notifications waiting.
+ */
+static void nus_tx_get(uint32_t * p_bytes, uint8_t * p_queued)
+{
+    ble_nus_tx_stats_t stats;
+
+    if (ble_nus_tx_stats_get(&m_nus, m_conn_handle, &stats) != NRF_SUCCESS)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    *p_bytes  = stats.bytes;
+    *p_queued = stats.queued;
+}
+
+
 /**@brief Function for initializing the Connection Parameters module.
  */
 static void conn_params_init(void)
@@ -365,6 +396,9 @@ static void conn_params_init(void)
 
     err_code = ble_conn_params_init(&cp_init);
     APP_ERROR_CHECK(err_code);
+
+    err_code = conn_policy_init(&m_gatt, nus_tx_get);
+    APP_ERROR_CHECK(err_code);
 }
 
 
@@ -432,6 +466,8 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
             err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
             APP_ERROR_CHECK(err_code);
+            m_nus_stats_tick  = xTaskGetTickCount();
+            m_nus_stats_bytes = 0;
             break;
 
         case BLE_GAP_EVT_DISCONNECTED:
@@ -514,6 +550,9 @@ static void ble_stack_init(void)
 /**@brief Function for handling events from the GATT library. */
 void gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt)
 {
+    ble_nus_on_gatt_evt(&m_nus, p_evt);
+    conn_policy_on_gatt_evt(p_evt);
+
     if ((m_conn_handle == p_evt->conn_handle) && (p_evt->evt_id == NRF_BLE_GATT_EVT_ATT_MTU_UPDATED))
     {
         m_ble_nus_max_data_len = p_evt->params.att_mtu_effective - OPCODE_LENGTH - HANDLE_LENGTH;
@@ -604,17 +643,14 @@ void uart_event_handle(app_uart_evt_t * p_event)
                     NRF_LOG_DEBUG("Ready to send data over BLE NUS");
                     NRF_LOG_HEXDUMP_DEBUG(data_array, index);
 
-                    do
+                    // Interrupt context: a full queue drops the line (counted in the NUS stats).
+                    err_code = ble_nus_data_queue(&m_nus, data_array, index, 0, m_conn_handle);
+                    if ((err_code != NRF_ERROR_INVALID_STATE) &&
+                        (err_code != NRF_ERROR_NO_MEM) &&
+                        (err_code != NRF_ERROR_NOT_FOUND))
                     {
-                        uint16_t length = (uint16_t)index;
-                        err_code = ble_nus_data_send(&m_nus, data_array, &length, m_conn_handle);
-                        if ((err_code != NRF_ERROR_INVALID_STATE) &&
-                            (err_code != NRF_ERROR_RESOURCES) &&
-                            (err_code != NRF_ERROR_NOT_FOUND))
-                        {
-                            APP_ERROR_CHECK(err_code);
-                        }
-                    } while (err_code == NRF_ERROR_RESOURCES);
+                        APP_ERROR_CHECK(err_code);
+                    }
                 }
 
                 index = 0;
@@ -822,10 +858,40 @@ static void clock_init(void)
 }
 
 #if NRF_LOG_ENABLED
+/**@brief Function for processing one batch of deferred log entries.
+ *
+ * @details A batch ends when the buffer is empty, after LOGGER_FLUSH_BATCH entries or
+ *          when LOGGER_FLUSH_BUDGET_MS has passed, whichever comes first.
+ *
+ * @return  true if entries are left in the buffer.
+ */
+static bool logger_batch(void)
+{
+    TickType_t start = xTaskGetTickCount();
+    uint32_t   count = 0;
+
+    m_logger_batches++;
+
+    while (NRF_LOG_PROCESS())
+    {
+        if (++count >= LOGGER_FLUSH_BATCH ||
+            (xTaskGetTickCount() - start) >= pdMS_TO_TICKS(LOGGER_FLUSH_BUDGET_MS))
+        {
+            m_logger_overruns++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /**@brief Thread for handling the logger.
  *
  * @details This thread is responsible for processing log entries if logs are deferred.
- *          Thread flushes all log entries and suspends. It is resumed by idle task hook.
+ *          Thread flushes log entries in batches and waits for a notification from
+ *          log_pending_hook. A notification given while flushing is kept, so none is lost.
+ *          Between batches the thread yields, so tasks of the same priority (howland task)
+ *          are not held off by a burst of logs, time slicing is off.
  *
  * @param[in]   arg   Pointer used for passing some arbitrary information (context) from the
  *                    osThreadCreate() call to the thread.
@@ -835,8 +901,11 @@ static void logger_thread(void * arg)
     UNUSED_PARAMETER(arg);
     while (1)
     {
-        NRF_LOG_FLUSH();
-        vTaskSuspend(NULL); // Suspend myself
+        while (logger_batch())
+        {
+            taskYIELD();
+        }
+        (void)ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
 }
 #endif //NRF_LOG_ENABLED
@@ -844,33 +913,73 @@ static void logger_thread(void * arg)
 #if NRF_LOG_ENABLED && NRF_LOG_DEFERRED
 void log_pending_hook( void )
 {
-//     BaseType_t result = pdFAIL;
-//    if ( __get_IPSR() != 0 )
-//    {
-//        BaseType_t higherPriorityTaskWoken = pdFALSE;
-//        result = xTaskNotifyFromISR( m_logger_thread, 0, eSetValueWithoutOverwrite, &higherPriorityTaskWoken );
-//        if ( pdFAIL != result )
-//        {
-//        portYIELD_FROM_ISR( higherPriorityTaskWoken );
-//        }
-//    }
-//    else
-//    {
-//        UNUSED_RETURN_VALUE(xTaskNotify( m_logger_thread, 0, eSetValueWithoutOverwrite ));
-//    }
-    BaseType_t YieldRequired = pdFAIL;
+    if (m_logger_thread == NULL)
+    {
+        return; // flushed when the thread starts
+    }
+
     if ( __get_IPSR() != 0 )
     {
-        YieldRequired = xTaskResumeFromISR( m_logger_thread );
-        portYIELD_FROM_ISR( YieldRequired );
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR( m_logger_thread, &higherPriorityTaskWoken );
+        portYIELD_FROM_ISR( higherPriorityTaskWoken );
     }
     else
     {
-        UNUSED_RETURN_VALUE(vTaskResume(m_logger_thread));
+        xTaskNotifyGive( m_logger_thread );
     }
- }
+}
 #endif
 
+void log_stats_get(proto_log_stats_t * p_stats)
+{
+    memset(p_stats, 0, sizeof(proto_log_stats_t));
+
+#if NRF_LOG_ENABLED
+    nrf_log_stats_t stats;
+
+    nrf_log_stats_get(&stats);
+    p_stats->dropped        = stats.dropped;
+    p_stats->batches        = m_logger_batches;
+    p_stats->overruns       = m_logger_overruns;
+    p_stats->buf_size       = (uint16_t)stats.buf_size;
+    p_stats->buf_high_water = (uint16_t)stats.buf_high_water;
+#endif
+}
+
+void nus_stats_get(proto_nus_stats_t * p_stats)
+{
+    ble_nus_tx_stats_t stats;
+    TickType_t         now = xTaskGetTickCount();
+    TickType_t         ticks;
+
+    memset(p_stats, 0, sizeof(proto_nus_stats_t));
+
+    if (ble_nus_tx_stats_get(&m_nus, m_conn_handle, &stats) != NRF_SUCCESS)
+    {
+        return;
+    }
+
+    // Bytes per second since the last request, or since the link came up.
+    ticks = now - m_nus_stats_tick;
+    if ((ticks > 0) && (stats.bytes >= m_nus_stats_bytes))
+    {
+        p_stats->rate = (uint32_t)(((uint64_t)(stats.bytes - m_nus_stats_bytes) * configTICK_RATE_HZ) / ticks);
+    }
+    m_nus_stats_tick  = now;
+    m_nus_stats_bytes = stats.bytes;
+
+    p_stats->bytes         = stats.bytes;
+    p_stats->notifications = stats.notifications;
+    p_stats->joined        = stats.joined;
+    p_stats->dropped       = stats.dropped;
+    p_stats->full          = stats.full;
+    p_stats->max_len       = stats.max_len;
+    p_stats->queued        = stats.queued;
+    p_stats->high_water    = stats.high_water;
+    p_stats->in_flight     = stats.in_flight;
+}
+
 /**@brief Application main function.
  */
 int main(void)
@@ -941,16 +1050,34 @@ int main(void)
 void ble_nus_send(uint8_t * p_data, uint16_t * p_length) 
 {
     uint32_t err_code;
-    do
+    // Replies to one v2 request share its header and go out in as few notifications as fit.
+    uint8_t  join_len = proto_is_frame(p_data, *p_length) ? PROTO_HEADER_LEN : BLE_NUS_JOIN_NEVER;
+
+    for (;;)
     {
-        err_code = ble_nus_data_send(&m_nus, p_data, p_length, m_conn_handle);
-        if ((err_code != NRF_ERROR_INVALID_STATE) &&
-            (err_code != NRF_ERROR_RESOURCES) &&
-            (err_code != NRF_ERROR_NOT_FOUND))
+        err_code = ble_nus_data_queue(&m_nus, p_data, *p_length, join_len, m_conn_handle);
+        if (err_code != NRF_ERROR_NO_MEM)
         {
-            APP_ERROR_CHECK(err_code);
-        }        
-    } while (err_code == NRF_ERROR_RESOURCES);
+            break;
+        }
+        conn_policy_bulk_hint();
+        if (xSemaphoreTake(m_nus_tx_ready, pdMS_TO_TICKS(NUS_TX_WAIT_MS)) != pdTRUE)
+        {
+            NRF_LOG_WARNING("NUS queue stalled, reply dropped");
+            return;
+        }
+    }
+
+    if ((err_code != NRF_ERROR_INVALID_STATE) &&
+        (err_code != NRF_ERROR_NOT_FOUND))
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+uint16_t ble_nus_max_len(void)
+{
+    return m_ble_nus_max_data_len;
 }
 
 
@@ -532,6 +532,13 @@
 #ifndef BLE_NUS_ENABLED
 #define BLE_NUS_ENABLED 1
 #endif
+// <o> BLE_NUS_TX_QUEUE_SIZE - Notifications queued per link by ble_nus_data_queue. <0-254> 
+// <i> Data queued while the SoftDevice has no room for more notifications waits here, and
+// <i> small pieces of it are joined into one notification. 0 leaves the queue out.
+#ifndef BLE_NUS_TX_QUEUE_SIZE
+#define BLE_NUS_TX_QUEUE_SIZE 8
+#endif
+
 // <e> BLE_NUS_CONFIG_LOG_ENABLED - Enables logging in the module.
 //==========================================================
 #ifndef BLE_NUS_CONFIG_LOG_ENABLED
@@ -6227,6 +6234,19 @@
 #define APP_TIMER_CONFIG_USE_SCHEDULER 0
 #endif
 
+// <q> APP_TIMER_CONFIG_USE_HEAP  - Keep queued timers in a pairing heap (nrf_pheap) instead of a sorted list
+ 
+
+// <i> Starting, stopping and expiring a timer is O(log n) instead of O(n) in the number
+// <i> of running timers. Timers expiring at the same tick may expire in any order.
+// <i> The list is faster to expire and restart timers up to some tens of running
+// <i> timers (tools/timerbench), enable only with more than that.
+// <i> Requires NRF_PHEAP_ENABLED.
+
+#ifndef APP_TIMER_CONFIG_USE_HEAP
+#define APP_TIMER_CONFIG_USE_HEAP 0
+#endif
+
 // <q> APP_TIMER_KEEPS_RTC_ACTIVE  - Enable RTC always on
  
 
@@ -6619,19 +6639,41 @@
 #define APP_USBD_MSC_ENABLED 0
 #endif
 
-// <q> CRC16_ENABLED  - crc16 - CRC16 calculation routines
- 
-
+// <e> CRC16_ENABLED - crc16 - CRC16 calculation routines
+//==========================================================
 #ifndef CRC16_ENABLED
 #define CRC16_ENABLED 0
 #endif
-
-// <q> CRC32_ENABLED  - crc32 - CRC32 calculation routines
+// <o> CRC16_CONFIG_IMPL  - Implementation, speed against flash used by tables
  
+// <0=> Shift and xor 
+// <1=> Nibble table (32 bytes) 
+// <2=> Byte table (512 bytes) 
 
+#ifndef CRC16_CONFIG_IMPL
+#define CRC16_CONFIG_IMPL 2
+#endif
+
+// </e>
+
+// <e> CRC32_ENABLED - crc32 - CRC32 calculation routines
+//==========================================================
 #ifndef CRC32_ENABLED
 #define CRC32_ENABLED 0
 #endif
+// <o> CRC32_CONFIG_IMPL  - Implementation, speed against flash used by tables
+ 
+// <0=> Bitwise 
+// <1=> Nibble table (64 bytes) 
+// <2=> Byte table (1 kB) 
+// <3=> Slice-by-4 (4 kB) 
+// <4=> Slice-by-8 (8 kB) 
+
+#ifndef CRC32_CONFIG_IMPL
+#define CRC32_CONFIG_IMPL 2
+#endif
+
+// </e>
 
 // <q> ECC_ENABLED  - ecc - Elliptic Curve Cryptography Library
  
@@ -6755,6 +6797,41 @@
 // </h> 
 //==========================================================
 
+// <h> Index - RAM index of records
+
+//==========================================================
+// <o> FDS_INDEX_SIZE - Number of records the RAM index can hold. 
+// <i> Each entry takes 8 bytes. Lookups by file ID and record key use the index instead of
+// <i> scanning flash. If there are more records than entries, the index is dropped and flash
+// <i> is scanned until the next garbage collection. 0 disables the index.
+#ifndef FDS_INDEX_SIZE
+#define FDS_INDEX_SIZE 32
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> GC - Garbage collection
+
+//==========================================================
+// <o> FDS_GC_RECORDS_PER_STEP - Records copied before other operations may run. 
+// <i> Garbage collection is paused after copying this many records, and between pages,
+// <i> so that queued writes and deletes do not wait for the whole collection.
+// <i> 0 runs garbage collection as a single operation.
+#ifndef FDS_GC_RECORDS_PER_STEP
+#define FDS_GC_RECORDS_PER_STEP 4
+#endif
+
+// <o> FDS_GC_MIN_DIRTY_PERCENT - Smallest share of deleted data for a page to be collected. <0-100> 
+// <i> Pages are collected in order of their share of deleted records. Collecting a page
+// <i> with a small share copies many records to free little space.
+#ifndef FDS_GC_MIN_DIRTY_PERCENT
+#define FDS_GC_MIN_DIRTY_PERCENT 0
+#endif
+
+// </h> 
+//==========================================================
+
 // </e>
 
 // <q> HARDFAULT_HANDLER_ENABLED  - hardfault_default - HardFault default handler for debugging and release
@@ -7363,6 +7440,13 @@
 #define NRF_SECTION_ITER_ENABLED 1
 #endif
 
+// <q> NRF_PHEAP_ENABLED  - nrf_pheap - Pairing heap
+ 
+
+#ifndef NRF_PHEAP_ENABLED
+#define NRF_PHEAP_ENABLED 0
+#endif
+
 // <q> NRF_SORTLIST_ENABLED  - nrf_sortlist - Sorted list
  
 
@@ -7659,6 +7743,30 @@
 
 // </e>
 
+// <e> NRF_LOG_BACKEND_BIN_ENABLED - nrf_log_backend_bin - Log binary backend
+// <i> Entries are sent as binary records on their own RTT up channel,
+// <i> format strings are resolved on the host from the ELF file.
+//==========================================================
+#ifndef NRF_LOG_BACKEND_BIN_ENABLED
+#define NRF_LOG_BACKEND_BIN_ENABLED 0
+#endif
+// <o> NRF_LOG_BACKEND_BIN_RTT_CHANNEL - RTT up channel, must not be 0 (terminal). 
+#ifndef NRF_LOG_BACKEND_BIN_RTT_CHANNEL
+#define NRF_LOG_BACKEND_BIN_RTT_CHANNEL 1
+#endif
+
+// <o> NRF_LOG_BACKEND_BIN_RTT_BUFFER_SIZE - Size of the RTT up channel buffer. 
+#ifndef NRF_LOG_BACKEND_BIN_RTT_BUFFER_SIZE
+#define NRF_LOG_BACKEND_BIN_RTT_BUFFER_SIZE 512
+#endif
+
+// <o> NRF_LOG_BACKEND_BIN_STR_MAX - Max length of a %s argument copied from RAM, with terminator. 
+#ifndef NRF_LOG_BACKEND_BIN_STR_MAX
+#define NRF_LOG_BACKEND_BIN_STR_MAX 32
+#endif
+
+// </e>
+
 // <e> NRF_LOG_ENABLED - nrf_log - Logger
 //==========================================================
 #ifndef NRF_LOG_ENABLED
@@ -7695,6 +7803,8 @@
 
 // <i> If set then oldest logs are overwritten. Otherwise a 
 // <i> marker is injected informing about overflow.
+// <i> Only warnings and errors overwrite older logs, less severe
+// <i> logs are dropped when the buffer is full.
 
 #ifndef NRF_LOG_ALLOW_OVERFLOW
 #define NRF_LOG_ALLOW_OVERFLOW 1
@@ -7718,6 +7828,15 @@
 #define NRF_LOG_BUFSIZE 1024
 #endif
 
+// <o> NRF_LOG_BUF_RESERVED - Part of NRF_LOG_BUFSIZE kept for warnings and errors (in bytes). 
+// <i> Logs less severe than warning are dropped instead of using it,
+// <i> so that warnings and errors get through a flood of them.
+// <i> Must be multiple of 4 and smaller than NRF_LOG_BUFSIZE.
+
+#ifndef NRF_LOG_BUF_RESERVED
+#define NRF_LOG_BUF_RESERVED 128
+#endif
+
 // <q> NRF_LOG_CLI_CMDS  - Enable CLI commands for the module.
  
 
@@ -0,0 +1,596 @@
+#include <string.h>
+
+#include "protocol.h"
+
+static uint8_t * put_u16(uint8_t * p, uint16_t v)
+{
+    *p++ = (uint8_t)(v);
+    *p++ = (uint8_t)(v >> 8);
+    return p;
+}
+
+static uint8_t * put_u32(uint8_t * p, uint32_t v)
+{
+    p = put_u16(p, (uint16_t)(v));
+    return put_u16(p, (uint16_t)(v >> 16));
+}
+
+static uint8_t * put_currents(uint8_t * p, int8_t const * current)
+{
+    memcpy(p, current, PROTO_NUM_OF_CHANNELS);
+    return p + PROTO_NUM_OF_CHANNELS;
+}
+
+static uint8_t const * get_u16(uint8_t const * p, uint16_t * v)
+{
+    *v = (uint16_t)(p[0] | (p[1] << 8));
+    return p + 2;
+}
+
+static uint8_t const * get_u32(uint8_t const * p, uint32_t * v)
+{
+    uint16_t l, h;
+
+    p = get_u16(p, &l);
+    p = get_u16(p, &h);
+    *v = ((uint32_t)h << 16) | l;
+    return p;
+}
+
+static uint8_t const * get_currents(uint8_t const * p, int8_t * current)
+{
+    memcpy(current, p, PROTO_NUM_OF_CHANNELS);
+    return p + PROTO_NUM_OF_CHANNELS;
+}
+
+static ret_code_t record_check(proto_record_t const * p_record, uint8_t type, uint8_t length)
+{
+    if (p_record->type != type)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    if (p_record->length != length)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    return NRF_SUCCESS;
+}
+
+bool proto_is_frame(uint8_t const * p_data, uint16_t length)
+{
+    return p_data != NULL && length >= PROTO_HEADER_LEN && p_data[0] == PROTO_MAGIC;
+}
+
+ret_code_t proto_reader_init(proto_reader_t * p_reader, uint8_t const * p_data, uint16_t length)
+{
+    uint16_t pos = PROTO_HEADER_LEN;
+
+    if (!proto_is_frame(p_data, length))
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    if (length > PROTO_MAX_FRAME_LEN)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    while (pos < length)
+    {
+        if (length - pos < PROTO_RECORD_HEADER_LEN ||
+            length - pos - PROTO_RECORD_HEADER_LEN < p_data[pos + 1])
+        {
+            return NRF_ERROR_INVALID_LENGTH;
+        }
+
+        pos += PROTO_RECORD_HEADER_LEN + p_data[pos + 1];
+    }
+
+    p_reader->p_buf     = p_data;
+    p_reader->length    = length;
+    p_reader->pos       = PROTO_HEADER_LEN;
+    p_reader->seq       = p_data[1];
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t proto_next(proto_reader_t * p_reader, proto_record_t * p_record)
+{
+    uint8_t const * p = &p_reader->p_buf[p_reader->pos];
+
+    if (p_reader->pos >= p_reader->length)
+    {
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    p_record->type      = p[0];
+    p_record->length    = p[1];
+    p_record->p_value   = &p[PROTO_RECORD_HEADER_LEN];
+
+    p_reader->pos += PROTO_RECORD_HEADER_LEN + p_record->length;
+
+    return NRF_SUCCESS;
+}
+
+void proto_writer_init(proto_writer_t * p_writer, uint8_t * p_buf, uint16_t size, uint8_t seq)
+{
+    p_writer->p_buf     = p_buf;
+    p_writer->size      = size > PROTO_MAX_FRAME_LEN ? PROTO_MAX_FRAME_LEN : size;
+    p_writer->length    = PROTO_HEADER_LEN;
+
+    p_buf[0] = PROTO_MAGIC;
+    p_buf[1] = seq;
+}
+
+bool proto_writer_empty(proto_writer_t const * p_writer)
+{
+    return p_writer->length <= PROTO_HEADER_LEN;
+}
+
+ret_code_t proto_put(proto_writer_t * p_writer, uint8_t type, uint8_t const * p_value, uint8_t length)
+{
+    uint8_t * p = &p_writer->p_buf[p_writer->length];
+
+    if (p_writer->length + PROTO_RECORD_HEADER_LEN + length > p_writer->size)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    p[0] = type;
+    p[1] = length;
+    if (length != 0)
+    {
+        memcpy(&p[PROTO_RECORD_HEADER_LEN], p_value, length);
+    }
+
+    p_writer->length += PROTO_RECORD_HEADER_LEN + length;
+
+    return NRF_SUCCESS;
+}
+
+static uint8_t * start_encode(uint8_t * p, proto_start_t const * p_start)
+{
+    p = put_u16(p, p_start->freq);
+    p = put_u16(p, p_start->pulse_width);
+    *p++ = p_start->recycle_ratio;
+    return put_currents(p, p_start->current);
+}
+
+static uint8_t const * start_decode(uint8_t const * p, proto_start_t * p_start)
+{
+    p = get_u16(p, &p_start->freq);
+    p = get_u16(p, &p_start->pulse_width);
+    p_start->recycle_ratio = *p++;
+    return get_currents(p, p_start->current);
+}
+
+ret_code_t proto_put_start(proto_writer_t * p_writer, proto_start_t const * p_start)
+{
+    uint8_t value[PROTO_START_LEN];
+
+    start_encode(value, p_start);
+    return proto_put(p_writer, PROTO_REQ_START, value, sizeof(value));
+}
+
+ret_code_t proto_put_wave(proto_writer_t * p_writer, proto_wave_t const * p_wave)
+{
+    uint8_t value[PROTO_WAVE_LEN(PROTO_MAX_SEGS)];
+    uint8_t * p = value;
+
+    if (p_wave->num_of_segs == 0 || p_wave->num_of_segs > PROTO_MAX_SEGS)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    p = put_u16(p, p_wave->freq);
+    for (uint8_t i = 0; i < p_wave->num_of_segs; i++)
+    {
+        *p++ = p_wave->segs[i].type;
+        p = put_u16(p, p_wave->segs[i].duration);
+        p = put_currents(p, p_wave->segs[i].current);
+    }
+
+    return proto_put(p_writer, PROTO_REQ_WAVE, value, (uint8_t)(p - value));
+}
+
+ret_code_t proto_put_ack(proto_writer_t * p_writer, proto_ack_t const * p_ack)
+{
+    uint8_t value[PROTO_ACK_LEN] = { p_ack->type, p_ack->result };
+
+    return proto_put(p_writer, PROTO_RSP_ACK, value, sizeof(value));
+}
+
+ret_code_t proto_put_state(proto_writer_t * p_writer, proto_state_t const * p_state)
+{
+    uint8_t value[PROTO_STATE_LEN];
+
+    value[0] = p_state->running;
+    start_encode(&value[1], &p_state->start);
+    return proto_put(p_writer, PROTO_RSP_STATE, value, sizeof(value));
+}
+
+ret_code_t proto_put_status(proto_writer_t * p_writer, proto_status_t const * p_status)
+{
+    uint8_t value[PROTO_STATUS_LEN];
+    uint8_t * p = value;
+
+    *p++ = p_status->running;
+    *p++ = p_status->pending;
+    p = put_u32(p, p_status->cycles);
+    p = put_u32(p, p_status->swaps);
+    p = put_u32(p, p_status->rx_dropped);
+    *p = p_status->rx_high_water;
+    return proto_put(p_writer, PROTO_RSP_STATUS, value, sizeof(value));
+}
+
+ret_code_t proto_get_start(proto_record_t const * p_record, proto_start_t * p_start)
+{
+    ret_code_t err = record_check(p_record, PROTO_REQ_START, PROTO_START_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        start_decode(p_record->p_value, p_start);
+    }
+
+    return err;
+}
+
+ret_code_t proto_get_wave(proto_record_t const * p_record, proto_wave_t * p_wave)
+{
+    uint8_t const * p = p_record->p_value;
+    uint8_t n;
+
+    if (p_record->type != PROTO_REQ_WAVE)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    if (p_record->length < PROTO_WAVE_LEN(1) ||
+        p_record->length > PROTO_WAVE_LEN(PROTO_MAX_SEGS) ||
+        (p_record->length - PROTO_WAVE_LEN(0)) % PROTO_SEGMENT_LEN != 0)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    n = (uint8_t)((p_record->length - PROTO_WAVE_LEN(0)) / PROTO_SEGMENT_LEN);
+
+    p = get_u16(p, &p_wave->freq);
+    p_wave->num_of_segs = n;
+    for (uint8_t i = 0; i < n; i++)
+    {
+        p_wave->segs[i].type = *p++;
+        p = get_u16(p, &p_wave->segs[i].duration);
+        p = get_currents(p, p_wave->segs[i].current);
+    }
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t proto_get_ack(proto_record_t const * p_record, proto_ack_t * p_ack)
+{
+    ret_code_t err = record_check(p_record, PROTO_RSP_ACK, PROTO_ACK_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p_ack->type     = p_record->p_value[0];
+        p_ack->result   = p_record->p_value[1];
+    }
+
+    return err;
+}
+
+ret_code_t proto_get_state(proto_record_t const * p_record, proto_state_t * p_state)
+{
+    ret_code_t err = record_check(p_record, PROTO_RSP_STATE, PROTO_STATE_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p_state->running = p_record->p_value[0];
+        start_decode(&p_record->p_value[1], &p_state->start);
+    }
+
+    return err;
+}
+
+ret_code_t proto_get_status(proto_record_t const * p_record, proto_status_t * p_status)
+{
+    uint8_t const * p = p_record->p_value;
+    ret_code_t err = record_check(p_record, PROTO_RSP_STATUS, PROTO_STATUS_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p_status->running   = *p++;
+        p_status->pending   = *p++;
+        p = get_u32(p, &p_status->cycles);
+        p = get_u32(p, &p_status->swaps);
+        p = get_u32(p, &p_status->rx_dropped);
+        p_status->rx_high_water = *p;
+    }
+
+    return err;
+}
+
+ret_code_t proto_put_stream_start(proto_writer_t * p_writer, uint16_t rate)
+{
+    uint8_t value[PROTO_STREAM_START_LEN];
+
+    put_u16(value, rate);
+    return proto_put(p_writer, PROTO_REQ_STREAM_START, value, sizeof(value));
+}
+
+ret_code_t proto_put_stream_data(proto_writer_t * p_writer, proto_sample_t const * p_samples, uint8_t num_of_samples)
+{
+    if (num_of_samples == 0 || num_of_samples > UINT8_MAX / PROTO_SAMPLE_LEN)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    return proto_put(p_writer,
+                     PROTO_REQ_STREAM_DATA,
+                     (uint8_t const *)p_samples,
+                     (uint8_t)(num_of_samples * PROTO_SAMPLE_LEN));
+}
+
+ret_code_t proto_put_stream_stats(proto_writer_t * p_writer, proto_stream_stats_t const * p_stats)
+{
+    uint8_t value[PROTO_STREAM_STATS_LEN];
+    uint8_t * p = value;
+
+    p = put_u32(p, p_stats->queued);
+    p = put_u32(p, p_stats->played);
+    p = put_u32(p, p_stats->underruns);
+    p = put_u32(p, p_stats->dropped);
+    p = put_u16(p, p_stats->level);
+    put_u16(p, p_stats->high_water);
+    return proto_put(p_writer, PROTO_RSP_STREAM_STATS, value, sizeof(value));
+}
+
+ret_code_t proto_get_stream_start(proto_record_t const * p_record, uint16_t * p_rate)
+{
+    ret_code_t err = record_check(p_record, PROTO_REQ_STREAM_START, PROTO_STREAM_START_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        get_u16(p_record->p_value, p_rate);
+    }
+
+    return err;
+}
+
+ret_code_t proto_get_stream_data(proto_record_t const * p_record,
+                                 proto_sample_t const ** pp_samples,
+                                 uint8_t * p_num_of_samples)
+{
+    if (p_record->type != PROTO_REQ_STREAM_DATA)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    if (p_record->length == 0 || p_record->length % PROTO_SAMPLE_LEN != 0)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    *pp_samples         = (proto_sample_t const *)p_record->p_value;
+    *p_num_of_samples   = p_record->length / PROTO_SAMPLE_LEN;
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t proto_get_stream_stats(proto_record_t const * p_record, proto_stream_stats_t * p_stats)
+{
+    uint8_t const * p = p_record->p_value;
+    ret_code_t err = record_check(p_record, PROTO_RSP_STREAM_STATS, PROTO_STREAM_STATS_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p = get_u32(p, &p_stats->queued);
+        p = get_u32(p, &p_stats->played);
+        p = get_u32(p, &p_stats->underruns);
+        p = get_u32(p, &p_stats->dropped);
+        p = get_u16(p, &p_stats->level);
+        get_u16(p, &p_stats->high_water);
+    }
+
+    return err;
+}
+
+ret_code_t proto_put_timing_stats(proto_writer_t * p_writer, proto_timing_stats_t const * p_stats)
+{
+    uint8_t value[PROTO_TIMING_STATS_LEN];
+    uint8_t * p = value;
+
+    p = put_u32(p, p_stats->cycles);
+    p = put_u32(p, p_stats->missed);
+    p = put_u32(p, p_stats->late);
+    p = put_u32(p, p_stats->overruns);
+    p = put_u16(p, p_stats->latency_min);
+    p = put_u16(p, p_stats->latency_max);
+    p = put_u16(p, p_stats->latency_mean);
+    p = put_u16(p, p_stats->duration_max);
+    for (int i = 0; i < PROTO_TIMING_HIST_BINS; i++)
+    {
+        p = put_u32(p, p_stats->hist[i]);
+    }
+    return proto_put(p_writer, PROTO_RSP_TIMING_STATS, value, sizeof(value));
+}
+
+ret_code_t proto_put_comp_stats(proto_writer_t * p_writer, proto_comp_stats_t const * p_stats)
+{
+    uint8_t value[PROTO_COMP_STATS_LEN];
+    uint8_t * p = value;
+
+    *p++ = p_stats->saturated;
+    *p++ = p_stats->vout_set;
+    p = put_u16(p, p_stats->scale);
+    p = put_u16(p, p_stats->vrect);
+    p = put_u16(p, p_stats->vout);
+    p = put_u32(p, p_stats->saturations);
+    p = put_u32(p, p_stats->vout_raises);
+    p = put_u32(p, p_stats->rescales);
+    p = put_u32(p, p_stats->errors);
+    return proto_put(p_writer, PROTO_RSP_COMP_STATS, value, sizeof(value));
+}
+
+ret_code_t proto_put_log_stats(proto_writer_t * p_writer, proto_log_stats_t const * p_stats)
+{
+    uint8_t value[PROTO_LOG_STATS_LEN];
+    uint8_t * p = value;
+
+    p = put_u32(p, p_stats->dropped);
+    p = put_u32(p, p_stats->batches);
+    p = put_u32(p, p_stats->overruns);
+    p = put_u16(p, p_stats->buf_size);
+    p = put_u16(p, p_stats->buf_high_water);
+    return proto_put(p_writer, PROTO_RSP_LOG_STATS, value, sizeof(value));
+}
+
+ret_code_t proto_put_nus_stats(proto_writer_t * p_writer, proto_nus_stats_t const * p_stats)
+{
+    uint8_t value[PROTO_NUS_STATS_LEN];
+    uint8_t * p = value;
+
+    p = put_u32(p, p_stats->bytes);
+    p = put_u32(p, p_stats->notifications);
+    p = put_u32(p, p_stats->joined);
+    p = put_u32(p, p_stats->dropped);
+    p = put_u32(p, p_stats->full);
+    p = put_u32(p, p_stats->rate);
+    p = put_u16(p, p_stats->max_len);
+    *p++ = p_stats->queued;
+    *p++ = p_stats->high_water;
+    *p++ = p_stats->in_flight;
+    return proto_put(p_writer, PROTO_RSP_NUS_STATS, value, sizeof(value));
+}
+
+ret_code_t proto_put_link_stats(proto_writer_t * p_writer, proto_link_stats_t const * p_stats)
+{
+    uint8_t value[PROTO_LINK_STATS_LEN];
+    uint8_t * p = value;
+
+    p = put_u32(p, p_stats->rate);
+    p = put_u32(p, p_stats->peak_rate);
+    p = put_u32(p, p_stats->bulk_bytes);
+    p = put_u32(p, p_stats->bulk_uj);
+    p = put_u32(p, p_stats->idle_bytes);
+    p = put_u32(p, p_stats->idle_uj);
+    p = put_u32(p, p_stats->switches);
+    p = put_u32(p, p_stats->refused);
+    p = put_u16(p, p_stats->interval);
+    p = put_u16(p, p_stats->latency);
+    *p++ = p_stats->data_len;
+    *p++ = p_stats->phy;
+    *p++ = p_stats->profile;
+    return proto_put(p_writer, PROTO_RSP_LINK_STATS, value, sizeof(value));
+}
+
+ret_code_t proto_get_timing_stats(proto_record_t const * p_record, proto_timing_stats_t * p_stats)
+{
+    uint8_t const * p = p_record->p_value;
+    ret_code_t err = record_check(p_record, PROTO_RSP_TIMING_STATS, PROTO_TIMING_STATS_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p = get_u32(p, &p_stats->cycles);
+        p = get_u32(p, &p_stats->missed);
+        p = get_u32(p, &p_stats->late);
+        p = get_u32(p, &p_stats->overruns);
+        p = get_u16(p, &p_stats->latency_min);
+        p = get_u16(p, &p_stats->latency_max);
+        p = get_u16(p, &p_stats->latency_mean);
+        p = get_u16(p, &p_stats->duration_max);
+        for (int i = 0; i < PROTO_TIMING_HIST_BINS; i++)
+        {
+            p = get_u32(p, &p_stats->hist[i]);
+        }
+    }
+
+    return err;
+}
+
+ret_code_t proto_get_comp_stats(proto_record_t const * p_record, proto_comp_stats_t * p_stats)
+{
+    uint8_t const * p = p_record->p_value;
+    ret_code_t err = record_check(p_record, PROTO_RSP_COMP_STATS, PROTO_COMP_STATS_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p_stats->saturated  = *p++;
+        p_stats->vout_set   = *p++;
+        p = get_u16(p, &p_stats->scale);
+        p = get_u16(p, &p_stats->vrect);
+        p = get_u16(p, &p_stats->vout);
+        p = get_u32(p, &p_stats->saturations);
+        p = get_u32(p, &p_stats->vout_raises);
+        p = get_u32(p, &p_stats->rescales);
+        p = get_u32(p, &p_stats->errors);
+    }
+
+    return err;
+}
+
+ret_code_t proto_get_log_stats(proto_record_t const * p_record, proto_log_stats_t * p_stats)
+{
+    uint8_t const * p = p_record->p_value;
+    ret_code_t err = record_check(p_record, PROTO_RSP_LOG_STATS, PROTO_LOG_STATS_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p = get_u32(p, &p_stats->dropped);
+        p = get_u32(p, &p_stats->batches);
+        p = get_u32(p, &p_stats->overruns);
+        p = get_u16(p, &p_stats->buf_size);
+        p = get_u16(p, &p_stats->buf_high_water);
+    }
+
+    return err;
+}
+
+ret_code_t proto_get_nus_stats(proto_record_t const * p_record, proto_nus_stats_t * p_stats)
+{
+    uint8_t const * p = p_record->p_value;
+    ret_code_t err = record_check(p_record, PROTO_RSP_NUS_STATS, PROTO_NUS_STATS_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p = get_u32(p, &p_stats->bytes);
+        p = get_u32(p, &p_stats->notifications);
+        p = get_u32(p, &p_stats->joined);
+        p = get_u32(p, &p_stats->dropped);
+        p = get_u32(p, &p_stats->full);
+        p = get_u32(p, &p_stats->rate);
+        p = get_u16(p, &p_stats->max_len);
+        p_stats->queued     = *p++;
+        p_stats->high_water = *p++;
+        p_stats->in_flight  = *p++;
+    }
+
+    return err;
+}
+
+ret_code_t proto_get_link_stats(proto_record_t const * p_record, proto_link_stats_t * p_stats)
+{
+    uint8_t const * p = p_record->p_value;
+    ret_code_t err = record_check(p_record, PROTO_RSP_LINK_STATS, PROTO_LINK_STATS_LEN);
+
+    if (err == NRF_SUCCESS)
+    {
+        p = get_u32(p, &p_stats->rate);
+        p = get_u32(p, &p_stats->peak_rate);
+        p = get_u32(p, &p_stats->bulk_bytes);
+        p = get_u32(p, &p_stats->bulk_uj);
+        p = get_u32(p, &p_stats->idle_bytes);
+        p = get_u32(p, &p_stats->idle_uj);
+        p = get_u32(p, &p_stats->switches);
+        p = get_u32(p, &p_stats->refused);
+        p = get_u16(p, &p_stats->interval);
+        p = get_u16(p, &p_stats->latency);
+        p_stats->data_len   = *p++;
+        p_stats->phy        = *p++;
+        p_stats->profile    = *p++;
+    }
+
+    return err;
+}
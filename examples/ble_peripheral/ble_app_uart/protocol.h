@@ -0,0 +1,345 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+/**
+ * NUS protocol v2
+ *
+ * One gatt write (or notification) carries one frame, up to ATT_MTU - 3 bytes:
+ *
+ * byte 0       PROTO_MAGIC
+ * byte 1       sequence number, set by app, echoed in all replies to this frame
+ * byte 2 ..    records, back to back, each one is
+ *              type (1 byte), length (1 byte), value (length bytes)
+ *
+ * multi-byte fields are little endian. v1 messages (ble_incomming_message_t)
+ * start with command 0, 1 or 2, so v1 and v2 can be told apart by byte 0.
+ *
+ * Framing of a request is checked as a whole before any record is executed,
+ * a malformed frame is answered with a single ACK of type PROTO_REQ_NONE.
+ * A record with bad value, or unknown type, is acked with an error and the
+ * rest of the frame is still executed.
+ * A frame howland can't take (rx ring full) is answered with a single ACK of
+ * type PROTO_REQ_NONE and result NRF_ERROR_BUSY, app should resend it.
+ * Replies to all records of a request are batched into as few notifications
+ * as the mtu allows, in request order. Replies waiting for the link are joined
+ * into one frame if their requests had the same sequence number, so an app
+ * polling with a fixed sequence number may get several replies in a frame.
+ *
+ * This file and protocol.c use nothing but libc and sdk_errors.h, they are
+ * shared with the test rig and app.
+ */
+#define PROTO_MAGIC                         0xB2
+#define PROTO_HEADER_LEN                    2
+#define PROTO_RECORD_HEADER_LEN             2
+#define PROTO_MAX_FRAME_LEN                 244     // BLE_NUS_MAX_DATA_LEN with 247 mtu
+
+#define PROTO_NUM_OF_CHANNELS               8
+#define PROTO_MAX_SEGS                      3       // WAVEFORM_MAX_SEGS - 1, last one is rest
+
+/**
+ * request records
+ */
+#define PROTO_REQ_NONE                      0x00
+#define PROTO_REQ_READ                      0x01    // no value, replied with STATE
+#define PROTO_REQ_STOP                      0x02    // no value, replied with ACK
+#define PROTO_REQ_START                     0x03    // proto_start_t, start or update, replied with ACK
+#define PROTO_REQ_WAVE                      0x04    // proto_wave_t, start or update, replied with ACK
+#define PROTO_REQ_STATUS                    0x05    // no value, replied with STATUS
+#define PROTO_REQ_STREAM_START              0x06    // sample rate u16, start or switch to streaming, replied with ACK
+#define PROTO_REQ_STREAM_DATA               0x07    // proto_sample_t x n, queued for playback, replied with ACK
+#define PROTO_REQ_STREAM_STATS              0x08    // no value, replied with STREAM_STATS
+#define PROTO_REQ_TIMING_STATS              0x09    // no value, replied with TIMING_STATS
+#define PROTO_REQ_COMP_STATS                0x0A    // no value, replied with COMP_STATS
+#define PROTO_REQ_LOG_STATS                 0x0B    // no value, replied with LOG_STATS
+#define PROTO_REQ_NUS_STATS                 0x0C    // no value, replied with NUS_STATS
+#define PROTO_REQ_LINK_STATS                0x0D    // no value, replied with LINK_STATS
+
+/**
+ * reply records
+ */
+#define PROTO_RSP_ACK                       0x81    // proto_ack_t
+#define PROTO_RSP_STATE                     0x82    // proto_state_t
+#define PROTO_RSP_STATUS                    0x83    // proto_status_t
+#define PROTO_RSP_STREAM_STATS              0x84    // proto_stream_stats_t
+#define PROTO_RSP_TIMING_STATS              0x85    // proto_timing_stats_t
+#define PROTO_RSP_COMP_STATS                0x86    // proto_comp_stats_t
+#define PROTO_RSP_LOG_STATS                 0x87    // proto_log_stats_t
+#define PROTO_RSP_NUS_STATS                 0x88    // proto_nus_stats_t
+#define PROTO_RSP_LINK_STATS                0x89    // proto_link_stats_t
+
+#define PROTO_START_LEN                     (2 + 2 + 1 + PROTO_NUM_OF_CHANNELS)
+#define PROTO_SEGMENT_LEN                   (1 + 2 + PROTO_NUM_OF_CHANNELS)
+#define PROTO_WAVE_LEN(n)                   (2 + (n) * PROTO_SEGMENT_LEN)
+#define PROTO_ACK_LEN                       2
+#define PROTO_STATE_LEN                     (1 + PROTO_START_LEN)
+#define PROTO_STATUS_LEN                    (1 + 1 + 4 + 4 + 4 + 1)
+#define PROTO_STREAM_START_LEN              2
+#define PROTO_SAMPLE_LEN                    PROTO_NUM_OF_CHANNELS
+#define PROTO_STREAM_STATS_LEN              (4 + 4 + 4 + 4 + 2 + 2)
+#define PROTO_TIMING_HIST_BINS              8
+#define PROTO_TIMING_STATS_LEN              (4 + 4 + 4 + 4 + 2 + 2 + 2 + 2 + 4 * PROTO_TIMING_HIST_BINS)
+#define PROTO_COMP_STATS_LEN                (1 + 1 + 2 + 2 + 2 + 4 + 4 + 4 + 4)
+#define PROTO_LOG_STATS_LEN                 (4 + 4 + 4 + 2 + 2)
+#define PROTO_NUS_STATS_LEN                 (4 + 4 + 4 + 4 + 4 + 4 + 2 + 1 + 1 + 1)
+#define PROTO_LINK_STATS_LEN                (4 + 4 + 4 + 4 + 4 + 4 + 4 + 4 + 2 + 2 + 1 + 1 + 1)
+
+/**
+ * link policy profiles, proto_link_stats_t profile
+ */
+#define PROTO_LINK_DEFAULT                  0       // parameters the central connected with
+#define PROTO_LINK_IDLE                     1
+#define PROTO_LINK_BULK                     2
+
+typedef struct proto_start
+{
+    uint16_t    freq;                       // Hz
+    uint16_t    pulse_width;                // us
+    uint8_t     recycle_ratio;
+    int8_t      current[PROTO_NUM_OF_CHANNELS];
+} proto_start_t;
+
+typedef struct proto_segment
+{
+    uint8_t     type;                       // waveform_seg_type_t
+    uint16_t    duration;                   // us
+    int8_t      current[PROTO_NUM_OF_CHANNELS];
+} proto_segment_t;
+
+typedef struct proto_wave
+{
+    uint16_t        freq;                   // Hz
+    uint8_t         num_of_segs;            // 1 - PROTO_MAX_SEGS
+    proto_segment_t segs[PROTO_MAX_SEGS];
+} proto_wave_t;
+
+typedef struct proto_ack
+{
+    uint8_t     type;                       // request record acked
+    uint8_t     result;                     // NRF_SUCCESS or NRF_ERROR_xxx
+} proto_ack_t;
+
+typedef struct proto_state
+{
+    uint8_t         running;
+    proto_start_t   start;                  // last accepted START
+} proto_state_t;
+
+typedef struct proto_status
+{
+    uint8_t     running;
+    uint8_t     pending;
+    uint32_t    cycles;
+    uint32_t    swaps;
+    uint32_t    rx_dropped;                 // frames dropped on full rx ring
+    uint8_t     rx_high_water;              // max frames waiting in rx ring
+} proto_status_t;
+
+/**
+ * one stream sample, dac code from VMID for each channel, held for one
+ * sample period. single bytes only, so a STREAM_DATA value can be used in place.
+ */
+typedef struct proto_sample
+{
+    int8_t      current[PROTO_NUM_OF_CHANNELS];
+} proto_sample_t;
+
+typedef struct proto_stream_stats
+{
+    uint32_t    queued;                     // samples taken into ring
+    uint32_t    played;                     // samples sent to dac
+    uint32_t    underruns;                  // periods with empty ring, last value held
+    uint32_t    dropped;                    // samples not taken, ring full
+    uint16_t    level;                      // samples waiting now
+    uint16_t    high_water;                 // max samples waiting
+} proto_stream_stats_t;
+
+/**
+ * stimulation chain timing since start. latency is from the rewind compare
+ * to the rewind isr, in us. hist bin 0 counts 0us, bin n counts
+ * [2^(n-1), 2^n) us, the last bin is open ended.
+ */
+typedef struct proto_timing_stats
+{
+    uint32_t    cycles;                     // cycles measured
+    uint32_t    missed;                     // cycles without rewind isr
+    uint32_t    late;                       // rewind isr done after cycle end
+    uint32_t    overruns;                   // spi burst still running at rewind compare
+    uint16_t    latency_min;
+    uint16_t    latency_max;
+    uint16_t    latency_mean;
+    uint16_t    duration_max;               // rewind isr, us
+    uint32_t    hist[PROTO_TIMING_HIST_BINS];
+} proto_timing_stats_t;
+
+/**
+ * compliance compensation. scale is applied to the amplitude of the
+ * playing waveform, 256 is 1.0.
+ */
+typedef struct proto_comp_stats
+{
+    uint8_t     saturated;                  // vout below what the amplitude needs, now
+    uint8_t     vout_set;                   // IDT_REG_VOUT_SET
+    uint16_t    scale;
+    uint16_t    vrect;                      // mV
+    uint16_t    vout;                       // mV
+    uint32_t    saturations;                // times vout fell below need
+    uint32_t    vout_raises;                // VOUT_SET steps up
+    uint32_t    rescales;                   // scaled tables committed
+    uint32_t    errors;                     // scaled tables rejected
+} proto_comp_stats_t;
+
+/**
+ * deferred logger, buffer figures in 32bit words
+ */
+typedef struct proto_log_stats
+{
+    uint32_t    dropped;                    // entries lost to a full buffer
+    uint32_t    batches;                    // flush batches run
+    uint32_t    overruns;                   // batches cut by the time budget
+    uint16_t    buf_size;
+    uint16_t    buf_high_water;
+} proto_log_stats_t;
+
+/**
+ * notification queue of the link the request came on, counted since connected
+ */
+typedef struct proto_nus_stats
+{
+    uint32_t    bytes;                      // notified
+    uint32_t    notifications;
+    uint32_t    joined;                     // replies sent in a notification with others
+    uint32_t    dropped;                    // notifications refused by the softdevice
+    uint32_t    full;                       // replies dropped on a full queue
+    uint32_t    rate;                       // bytes/s notified since the last NUS_STATS
+    uint16_t    max_len;                    // notification length, from mtu
+    uint8_t     queued;                     // notifications waiting now
+    uint8_t     high_water;
+    uint8_t     in_flight;                  // handed to the softdevice, not sent yet
+} proto_nus_stats_t;
+
+/**
+ * link policy, counted since connected. energy is an estimate of the radio
+ * alone (connection events, packets, bytes on air), bytes are att payload
+ * both ways. uj x 1000 / bytes is the nJ per byte of a profile.
+ */
+typedef struct proto_link_stats
+{
+    uint32_t    rate;                       // bytes/s, last sample period
+    uint32_t    peak_rate;
+    uint32_t    bulk_bytes;                 // moved in BULK
+    uint32_t    bulk_uj;
+    uint32_t    idle_bytes;                 // moved in IDLE or DEFAULT
+    uint32_t    idle_uj;
+    uint32_t    switches;                   // profile changes asked for
+    uint32_t    refused;                    // parameter requests the central did not follow
+    uint16_t    interval;                   // 1.25ms units, now
+    uint16_t    latency;
+    uint8_t     data_len;                   // ll payload octets, tx
+    uint8_t     phy;                        // tx, BLE_GAP_PHY_1MBPS or BLE_GAP_PHY_2MBPS
+    uint8_t     profile;                    // PROTO_LINK_xxx
+} proto_link_stats_t;
+
+typedef struct proto_record
+{
+    uint8_t         type;
+    uint8_t         length;
+    uint8_t const * p_value;
+} proto_record_t;
+
+typedef struct proto_reader
+{
+    uint8_t const * p_buf;
+    uint16_t        length;
+    uint16_t        pos;
+    uint8_t         seq;
+} proto_reader_t;
+
+typedef struct proto_writer
+{
+    uint8_t *       p_buf;
+    uint16_t        size;
+    uint16_t        length;
+} proto_writer_t;
+
+/**
+ * true if p_data starts a v2 frame
+ */
+bool proto_is_frame(uint8_t const * p_data, uint16_t length);
+
+/**
+ * check frame header and that all records are within length.
+ * returns NRF_ERROR_INVALID_DATA if not a v2 frame,
+ * NRF_ERROR_INVALID_LENGTH if truncated or too long.
+ */
+ret_code_t proto_reader_init(proto_reader_t * p_reader, uint8_t const * p_data, uint16_t length);
+
+/**
+ * next record, p_record->p_value points into the frame.
+ * returns NRF_ERROR_NOT_FOUND after the last one.
+ */
+ret_code_t proto_next(proto_reader_t * p_reader, proto_record_t * p_record);
+
+/**
+ * start a frame with seq in p_buf, size is the max frame length,
+ * usually what mtu allows.
+ */
+void proto_writer_init(proto_writer_t * p_writer, uint8_t * p_buf, uint16_t size, uint8_t seq);
+
+/**
+ * true if no record is written yet
+ */
+bool proto_writer_empty(proto_writer_t const * p_writer);
+
+/**
+ * append a record, returns NRF_ERROR_NO_MEM if it doesn't fit,
+ * p_writer is untouched then.
+ */
+ret_code_t proto_put(proto_writer_t * p_writer, uint8_t type, uint8_t const * p_value, uint8_t length);
+
+/**
+ * typed encoders, each writes its own record type. requests without value
+ * (READ, STOP, STATUS) are written with proto_put. errors as proto_put.
+ */
+ret_code_t proto_put_start(proto_writer_t * p_writer, proto_start_t const * p_start);
+ret_code_t proto_put_wave(proto_writer_t * p_writer, proto_wave_t const * p_wave);
+ret_code_t proto_put_ack(proto_writer_t * p_writer, proto_ack_t const * p_ack);
+ret_code_t proto_put_state(proto_writer_t * p_writer, proto_state_t const * p_state);
+ret_code_t proto_put_status(proto_writer_t * p_writer, proto_status_t const * p_status);
+ret_code_t proto_put_stream_start(proto_writer_t * p_writer, uint16_t rate);
+ret_code_t proto_put_stream_data(proto_writer_t * p_writer, proto_sample_t const * p_samples, uint8_t num_of_samples);
+ret_code_t proto_put_stream_stats(proto_writer_t * p_writer, proto_stream_stats_t const * p_stats);
+ret_code_t proto_put_timing_stats(proto_writer_t * p_writer, proto_timing_stats_t const * p_stats);
+ret_code_t proto_put_comp_stats(proto_writer_t * p_writer, proto_comp_stats_t const * p_stats);
+ret_code_t proto_put_log_stats(proto_writer_t * p_writer, proto_log_stats_t const * p_stats);
+ret_code_t proto_put_nus_stats(proto_writer_t * p_writer, proto_nus_stats_t const * p_stats);
+ret_code_t proto_put_link_stats(proto_writer_t * p_writer, proto_link_stats_t const * p_stats);
+
+/**
+ * typed decoders, return NRF_ERROR_INVALID_PARAM if record type doesn't
+ * match, NRF_ERROR_INVALID_LENGTH if length doesn't.
+ */
+ret_code_t proto_get_start(proto_record_t const * p_record, proto_start_t * p_start);
+ret_code_t proto_get_wave(proto_record_t const * p_record, proto_wave_t * p_wave);
+ret_code_t proto_get_ack(proto_record_t const * p_record, proto_ack_t * p_ack);
+ret_code_t proto_get_state(proto_record_t const * p_record, proto_state_t * p_state);
+ret_code_t proto_get_status(proto_record_t const * p_record, proto_status_t * p_status);
+ret_code_t proto_get_stream_start(proto_record_t const * p_record, uint16_t * p_rate);
+ret_code_t proto_get_stream_stats(proto_record_t const * p_record, proto_stream_stats_t * p_stats);
+ret_code_t proto_get_timing_stats(proto_record_t const * p_record, proto_timing_stats_t * p_stats);
+ret_code_t proto_get_comp_stats(proto_record_t const * p_record, proto_comp_stats_t * p_stats);
+ret_code_t proto_get_log_stats(proto_record_t const * p_record, proto_log_stats_t * p_stats);
+ret_code_t proto_get_nus_stats(proto_record_t const * p_record, proto_nus_stats_t * p_stats);
+ret_code_t proto_get_link_stats(proto_record_t const * p_record, proto_link_stats_t * p_stats);
+
+/**
+ * samples are not copied, *pp_samples points into the frame.
+ */
+ret_code_t proto_get_stream_data(proto_record_t const * p_record,
+                                 proto_sample_t const ** pp_samples,
+                                 uint8_t * p_num_of_samples);
+
+#endif
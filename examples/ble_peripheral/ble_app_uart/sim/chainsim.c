@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "chainsim.h"
+#include "../stim_chain.h"
+
+/*
+ * timers are indexed as end points number them, events from 0x1, tasks from 0x8
+ */
+#define SIM_SPI_TIMER                       0
+#define SIM_SEG_TIMER                       1
+#define SIM_SEG_COUNTER                     2
+#define SIM_CYC_COUNTER                     3
+
+#define SIM_EP_PERIPH(ep)                   ((ep) >> 4)
+#define SIM_EP_INDEX(ep)                    ((ep) & 0x0F)
+#define SIM_EVT_TIMER(t, cc)                ((timing_ep_t)(((1 + (t)) << 4) | (cc)))
+
+#define SIM_EP_EVT_TIMER_FIRST              0x1
+#define SIM_EP_EVT_TIMER_LAST               0x4
+#define SIM_EP_TASK_TIMER_FIRST             0x8
+#define SIM_EP_TASK_TIMER_LAST              0xB
+
+// a link table looping back on itself is cut here
+#define SIM_MAX_DEPTH                       8
+
+#define SIM_SPI_BITS                        16
+#define SIM_SPI_WORD_TICKS                  (CHAINSIM_SPI_LEAD_TICKS + SIM_SPI_BITS * CHAINSIM_SPI_BIT_TICKS - 1 + CHAINSIM_SPI_TAIL_TICKS)
+
+#define SIM_VCD_PS_PER_TICK                 625     // vcd time unit is 100ps
+
+static void sim_event(chainsim_t * p_sim, timing_ep_t event, uint8_t depth);
+
+static void cycle_begin(chainsim_t * p_sim)
+{
+    p_sim->word_index = 0;
+    p_sim->latch_index = 0;
+}
+
+/*
+ * step a timer onto its next value, compare events are generated after the
+ * clear shorts are applied, as ppi tasks follow the event.
+ */
+static void timer_step(chainsim_t * p_sim, uint8_t t, uint8_t depth)
+{
+    chainsim_timer_t * p_timer = &p_sim->timers[t];
+    uint8_t match = 0;
+
+    p_timer->counter++;
+
+    for (uint8_t cc = 0; cc < CHAINSIM_NUM_OF_CC; cc++)
+    {
+        if (p_timer->counter == p_timer->cc[cc]) match |= (1 << cc);
+    }
+
+    if (match & p_timer->short_clear)
+    {
+        p_timer->counter = 0;
+    }
+
+    for (uint8_t cc = 0; cc < CHAINSIM_NUM_OF_CC; cc++)
+    {
+        if (match & (1 << cc)) sim_event(p_sim, SIM_EVT_TIMER(t, cc), depth);
+    }
+}
+
+static void timers_load(chainsim_t * p_sim, waveform_t const * p_wave)
+{
+    chainsim_timer_t * p_seg_timer = &p_sim->timers[SIM_SEG_TIMER];
+    chainsim_timer_t * p_seg_counter = &p_sim->timers[SIM_SEG_COUNTER];
+    uint32_t words = 0;
+
+    for (uint8_t i = 0; i < WAVEFORM_MAX_SEGS; i++)
+    {
+        if (i < p_wave->num_of_segs)
+        {
+            words += p_wave->seg_words[i];
+            p_seg_timer->cc[i] = p_wave->seg_time[i];
+            p_seg_counter->cc[i] = words;
+        }
+        else
+        {
+            p_seg_timer->cc[i] = STIM_CC_UNUSED;
+            p_seg_counter->cc[i] = STIM_CC_UNUSED;
+        }
+    }
+
+    p_seg_timer->cc[STIM_SEG_TIMER_CC_REWIND] = waveform_last_burst_end(p_wave);
+    p_seg_timer->cc[STIM_SEG_TIMER_CC_CYCLE] = p_wave->cycle_time;
+    p_seg_timer->short_clear = (1 << STIM_SEG_TIMER_CC_CYCLE);
+}
+
+static void dac_latch(chainsim_t * p_sim)
+{
+    waveform_t const * p_wave = p_sim->p_wave;
+    uint8_t seg = p_sim->latch_index++;
+    uint32_t burst = (uint32_t)(p_sim->tick - p_sim->seg_start);
+
+    p_sim->report.latches++;
+
+    if (seg >= p_wave->num_of_segs ||
+        memcmp(p_sim->dac_out, p_wave->seg_codes[seg], DAC_NUM_OF_CHANNELS) != 0)
+    {
+        p_sim->report.dac_errors++;
+    }
+
+    if (burst > p_sim->report.max_burst) p_sim->report.max_burst = burst;
+}
+
+/*
+ * a complete 16 bit frame, checked against the table and run as
+ * DAC088S085 does (see wave_replay in waveform.c).
+ */
+static void dac_command(chainsim_t * p_sim, uint16_t w)
+{
+    waveform_t const * p_wave = p_sim->p_wave;
+    uint8_t code = (uint8_t)(w >> 4);
+
+    p_sim->report.words++;
+    if (p_wave == NULL ||
+        p_sim->word_index >= p_wave->num_of_words ||
+        waveform_word_get(p_wave, p_sim->word_index) != w)
+    {
+        p_sim->report.word_errors++;
+    }
+    p_sim->word_index++;
+
+    switch (w >> 12)
+    {
+        case 0x8:
+            p_sim->dac_wtm = false;
+            break;
+        case 0x9:
+            p_sim->dac_wtm = true;
+            break;
+        case 0xA:
+            for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+            {
+                if (w & (1 << i)) p_sim->dac_out[i] = p_sim->dac_reg[i];
+            }
+            if (p_wave != NULL) dac_latch(p_sim);
+            break;
+        case 0xB:   // write A and update all
+            p_sim->dac_reg[0] = code;
+            memcpy(p_sim->dac_out, p_sim->dac_reg, DAC_NUM_OF_CHANNELS);
+            if (p_wave != NULL) dac_latch(p_sim);
+            break;
+        case 0xC:
+            memset(p_sim->dac_reg, code, DAC_NUM_OF_CHANNELS);
+            memset(p_sim->dac_out, code, DAC_NUM_OF_CHANNELS);
+            break;
+        case 0xD: case 0xE: case 0xF:
+            break;
+        default:    // 0x0 - 0x7 channel write
+            p_sim->dac_reg[w >> 12] = code;
+            if (p_sim->dac_wtm) p_sim->dac_out[w >> 12] = code;
+            break;
+    }
+}
+
+static void ss_toggle(chainsim_t * p_sim)
+{
+    p_sim->ss = !p_sim->ss;
+
+    if (!p_sim->ss)
+    {
+        p_sim->dac_shift = 0;
+        p_sim->dac_bits = 0;
+    }
+    else if (p_sim->dac_bits == SIM_SPI_BITS)
+    {
+        dac_command(p_sim, p_sim->dac_shift);
+    }
+    else
+    {
+        p_sim->report.frame_errors++;
+    }
+}
+
+static void spi_start(chainsim_t * p_sim)
+{
+    waveform_t const * p_wave = p_sim->p_wave;
+
+    if (p_sim->spi_busy)
+    {
+        p_sim->report.start_errors++;
+        return;
+    }
+
+    // past the table is whatever ram holds, all ones is ignored by the dac
+    if (p_wave != NULL && p_sim->tx_offset + 1 < sizeof(p_wave->spi_words))
+    {
+        p_sim->spi_word = (uint16_t)((p_wave->spi_words[p_sim->tx_offset] << 8) |
+                                     p_wave->spi_words[p_sim->tx_offset + 1]);
+    }
+    else
+    {
+        p_sim->spi_word = 0xFFFF;
+    }
+
+    p_sim->spi_busy = true;
+    p_sim->spi_elapsed = 0;
+    p_sim->spi_unframed = false;
+}
+
+static void spi_tick(chainsim_t * p_sim)
+{
+    uint32_t bit;
+
+    if (!p_sim->spi_busy) return;
+
+    p_sim->spi_elapsed++;
+
+    if (p_sim->spi_elapsed == SIM_SPI_WORD_TICKS)
+    {
+        p_sim->spi_busy = false;
+        p_sim->tx_offset += 2;
+        if (p_sim->spi_unframed) p_sim->report.frame_errors++;
+        sim_event(p_sim, TIMING_EVT_SPI_END, 0);
+        return;
+    }
+
+    if (p_sim->spi_elapsed < CHAINSIM_SPI_LEAD_TICKS ||
+        p_sim->spi_elapsed >= CHAINSIM_SPI_LEAD_TICKS + SIM_SPI_BITS * CHAINSIM_SPI_BIT_TICKS)
+    {
+        return;
+    }
+
+    bit = (p_sim->spi_elapsed - CHAINSIM_SPI_LEAD_TICKS) / CHAINSIM_SPI_BIT_TICKS;
+
+    if ((p_sim->spi_elapsed - CHAINSIM_SPI_LEAD_TICKS) % CHAINSIM_SPI_BIT_TICKS == 0)
+    {
+        p_sim->sck = true;
+        p_sim->mosi = (p_sim->spi_word >> (SIM_SPI_BITS - 1 - bit)) & 1;
+    }
+    else if (p_sim->sck)
+    {
+        p_sim->sck = false;
+
+        if (p_sim->ss)
+        {
+            p_sim->spi_unframed = true;
+        }
+        else if (p_sim->dac_bits < SIM_SPI_BITS)
+        {
+            p_sim->dac_shift = (uint16_t)((p_sim->dac_shift << 1) | p_sim->mosi);
+            p_sim->dac_bits++;
+        }
+    }
+}
+
+static void sim_task(chainsim_t * p_sim, timing_ep_t task, uint8_t depth)
+{
+    uint8_t periph = SIM_EP_PERIPH(task);
+    uint8_t index = SIM_EP_INDEX(task);
+    chainsim_timer_t * p_timer;
+
+    if (task == TIMING_TASK_SPI_START)
+    {
+        spi_start(p_sim);
+        return;
+    }
+
+    if (task == TIMING_TASK_SS_TOGGLE)
+    {
+        ss_toggle(p_sim);
+        return;
+    }
+
+    if (periph < SIM_EP_TASK_TIMER_FIRST || periph > SIM_EP_TASK_TIMER_LAST) return;
+
+    p_timer = &p_sim->timers[periph - SIM_EP_TASK_TIMER_FIRST];
+
+    switch (index)
+    {
+        case TIMING_TIMER_START:
+            p_timer->running = true;
+            break;
+        case TIMING_TIMER_STOP:
+            p_timer->running = false;
+            break;
+        case TIMING_TIMER_COUNT:
+            if (p_timer->prescaler == 0 && p_timer->running)
+            {
+                timer_step(p_sim, periph - SIM_EP_TASK_TIMER_FIRST, depth);
+            }
+            break;
+        case TIMING_TIMER_CLEAR:
+            p_timer->counter = 0;
+            p_timer->phase = 0;
+            break;
+        default:
+            if (index >= TIMING_TIMER_CAPTURE(0) && index < TIMING_TIMER_CAPTURE(CHAINSIM_NUM_OF_CC))
+            {
+                p_timer->cc[index - TIMING_TIMER_CAPTURE(0)] = p_timer->counter;
+            }
+            break;
+    }
+}
+
+/*
+ * what the engine hangs on seg timer besides ppi: segment starts are
+ * checked (before ppi starts the burst), the rewind compare has its
+ * interrupt enabled and the cycle compare starts a new cycle.
+ */
+static void seg_timer_event(chainsim_t * p_sim, uint8_t cc)
+{
+    if (cc < WAVEFORM_MAX_SEGS)
+    {
+        if (p_sim->spi_busy || p_sim->timers[SIM_SPI_TIMER].running)
+        {
+            p_sim->report.late_bursts++;
+        }
+        p_sim->seg_start = p_sim->tick;
+    }
+    else if (cc == STIM_SEG_TIMER_CC_REWIND)
+    {
+        // a pending interrupt is not pended twice
+        if (!p_sim->isr_pending)
+        {
+            p_sim->isr_pending = true;
+            p_sim->isr_due = p_sim->tick + p_sim->config.isr_latency;
+        }
+    }
+    else if (cc == STIM_SEG_TIMER_CC_CYCLE)
+    {
+        cycle_begin(p_sim);
+    }
+}
+
+static void sim_event(chainsim_t * p_sim, timing_ep_t event, uint8_t depth)
+{
+    if (depth >= SIM_MAX_DEPTH) return;
+
+    if (SIM_EP_PERIPH(event) == SIM_EP_EVT_TIMER_FIRST + SIM_SEG_TIMER)
+    {
+        seg_timer_event(p_sim, SIM_EP_INDEX(event));
+    }
+
+    for (uint8_t i = 0; i < p_sim->config.num_of_links; i++)
+    {
+        timing_link_t const * p_link = &p_sim->config.p_links[i];
+
+        if (p_link->event != event) continue;
+
+        sim_task(p_sim, p_link->task, depth + 1);
+        if (p_link->fork != TIMING_EP_NONE)
+        {
+            sim_task(p_sim, p_link->fork, depth + 1);
+        }
+    }
+}
+
+/*
+ * stim_seg_timer_callback on the rewind compare, without timing and
+ * stream refill. it takes no time.
+ */
+static void sim_isr(chainsim_t * p_sim)
+{
+    waveform_t const * p_old = p_sim->p_wave;
+    waveform_t const * p_wave = p_sim->p_pending;
+    uint32_t old_end;
+
+    p_sim->isr_pending = false;
+    p_sim->report.isrs++;
+
+    if (p_sim->timers[SIM_SPI_TIMER].cc[STIM_SPI_TIMER_CC_PROBE] != 0)
+    {
+        p_sim->report.overruns++;
+    }
+
+    p_sim->tx_offset = 0;
+
+    if (p_wave == NULL) return;
+
+    old_end = waveform_last_burst_end(p_old);
+    p_sim->p_wave = p_wave;
+    p_sim->p_pending = NULL;
+    p_sim->report.swaps++;
+    timers_load(p_sim, p_wave);
+
+    if (p_wave->cycle_time <= old_end + WAVEFORM_REWIND_US * WAVEFORM_TICKS_PER_US ||
+        p_wave->seg_time[p_wave->num_of_segs - 1] > old_end)
+    {
+        p_sim->timers[SIM_SEG_TIMER].counter = 0;
+        p_sim->timers[SIM_SEG_COUNTER].counter = 0;
+        timer_step(p_sim, SIM_CYC_COUNTER, 0);
+        cycle_begin(p_sim);
+    }
+}
+
+static void vcd_put(chainsim_t * p_sim, char const * p_str)
+{
+    if (p_sim->config.vcd_put != NULL)
+    {
+        p_sim->config.vcd_put(p_str, p_sim->config.p_context);
+    }
+}
+
+static void vcd_sample(chainsim_t * p_sim, uint8_t * p_now)
+{
+    p_now[0] = p_sim->ss;
+    p_now[1] = p_sim->sck;
+    p_now[2] = p_sim->mosi;
+    memcpy(&p_now[3], p_sim->dac_out, DAC_NUM_OF_CHANNELS);
+}
+
+/*
+ * signals are ss, sck, mosi (ids s, k, m) and dac_a - dac_h (ids A - H)
+ */
+static int vcd_value(char * p_buf, size_t size, uint8_t signal, uint8_t value)
+{
+    static char const ids[3] = { 's', 'k', 'm' };
+
+    if (signal < 3)
+    {
+        return snprintf(p_buf, size, "%d%c\n", value, ids[signal]);
+    }
+
+    char bits[9];
+    for (int i = 0; i < 8; i++)
+    {
+        bits[i] = (value & (0x80 >> i)) ? '1' : '0';
+    }
+    bits[8] = 0;
+
+    return snprintf(p_buf, size, "b%s %c\n", bits, 'A' + signal - 3);
+}
+
+static void vcd_header(chainsim_t * p_sim)
+{
+    char buf[512];
+    int n = 0;
+
+    n += snprintf(buf + n, sizeof(buf) - n,
+                  "$timescale 100 ps $end\n"
+                  "$scope module stim $end\n"
+                  "$var wire 1 s ss $end\n"
+                  "$var wire 1 k sck $end\n"
+                  "$var wire 1 m mosi $end\n");
+
+    for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+    {
+        n += snprintf(buf + n, sizeof(buf) - n, "$var wire 8 %c dac_%c $end\n", 'A' + i, 'a' + i);
+    }
+
+    n += snprintf(buf + n, sizeof(buf) - n, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+
+    vcd_sample(p_sim, p_sim->vcd_last);
+    for (uint8_t i = 0; i < sizeof(p_sim->vcd_last); i++)
+    {
+        n += vcd_value(buf + n, sizeof(buf) - n, i, p_sim->vcd_last[i]);
+    }
+
+    snprintf(buf + n, sizeof(buf) - n, "$end\n");
+    vcd_put(p_sim, buf);
+}
+
+static void vcd_dump(chainsim_t * p_sim)
+{
+    uint8_t now[sizeof(p_sim->vcd_last)];
+    char buf[256];
+    int n;
+
+    vcd_sample(p_sim, now);
+    if (memcmp(now, p_sim->vcd_last, sizeof(now)) == 0) return;
+
+    n = snprintf(buf, sizeof(buf), "#%llu\n", (unsigned long long)(p_sim->tick * SIM_VCD_PS_PER_TICK));
+
+    for (uint8_t i = 0; i < sizeof(now); i++)
+    {
+        if (now[i] != p_sim->vcd_last[i])
+        {
+            n += vcd_value(buf + n, sizeof(buf) - n, i, now[i]);
+        }
+    }
+
+    memcpy(p_sim->vcd_last, now, sizeof(now));
+    vcd_put(p_sim, buf);
+}
+
+void chainsim_init(chainsim_t * p_sim, chainsim_config_t const * p_config)
+{
+    memset(p_sim, 0, sizeof(*p_sim));
+    p_sim->config = *p_config;
+
+    for (uint8_t t = 0; t < CHAINSIM_NUM_OF_TIMERS; t++)
+    {
+        for (uint8_t cc = 0; cc < CHAINSIM_NUM_OF_CC; cc++)
+        {
+            p_sim->timers[t].cc[cc] = STIM_CC_UNUSED;
+        }
+    }
+
+    // spi timer enabled in stopped state, counters never stopped
+    p_sim->timers[SIM_SPI_TIMER].prescaler = 1;
+    p_sim->timers[SIM_SPI_TIMER].cc[0] = STIM_SPI_TIMER_START_TICKS;
+    p_sim->timers[SIM_SPI_TIMER].cc[1] = STIM_SPI_TIMER_SS_TICKS;
+    p_sim->timers[SIM_SEG_TIMER].prescaler = CHAINSIM_TICKS_PER_US / WAVEFORM_TICKS_PER_US;
+    p_sim->timers[SIM_SEG_COUNTER].running = true;
+    p_sim->timers[SIM_CYC_COUNTER].running = true;
+
+    // ss pin initial high, dac set to wrm mode and VMID by stim_prepare
+    p_sim->ss = true;
+    p_sim->dac_wtm = false;
+    memset(p_sim->dac_reg, DAC_CODE_MID, DAC_NUM_OF_CHANNELS);
+    memset(p_sim->dac_out, DAC_CODE_MID, DAC_NUM_OF_CHANNELS);
+
+    vcd_header(p_sim);
+}
+
+void chainsim_start(chainsim_t * p_sim, waveform_t const * p_wave)
+{
+    p_sim->p_wave = p_wave;
+    p_sim->p_pending = NULL;
+
+    p_sim->timers[SIM_SEG_COUNTER].counter = 0;
+    p_sim->timers[SIM_CYC_COUNTER].counter = 0;
+
+    timers_load(p_sim, p_wave);
+    p_sim->tx_offset = 0;
+
+    p_sim->timers[SIM_SEG_TIMER].counter = 0;
+    p_sim->timers[SIM_SEG_TIMER].phase = 0;
+    p_sim->timers[SIM_SEG_TIMER].running = true;
+    cycle_begin(p_sim);
+}
+
+void chainsim_swap(chainsim_t * p_sim, waveform_t const * p_wave)
+{
+    p_sim->p_pending = p_wave;
+}
+
+void chainsim_run(chainsim_t * p_sim, uint64_t ticks)
+{
+    for (uint64_t end = p_sim->tick + ticks; p_sim->tick < end; )
+    {
+        p_sim->tick++;
+
+        for (uint8_t t = 0; t < CHAINSIM_NUM_OF_TIMERS; t++)
+        {
+            chainsim_timer_t * p_timer = &p_sim->timers[t];
+
+            if (p_timer->prescaler == 0 || !p_timer->running) continue;
+
+            if (++p_timer->phase >= p_timer->prescaler)
+            {
+                p_timer->phase = 0;
+                timer_step(p_sim, t, 0);
+            }
+        }
+
+        spi_tick(p_sim);
+
+        if (p_sim->isr_pending && p_sim->tick >= p_sim->isr_due)
+        {
+            sim_isr(p_sim);
+        }
+
+        if (p_sim->config.vcd_put != NULL)
+        {
+            vcd_dump(p_sim);
+        }
+    }
+
+    p_sim->report.ticks = p_sim->tick;
+    p_sim->report.cycles = p_sim->timers[SIM_CYC_COUNTER].counter;
+}
+
+bool chainsim_ok(chainsim_t const * p_sim)
+{
+    chainsim_report_t const * p_report = &p_sim->report;
+
+    return p_report->word_errors == 0 &&
+           p_report->frame_errors == 0 &&
+           p_report->start_errors == 0 &&
+           p_report->dac_errors == 0 &&
+           p_report->late_bursts == 0 &&
+           p_report->overruns == 0;
+}
@@ -0,0 +1,154 @@
+#ifndef __CHAINSIM_H__
+#define __CHAINSIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../timing_link.h"
+#include "../waveform.h"
+
+/**
+ * Host simulator of the stimulation chain
+ *
+ * Runs a timing_link_t table (normally m_stim_links from stim_chain.h) over
+ * a model of the four timers, ppi, the ss gpiote toggle and spim, one step
+ * per 16MHz tick, and replays what a DAC088S085 on the bus would see. The
+ * rewind isr of howland.c is modelled with a given latency, so a compiled
+ * waveform_t can be checked word for word and latch for latch without a
+ * board or a scope.
+ *
+ * timer model, as on nrf52:
+ * - a compare event is generated when the counter steps onto cc, not when
+ *   it is cleared onto it.
+ * - seg timer runs at 1MHz (WAVEFORM_TICKS_PER_US), spi timer at 16MHz,
+ *   seg counter and cyc counter are counters. all are 32 bit.
+ * - seg timer cc STIM_SEG_TIMER_CC_CYCLE has the clear short.
+ *
+ * spim model (8MHz, mode 1, msb first, one 16 bit word per start):
+ * CHAINSIM_SPI_LEAD_TICKS from start task to first sck rise, 2 ticks per bit,
+ * mosi changes on rise and the dac samples on fall, end event
+ * CHAINSIM_SPI_TAIL_TICKS after the last fall. tx pointer is post
+ * incremented at end. with the spi timer restart that is 48 ticks per word,
+ * as measured in test6e.
+ *
+ * This is host only code, it is not part of the firmware project. Build
+ * with waveform.c and the sdk include paths used for the firmware, see
+ * chainsim_main.c.
+ */
+#define CHAINSIM_TICKS_PER_US               16
+#define CHAINSIM_SPI_LEAD_TICKS             8
+#define CHAINSIM_SPI_BIT_TICKS              2
+#define CHAINSIM_SPI_TAIL_TICKS             8
+
+#define CHAINSIM_NUM_OF_TIMERS              4
+#define CHAINSIM_NUM_OF_CC                  6
+
+/**
+ * vcd output, p_str is one or more complete lines
+ */
+typedef void (*chainsim_vcd_put_t)(char const * p_str, void * p_context);
+
+typedef struct chainsim_config
+{
+    timing_link_t const *   p_links;
+    uint8_t                 num_of_links;
+    uint32_t                isr_latency;            // 16MHz ticks from rewind compare to isr
+    chainsim_vcd_put_t      vcd_put;                // NULL for no trace
+    void *                  p_context;
+} chainsim_config_t;
+
+typedef struct chainsim_report
+{
+    uint64_t    ticks;
+    uint32_t    cycles;                     // cyc counter
+    uint32_t    isrs;                       // rewind isrs run
+    uint32_t    swaps;
+    uint32_t    words;                      // words clocked into dac
+    uint32_t    word_errors;                // word differs from table at its place in cycle
+    uint32_t    frame_errors;               // ss pulse without exactly 16 bits, or clock with ss high
+    uint32_t    start_errors;               // spi start while busy
+    uint32_t    latches;                    // dac update commands
+    uint32_t    dac_errors;                 // outputs after update differ from seg_codes
+    uint32_t    late_bursts;                // spi timer still running at a segment start
+    uint32_t    overruns;                   // spi timer probe non zero at rewind compare
+    uint32_t    max_burst;                  // ticks from segment start to its latch
+} chainsim_report_t;
+
+typedef struct chainsim_timer
+{
+    uint32_t    counter;
+    uint32_t    cc[CHAINSIM_NUM_OF_CC];
+    uint32_t    prescaler;                  // ticks per step, 0 for counter mode
+    uint32_t    phase;
+    uint8_t     short_clear;                // cc mask clearing the timer
+    bool        running;
+} chainsim_timer_t;
+
+// set up by chainsim_init, report is read directly
+typedef struct chainsim
+{
+    chainsim_config_t   config;
+    chainsim_timer_t    timers[CHAINSIM_NUM_OF_TIMERS];
+
+    waveform_t const *  p_wave;             // playing
+    waveform_t const *  p_pending;          // swapped in by next isr
+    uint32_t            tx_offset;          // spim tx pointer, bytes into p_wave->spi_words
+
+    // spim
+    bool                spi_busy;
+    uint32_t            spi_elapsed;
+    uint16_t            spi_word;
+    bool                ss;
+    bool                sck;
+    bool                mosi;
+    bool                spi_unframed;       // a bit was clocked with ss high
+
+    // dac
+    uint16_t            dac_shift;
+    uint8_t             dac_bits;
+    bool                dac_wtm;
+    uint8_t             dac_reg[DAC_NUM_OF_CHANNELS];
+    uint8_t             dac_out[DAC_NUM_OF_CHANNELS];
+
+    // checks, per cycle
+    uint16_t            word_index;
+    uint8_t             latch_index;
+    uint64_t            seg_start;
+    uint64_t            isr_due;
+    bool                isr_pending;
+
+    uint64_t            tick;
+    uint8_t             vcd_last[3 + DAC_NUM_OF_CHANNELS];  // ss, sck, mosi, outputs
+    chainsim_report_t   report;
+} chainsim_t;
+
+/**
+ * set up peripherals as stim_prepare leaves them: ss high, spi timer
+ * stopped with STIM_SPI_TIMER_START_TICKS and STIM_SPI_TIMER_SS_TICKS,
+ * counters running, dac in WRM mode with all outputs VMID, and write the vcd
+ * header if a trace is wanted.
+ */
+void chainsim_init(chainsim_t * p_sim, chainsim_config_t const * p_config);
+
+/**
+ * load p_wave and start seg timer, as stim_start.
+ * p_wave must stay valid while it is played.
+ */
+void chainsim_start(chainsim_t * p_sim, waveform_t const * p_wave);
+
+/**
+ * have the next rewind isr swap p_wave in, as stim_commit while running.
+ */
+void chainsim_swap(chainsim_t * p_sim, waveform_t const * p_wave);
+
+/**
+ * run for ticks (16MHz)
+ */
+void chainsim_run(chainsim_t * p_sim, uint64_t ticks);
+
+/**
+ * true if nothing went wrong so far
+ */
+bool chainsim_ok(chainsim_t const * p_sim);
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * chainsim, regression run of the stimulation chain on a host
+ *
+ * plays a few waveforms through m_stim_links (stim_chain.h) and checks what
+ * the dac receives, see chainsim.h. exits non zero if any check fails.
+ *
+ * usage: chainsim [-l isr latency us] [-v vcd file prefix]
+ *
+ * with -v each scenario is traced to <prefix>_<name>.vcd (gtkwave etc).
+ *
+ * build as described in sim/README:
+ * gcc -std=gnu99 -DNRF52832_XXAA $INC sim/chainsim.c sim/chainsim_main.c waveform.c -o chainsim
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chainsim.h"
+#include "../stim_chain.h"
+
+#define SIM_DEFAULT_LATENCY_US              10
+
+typedef struct scenario
+{
+    char const *    name;
+    bool            (*run)(chainsim_t * p_sim);
+} scenario_t;
+
+static waveform_t m_wave[2];
+
+static ret_code_t compile(uint16_t freq, uint16_t pulse_width, uint16_t recycle_ratio, waveform_t * p_wave)
+{
+    ble_incomming_message_t msg = {
+        .c              = 2,
+        .freq           = freq,
+        .num_of_pulses  = 1,
+        .pulse_width    = pulse_width,
+        .recycle_ratio  = recycle_ratio,
+        .current        = { 20, -20, 10, -10, 40, -40, 0, 1 },
+    };
+
+    return waveform_compile(&msg, p_wave);
+}
+
+static uint64_t cycles_ticks(waveform_t const * p_wave, uint32_t cycles)
+{
+    return (uint64_t)p_wave->cycle_time * cycles * CHAINSIM_TICKS_PER_US / WAVEFORM_TICKS_PER_US;
+}
+
+/*
+ * each run ends after the expected number of cycles, checks are run on
+ * every word and latch on the way.
+ */
+static bool run_pulse(chainsim_t * p_sim)
+{
+    if (compile(1000, 100, 2, &m_wave[0]) != NRF_SUCCESS) return false;
+
+    chainsim_start(p_sim, &m_wave[0]);
+    chainsim_run(p_sim, cycles_ticks(&m_wave[0], 20));
+
+    return p_sim->report.cycles == 20 && p_sim->report.latches == 20 * m_wave[0].num_of_segs;
+}
+
+/*
+ * the isr loads the new cycle compare, so the cycle it runs in already ends
+ * at the new cycle time. going back to the long cycle, its segments start
+ * past where the short one is at the swap, so the idle tail is cut rather
+ * than having them fire in it. last, a table of the same period with a
+ * longer pulse, its segments start past the old ones too.
+ * every step is checked on its own, words and latches against the table
+ * playing, and the spi timer at each rewind.
+ */
+static bool swap_step(chainsim_t * p_sim, waveform_t const * p_wave, uint32_t cycles, uint32_t min_cycles)
+{
+    chainsim_report_t before = p_sim->report;
+
+    chainsim_swap(p_sim, p_wave);
+    chainsim_run(p_sim, cycles_ticks(p_wave, cycles));
+
+    return p_sim->report.swaps == before.swaps + 1 &&
+           p_sim->report.cycles >= before.cycles + min_cycles &&
+           p_sim->report.word_errors == before.word_errors &&
+           p_sim->report.dac_errors == before.dac_errors &&
+           p_sim->report.overruns == before.overruns;
+}
+
+static bool run_swap(chainsim_t * p_sim)
+{
+    static waveform_t same;
+
+    if (compile(200, 100, 4, &m_wave[0]) != NRF_SUCCESS) return false;
+    if (compile(500, 50, 0, &m_wave[1]) != NRF_SUCCESS) return false;
+    if (compile(200, 300, 1, &same) != NRF_SUCCESS) return false;
+    if (same.cycle_time != m_wave[0].cycle_time) return false;
+
+    chainsim_start(p_sim, &m_wave[0]);
+    chainsim_run(p_sim, cycles_ticks(&m_wave[0], 2));
+
+    // long to short, the old cycle ends at the new cycle time
+    if (!swap_step(p_sim, &m_wave[1], 5, 5) || p_sim->report.cycles != 7) return false;
+
+    // short to long, and long to a long one of the same period
+    return swap_step(p_sim, &m_wave[0], 4, 3) && swap_step(p_sim, &same, 4, 3);
+}
+
+/*
+ * the new cycle is shorter than where the old one is at the swap, the idle
+ * tail is cut and the new one starts from the isr.
+ */
+static bool run_cut(chainsim_t * p_sim)
+{
+    if (compile(10, 500, 1, &m_wave[0]) != NRF_SUCCESS) return false;
+    if (compile(1000, 100, 1, &m_wave[1]) != NRF_SUCCESS) return false;
+
+    chainsim_start(p_sim, &m_wave[0]);
+    chainsim_swap(p_sim, &m_wave[1]);
+    chainsim_run(p_sim, cycles_ticks(&m_wave[1], 6));
+
+    return p_sim->report.swaps == 1 && p_sim->report.cycles >= 5;
+}
+
+/*
+ * only C and D move, each segment is their two writes and the update, and
+ * the other outputs stay at VMID from stim_prepare.
+ */
+static bool run_sparse(chainsim_t * p_sim)
+{
+    ble_incomming_message_t msg = {
+        .c              = 2,
+        .freq           = 1000,
+        .num_of_pulses  = 1,
+        .pulse_width    = 10,
+        .recycle_ratio  = 4,
+        .current        = { 0, 0, 10, -10, 0, 0, 0, 0 },
+    };
+
+    if (waveform_compile(&msg, &m_wave[0]) != NRF_SUCCESS) return false;
+
+    chainsim_start(p_sim, &m_wave[0]);
+    chainsim_run(p_sim, cycles_ticks(&m_wave[0], 10));
+
+    return m_wave[0].num_of_words == 3 * 3 && p_sim->report.words == 10 * m_wave[0].num_of_words;
+}
+
+static bool run_stream(chainsim_t * p_sim)
+{
+    int8_t current[DAC_NUM_OF_CHANNELS] = { 0 };
+
+    if (waveform_compile_stream(1000, &m_wave[0]) != NRF_SUCCESS) return false;
+    if (waveform_compile_stream(1000, &m_wave[1]) != NRF_SUCCESS) return false;
+
+    chainsim_start(p_sim, &m_wave[0]);
+
+    // a new sample every cycle, through the ping pong tables
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        current[i % DAC_NUM_OF_CHANNELS] = (int8_t)(i * 7);
+        waveform_stream_set(&m_wave[(i + 1) & 1], current);
+        chainsim_swap(p_sim, &m_wave[(i + 1) & 1]);
+        chainsim_run(p_sim, cycles_ticks(&m_wave[0], 1));
+    }
+
+    return p_sim->report.swaps == 16;
+}
+
+static scenario_t const m_scenarios[] = {
+    { "pulse",      run_pulse },
+    { "swap",       run_swap },
+    { "cut",        run_cut },
+    { "sparse",     run_sparse },
+    { "stream",     run_stream },
+};
+
+static void vcd_write(char const * p_str, void * p_context)
+{
+    fputs(p_str, (FILE *)p_context);
+}
+
+static void report_print(char const * p_name, chainsim_t const * p_sim, bool ok)
+{
+    chainsim_report_t const * p = &p_sim->report;
+
+    printf("%-8s %s cycles %u isrs %u swaps %u words %u latches %u max burst %uus\n",
+           p_name, ok ? "ok  " : "FAIL",
+           p->cycles, p->isrs, p->swaps, p->words, p->latches,
+           p->max_burst / CHAINSIM_TICKS_PER_US);
+
+    if (!chainsim_ok(p_sim))
+    {
+        printf("         word %u frame %u start %u dac %u late %u overrun %u\n",
+               p->word_errors, p->frame_errors, p->start_errors,
+               p->dac_errors, p->late_bursts, p->overruns);
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t latency = SIM_DEFAULT_LATENCY_US;
+    char const * p_prefix = NULL;
+    int failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:v:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                latency = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                p_prefix = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-l isr latency us] [-v vcd file prefix]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(m_scenarios) / sizeof(m_scenarios[0]); i++)
+    {
+        static chainsim_t sim;
+        chainsim_config_t config = {
+            .p_links        = m_stim_links,
+            .num_of_links   = STIM_NUM_OF_LINKS,
+            .isr_latency    = latency * CHAINSIM_TICKS_PER_US,
+        };
+        FILE * p_file = NULL;
+        bool ok;
+
+        if (p_prefix != NULL)
+        {
+            char path[256];
+
+            snprintf(path, sizeof(path), "%s_%s.vcd", p_prefix, m_scenarios[i].name);
+            p_file = fopen(path, "w");
+            if (p_file == NULL)
+            {
+                perror(path);
+                return 2;
+            }
+            config.vcd_put = vcd_write;
+            config.p_context = p_file;
+        }
+
+        chainsim_init(&sim, &config);
+        ok = m_scenarios[i].run(&sim) && chainsim_ok(&sim);
+        report_print(m_scenarios[i].name, &sim, ok);
+        failed += ok ? 0 : 1;
+
+        if (p_file != NULL) fclose(p_file);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,526 @@
+/*
+ * chaintest, checks timing_chain_apply and friends (timing.c) on a host
+ * against a model of nrfx_ppi
+ *
+ * the model keeps what the ppi driver and peripheral would: channels and
+ * groups allocated, eep, tep and fork of each channel, group members and
+ * group enable. it rejects what nrfx_ppi rejects (assign or free of a channel
+ * not allocated, etc), such an error ends up in app_error_handler_bare and
+ * fails the check. channels or groups can be taken away to make allocation
+ * fail.
+ *
+ * checked: apply, apply again with fewer and more links (channels reused,
+ * surplus freed, forks cleared), invalid tables (unknown end points, a
+ * task where an event goes or the other way round) leave the chain alone,
+ * release of everything after a channel or group allocation failure, group
+ * enable and disable, release. exits non zero if any check fails.
+ *
+ * usage: chaintest
+ *
+ * build as described in sim/README:
+ * gcc -std=gnu99 -DNRF52832_XXAA $INC sim/chaintest.c timing.c -o chaintest
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "nrf_drv_spi.h"
+#include "nrf_drv_timer.h"
+#include "nrfx_gpiote.h"
+#include "nrfx_ppi.h"
+
+#include "../howland.h"
+#include "../timing.h"
+#include "../stim_chain.h"
+
+#define MOCK_NUM_OF_CHANNELS                20      // PPI_CH_NUM, app channels of nrf52832
+#define MOCK_NUM_OF_GROUPS                  6
+
+#define MOCK_SPI_END_ADDR                   0x40004118UL
+#define MOCK_SPI_START_ADDR                 0x40004010UL
+#define MOCK_GPIOTE_OUT_ADDR(pin)           (0x40006000UL + (pin))
+
+/*
+ * the peripherals the links are resolved against, as howland.c defines them
+ */
+nrf_drv_spi_t const m_dac_spi         = NRF_DRV_SPI_INSTANCE(DAC_SPI_INSTANCE);
+nrf_drv_timer_t const m_seg_counter   = NRF_DRV_TIMER_INSTANCE(SEG_COUNTER_ID);
+nrf_drv_timer_t const m_cyc_counter   = NRF_DRV_TIMER_INSTANCE(CYC_COUNTER_ID);
+nrf_drv_timer_t const m_spi_timer     = NRF_DRV_TIMER_INSTANCE(SPI_TIMER_ID);
+nrf_drv_timer_t const m_seg_timer     = NRF_DRV_TIMER_INSTANCE(SEG_TIMER_ID);
+
+typedef struct mock_channel
+{
+    bool        allocated;
+    bool        enabled;
+    uint32_t    eep;
+    uint32_t    tep;
+    uint32_t    fork;
+} mock_channel_t;
+
+typedef struct mock_group
+{
+    bool        allocated;
+    bool        enabled;
+    uint32_t    mask;
+} mock_group_t;
+
+static mock_channel_t   m_ch[MOCK_NUM_OF_CHANNELS];
+static mock_group_t     m_grp[MOCK_NUM_OF_GROUPS];
+static int              m_app_errors;
+static int              m_failed;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) { printf("  " __VA_ARGS__); printf("\n"); m_failed++; }    \
+    } while (0)
+
+/*
+ * nrfx_ppi model
+ */
+nrfx_err_t nrfx_ppi_channel_alloc(nrf_ppi_channel_t * p_channel)
+{
+    for (int i = 0; i < MOCK_NUM_OF_CHANNELS; i++)
+    {
+        if (!m_ch[i].allocated)
+        {
+            memset(&m_ch[i], 0, sizeof(mock_channel_t));
+            m_ch[i].allocated = true;
+            *p_channel = (nrf_ppi_channel_t)i;
+            return NRFX_SUCCESS;
+        }
+    }
+    return NRFX_ERROR_NO_MEM;
+}
+
+nrfx_err_t nrfx_ppi_channel_free(nrf_ppi_channel_t channel)
+{
+    if (channel >= MOCK_NUM_OF_CHANNELS || !m_ch[channel].allocated) return NRFX_ERROR_INVALID_PARAM;
+
+    m_ch[channel].allocated = false;
+    m_ch[channel].enabled = false;
+    for (int g = 0; g < MOCK_NUM_OF_GROUPS; g++)
+    {
+        m_grp[g].mask &= ~(1UL << channel);
+    }
+    return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_ppi_channel_assign(nrf_ppi_channel_t channel, uint32_t eep, uint32_t tep)
+{
+    if (channel >= MOCK_NUM_OF_CHANNELS || !m_ch[channel].allocated) return NRFX_ERROR_INVALID_STATE;
+    if (eep == 0 || tep == 0) return NRFX_ERROR_INVALID_PARAM;
+
+    m_ch[channel].eep = eep;
+    m_ch[channel].tep = tep;
+    return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_ppi_channel_fork_assign(nrf_ppi_channel_t channel, uint32_t fork_tep)
+{
+    if (channel >= MOCK_NUM_OF_CHANNELS || !m_ch[channel].allocated) return NRFX_ERROR_INVALID_STATE;
+
+    m_ch[channel].fork = fork_tep;
+    return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_ppi_channel_enable(nrf_ppi_channel_t channel)
+{
+    if (channel >= MOCK_NUM_OF_CHANNELS || !m_ch[channel].allocated) return NRFX_ERROR_INVALID_STATE;
+
+    m_ch[channel].enabled = true;
+    return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_ppi_group_alloc(nrf_ppi_channel_group_t * p_group)
+{
+    for (int g = 0; g < MOCK_NUM_OF_GROUPS; g++)
+    {
+        if (!m_grp[g].allocated)
+        {
+            memset(&m_grp[g], 0, sizeof(mock_group_t));
+            m_grp[g].allocated = true;
+            *p_group = (nrf_ppi_channel_group_t)g;
+            return NRFX_SUCCESS;
+        }
+    }
+    return NRFX_ERROR_NO_MEM;
+}
+
+nrfx_err_t nrfx_ppi_group_free(nrf_ppi_channel_group_t group)
+{
+    if (group >= MOCK_NUM_OF_GROUPS || !m_grp[group].allocated) return NRFX_ERROR_INVALID_PARAM;
+
+    m_grp[group].allocated = false;
+    m_grp[group].enabled = false;
+    m_grp[group].mask = 0;
+    return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_ppi_channels_include_in_group(uint32_t channel_mask, nrf_ppi_channel_group_t group)
+{
+    if (group >= MOCK_NUM_OF_GROUPS || !m_grp[group].allocated) return NRFX_ERROR_INVALID_STATE;
+
+    for (int i = 0; i < MOCK_NUM_OF_CHANNELS; i++)
+    {
+        if ((channel_mask & (1UL << i)) && !m_ch[i].allocated) return NRFX_ERROR_INVALID_PARAM;
+    }
+    m_grp[group].mask |= channel_mask;
+    return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_ppi_channels_remove_from_group(uint32_t channel_mask, nrf_ppi_channel_group_t group)
+{
+    if (group >= MOCK_NUM_OF_GROUPS || !m_grp[group].allocated) return NRFX_ERROR_INVALID_STATE;
+
+    m_grp[group].mask &= ~channel_mask;
+    return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_ppi_group_enable(nrf_ppi_channel_group_t group)
+{
+    if (group >= MOCK_NUM_OF_GROUPS || !m_grp[group].allocated) return NRFX_ERROR_INVALID_STATE;
+
+    m_grp[group].enabled = true;
+    return NRFX_SUCCESS;
+}
+
+nrfx_err_t nrfx_ppi_group_disable(nrf_ppi_channel_group_t group)
+{
+    if (group >= MOCK_NUM_OF_GROUPS || !m_grp[group].allocated) return NRFX_ERROR_INVALID_STATE;
+
+    m_grp[group].enabled = false;
+    return NRFX_SUCCESS;
+}
+
+/*
+ * the rest of what timing.c links against, only addresses are used here
+ */
+uint32_t nrfx_spim_end_event_get(nrfx_spim_t const * p_instance)
+{
+    (void)p_instance;
+    return MOCK_SPI_END_ADDR;
+}
+
+uint32_t nrfx_spim_start_task_get(nrfx_spim_t const * p_instance)
+{
+    (void)p_instance;
+    return MOCK_SPI_START_ADDR;
+}
+
+uint32_t nrfx_gpiote_out_task_addr_get(nrfx_gpiote_pin_t pin)
+{
+    return MOCK_GPIOTE_OUT_ADDR(pin);
+}
+
+bool nrfx_gpiote_is_init(void) { return true; }
+nrfx_err_t nrfx_gpiote_init(void) { return NRFX_SUCCESS; }
+nrfx_err_t nrfx_gpiote_out_init(nrfx_gpiote_pin_t pin, nrfx_gpiote_out_config_t const * p_config)
+{
+    (void)pin; (void)p_config;
+    return NRFX_SUCCESS;
+}
+void nrfx_gpiote_out_task_enable(nrfx_gpiote_pin_t pin) { (void)pin; }
+
+nrfx_err_t nrfx_timer_init(nrfx_timer_t const * p_instance, nrfx_timer_config_t const * p_config,
+                           nrfx_timer_event_handler_t timer_event_handler)
+{
+    (void)p_instance; (void)p_config; (void)timer_event_handler;
+    return NRFX_SUCCESS;
+}
+
+void nrfx_timer_compare(nrfx_timer_t const * p_instance, nrf_timer_cc_channel_t cc_channel,
+                        uint32_t cc_value, bool enable_int)
+{
+    (void)p_instance; (void)cc_channel; (void)cc_value; (void)enable_int;
+}
+
+void nrfx_timer_extended_compare(nrfx_timer_t const * p_instance, nrf_timer_cc_channel_t cc_channel,
+                                 uint32_t cc_value, nrf_timer_short_mask_t timer_short_mask,
+                                 bool enable_int)
+{
+    (void)p_instance; (void)cc_channel; (void)cc_value; (void)timer_short_mask; (void)enable_int;
+}
+
+void app_error_handler_bare(ret_code_t error_code)
+{
+    printf("  app error 0x%X\n", (unsigned)error_code);
+    m_app_errors++;
+}
+
+/*
+ * expected register addresses, resolved here from the end point codes of
+ * timing_link.h without timing.c
+ */
+static nrf_drv_timer_t const * timer_get(uint8_t periph)
+{
+    switch (periph)
+    {
+        case 0x1: case 0x8: return &m_spi_timer;
+        case 0x2: case 0x9: return &m_seg_timer;
+        case 0x3: case 0xA: return &m_seg_counter;
+        case 0x4: case 0xB: return &m_cyc_counter;
+        default:            return NULL;
+    }
+}
+
+static uint32_t expected_addr(timing_ep_t ep)
+{
+    static nrf_timer_task_t const tasks[] = {
+        NRF_TIMER_TASK_START, NRF_TIMER_TASK_STOP, NRF_TIMER_TASK_COUNT, NRF_TIMER_TASK_CLEAR,
+    };
+    uint8_t periph = ep >> 4;
+    uint8_t idx = ep & 0x0F;
+
+    if (ep == TIMING_EP_NONE)       return 0;
+    if (ep == TIMING_EVT_SPI_END)   return MOCK_SPI_END_ADDR;
+    if (ep == TIMING_TASK_SPI_START) return MOCK_SPI_START_ADDR;
+    if (ep == TIMING_TASK_SS_TOGGLE) return MOCK_GPIOTE_OUT_ADDR(DAC_SPI_SS_PIN);
+    if (periph <= 0x4)              return nrfx_timer_compare_event_address_get(timer_get(periph), idx);
+    if (idx < 4)                    return nrfx_timer_task_address_get(timer_get(periph), tasks[idx]);
+    return nrfx_timer_capture_task_address_get(timer_get(periph), idx - TIMING_TIMER_CAPTURE(0));
+}
+
+static int channels_allocated(void)
+{
+    int n = 0;
+
+    for (int i = 0; i < MOCK_NUM_OF_CHANNELS; i++)
+    {
+        if (m_ch[i].allocated) n++;
+    }
+    return n;
+}
+
+static int groups_allocated(void)
+{
+    int n = 0;
+
+    for (int g = 0; g < MOCK_NUM_OF_GROUPS; g++)
+    {
+        if (m_grp[g].allocated) n++;
+    }
+    return n;
+}
+
+/*
+ * the chain runs exactly p_links, in one disabled group
+ */
+static void chain_check(timing_chain_t const * p_chain, timing_link_t const * p_links, uint8_t num_of_links)
+{
+    uint32_t mask = 0;
+
+    CHECK(p_chain->has_group && m_grp[p_chain->group].allocated, "no group");
+    CHECK(p_chain->num_of_links == num_of_links && p_chain->num_of_channels == num_of_links,
+          "links %u channels %u, want %u", p_chain->num_of_links, p_chain->num_of_channels, num_of_links);
+
+    for (uint8_t i = 0; i < num_of_links && i < p_chain->num_of_channels; i++)
+    {
+        mock_channel_t const * p_ch = &m_ch[p_chain->channels[i]];
+
+        CHECK(p_ch->allocated, "link %u channel %u not allocated", i, p_chain->channels[i]);
+        CHECK(p_ch->eep == expected_addr(p_links[i].event), "link %u eep 0x%08X, want 0x%08X",
+              i, (unsigned)p_ch->eep, (unsigned)expected_addr(p_links[i].event));
+        CHECK(p_ch->tep == expected_addr(p_links[i].task), "link %u tep 0x%08X, want 0x%08X",
+              i, (unsigned)p_ch->tep, (unsigned)expected_addr(p_links[i].task));
+        CHECK(p_ch->fork == expected_addr(p_links[i].fork), "link %u fork 0x%08X, want 0x%08X",
+              i, (unsigned)p_ch->fork, (unsigned)expected_addr(p_links[i].fork));
+        CHECK(!p_ch->enabled, "link %u channel enabled on its own", i);
+        mask |= 1UL << p_chain->channels[i];
+    }
+
+    CHECK(m_grp[p_chain->group].mask == mask, "group mask 0x%05X, want 0x%05X",
+          (unsigned)m_grp[p_chain->group].mask, (unsigned)mask);
+    CHECK(!m_grp[p_chain->group].enabled, "group left enabled");
+}
+
+static void mock_reset(void)
+{
+    memset(m_ch, 0, sizeof(m_ch));
+    memset(m_grp, 0, sizeof(m_grp));
+}
+
+static void run(char const * name, void (*test)(void))
+{
+    int failed = m_failed;
+
+    mock_reset();
+    m_app_errors = 0;
+    test();
+    CHECK(m_app_errors == 0, "%d app errors", m_app_errors);
+    printf("%-10s %s\n", name, m_failed == failed ? "ok" : "FAILED");
+}
+
+static timing_link_t const m_short_links[] = {
+    { TIMING_EVT_SPI_TIMER(0),      TIMING_TASK_SPI_START,                      TIMING_TASK_SS_TOGGLE },
+    { TIMING_EVT_SPI_END,           TIMING_TASK_SS_TOGGLE,                      TIMING_EP_NONE },
+    { TIMING_EVT_CYC_COUNTER(0),    TIMING_TASK_SEG_TIMER(TIMING_TIMER_STOP),   TIMING_EP_NONE },
+};
+
+#define NUM_OF_SHORT_LINKS                  (sizeof(m_short_links) / sizeof(m_short_links[0]))
+
+static void test_apply(void)
+{
+    timing_chain_t chain = { 0 };
+
+    CHECK(timing_chain_apply(&chain, m_stim_links, STIM_NUM_OF_LINKS) == NRF_SUCCESS, "apply");
+    chain_check(&chain, m_stim_links, STIM_NUM_OF_LINKS);
+    CHECK(channels_allocated() == (int)STIM_NUM_OF_LINKS && groups_allocated() == 1, "held %d %d",
+          channels_allocated(), groups_allocated());
+
+    timing_chain_release(&chain);
+    CHECK(channels_allocated() == 0 && groups_allocated() == 0, "not released");
+    CHECK(!chain.has_group && chain.num_of_channels == 0 && chain.num_of_links == 0, "chain not cleared");
+}
+
+/*
+ * fewer links keep the first channels and free the rest, forks left from
+ * the table before are cleared. more links keep them all and add new ones.
+ */
+static void test_reapply(void)
+{
+    timing_chain_t chain = { 0 };
+    nrf_ppi_channel_t before[TIMING_MAX_LINKS];
+    nrf_ppi_channel_group_t group;
+
+    CHECK(timing_chain_apply(&chain, m_stim_links, STIM_NUM_OF_LINKS) == NRF_SUCCESS, "apply");
+    memcpy(before, chain.channels, sizeof(before));
+    group = chain.group;
+
+    CHECK(timing_chain_apply(&chain, m_short_links, NUM_OF_SHORT_LINKS) == NRF_SUCCESS, "apply fewer");
+    chain_check(&chain, m_short_links, NUM_OF_SHORT_LINKS);
+    CHECK(memcmp(chain.channels, before, NUM_OF_SHORT_LINKS * sizeof(nrf_ppi_channel_t)) == 0, "channels not reused");
+    CHECK(chain.group == group, "group not reused");
+    CHECK(channels_allocated() == (int)NUM_OF_SHORT_LINKS && groups_allocated() == 1, "surplus not freed");
+
+    CHECK(timing_chain_apply(&chain, m_stim_links, STIM_NUM_OF_LINKS) == NRF_SUCCESS, "apply more");
+    chain_check(&chain, m_stim_links, STIM_NUM_OF_LINKS);
+    CHECK(memcmp(chain.channels, before, NUM_OF_SHORT_LINKS * sizeof(nrf_ppi_channel_t)) == 0, "channels not reused");
+    CHECK(channels_allocated() == (int)STIM_NUM_OF_LINKS && groups_allocated() == 1, "held %d %d",
+          channels_allocated(), groups_allocated());
+
+    // empty table, channels freed, group kept
+    CHECK(timing_chain_apply(&chain, m_stim_links, 0) == NRF_SUCCESS, "apply none");
+    chain_check(&chain, m_stim_links, 0);
+    CHECK(channels_allocated() == 0 && groups_allocated() == 1, "held %d %d",
+          channels_allocated(), groups_allocated());
+
+    timing_chain_release(&chain);
+}
+
+/*
+ * rejected before anything is touched
+ */
+static void test_invalid(void)
+{
+    static timing_link_t const bad_links[][1] = {
+        { { TIMING_EVT_SEG_TIMER(6),    TIMING_TASK_SPI_START,                      TIMING_EP_NONE } },
+        { { TIMING_TASK_SPI_START,      TIMING_TASK_SS_TOGGLE,                      TIMING_EP_NONE } },
+        { { TIMING_EVT_SPI_END,         TIMING_EVT_SEG_TIMER(0),                    TIMING_EP_NONE } },
+        { { TIMING_EVT_SPI_END,         TIMING_TASK_SS_TOGGLE,                      TIMING_EVT_SEG_TIMER(0) } },
+        { { TIMING_EVT_SPI_END,         TIMING_EP_NONE,                             TIMING_EP_NONE } },
+        { { TIMING_EVT_SPI_END,         TIMING_TASK_SS_TOGGLE,                      0x51 } },
+        { { TIMING_EVT_SPI_END,         TIMING_TASK_SEG_TIMER(TIMING_TIMER_CAPTURE(6)), TIMING_EP_NONE } },
+        { { TIMING_EVT_SPI_END,         TIMING_TASK_SEG_TIMER(4),                   TIMING_EP_NONE } },
+    };
+    timing_link_t many[TIMING_MAX_LINKS + 1];
+    timing_chain_t chain = { 0 };
+    timing_chain_t before;
+    mock_channel_t ch_before[MOCK_NUM_OF_CHANNELS];
+
+    CHECK(timing_chain_apply(&chain, m_short_links, NUM_OF_SHORT_LINKS) == NRF_SUCCESS, "apply");
+    timing_chain_enable(&chain);
+    before = chain;
+    memcpy(ch_before, m_ch, sizeof(m_ch));
+
+    for (size_t i = 0; i < sizeof(bad_links) / sizeof(bad_links[0]); i++)
+    {
+        CHECK(timing_chain_apply(&chain, bad_links[i], 1) == NRF_ERROR_INVALID_PARAM, "bad link %u", (unsigned)i);
+    }
+
+    for (int i = 0; i < TIMING_MAX_LINKS + 1; i++)
+    {
+        many[i] = m_short_links[0];
+    }
+    CHECK(timing_chain_apply(&chain, many, TIMING_MAX_LINKS + 1) == NRF_ERROR_INVALID_PARAM, "too many links");
+
+    CHECK(memcmp(&chain, &before, sizeof(chain)) == 0, "chain changed");
+    CHECK(memcmp(m_ch, ch_before, sizeof(m_ch)) == 0, "channels changed");
+    CHECK(m_grp[chain.group].enabled, "running chain stopped");
+
+    timing_chain_release(&chain);
+}
+
+/*
+ * out of channels or groups, everything the chain held is given back
+ */
+static void test_alloc_fail(void)
+{
+    timing_chain_t chain = { 0 };
+    nrf_ppi_channel_t other;
+
+    // another user leaves 6 channels
+    for (int i = 0; i < MOCK_NUM_OF_CHANNELS - 6; i++)
+    {
+        CHECK(nrfx_ppi_channel_alloc(&other) == NRFX_SUCCESS, "other alloc");
+    }
+
+    CHECK(timing_chain_apply(&chain, m_short_links, NUM_OF_SHORT_LINKS) == NRF_SUCCESS, "apply");
+    CHECK(timing_chain_apply(&chain, m_stim_links, STIM_NUM_OF_LINKS) == NRFX_ERROR_NO_MEM, "apply more");
+    CHECK(channels_allocated() == MOCK_NUM_OF_CHANNELS - 6 && groups_allocated() == 0, "not released, held %d %d",
+          channels_allocated(), groups_allocated());
+    CHECK(!chain.has_group && chain.num_of_channels == 0 && chain.num_of_links == 0, "chain not cleared");
+
+    // the chain can be used again once channels are back
+    mock_reset();
+    CHECK(timing_chain_apply(&chain, m_stim_links, STIM_NUM_OF_LINKS) == NRF_SUCCESS, "apply after");
+    chain_check(&chain, m_stim_links, STIM_NUM_OF_LINKS);
+    timing_chain_release(&chain);
+
+    // no group left
+    for (int g = 0; g < MOCK_NUM_OF_GROUPS; g++)
+    {
+        nrf_ppi_channel_group_t group;
+        CHECK(nrfx_ppi_group_alloc(&group) == NRFX_SUCCESS, "other group alloc");
+    }
+    CHECK(timing_chain_apply(&chain, m_short_links, NUM_OF_SHORT_LINKS) == NRFX_ERROR_NO_MEM, "apply no group");
+    CHECK(channels_allocated() == 0, "channels held");
+    CHECK(!chain.has_group && chain.num_of_channels == 0, "chain not cleared");
+}
+
+/*
+ * enable and disable switch the group, apply leaves it disabled
+ */
+static void test_group(void)
+{
+    timing_chain_t chain = { 0 };
+
+    // nothing held, nothing to switch
+    timing_chain_enable(&chain);
+    timing_chain_disable(&chain);
+    CHECK(groups_allocated() == 0, "group allocated by enable");
+
+    CHECK(timing_chain_apply(&chain, m_stim_links, STIM_NUM_OF_LINKS) == NRF_SUCCESS, "apply");
+    timing_chain_enable(&chain);
+    CHECK(m_grp[chain.group].enabled, "not enabled");
+    timing_chain_disable(&chain);
+    CHECK(!m_grp[chain.group].enabled, "not disabled");
+
+    timing_chain_enable(&chain);
+    CHECK(timing_chain_apply(&chain, m_short_links, NUM_OF_SHORT_LINKS) == NRF_SUCCESS, "apply while enabled");
+    chain_check(&chain, m_short_links, NUM_OF_SHORT_LINKS);
+
+    timing_chain_enable(&chain);
+    timing_chain_release(&chain);
+    CHECK(groups_allocated() == 0 && channels_allocated() == 0, "not released");
+}
+
+int main(void)
+{
+    run("apply", test_apply);
+    run("reapply", test_reapply);
+    run("invalid", test_invalid);
+    run("allocfail", test_alloc_fail);
+    run("group", test_group);
+
+    return m_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,1081 @@
+/*
+ * fdssim, runs fds on a host over a RAM backed stand-in for nrf_fstorage and
+ * checks the RAM index (FDS_INDEX_SIZE) against scanning flash
+ *
+ * random writes, updates, record and file deletes and garbage collections are
+ * run against a model of the records that should exist. after each operation
+ * every (file, key) is looked up through the index and by scanning flash, the
+ * two must return the same records in the same order, and these must match
+ * the model. records are also opened through descriptors from before the last
+ * GC, which looks them up by record ID.
+ *
+ * the flash stand-in applies writes either when they are issued, as the NVMC
+ * backend does, or when their event is delivered, as the SoftDevice does. in
+ * the second half of the run it also makes writes fail or time out, then only
+ * index and scan are compared, since the model can't know what was written.
+ *
+ * with "crash", GC runs paused every FDS_GC_RECORDS_PER_STEP records while
+ * other operations go on, and power is cut at every flash operation in turn.
+ * after fds starts again every record it confirmed must be there, no deleted
+ * record may be back and no record may be there twice.
+ *
+ * usage: fdssim [operations, default 20000] [seed]
+ *        fdssim crash [seed]
+ *
+ * build as described in sim/README, once with the index size from
+ * sdk_config and once with one that overflows:
+ * gcc -O2 -std=gnu99 -no-pie -DNRF52832_XXAA -DNRF_ATOMIC_USE_BUILD_IN=1 [-DFDS_INDEX_SIZE=8] \
+ *     $INC sim/fdssim.c ../../../components/libraries/atomic/nrf_atomic.c -o fdssim
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sdk_config.h"
+#include "nrf.h"
+#include "app_util.h"
+#include "fds.h"
+#include "fds_internal_defs.h"
+
+#define SIM_FILES                           4
+#define SIM_KEYS                            6
+#define SIM_MAX_RECORDS                     40      // live records kept by the model
+#define SIM_MAX_WORDS                       8       // record data length
+#define SIM_FLASH_OPS                       64      // fstorage operations in flight
+#define SIM_FAULT_PERCENT                   3
+
+/* the flash: the fds pages and the reserved pages after them, the "bootloader" follows */
+#define SIM_FLASH_WORDS                     ((FDS_PHY_PAGES + FDS_PHY_PAGES_RESERVED) * FDS_PHY_PAGE_SIZE)
+
+// fds keeps flash addresses in 32 bits, build with -no-pie so this stays low
+static uint32_t m_flash[SIM_FLASH_WORDS] __attribute__((aligned(4096)));
+
+static NRF_FICR_Type m_ficr = {.CODEPAGESIZE = FDS_PHY_PAGE_SIZE * sizeof(uint32_t)};
+
+#undef  NRF_FICR
+#define NRF_FICR                            (&m_ficr)
+#undef  BOOTLOADER_ADDRESS
+#define BOOTLOADER_ADDRESS                  ((uint32_t)(uintptr_t)&m_flash[SIM_FLASH_WORDS])
+
+/*
+ * nrf_atfifo is written in ARM assembly. fds only uses it from one context
+ * here, a plain ring stands in for it.
+ */
+#define NRF_ATFIFO_H__
+typedef struct
+{
+    uint8_t * p_buf;
+    uint16_t  size;
+    uint16_t  item;
+    uint32_t  head;
+    uint32_t  tail;
+} nrf_atfifo_t;
+typedef struct { int unused; } nrf_atfifo_item_put_t;
+typedef struct { int unused; } nrf_atfifo_item_get_t;
+
+#define NRF_ATFIFO_DEF(id, type, cnt)                           \
+    static type id##_buf[cnt];                                  \
+    static nrf_atfifo_t id##_inst;                              \
+    static nrf_atfifo_t * const id = &id##_inst
+
+#define NRF_ATFIFO_INIT(id)                                     \
+    (id->p_buf = (uint8_t *)id##_buf,                           \
+     id->size  = ARRAY_SIZE(id##_buf),                          \
+     id->item  = sizeof(id##_buf[0]),                           \
+     id->head  = id->tail = 0,                                  \
+     NRF_SUCCESS)
+
+static void * nrf_atfifo_item_alloc(nrf_atfifo_t * p_fifo, nrf_atfifo_item_put_t * p_context)
+{
+    (void)p_context;
+    return (p_fifo->tail - p_fifo->head >= p_fifo->size) ? NULL :
+           p_fifo->p_buf + (p_fifo->tail % p_fifo->size) * p_fifo->item;
+}
+
+static bool nrf_atfifo_item_put(nrf_atfifo_t * p_fifo, nrf_atfifo_item_put_t * p_context)
+{
+    (void)p_context;
+    p_fifo->tail++;
+    return true;
+}
+
+static void * nrf_atfifo_item_get(nrf_atfifo_t * p_fifo, nrf_atfifo_item_get_t * p_context)
+{
+    (void)p_context;
+    return (p_fifo->tail == p_fifo->head) ? NULL :
+           p_fifo->p_buf + (p_fifo->head % p_fifo->size) * p_fifo->item;
+}
+
+static bool nrf_atfifo_item_free(nrf_atfifo_t * p_fifo, nrf_atfifo_item_get_t * p_context)
+{
+    (void)p_context;
+    p_fifo->head++;
+    return p_fifo->tail == p_fifo->head;
+}
+
+#include "../../../../components/libraries/fds/fds.c"
+
+#if (FDS_INDEX_SIZE == 0)
+#error fdssim checks the RAM index, build it with FDS_INDEX_SIZE > 0.
+#endif
+
+/* nrf_fstorage stand-in */
+
+typedef struct
+{
+    bool             erase;
+    uint32_t         addr;
+    void const *     p_src;
+    uint32_t         len;       // bytes, or pages for an erase
+    ret_code_t       result;
+} sim_flash_op_t;
+
+static sim_flash_op_t m_flash_ops[SIM_FLASH_OPS];
+static uint32_t       m_flash_head;
+static uint32_t       m_flash_tail;
+static bool           m_deferred;       // apply writes when their event is delivered
+static bool           m_faults;
+static uint32_t       m_faults_injected;
+static uint32_t       m_applied;        // writes and erases applied
+static uint32_t       m_cut = UINT32_MAX;   // power is cut while applying this one
+static uint32_t       m_torn;           // words of the cut write which make it to flash
+static bool           m_power_off;
+
+nrf_fstorage_api_t nrf_fstorage_sd;
+
+static uint32_t * flash_word(uint32_t addr)
+{
+    uint32_t index = (addr - (uint32_t)(uintptr_t)m_flash) / sizeof(uint32_t);
+
+    if ((addr % sizeof(uint32_t)) || (index >= SIM_FLASH_WORDS))
+    {
+        printf("FAIL flash access out of bounds at 0x%08x\n", addr);
+        exit(1);
+    }
+    return &m_flash[index];
+}
+
+static void flash_apply(sim_flash_op_t const * p_op)
+{
+    if (p_op->erase)
+    {
+        memset(flash_word(p_op->addr), 0xFF, p_op->len * FDS_PHY_PAGE_SIZE * sizeof(uint32_t));
+        return;
+    }
+
+    for (uint32_t i = 0; i < p_op->len / sizeof(uint32_t); i++)
+    {
+        // like flash, a write can only clear bits
+        *flash_word(p_op->addr + i * sizeof(uint32_t)) &= ((uint32_t const *)p_op->p_src)[i];
+    }
+}
+
+static ret_code_t flash_op_push(sim_flash_op_t * p_op)
+{
+    if (m_flash_tail - m_flash_head == SIM_FLASH_OPS)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+    if (m_faults && (rand() % 100 < SIM_FAULT_PERCENT))
+    {
+        m_faults_injected++;
+        if (rand() % 2)
+        {
+            return NRF_ERROR_NO_MEM;
+        }
+        // times out, nothing is written
+        p_op->result = NRF_ERROR_TIMEOUT;
+    }
+    else
+    {
+        p_op->result = NRF_SUCCESS;
+        if (!m_deferred)
+        {
+            flash_apply(p_op);
+        }
+    }
+
+    m_flash_ops[m_flash_tail++ % SIM_FLASH_OPS] = *p_op;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_fstorage_init(nrf_fstorage_t * p_fs, nrf_fstorage_api_t * p_api, void * p_param)
+{
+    (void)p_param;
+    p_fs->p_api = p_api;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_fstorage_write(nrf_fstorage_t const * p_fs, uint32_t dest, void const * p_src,
+                              uint32_t len, void * p_param)
+{
+    sim_flash_op_t op = {.erase = false, .addr = dest, .p_src = p_src, .len = len};
+
+    (void)p_fs;
+    (void)p_param;
+    return flash_op_push(&op);
+}
+
+ret_code_t nrf_fstorage_erase(nrf_fstorage_t const * p_fs, uint32_t page_addr, uint32_t len,
+                              void * p_param)
+{
+    sim_flash_op_t op = {.erase = true, .addr = page_addr, .len = len};
+
+    (void)p_fs;
+    (void)p_param;
+    return flash_op_push(&op);
+}
+
+// deliver fstorage events until fds has nothing left to do
+static void flash_run(void)
+{
+    while (m_flash_head != m_flash_tail)
+    {
+        sim_flash_op_t     op  = m_flash_ops[m_flash_head++ % SIM_FLASH_OPS];
+        nrf_fstorage_evt_t evt = {0};
+
+        if (m_power_off)
+        {
+            // nothing is written any more, let fds run its queue dry
+            op.result = NRF_ERROR_TIMEOUT;
+        }
+        else if (m_deferred && (op.result == NRF_SUCCESS))
+        {
+            if (m_applied++ == m_cut)
+            {
+                op.len      = op.erase ? 0 : MIN(op.len, m_torn * sizeof(uint32_t));
+                op.result   = NRF_ERROR_TIMEOUT;
+                m_power_off = true;
+            }
+            flash_apply(&op);
+        }
+        evt.id     = op.erase ? NRF_FSTORAGE_EVT_ERASE_RESULT : NRF_FSTORAGE_EVT_WRITE_RESULT;
+        evt.result = op.result;
+        m_fs.evt_handler(&evt);
+    }
+}
+
+/* the model */
+
+typedef struct
+{
+    uint32_t          record_id;
+    uint16_t          file_id;
+    uint16_t          record_key;
+    uint16_t          len;
+    uint32_t          data[SIM_MAX_WORDS];
+    fds_record_desc_t desc;     // as returned when written, goes stale at the next GC
+} sim_record_t;
+
+static sim_record_t m_records[SIM_MAX_RECORDS];
+static uint32_t     m_record_cnt;
+static bool         m_model_valid = true;
+
+static fds_evt_t    m_evt;
+static bool         m_evt_received;
+static uint32_t     m_data_buf[SIM_MAX_WORDS];     // fds reads it until the write completes
+
+static uint32_t     m_ops;
+static uint32_t     m_checks;
+static uint32_t     m_gc_runs;
+static uint32_t     m_rebuilds;
+
+static void fail(char const * p_what)
+{
+    printf("FAIL %s, operation %u, index %s, %u entries\n", p_what, m_ops,
+           m_index.valid ? "valid" : "invalid", m_index.count);
+    exit(1);
+}
+
+static void crash_evt(fds_evt_t const * p_evt);
+static bool m_crash_running;
+
+static void fds_evt_handler(fds_evt_t const * p_evt)
+{
+    if (m_crash_running)
+    {
+        crash_evt(p_evt);
+        return;
+    }
+    m_evt          = *p_evt;
+    m_evt_received = true;
+}
+
+// run an fds call to its end and return the result of its event, which fds
+// sends from within the call if the operation needs no flash access
+static ret_code_t op_run(ret_code_t ret)
+{
+    if (ret != NRF_SUCCESS)
+    {
+        return ret;
+    }
+    flash_run();
+    if (!m_evt_received)
+    {
+        fail("no event");
+    }
+    m_evt_received = false;
+    return m_evt.result;
+}
+
+static sim_record_t * model_find(uint32_t record_id)
+{
+    for (uint32_t i = 0; i < m_record_cnt; i++)
+    {
+        if (m_records[i].record_id == record_id)
+        {
+            return &m_records[i];
+        }
+    }
+    return NULL;
+}
+
+static void model_remove(sim_record_t * p_rec)
+{
+    *p_rec = m_records[--m_record_cnt];
+}
+
+/* lookups */
+
+// all records of a (file, key), through the index or by scanning flash
+static uint32_t lookup(uint16_t file_id, uint16_t record_key, bool use_index,
+                       fds_record_desc_t * p_descs, uint32_t max)
+{
+    bool const       index_valid = m_index.valid;
+    fds_find_token_t tok         = {0};
+    uint32_t         cnt         = 0;
+
+    if (!use_index)
+    {
+        m_index.valid = false;
+    }
+    while (fds_record_find(file_id, record_key, &p_descs[cnt], &tok) == NRF_SUCCESS)
+    {
+        if (++cnt == max)
+        {
+            fail("too many records found");
+        }
+    }
+    m_index.valid = use_index ? m_index.valid : index_valid;
+
+    return cnt;
+}
+
+// a valid index holds every valid record on the data pages, in order
+static void index_check(void)
+{
+    uint32_t cnt = 0;
+
+    if (!m_index.valid)
+    {
+        return;
+    }
+    for (uint16_t page = 0; page < FDS_DATA_PAGES; page++)
+    {
+        uint32_t const * p_record = NULL;
+
+        while ((m_pages[page].page_type == FDS_PAGE_DATA) && record_find_next(page, &p_record))
+        {
+            cnt++;
+        }
+    }
+    if (cnt != m_index.count)
+    {
+        fail("index count");
+    }
+    for (uint32_t i = 0; i < m_index.count; i++)
+    {
+        fds_index_entry_t const * p_entry  = &m_index.entries[i];
+        fds_header_t      const * p_header = (fds_header_t const *)index_entry_addr(p_entry);
+
+        if ((p_header->file_id != p_entry->file_id) || (p_header->record_key != p_entry->record_key))
+        {
+            fail("index entry");
+        }
+        if ((i > 0) &&
+            (index_key(p_entry[-1].file_id, p_entry[-1].record_key, p_entry[-1].page, p_entry[-1].offset) >=
+             index_key(p_entry->file_id, p_entry->record_key, p_entry->page, p_entry->offset)))
+        {
+            fail("index order");
+        }
+    }
+}
+
+static void lookups_check(void)
+{
+    static fds_record_desc_t indexed[SIM_MAX_RECORDS * 8];
+    static fds_record_desc_t scanned[SIM_MAX_RECORDS * 8];
+
+    index_check();
+
+    for (uint16_t file_id = 1; file_id <= SIM_FILES; file_id++)
+    {
+        for (uint16_t key = 1; key <= SIM_KEYS; key++)
+        {
+            uint32_t const n_idx  = lookup(file_id, key, true, indexed, ARRAY_SIZE(indexed));
+            uint32_t const n_scan = lookup(file_id, key, false, scanned, ARRAY_SIZE(scanned));
+            uint32_t       n_model = 0;
+
+            m_checks++;
+            if (n_idx != n_scan)
+            {
+                fail("index and scan found a different number of records");
+            }
+            for (uint32_t i = 0; i < n_idx; i++)
+            {
+                if ((indexed[i].record_id != scanned[i].record_id) ||
+                    (indexed[i].p_record  != scanned[i].p_record))
+                {
+                    fail("index and scan found different records");
+                }
+            }
+            if (!m_model_valid)
+            {
+                continue;
+            }
+
+            for (uint32_t i = 0; i < m_record_cnt; i++)
+            {
+                n_model += (m_records[i].file_id == file_id) && (m_records[i].record_key == key);
+            }
+            if (n_model != n_idx)
+            {
+                fail("model and flash hold a different number of records");
+            }
+            for (uint32_t i = 0; i < n_idx; i++)
+            {
+                sim_record_t const * p_rec = model_find(indexed[i].record_id);
+                fds_flash_record_t   flash_rec;
+
+                if ((p_rec == NULL) || (p_rec->file_id != file_id) || (p_rec->record_key != key))
+                {
+                    fail("record not in the model");
+                }
+                if (fds_record_open(&indexed[i], &flash_rec) != NRF_SUCCESS)
+                {
+                    fail("open");
+                }
+                if ((flash_rec.p_header->length_words != p_rec->len) ||
+                    memcmp(flash_rec.p_data, p_rec->data, p_rec->len * sizeof(uint32_t)))
+                {
+                    fail("record data");
+                }
+                (void)fds_record_close(&indexed[i]);
+            }
+        }
+    }
+
+    // descriptors from before a GC are looked up by record ID
+    for (uint32_t i = 0; m_model_valid && (i < m_record_cnt); i++)
+    {
+        fds_flash_record_t flash_rec;
+        fds_record_desc_t  desc = m_records[i].desc;
+
+        if ((fds_record_open(&desc, &flash_rec) != NRF_SUCCESS) ||
+            (flash_rec.p_header->record_id != m_records[i].record_id))
+        {
+            fail("open by record ID");
+        }
+        (void)fds_record_close(&desc);
+    }
+}
+
+/* operations */
+
+static void data_fill(sim_record_t * p_rec)
+{
+    p_rec->len = 1 + (uint16_t)(rand() % SIM_MAX_WORDS);
+    for (uint16_t i = 0; i < p_rec->len; i++)
+    {
+        p_rec->data[i] = (uint32_t)rand();
+    }
+    memcpy(m_data_buf, p_rec->data, sizeof(m_data_buf));
+}
+
+static void gc_run(void)
+{
+    if (op_run(fds_gc()) == NRF_SUCCESS)
+    {
+        m_gc_runs++;
+        m_rebuilds += m_index.valid;
+    }
+}
+
+static void record_write(void)
+{
+    sim_record_t rec = {0};
+    fds_record_t record;
+    ret_code_t   ret;
+
+    if (m_record_cnt == SIM_MAX_RECORDS)
+    {
+        return;
+    }
+
+    rec.file_id    = 1 + (uint16_t)(rand() % SIM_FILES);
+    rec.record_key = 1 + (uint16_t)(rand() % SIM_KEYS);
+    data_fill(&rec);
+
+    record.file_id           = rec.file_id;
+    record.key               = rec.record_key;
+    record.data.p_data       = m_data_buf;
+    record.data.length_words = rec.len;
+
+    ret = op_run(fds_record_write(&rec.desc, &record));
+    if (ret == FDS_ERR_NO_SPACE_IN_FLASH)
+    {
+        gc_run();
+        return;
+    }
+    if (ret == NRF_SUCCESS)
+    {
+        rec.record_id = rec.desc.record_id;
+        m_records[m_record_cnt++] = rec;
+    }
+    else if (!m_faults)
+    {
+        fail("write");
+    }
+}
+
+static void record_update(sim_record_t * p_rec)
+{
+    sim_record_t rec = *p_rec;
+    fds_record_t record;
+    ret_code_t   ret;
+
+    data_fill(&rec);
+    record.file_id           = rec.file_id;
+    record.key               = rec.record_key;
+    record.data.p_data       = m_data_buf;
+    record.data.length_words = rec.len;
+
+    ret = op_run(fds_record_update(&rec.desc, &record));
+    if (ret == FDS_ERR_NO_SPACE_IN_FLASH)
+    {
+        gc_run();
+        return;
+    }
+    if (ret == NRF_SUCCESS)
+    {
+        rec.record_id = rec.desc.record_id;
+        *p_rec = rec;
+    }
+    else if (!m_faults)
+    {
+        fail("update");
+    }
+}
+
+static void record_delete(sim_record_t * p_rec)
+{
+    ret_code_t ret = op_run(fds_record_delete(&p_rec->desc));
+
+    if (ret == NRF_SUCCESS)
+    {
+        model_remove(p_rec);
+    }
+    else if (!m_faults)
+    {
+        fail("delete");
+    }
+}
+
+static void file_delete(uint16_t file_id)
+{
+    ret_code_t ret = op_run(fds_file_delete(file_id));
+
+    if (ret == NRF_SUCCESS)
+    {
+        for (uint32_t i = m_record_cnt; i-- > 0;)
+        {
+            if (m_records[i].file_id == file_id)
+            {
+                model_remove(&m_records[i]);
+            }
+        }
+    }
+    else if (!m_faults)
+    {
+        fail("file delete");
+    }
+}
+
+static void op_random(void)
+{
+    int const      r     = rand() % 100;
+    sim_record_t * p_rec = m_record_cnt ? &m_records[(uint32_t)rand() % m_record_cnt] : NULL;
+
+    if ((r < 40) || (p_rec == NULL))
+    {
+        record_write();
+    }
+    else if (r < 70)
+    {
+        record_update(p_rec);
+    }
+    else if (r < 90)
+    {
+        record_delete(p_rec);
+    }
+    else if (r < 93)
+    {
+        file_delete(1 + (uint16_t)(rand() % SIM_FILES));
+    }
+    else
+    {
+        gc_run();
+    }
+}
+
+// the cost of a lookup through the index and by scanning, with the records left in flash
+static void lookups_time(void)
+{
+    static fds_record_desc_t descs[SIM_MAX_RECORDS * 8];
+    double                   t[2];
+
+    for (int use_index = 0; use_index < 2; use_index++)
+    {
+        struct timespec t0;
+        struct timespec t1;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (uint32_t round = 0; round < 200; round++)
+        {
+            for (uint16_t file_id = 1; file_id <= SIM_FILES; file_id++)
+            {
+                for (uint16_t key = 1; key <= SIM_KEYS; key++)
+                {
+                    (void)lookup(file_id, key, use_index, descs, ARRAY_SIZE(descs));
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        t[use_index] = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+                       (200.0 * SIM_FILES * SIM_KEYS);
+    }
+    printf("find all of a file and key: scan %.0f ns, index %.0f ns (%s, %u entries)\n",
+           t[0], t[1], m_index.valid ? "valid" : "invalid", m_index.count);
+}
+
+/*
+ * power cuts: records are written and about half deleted, then a GC is
+ * queued and writes, updates and deletes are queued behind it as events come
+ * in, so that they run while GC is paused. power is cut at the n-th flash
+ * write or erase, for every n, with none or half of the cut write made. fds
+ * is then started again on what was left in flash.
+ */
+
+#define SIM_CRASH_RECORDS                   120
+#define SIM_CRASH_OPS                       24
+
+typedef struct
+{
+    fds_evt_id_t id;            // FDS_EVT_WRITE, FDS_EVT_UPDATE or FDS_EVT_DEL_RECORD
+    uint32_t     old_id;        // the record updated or deleted
+    sim_record_t rec;           // the record written, its data is written from here
+    bool         queued;
+    bool         acked;
+} crash_op_t;
+
+static sim_record_t m_acked[SIM_CRASH_RECORDS + SIM_CRASH_OPS];  // records fds has confirmed
+static uint32_t     m_acked_cnt;
+static crash_op_t   m_crash_ops[SIM_CRASH_OPS];
+static uint32_t     m_crash_next;       // the next op to queue
+static uint32_t     m_crash_acks;       // ops acked so far, they are acked in order
+static bool         m_crash_gc_done;
+static uint32_t     m_crash_overlap;    // ops acked while the GC was queued
+static uint32_t     m_crash_restarts;
+
+static sim_record_t * acked_find(uint32_t record_id)
+{
+    for (uint32_t i = 0; i < m_acked_cnt; i++)
+    {
+        if (m_acked[i].record_id == record_id)
+        {
+            return &m_acked[i];
+        }
+    }
+    return NULL;
+}
+
+// forget everything fds keeps in RAM, as a reset would
+static void fds_reset(void)
+{
+    memset(&m_flags, 0, sizeof(m_flags));
+    memset(m_pages, 0, sizeof(m_pages));
+    memset(&m_swap_page, 0, sizeof(m_swap_page));
+    memset(&m_gc, 0, sizeof(m_gc));
+    memset(&m_index, 0, sizeof(m_index));
+    memset(m_cb_table, 0, sizeof(m_cb_table));
+    m_users         = 0;
+    m_queued_op_cnt = 0;
+    m_latest_rec_id = 0;
+
+    m_flash_head = m_flash_tail = 0;
+    m_power_off  = false;
+    m_applied    = 0;
+    m_cut        = UINT32_MAX;
+
+    if ((fds_register(fds_evt_handler) != NRF_SUCCESS) || (op_run(fds_init()) != NRF_SUCCESS))
+    {
+        fail("init");
+    }
+}
+
+static void crash_queue(void)
+{
+    while (m_crash_next < SIM_CRASH_OPS)
+    {
+        crash_op_t *      p_op = &m_crash_ops[m_crash_next];
+        fds_record_desc_t desc = {.record_id = p_op->old_id};
+        fds_record_t      record =
+        {
+            .file_id           = p_op->rec.file_id,
+            .key               = p_op->rec.record_key,
+            .data.p_data       = p_op->rec.data,
+            .data.length_words = p_op->rec.len,
+        };
+        ret_code_t ret;
+
+        switch (p_op->id)
+        {
+            case FDS_EVT_WRITE:  ret = fds_record_write(&desc, &record);  break;
+            case FDS_EVT_UPDATE: ret = fds_record_update(&desc, &record); break;
+            default:             ret = fds_record_delete(&desc);          break;
+        }
+        if (ret == FDS_ERR_NO_SPACE_IN_QUEUES)
+        {
+            return;
+        }
+        if (ret != NRF_SUCCESS)
+        {
+            fail("crash op queue");
+        }
+        p_op->rec.record_id = desc.record_id;
+        p_op->queued        = true;
+        m_crash_next++;
+    }
+}
+
+static void crash_evt(fds_evt_t const * p_evt)
+{
+    crash_op_t * p_op;
+
+    if (m_power_off)
+    {
+        return;
+    }
+    if (p_evt->result != NRF_SUCCESS)
+    {
+        fail("crash op result");
+    }
+    if (p_evt->id == FDS_EVT_GC)
+    {
+        m_crash_gc_done = true;
+        return;
+    }
+
+    // other operations complete in the order they were queued
+    p_op = &m_crash_ops[m_crash_acks++];
+    if ((p_evt->id != p_op->id) ||
+        ((p_op->id == FDS_EVT_DEL_RECORD) ? (p_evt->del.record_id != p_op->old_id)
+                                          : (p_evt->write.record_id != p_op->rec.record_id)))
+    {
+        fail("crash op event");
+    }
+    p_op->acked      = true;
+    m_crash_overlap += !m_crash_gc_done;
+
+    if (p_op->id != FDS_EVT_WRITE)
+    {
+        sim_record_t * p_old = acked_find(p_op->old_id);
+        *p_old = m_acked[--m_acked_cnt];
+    }
+    if (p_op->id != FDS_EVT_DEL_RECORD)
+    {
+        m_acked[m_acked_cnt++] = p_op->rec;
+    }
+
+    crash_queue();
+}
+
+// the records in flash, each must be acked, or written by an op which was not
+static uint32_t crash_check(sim_record_t * p_found)
+{
+    fds_record_desc_t desc = {0};
+    fds_find_token_t  tok  = {0};
+    uint32_t          cnt  = 0;
+
+    while (fds_record_iterate(&desc, &tok) == NRF_SUCCESS)
+    {
+        fds_flash_record_t   flash_rec;
+        sim_record_t const * p_rec = acked_find(desc.record_id);
+
+        for (uint32_t i = 0; (p_rec == NULL) && (i < SIM_CRASH_OPS); i++)
+        {
+            if (m_crash_ops[i].queued && !m_crash_ops[i].acked &&
+                (m_crash_ops[i].id != FDS_EVT_DEL_RECORD) &&
+                (m_crash_ops[i].rec.record_id == desc.record_id))
+            {
+                p_rec = &m_crash_ops[i].rec;
+            }
+        }
+        if (p_rec == NULL)
+        {
+            fail("a deleted record is back, or a record is made up");
+        }
+        for (uint32_t i = 0; i < cnt; i++)
+        {
+            if (p_found[i].record_id == desc.record_id)
+            {
+                fail("a record is in flash twice");
+            }
+        }
+        if (fds_record_open(&desc, &flash_rec) != NRF_SUCCESS)
+        {
+            fail("open");
+        }
+        if ((flash_rec.p_header->file_id != p_rec->file_id) ||
+            (flash_rec.p_header->record_key != p_rec->record_key) ||
+            (flash_rec.p_header->length_words != p_rec->len) ||
+            memcmp(flash_rec.p_data, p_rec->data, p_rec->len * sizeof(uint32_t)))
+        {
+            fail("record data");
+        }
+        (void)fds_record_close(&desc);
+        p_found[cnt++] = *p_rec;
+    }
+
+    // acked records must be there, unless an op which was not acked deleted them;
+    // an update which was not acked leaves the old copy, the new copy or both
+    for (uint32_t i = 0; i < m_acked_cnt; i++)
+    {
+        bool found = false;
+        bool maybe = false;
+
+        for (uint32_t j = 0; j < cnt; j++)
+        {
+            found |= (p_found[j].record_id == m_acked[i].record_id);
+        }
+        for (uint32_t j = 0; !found && (j < SIM_CRASH_OPS); j++)
+        {
+            crash_op_t const * p_op = &m_crash_ops[j];
+
+            if (!p_op->queued || p_op->acked || (p_op->old_id != m_acked[i].record_id))
+            {
+                continue;
+            }
+            maybe = (p_op->id == FDS_EVT_DEL_RECORD);
+            for (uint32_t k = 0; (p_op->id == FDS_EVT_UPDATE) && (k < cnt); k++)
+            {
+                maybe |= (p_found[k].record_id == p_op->rec.record_id);
+            }
+        }
+        if (!found && !maybe)
+        {
+            fail("an acked record is lost");
+        }
+    }
+    return cnt;
+}
+
+// one run, power is cut at flash operation cut or not at all; returns the flash operations run
+static uint32_t crash_run(unsigned seed, uint32_t cut, uint32_t torn)
+{
+    static sim_record_t found[SIM_CRASH_RECORDS + SIM_CRASH_OPS];
+    fds_gc_stat_t       stat;
+    uint32_t            applied;
+    uint32_t            cnt;
+
+    srand(seed);
+    memset(m_flash, 0xFF, sizeof(m_flash));
+    memset(m_crash_ops, 0, sizeof(m_crash_ops));
+    m_deferred    = false;
+    m_crash_next  = m_crash_acks = m_acked_cnt = 0;
+    m_crash_gc_done = false;
+    m_crash_overlap = 0;
+    fds_reset();
+
+    for (uint32_t i = 0; i < SIM_CRASH_RECORDS; i++)
+    {
+        sim_record_t rec =
+        {
+            .file_id    = 1 + (uint16_t)(rand() % SIM_FILES),
+            .record_key = 1 + (uint16_t)(rand() % SIM_KEYS),
+        };
+        fds_record_t record;
+
+        data_fill(&rec);
+        record.file_id           = rec.file_id;
+        record.key               = rec.record_key;
+        record.data.p_data       = m_data_buf;
+        record.data.length_words = rec.len;
+        if (op_run(fds_record_write(&rec.desc, &record)) != NRF_SUCCESS)
+        {
+            fail("crash setup write");
+        }
+        rec.record_id          = rec.desc.record_id;
+        m_acked[m_acked_cnt++] = rec;
+    }
+    for (uint32_t i = m_acked_cnt; i-- > 0;)
+    {
+        if ((rand() % 2) && (op_run(fds_record_delete(&m_acked[i].desc)) == NRF_SUCCESS))
+        {
+            m_acked[i] = m_acked[--m_acked_cnt];
+        }
+    }
+
+    // the ops to run during the GC, each updating or deleting a different record
+    for (uint32_t i = 0; i < SIM_CRASH_OPS; i++)
+    {
+        crash_op_t * p_op = &m_crash_ops[i];
+        int const    r    = rand() % 3;
+
+        p_op->id = (r == 0) ? FDS_EVT_WRITE : (r == 1) ? FDS_EVT_UPDATE : FDS_EVT_DEL_RECORD;
+        if (p_op->id == FDS_EVT_WRITE)
+        {
+            p_op->rec.file_id    = 1 + (uint16_t)(rand() % SIM_FILES);
+            p_op->rec.record_key = 1 + (uint16_t)(rand() % SIM_KEYS);
+        }
+        else
+        {
+            p_op->old_id         = m_acked[i].record_id;
+            p_op->rec.file_id    = m_acked[i].file_id;
+            p_op->rec.record_key = m_acked[i].record_key;
+        }
+        data_fill(&p_op->rec);
+    }
+
+    m_deferred      = true;
+    m_cut           = cut;
+    m_torn          = torn;
+    m_crash_running = true;
+    if (fds_gc() != NRF_SUCCESS)
+    {
+        fail("crash gc");
+    }
+    crash_queue();
+    flash_run();
+    m_crash_running = false;
+    applied         = m_applied;
+
+    if (m_queued_op_cnt != 0)
+    {
+        fail("fds did not run its queue dry");
+    }
+    if (!m_power_off)
+    {
+        if (!m_crash_gc_done || (m_crash_acks != SIM_CRASH_OPS))
+        {
+            fail("crash ops did not complete");
+        }
+        (void)fds_gc_stat(&stat);
+        m_crash_restarts = stat.gc_restarts;
+    }
+
+    // power up, the records must be as acked, then stay so through a GC and a write
+    fds_reset();
+    cnt = crash_check(found);
+    memcpy(m_acked, found, cnt * sizeof(found[0]));
+    m_acked_cnt = cnt;
+    memset(m_crash_ops, 0, sizeof(m_crash_ops));
+
+    m_deferred = false;
+    if (op_run(fds_gc()) != NRF_SUCCESS)
+    {
+        fail("gc after power up");
+    }
+    if (crash_check(found) != m_acked_cnt)
+    {
+        fail("gc after power up lost records");
+    }
+    record_write();
+    if ((m_record_cnt != 1) || (acked_find(m_records[0].record_id) != NULL))
+    {
+        fail("write after power up");
+    }
+    m_acked[m_acked_cnt++] = m_records[0];
+    m_record_cnt           = 0;
+    if (crash_check(found) != m_acked_cnt)
+    {
+        fail("write after power up lost records");
+    }
+
+    return applied;
+}
+
+static void crash_sweep(unsigned seed)
+{
+    uint32_t const total = crash_run(seed, UINT32_MAX, 0);
+    uint32_t const overlap  = m_crash_overlap;
+    uint32_t const restarts = m_crash_restarts;
+
+    for (uint32_t cut = 0; cut < total; cut++)
+    {
+        m_ops = cut;
+        (void)crash_run(seed, cut, 0);
+        (void)crash_run(seed, cut, SIM_MAX_WORDS / 2);
+    }
+    printf("%u flash operations, power cut at each, %u ops acked during the GC, %u GC restarts\n",
+           total, overlap, restarts);
+    printf("no acked record lost, no deleted record back\n");
+}
+
+int main(int argc, char * argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "crash") == 0))
+    {
+        crash_sweep((argc > 2) ? (unsigned)atoi(argv[2]) : 1);
+        return 0;
+    }
+
+    uint32_t const ops  = (argc > 1) ? (uint32_t)atoi(argv[1]) : 20000;
+    unsigned const seed = (argc > 2) ? (unsigned)atoi(argv[2]) : 1;
+
+    srand(seed);
+    memset(m_flash, 0xFF, sizeof(m_flash));
+
+    if ((fds_register(fds_evt_handler) != NRF_SUCCESS) || (op_run(fds_init()) != NRF_SUCCESS))
+    {
+        fail("init");
+    }
+
+    for (m_ops = 0; m_ops < ops; m_ops++)
+    {
+        // a quarter each: synchronous and deferred writes, without and with faults
+        uint32_t const quarter = (uint32_t)(((uint64_t)m_ops * 4) / ops);
+
+        m_deferred = (quarter % 2) == 1;
+        if (!m_faults && (quarter >= 2))
+        {
+            m_faults      = true;
+            m_model_valid = false;
+        }
+
+        op_random();
+        lookups_check();
+
+        if ((m_ops == ops / 2 - 1) || (m_ops == ops - 1))
+        {
+            lookups_time();
+        }
+    }
+
+    printf("%u operations, %u lookups checked, %u GCs, index rebuilt by %u, %u faults injected\n",
+           m_ops, m_checks, m_gc_runs, m_rebuilds, m_faults_injected);
+    printf("index and scan match\n");
+
+    fds_gc_stat_t stat;
+    (void)fds_gc_stat(&stat);
+    printf("GC: %u words written, %u copied, %u freed, write amplification %u%%, %u yields, erases",
+           stat.words_written, stat.words_copied, stat.words_freed, stat.write_amp_pct,
+           stat.gc_yields);
+    for (uint16_t i = 0; i < stat.pages; i++)
+    {
+        printf(" %u", stat.p_erase_count[i]);
+    }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,1016 @@
+/*
+ * gqsim, checks the scheduler of nrf_ble_gq on a host against a model of the
+ * SoftDevice, memobj and app_timer are stubbed
+ *
+ * the model takes notifications while a link has buffers left and refuses
+ * the next one with NRF_ERROR_RESOURCES, the same for write commands. a
+ * write request or read keeps the link busy (NRF_ERROR_BUSY) until its
+ * response. TX complete and response events give the resources back. every
+ * request carries a sequence number, recorded when the model takes it.
+ *
+ * checked: requests going straight out while nothing waits before them,
+ * credits, the byte share of connection weights, busy procedures, high
+ * priority queues, purge, counters, the purge of a disconnected link. and
+ * what an interrupt does when it comes during a SoftDevice call: a request
+ * added then must not pass the one being sent, a purge is refused, a TX
+ * complete event for the packet being sent or for the buffers just found
+ * full must not stall the link, and a link disconnected then is purged when
+ * the call is done, its ID reused after that. the "random" test adds
+ * requests and delivers events at random, also from inside the SoftDevice
+ * calls, then drains the queues: every request must go out once, in order
+ * per link, with no memory left. exits non zero if any check fails.
+ *
+ * usage: gqsim [random rounds, default 20000] [seed]
+ *
+ * build as described in sim/README:
+ * gcc -std=gnu99 -DNRF52832_XXAA -DS132 -DSOFTDEVICE_PRESENT -DNRF_SD_BLE_API_VERSION=7 \
+ *     -DSVCALL_AS_NORMAL_FUNCTION -DNRF_LOG_ENABLED=0 -DNRF_ATOMIC_USE_BUILD_IN=1 $INC \
+ *     sim/gqsim.c ../../../components/libraries/queue/nrf_queue.c \
+ *     ../../../components/libraries/atomic/nrf_atomic.c -o gqsim
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The firmware project does not use the module, its sdk_config.h has no entries for it.
+#define NRF_BLE_GQ_ENABLED                  1
+#define NRF_BLE_GQ_DATAPOOL_ELEMENT_SIZE    64
+#define NRF_BLE_GQ_DATAPOOL_ELEMENT_COUNT   8
+#define NRF_BLE_GQ_GATTC_WRITE_MAX_DATA_LEN 16
+#define NRF_BLE_GQ_GATTS_HVX_MAX_DATA_LEN   60
+#define NRF_BLE_GQ_BLE_OBSERVER_PRIO        1
+#define NRF_BLE_GQ_LATENCY_ENABLED          1
+
+#include "sdk_common.h"
+#include "ble.h"
+#include "nrf_memobj.h"
+
+#define MOCK_CONN_HANDLES                   16
+#define MOCK_MAX_SENT                       8192
+#define MOCK_WCMD_BUFFERS                   2
+
+static int      m_failed;
+static int      m_app_errors;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) { printf("  " __VA_ARGS__); printf("\n"); m_failed++; }    \
+    } while (0)
+
+/*
+ * memobj, app_timer and platform stand-ins
+ */
+typedef struct
+{
+    size_t  size;
+    uint8_t data[];
+} mock_memobj_t;
+
+static int      m_memobjs;                          // allocated, not yet freed
+static uint32_t m_ticks;
+
+nrf_memobj_t * nrf_memobj_alloc(nrf_memobj_pool_t const * p_pool, size_t size)
+{
+    mock_memobj_t * p_obj = calloc(1, sizeof(mock_memobj_t) + size);
+
+    (void)p_pool;
+    p_obj->size = size;
+    m_memobjs++;
+    return (nrf_memobj_t *)p_obj;
+}
+
+void nrf_memobj_free(nrf_memobj_t * p_obj)
+{
+    m_memobjs--;
+    free(p_obj);
+}
+
+void nrf_memobj_write(nrf_memobj_t * p_obj, void * p_data, size_t len, size_t offset)
+{
+    CHECK(offset + len <= ((mock_memobj_t *)p_obj)->size, "memobj write over the end");
+    memcpy(((mock_memobj_t *)p_obj)->data + offset, p_data, len);
+}
+
+void nrf_memobj_read(nrf_memobj_t * p_obj, void * p_data, size_t len, size_t offset)
+{
+    CHECK(offset + len <= ((mock_memobj_t *)p_obj)->size, "memobj read over the end");
+    memcpy(p_data, ((mock_memobj_t *)p_obj)->data + offset, len);
+}
+
+ret_code_t nrf_memobj_pool_init(nrf_memobj_pool_t const * p_pool)
+{
+    (void)p_pool;
+    CHECK(m_memobjs == 0, "pool reset with %d memobjs in use", m_memobjs);
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_cnt_get(void)
+{
+    return m_ticks;
+}
+
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from)
+{
+    return ticks_to - ticks_from;
+}
+
+void app_util_critical_region_enter(uint8_t * p_nested)
+{
+    (void)p_nested;
+}
+
+void app_util_critical_region_exit(uint8_t nested)
+{
+    (void)nested;
+}
+
+void app_error_handler(ret_code_t error_code, uint32_t line_num, const uint8_t * p_file_name)
+{
+    printf("  app error 0x%x at %s:%u\n", (unsigned)error_code, p_file_name, (unsigned)line_num);
+    m_app_errors++;
+}
+
+/*
+ * SoftDevice model
+ */
+typedef struct
+{
+    uint16_t conn_handle;
+    uint16_t seq;
+} mock_sent_t;
+
+static int          m_sd_hvn_buffers;               // notification buffers of each link
+static int          m_sd_hvn[MOCK_CONN_HANDLES];    // buffers taken, not yet sent
+static int          m_sd_wcmd[MOCK_CONN_HANDLES];
+static int          m_sd_proc[MOCK_CONN_HANDLES];   // a procedure waits for its response
+static mock_sent_t  m_sent[MOCK_MAX_SENT];
+static int          m_sent_cnt;
+static void      (* m_sd_enter)(uint16_t conn_handle);                  // runs as a call starts,
+static void      (* m_sd_leave)(uint16_t conn_handle, uint32_t result); // or before it returns
+
+static void sd_hook_enter(uint16_t conn_handle)
+{
+    void (* hook)(uint16_t) = m_sd_enter;
+
+    if (hook != NULL)
+    {
+        m_sd_enter = NULL;
+        hook(conn_handle);
+    }
+}
+
+static uint32_t sd_hook_leave(uint16_t conn_handle, uint32_t result)
+{
+    void (* hook)(uint16_t, uint32_t) = m_sd_leave;
+
+    if (hook != NULL)
+    {
+        m_sd_leave = NULL;
+        hook(conn_handle, result);
+    }
+    return result;
+}
+
+static void sd_record(uint16_t conn_handle, uint8_t const * p_data)
+{
+    if (m_sent_cnt < MOCK_MAX_SENT)
+    {
+        m_sent[m_sent_cnt].conn_handle = conn_handle;
+        m_sent[m_sent_cnt].seq         = uint16_decode(p_data);
+    }
+    m_sent_cnt++;
+}
+
+uint32_t sd_ble_gatts_hvx(uint16_t conn_handle, ble_gatts_hvx_params_t const * p_hvx_params)
+{
+    sd_hook_enter(conn_handle);
+
+    if (m_sd_hvn[conn_handle] >= m_sd_hvn_buffers)
+    {
+        return sd_hook_leave(conn_handle, NRF_ERROR_RESOURCES);
+    }
+    m_sd_hvn[conn_handle]++;
+    sd_record(conn_handle, p_hvx_params->p_data);
+    return sd_hook_leave(conn_handle, NRF_SUCCESS);
+}
+
+uint32_t sd_ble_gattc_write(uint16_t conn_handle, ble_gattc_write_params_t const * p_write_params)
+{
+    sd_hook_enter(conn_handle);
+
+    if (p_write_params->write_op == BLE_GATT_OP_WRITE_CMD)
+    {
+        if (m_sd_wcmd[conn_handle] >= MOCK_WCMD_BUFFERS)
+        {
+            return sd_hook_leave(conn_handle, NRF_ERROR_RESOURCES);
+        }
+        m_sd_wcmd[conn_handle]++;
+    }
+    else
+    {
+        if (m_sd_proc[conn_handle] != 0)
+        {
+            return sd_hook_leave(conn_handle, NRF_ERROR_BUSY);
+        }
+        m_sd_proc[conn_handle] = 1;
+    }
+    sd_record(conn_handle, p_write_params->p_value);
+    return sd_hook_leave(conn_handle, NRF_SUCCESS);
+}
+
+uint32_t sd_ble_gattc_read(uint16_t conn_handle, uint16_t handle, uint16_t offset)
+{
+    uint8_t seq[2];
+
+    (void)offset;
+    sd_hook_enter(conn_handle);
+
+    if (m_sd_proc[conn_handle] != 0)
+    {
+        return sd_hook_leave(conn_handle, NRF_ERROR_BUSY);
+    }
+    m_sd_proc[conn_handle] = 1;
+    UNUSED_RETURN_VALUE(uint16_encode(handle, seq));
+    sd_record(conn_handle, seq);
+    return sd_hook_leave(conn_handle, NRF_SUCCESS);
+}
+
+uint32_t sd_ble_gattc_primary_services_discover(uint16_t           conn_handle,
+                                                uint16_t           start_handle,
+                                                ble_uuid_t const * p_srvc_uuid)
+{
+    (void)conn_handle;
+    (void)start_handle;
+    (void)p_srvc_uuid;
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+uint32_t sd_ble_gattc_characteristics_discover(uint16_t                         conn_handle,
+                                               ble_gattc_handle_range_t const * p_handle_range)
+{
+    (void)conn_handle;
+    (void)p_handle_range;
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+uint32_t sd_ble_gattc_descriptors_discover(uint16_t                         conn_handle,
+                                           ble_gattc_handle_range_t const * p_handle_range)
+{
+    (void)conn_handle;
+    (void)p_handle_range;
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+#include "../../../../components/ble/nrf_ble_gq/nrf_ble_gq.c"
+
+NRF_BLE_GQ_DEF(m_gq, 4, 32);
+NRF_BLE_GQ_PRIO_DEF(m_pq, 4, 32, 8, NRF_BLE_GQ_DATAPOOL_ELEMENT_SIZE,
+                    NRF_BLE_GQ_DATAPOOL_ELEMENT_COUNT);
+
+/*
+ * events and requests
+ */
+static int m_req_errors;
+
+static void req_error_handler(uint32_t nrf_error, void * p_context, uint16_t conn_handle)
+{
+    printf("  request error 0x%x on link %u\n", (unsigned)nrf_error, conn_handle);
+    (void)p_context;
+    m_req_errors++;
+}
+
+static void evt_send(nrf_ble_gq_t * p_gq, uint16_t evt_id, uint16_t conn_handle, uint8_t count)
+{
+    ble_evt_t evt;
+
+    memset(&evt, 0, sizeof(evt));
+    evt.header.evt_id = evt_id;
+    switch (evt_id)
+    {
+        case BLE_GAP_EVT_DISCONNECTED:
+            evt.evt.gap_evt.conn_handle = conn_handle;
+            m_sd_hvn[conn_handle]       = 0;
+            m_sd_wcmd[conn_handle]      = 0;
+            m_sd_proc[conn_handle]      = 0;
+            break;
+
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+            evt.evt.gatts_evt.conn_handle                   = conn_handle;
+            evt.evt.gatts_evt.params.hvn_tx_complete.count  = count;
+            m_sd_hvn[conn_handle]                          -= count;
+            break;
+
+        case BLE_GATTC_EVT_WRITE_CMD_TX_COMPLETE:
+            evt.evt.gattc_evt.conn_handle                         = conn_handle;
+            evt.evt.gattc_evt.params.write_cmd_tx_complete.count  = count;
+            m_sd_wcmd[conn_handle]                               -= count;
+            break;
+
+        default:
+            // A response, the procedure is over.
+            evt.evt.gattc_evt.conn_handle = conn_handle;
+            m_sd_proc[conn_handle]        = 0;
+            break;
+    }
+    nrf_ble_gq_on_ble_evt(&evt, p_gq);
+}
+
+static ret_code_t hvn(nrf_ble_gq_t * p_gq, uint16_t conn_handle, uint16_t len, uint16_t seq)
+{
+    uint8_t          data[NRF_BLE_GQ_GATTS_HVX_MAX_DATA_LEN + 1] = { 0 };
+    nrf_ble_gq_req_t req;
+
+    memset(&req, 0, sizeof(req));
+    UNUSED_RETURN_VALUE(uint16_encode(seq, data));
+    req.type                     = NRF_BLE_GQ_REQ_GATTS_HVX;
+    req.error_handler.cb         = req_error_handler;
+    req.params.gatts_hvx.type    = BLE_GATT_HVX_NOTIFICATION;
+    req.params.gatts_hvx.p_len   = &len;
+    req.params.gatts_hvx.p_data  = data;
+    return nrf_ble_gq_item_add(p_gq, &req, conn_handle);
+}
+
+static ret_code_t wr(nrf_ble_gq_t * p_gq, uint16_t conn_handle, uint8_t write_op, uint16_t seq)
+{
+    uint8_t          data[4] = { 0 };
+    nrf_ble_gq_req_t req;
+
+    memset(&req, 0, sizeof(req));
+    UNUSED_RETURN_VALUE(uint16_encode(seq, data));
+    req.type                       = NRF_BLE_GQ_REQ_GATTC_WRITE;
+    req.error_handler.cb           = req_error_handler;
+    req.params.gattc_write.write_op = write_op;
+    req.params.gattc_write.len     = sizeof(data);
+    req.params.gattc_write.p_value = data;
+    return nrf_ble_gq_item_add(p_gq, &req, conn_handle);
+}
+
+static ret_code_t rd(nrf_ble_gq_t * p_gq, uint16_t conn_handle, uint16_t seq)
+{
+    nrf_ble_gq_req_t req;
+
+    memset(&req, 0, sizeof(req));
+    req.type                     = NRF_BLE_GQ_REQ_GATTC_READ;
+    req.error_handler.cb         = req_error_handler;
+    req.params.gattc_read.handle = seq;
+    return nrf_ble_gq_item_add(p_gq, &req, conn_handle);
+}
+
+static uint16_t queued(nrf_ble_gq_t * p_gq, uint16_t conn_handle, nrf_ble_gq_prio_t prio)
+{
+    uint16_t            conn_id = conn_handle_id_find(p_gq, conn_handle);
+    nrf_queue_t const * p_queue = level_queue_get(p_gq, conn_id, prio);
+
+    return (uint16_t)nrf_queue_utilization_get(p_queue);
+}
+
+static nrf_ble_gq_stats_t stats(nrf_ble_gq_t * p_gq, uint16_t conn_handle, nrf_ble_gq_prio_t prio)
+{
+    nrf_ble_gq_stats_t s;
+
+    CHECK(nrf_ble_gq_stats_get(p_gq, conn_handle, prio, &s) == NRF_SUCCESS, "stats_get");
+    return s;
+}
+
+static void cfg_set(nrf_ble_gq_t * p_gq, uint16_t conn_handle, uint8_t weight, uint8_t prio,
+                    uint8_t hvn_credits)
+{
+    nrf_ble_gq_conn_cfg_t cfg = { weight, prio, hvn_credits, MOCK_WCMD_BUFFERS };
+
+    CHECK(nrf_ble_gq_conn_cfg_set(p_gq, conn_handle, &cfg) == NRF_SUCCESS, "cfg_set");
+}
+
+// every request handed over, in order per link
+static void sent_check(int first, uint16_t conn_handle, uint16_t seq_first, int count)
+{
+    int n = 0;
+
+    for (int i = first; i < m_sent_cnt && n < count; i++)
+    {
+        if (m_sent[i].conn_handle == conn_handle)
+        {
+            CHECK(m_sent[i].seq == seq_first + n, "link %u sent %u, expected %u",
+                  conn_handle, m_sent[i].seq, seq_first + n);
+            n++;
+        }
+    }
+    CHECK(n == count, "link %u sent %d, expected %d", conn_handle, n, count);
+}
+
+static void mock_reset(int links)
+{
+    for (uint16_t c = 0; c < MOCK_CONN_HANDLES; c++)
+    {
+        if (conn_handle_id_find(&m_gq, c) != m_gq.max_conns)
+        {
+            evt_send(&m_gq, BLE_GAP_EVT_DISCONNECTED, c, 0);
+        }
+        if (conn_handle_id_find(&m_pq, c) != m_pq.max_conns)
+        {
+            evt_send(&m_pq, BLE_GAP_EVT_DISCONNECTED, c, 0);
+        }
+    }
+    CHECK(m_memobjs == 0, "%d memobjs left by the last test", m_memobjs);
+
+    memset(m_sd_hvn, 0, sizeof(m_sd_hvn));
+    memset(m_sd_wcmd, 0, sizeof(m_sd_wcmd));
+    memset(m_sd_proc, 0, sizeof(m_sd_proc));
+    m_sd_hvn_buffers = 6;
+    m_sent_cnt       = 0;
+    m_sd_enter       = NULL;
+    m_sd_leave       = NULL;
+    m_req_errors     = 0;
+    m_ticks          = 0;
+
+    for (uint8_t type = 0; type < NRF_BLE_GQ_REQ_NUM; type++)
+    {
+        UNUSED_RETURN_VALUE(nrf_ble_gq_type_prio_set(&m_pq, type, NRF_BLE_GQ_PRIO_NORMAL));
+    }
+    for (uint16_t c = 0; c < links; c++)
+    {
+        CHECK(nrf_ble_gq_conn_handle_register(&m_gq, c) == NRF_SUCCESS, "register %u", c);
+        CHECK(nrf_ble_gq_conn_handle_register(&m_pq, c) == NRF_SUCCESS, "register %u", c);
+    }
+}
+
+static void run(char const * name, void (*test)(void))
+{
+    int failed = m_failed;
+
+    m_app_errors = 0;
+    test();
+    CHECK(m_app_errors == 0, "%d app errors", m_app_errors);
+    CHECK(m_req_errors == 0, "%d request errors", m_req_errors);
+    printf("%-10s %s\n", name, m_failed == failed ? "ok" : "FAILED");
+}
+
+/*
+ * straight out while the SoftDevice takes them, queued in order when it
+ * runs out of buffers
+ */
+static void test_direct(void)
+{
+    mock_reset(3);
+
+    CHECK(hvn(&m_gq, 0, 20, 0) == NRF_SUCCESS && m_sent_cnt == 1 && m_memobjs == 0,
+          "not sent without queueing");
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 0, 1);
+
+    for (uint16_t i = 1; i < 11; i++)
+    {
+        CHECK(hvn(&m_gq, 0, 20, i) == NRF_SUCCESS, "hvn %u", i);
+    }
+    CHECK(m_sent_cnt == 7 && queued(&m_gq, 0, NRF_BLE_GQ_PRIO_NORMAL) == 4,
+          "sent %d queued %u", m_sent_cnt, queued(&m_gq, 0, NRF_BLE_GQ_PRIO_NORMAL));
+
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 0, 3);
+    CHECK(m_sent_cnt == 10, "sent %d after 3 buffers came back", m_sent_cnt);
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 0, 6);
+    CHECK(m_sent_cnt == 11 && queued(&m_gq, 0, NRF_BLE_GQ_PRIO_NORMAL) == 0, "sent %d", m_sent_cnt);
+    sent_check(0, 0, 0, 11);
+    CHECK(stats(&m_gq, 0, NRF_BLE_GQ_PRIO_NORMAL).dispatched == 11, "dispatched");
+
+    nrf_ble_gq_conn_cfg_t cfg = { 1, NRF_BLE_GQ_PRIO_HIGH, 0, 0 };
+
+    CHECK(nrf_ble_gq_conn_cfg_set(&m_gq, 0, &cfg) == NRF_ERROR_NOT_SUPPORTED, "high without queues");
+    CHECK(nrf_ble_gq_type_prio_set(&m_gq, NRF_BLE_GQ_REQ_GATTS_HVX, NRF_BLE_GQ_PRIO_HIGH) ==
+          NRF_ERROR_NOT_SUPPORTED, "high type without queues");
+    CHECK(hvn(&m_gq, 7, 20, 0) == NRF_ERROR_INVALID_PARAM, "unregistered link taken");
+}
+
+/*
+ * credits keep notifications in the queue, the byte share of the weights
+ */
+static void test_credits(void)
+{
+    mock_reset(3);
+
+    cfg_set(&m_gq, 0, 1, NRF_BLE_GQ_PRIO_NORMAL, 2);
+    cfg_set(&m_gq, 1, 1, NRF_BLE_GQ_PRIO_NORMAL, 2);
+    for (uint16_t i = 0; i < 30; i++)
+    {
+        UNUSED_RETURN_VALUE(hvn(&m_gq, 0, 60, i));
+        UNUSED_RETURN_VALUE(hvn(&m_gq, 1, 10, i));
+    }
+    CHECK(m_sd_hvn[0] == 2 && m_sd_hvn[1] == 2, "in the SoftDevice %d %d, 2 credits",
+          m_sd_hvn[0], m_sd_hvn[1]);
+
+    for (int round = 0; round < 100 && m_sent_cnt < 60; round++)
+    {
+        for (uint16_t c = 0; c < 2; c++)
+        {
+            evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, c, (uint8_t)m_sd_hvn[c]);
+        }
+        CHECK(m_sd_hvn[0] <= 2 && m_sd_hvn[1] <= 2, "over the credits");
+    }
+    sent_check(0, 0, 0, 30);
+    sent_check(0, 1, 0, 30);
+    for (uint16_t c = 0; c < 2; c++)
+    {
+        evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, c, (uint8_t)m_sd_hvn[c]);
+    }
+
+    // both backlogged, the SoftDevice takes them all once an event frees it
+    cfg_set(&m_gq, 0, 3, NRF_BLE_GQ_PRIO_NORMAL, 0);
+    cfg_set(&m_gq, 1, 1, NRF_BLE_GQ_PRIO_NORMAL, 0);
+    m_sd_hvn[0] = m_sd_hvn_buffers;
+    m_sd_hvn[1] = m_sd_hvn_buffers;
+    for (uint16_t i = 0; i < 31; i++)
+    {
+        CHECK(hvn(&m_gq, 0, 20, 100 + i) == NRF_SUCCESS, "hvn 0");
+        CHECK(hvn(&m_gq, 1, 20, 100 + i) == NRF_SUCCESS, "hvn 1");
+    }
+    m_sent_cnt       = 0;
+    m_sd_hvn_buffers = 100;
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 0, (uint8_t)m_sd_hvn[0]);
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 1, (uint8_t)m_sd_hvn[1]);
+
+    int first = 0;
+
+    for (int i = 0; i < 40; i++)
+    {
+        first += (m_sent[i].conn_handle == 0);
+    }
+    CHECK(first >= 28 && first <= 32, "weight 3 to 1: %d of the first 40 from link 0", first);
+    sent_check(0, 0, 100, 31);
+    sent_check(0, 1, 100, 31);
+    m_sd_hvn[0] = 0;
+    m_sd_hvn[1] = 0;
+}
+
+/*
+ * a write request holds the link until its response, write commands have
+ * their own buffers, the order of the queue is kept across both
+ */
+static void test_busy(void)
+{
+    mock_reset(3);
+
+    CHECK(wr(&m_gq, 2, BLE_GATT_OP_WRITE_REQ, 0) == NRF_SUCCESS, "write req");
+    CHECK(wr(&m_gq, 2, BLE_GATT_OP_WRITE_REQ, 1) == NRF_SUCCESS, "write req");
+    CHECK(m_sent_cnt == 1 && m_gq.p_links[2].busy == RES_PROC, "sent %d busy %u",
+          m_sent_cnt, m_gq.p_links[2].busy);
+    for (uint16_t i = 2; i < 6; i++)
+    {
+        CHECK(wr(&m_gq, 2, BLE_GATT_OP_WRITE_CMD, i) == NRF_SUCCESS, "write cmd");
+    }
+    CHECK(m_sent_cnt == 1, "write cmd passed a write req");
+
+    evt_send(&m_gq, BLE_GATTC_EVT_WRITE_RSP, 2, 0);
+    CHECK(m_sent_cnt == 4 && m_gq.p_links[2].full == RES_WCMD, "sent %d full %u",
+          m_sent_cnt, m_gq.p_links[2].full);
+    evt_send(&m_gq, BLE_GATTC_EVT_WRITE_CMD_TX_COMPLETE, 2, 2);
+    evt_send(&m_gq, BLE_GATTC_EVT_WRITE_RSP, 2, 0);
+    CHECK(m_sent_cnt == 6, "sent %d", m_sent_cnt);
+    sent_check(0, 2, 0, 6);
+    evt_send(&m_gq, BLE_GATTC_EVT_WRITE_CMD_TX_COMPLETE, 2, 2);
+}
+
+/*
+ * high priority queues go first, by type or by link, with their counters
+ */
+static void test_prio(void)
+{
+    mock_reset(3);
+
+    CHECK(nrf_ble_gq_type_prio_set(&m_pq, NRF_BLE_GQ_REQ_GATTC_READ, NRF_BLE_GQ_PRIO_HIGH) ==
+          NRF_SUCCESS, "type prio");
+    cfg_set(&m_pq, 0, 1, NRF_BLE_GQ_PRIO_NORMAL, 1);
+    cfg_set(&m_pq, 1, 1, NRF_BLE_GQ_PRIO_HIGH, 1);
+    cfg_set(&m_pq, 2, 1, NRF_BLE_GQ_PRIO_NORMAL, 1);
+
+    m_ticks = 1000;
+    for (uint16_t i = 0; i < 5; i++)
+    {
+        for (uint16_t c = 0; c < 3; c++)
+        {
+            UNUSED_RETURN_VALUE(hvn(&m_pq, c, 20, i));
+        }
+    }
+    CHECK(m_sent_cnt == 3, "sent %d, 1 credit each", m_sent_cnt);
+    CHECK(queued(&m_pq, 1, NRF_BLE_GQ_PRIO_HIGH) == 4 && queued(&m_pq, 1, NRF_BLE_GQ_PRIO_NORMAL) == 0,
+          "link 1 not in the high queue");
+
+    // a read of link 2 is high by type, it goes before its notifications once the link is free
+    CHECK(rd(&m_pq, 2, 100) == NRF_SUCCESS, "read");
+    CHECK(m_sent_cnt == 4 && m_sent[3].seq == 100, "read not sent ahead");
+    evt_send(&m_pq, BLE_GATTC_EVT_READ_RSP, 2, 0);
+
+    // one TX complete per link while the module is busy: link 1 goes first after
+    for (int round = 0; round < 4; round++)
+    {
+        int first = m_sent_cnt;
+
+        UNUSED_RETURN_VALUE(nrf_atomic_flag_set(&m_pq.p_sched->running));
+        for (uint16_t c = 0; c < 3; c++)
+        {
+            evt_send(&m_pq, BLE_GATTS_EVT_HVN_TX_COMPLETE, c, 1);
+        }
+        m_ticks += 50;
+        sched_unlock(&m_pq);
+        CHECK(m_sent_cnt == first + 3 && m_sent[first].conn_handle == 1, "round %d: link %u first",
+              round, m_sent[first].conn_handle);
+    }
+
+    nrf_ble_gq_stats_t s = stats(&m_pq, 1, NRF_BLE_GQ_PRIO_HIGH);
+
+    CHECK(s.dispatched == 5 && s.high_water == 4 && s.wait_max == 200 && s.wait_total == 500,
+          "link 1 high: dispatched %u wait total %u max %u high water %u",
+          (unsigned)s.dispatched, (unsigned)s.wait_total, (unsigned)s.wait_max, s.high_water);
+    s = stats(&m_pq, 2, NRF_BLE_GQ_PRIO_HIGH);
+    CHECK(s.dispatched == 1 && s.wait_max == 0, "read without queueing %u", (unsigned)s.dispatched);
+    for (uint16_t c = 0; c < 3; c++)
+    {
+        evt_send(&m_pq, BLE_GATTS_EVT_HVN_TX_COMPLETE, c, (uint8_t)m_sd_hvn[c]);
+    }
+    sent_check(0, 0, 0, 5);
+    sent_check(0, 1, 0, 5);
+}
+
+/*
+ * purge takes out some types and keeps the order of the rest
+ */
+static void test_purge(void)
+{
+    uint16_t purged;
+
+    mock_reset(3);
+
+    cfg_set(&m_gq, 2, 1, NRF_BLE_GQ_PRIO_NORMAL, 1);
+    m_sd_hvn[2] = m_sd_hvn_buffers;
+    for (uint16_t i = 0; i < 8; i++)
+    {
+        if ((i & 1) != 0)
+        {
+            CHECK(wr(&m_gq, 2, BLE_GATT_OP_WRITE_CMD, i) == NRF_SUCCESS, "write cmd");
+        }
+        else
+        {
+            CHECK(hvn(&m_gq, 2, 20, i) == NRF_SUCCESS, "hvn");
+        }
+    }
+    CHECK(m_sent_cnt == 0, "sent %d behind a full link", m_sent_cnt);
+    CHECK(nrf_ble_gq_conn_purge(&m_gq, 2, NRF_BLE_GQ_REQ_MASK(NRF_BLE_GQ_REQ_GATTC_WRITE), &purged)
+          == NRF_SUCCESS && purged == 4, "purged %u", purged);
+    CHECK(m_memobjs == 4, "%d memobjs, 4 left", m_memobjs);
+    CHECK(nrf_ble_gq_conn_purge(&m_gq, 7, 0, NULL) == NRF_ERROR_INVALID_PARAM, "unregistered purge");
+
+    m_sd_hvn[2] = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 2, (uint8_t)m_sd_hvn[2]);
+    }
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 2, (uint8_t)m_sd_hvn[2]);
+    CHECK(m_sent_cnt == 4, "sent %d", m_sent_cnt);
+    for (int i = 0; i < m_sent_cnt; i++)
+    {
+        CHECK(m_sent[i].seq == 2 * i, "sent %u, expected %d", m_sent[i].seq, 2 * i);
+    }
+}
+
+/*
+ * interrupts during a SoftDevice call of the module
+ */
+static uint16_t m_nested_seq;
+static uint32_t m_nested_result;
+
+static void nested_hvn(uint16_t conn_handle)
+{
+    m_nested_result = hvn(&m_gq, conn_handle, 20, m_nested_seq);
+}
+
+static void nested_purge(uint16_t conn_handle)
+{
+    m_nested_result = nrf_ble_gq_conn_purge(&m_gq, conn_handle, 0, NULL);
+}
+
+static void nested_tx_complete(uint16_t conn_handle, uint32_t result)
+{
+    (void)result;
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, conn_handle, (uint8_t)m_sd_hvn[conn_handle]);
+}
+
+static void nested_disconnect(uint16_t conn_handle)
+{
+    evt_send(&m_gq, BLE_GAP_EVT_DISCONNECTED, 3, 0);
+    m_nested_result = nrf_ble_gq_conn_handle_register(&m_gq, 9);
+    (void)conn_handle;
+}
+
+static void test_nested(void)
+{
+    mock_reset(3);
+
+    // added from an interrupt while the first one is handed over: it goes after it
+    m_sd_enter   = nested_hvn;
+    m_nested_seq = 1;
+    CHECK(hvn(&m_gq, 0, 20, 0) == NRF_SUCCESS && m_nested_result == NRF_SUCCESS, "hvn");
+    CHECK(m_sent_cnt == 2 && queued(&m_gq, 0, NRF_BLE_GQ_PRIO_NORMAL) == 0, "sent %d", m_sent_cnt);
+    sent_check(0, 0, 0, 2);
+
+    // the same while queued requests are dispatched
+    m_sd_hvn[1] = m_sd_hvn_buffers;
+    for (uint16_t i = 0; i < 3; i++)
+    {
+        UNUSED_RETURN_VALUE(hvn(&m_gq, 1, 20, i));
+    }
+    m_sd_enter   = nested_hvn;
+    m_nested_seq = 3;
+    m_sent_cnt   = 0;
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 1, (uint8_t)m_sd_hvn[1]);
+    sent_check(0, 1, 0, 4);
+
+    // purging while dispatching is refused, not done under the feet of the scheduler
+    m_sd_enter = nested_purge;
+    CHECK(hvn(&m_gq, 2, 20, 0) == NRF_SUCCESS && m_nested_result == NRF_ERROR_BUSY,
+          "purge during a call: 0x%x", (unsigned)m_nested_result);
+    CHECK(nrf_ble_gq_conn_purge(&m_gq, 2, 0, NULL) == NRF_SUCCESS, "purge after");
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 0, (uint8_t)m_sd_hvn[0]);
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 1, (uint8_t)m_sd_hvn[1]);
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 2, (uint8_t)m_sd_hvn[2]);
+
+    // a link disconnected during a call is purged when it is done, its ID is reused then
+    CHECK(nrf_ble_gq_conn_handle_register(&m_gq, 3) == NRF_SUCCESS, "register 3");
+    m_sd_hvn[3] = m_sd_hvn_buffers;
+    UNUSED_RETURN_VALUE(hvn(&m_gq, 3, 20, 0));
+    UNUSED_RETURN_VALUE(hvn(&m_gq, 3, 20, 1));
+    m_sd_enter = nested_disconnect;
+    CHECK(hvn(&m_gq, 0, 20, 10) == NRF_SUCCESS, "hvn");
+    CHECK(m_nested_result == NRF_ERROR_BUSY, "ID reused before the purge: 0x%x",
+          (unsigned)m_nested_result);
+    CHECK(m_memobjs == 0, "%d memobjs of link 3 not purged", m_memobjs);
+    CHECK(nrf_ble_gq_conn_handle_register(&m_gq, 9) == NRF_SUCCESS, "register 9 after the purge");
+    m_sent_cnt = 0;
+    CHECK(hvn(&m_gq, 9, 20, 0) == NRF_SUCCESS && m_sent_cnt == 1, "link 9 not served");
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 0, (uint8_t)m_sd_hvn[0]);
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 9, (uint8_t)m_sd_hvn[9]);
+}
+
+/*
+ * TX complete during the call: for the packet just taken, and for the
+ * buffers just found full
+ */
+static void test_txnested(void)
+{
+    mock_reset(3);
+
+    // one credit, every packet is sent before the call returns
+    cfg_set(&m_gq, 0, 1, NRF_BLE_GQ_PRIO_NORMAL, 1);
+    for (uint16_t i = 0; i < 5; i++)
+    {
+        m_sd_leave = nested_tx_complete;
+        CHECK(hvn(&m_gq, 0, 20, i) == NRF_SUCCESS, "hvn %u", i);
+    }
+    CHECK(m_sent_cnt == 5 && m_gq.p_links[0].hvn_in_flight == 0, "sent %d, %u credits lost",
+          m_sent_cnt, m_gq.p_links[0].hvn_in_flight);
+
+    // buffers taken by another service, they come back as the call is refused
+    m_sd_hvn[1] = m_sd_hvn_buffers;
+    m_sent_cnt  = 0;
+    m_sd_leave  = nested_tx_complete;
+    for (uint16_t i = 0; i < 3; i++)
+    {
+        CHECK(hvn(&m_gq, 1, 20, i) == NRF_SUCCESS, "hvn %u", i);
+    }
+    CHECK(m_sent_cnt == 3 && queued(&m_gq, 1, NRF_BLE_GQ_PRIO_NORMAL) == 0,
+          "link stalled: sent %d, %u queued, full %u", m_sent_cnt,
+          queued(&m_gq, 1, NRF_BLE_GQ_PRIO_NORMAL), m_gq.p_links[1].full);
+    sent_check(0, 1, 0, 3);
+    evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, 1, (uint8_t)m_sd_hvn[1]);
+}
+
+/*
+ * random requests and events, also from inside the SoftDevice calls
+ */
+#define RANDOM_LINKS 3
+
+static uint32_t m_rng;
+static int      m_random_rounds = 20000;
+static uint16_t m_random_seq[RANDOM_LINKS];
+static int      m_random_added[RANDOM_LINKS];
+static uint16_t m_random_next[RANDOM_LINKS];              // sequence number expected next
+static int      m_random_checked;
+
+static uint32_t rnd(void)
+{
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 17;
+    m_rng ^= m_rng << 5;
+    return m_rng;
+}
+
+// requests of one link added at the same time have no order, so an interrupt adds to another
+static void random_add(uint16_t busy_link)
+{
+    uint16_t   c   = rnd() % RANDOM_LINKS;
+    uint16_t   seq;
+    uint32_t   r   = rnd() % 10;
+    ret_code_t err_code;
+
+    if (c == busy_link)
+    {
+        c = (c + 1) % RANDOM_LINKS;
+    }
+    seq = m_random_seq[c];
+
+    if (r < 6)
+    {
+        err_code = hvn(&m_gq, c, (uint16_t)(2 + rnd() % 59), seq);
+    }
+    else if (r < 8)
+    {
+        err_code = wr(&m_gq, c, BLE_GATT_OP_WRITE_CMD, seq);
+    }
+    else
+    {
+        err_code = wr(&m_gq, c, BLE_GATT_OP_WRITE_REQ, seq);
+    }
+
+    CHECK(err_code == NRF_SUCCESS || err_code == NRF_ERROR_NO_MEM, "add 0x%x", (unsigned)err_code);
+    if (err_code == NRF_SUCCESS)
+    {
+        m_random_seq[c]++;
+        m_random_added[c]++;
+    }
+}
+
+static void random_event(void)
+{
+    uint16_t c = rnd() % RANDOM_LINKS;
+
+    switch (rnd() % 3)
+    {
+        case 0:
+            if (m_sd_hvn[c] > 0)
+            {
+                evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, c, (uint8_t)(1 + rnd() % m_sd_hvn[c]));
+            }
+            break;
+
+        case 1:
+            if (m_sd_wcmd[c] > 0)
+            {
+                evt_send(&m_gq, BLE_GATTC_EVT_WRITE_CMD_TX_COMPLETE, c, (uint8_t)m_sd_wcmd[c]);
+            }
+            break;
+
+        default:
+            if (m_sd_proc[c] != 0)
+            {
+                evt_send(&m_gq, BLE_GATTC_EVT_WRITE_RSP, c, 0);
+            }
+            break;
+    }
+}
+
+static void random_interrupt(uint16_t conn_handle)
+{
+    if ((rnd() % 2) == 0)
+    {
+        random_add(conn_handle);
+    }
+    else
+    {
+        random_event();
+    }
+}
+
+static void random_enter(uint16_t conn_handle)
+{
+    random_interrupt(conn_handle);
+}
+
+static void random_leave(uint16_t conn_handle, uint32_t result)
+{
+    (void)result;
+    random_interrupt(conn_handle);
+}
+
+// everything handed over since the last look, in order per link
+static void random_sent_check(void)
+{
+    for (; m_random_checked < m_sent_cnt; m_random_checked++)
+    {
+        mock_sent_t const * p_sent = &m_sent[m_random_checked];
+
+        CHECK(p_sent->seq == m_random_next[p_sent->conn_handle], "link %u sent %u, expected %u",
+              p_sent->conn_handle, p_sent->seq, m_random_next[p_sent->conn_handle]);
+        m_random_next[p_sent->conn_handle] = p_sent->seq + 1;
+    }
+    if (m_sent_cnt > MOCK_MAX_SENT / 2)
+    {
+        m_sent_cnt       = 0;
+        m_random_checked = 0;
+    }
+}
+
+static void test_random(void)
+{
+    int total_added = 0;
+
+    mock_reset(RANDOM_LINKS);
+    memset(m_random_seq, 0, sizeof(m_random_seq));
+    memset(m_random_added, 0, sizeof(m_random_added));
+    memset(m_random_next, 0, sizeof(m_random_next));
+    m_random_checked = 0;
+
+    m_sd_hvn_buffers = 4;
+    cfg_set(&m_gq, 0, 1, NRF_BLE_GQ_PRIO_NORMAL, 4);
+    cfg_set(&m_gq, 1, 2, NRF_BLE_GQ_PRIO_NORMAL, 0);
+    cfg_set(&m_gq, 2, 1, NRF_BLE_GQ_PRIO_NORMAL, 2);
+
+    for (int round = 0; round < m_random_rounds; round++)
+    {
+        if ((rnd() % 4) == 0)
+        {
+            m_sd_enter = random_enter;
+        }
+        else if ((rnd() % 4) == 0)
+        {
+            m_sd_leave = random_leave;
+        }
+
+        if ((rnd() % 2) == 0)
+        {
+            random_add(BLE_CONN_HANDLE_INVALID);
+        }
+        else
+        {
+            random_event();
+        }
+        m_ticks++;
+        random_sent_check();
+    }
+
+    m_sd_enter = NULL;
+    m_sd_leave = NULL;
+
+    // drain: with the SoftDevice empty, nothing may be left queued
+    for (;;)
+    {
+        bool busy = false;
+
+        for (uint16_t c = 0; c < RANDOM_LINKS; c++)
+        {
+            if (m_sd_hvn[c] > 0)
+            {
+                evt_send(&m_gq, BLE_GATTS_EVT_HVN_TX_COMPLETE, c, (uint8_t)m_sd_hvn[c]);
+                busy = true;
+            }
+            if (m_sd_wcmd[c] > 0)
+            {
+                evt_send(&m_gq, BLE_GATTC_EVT_WRITE_CMD_TX_COMPLETE, c, (uint8_t)m_sd_wcmd[c]);
+                busy = true;
+            }
+            if (m_sd_proc[c] != 0)
+            {
+                evt_send(&m_gq, BLE_GATTC_EVT_WRITE_RSP, c, 0);
+                busy = true;
+            }
+        }
+        random_sent_check();
+        if (!busy)
+        {
+            break;
+        }
+    }
+
+    for (uint16_t c = 0; c < RANDOM_LINKS; c++)
+    {
+        nrf_ble_gq_link_t const * p_link = &m_gq.p_links[conn_handle_id_find(&m_gq, c)];
+
+        CHECK(queued(&m_gq, c, NRF_BLE_GQ_PRIO_NORMAL) == 0, "link %u stalled with %u queued",
+              c, queued(&m_gq, c, NRF_BLE_GQ_PRIO_NORMAL));
+        CHECK(m_random_next[c] == m_random_seq[c], "link %u sent up to %u of %u",
+              c, m_random_next[c], m_random_seq[c]);
+        CHECK(p_link->hvn_in_flight == 0 && p_link->wcmd_in_flight == 0,
+              "link %u credits lost: %u %u", c, p_link->hvn_in_flight, p_link->wcmd_in_flight);
+        total_added += m_random_added[c];
+    }
+    CHECK(m_memobjs == 0, "%d memobjs left", m_memobjs);
+    CHECK(total_added > m_random_rounds / 8, "only %d requests added", total_added);
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc > 1)
+    {
+        m_random_rounds = atoi(argv[1]);
+    }
+    m_rng = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 1;
+    if (m_rng == 0)
+    {
+        m_rng = 1;
+    }
+
+    run("direct", test_direct);
+    run("credits", test_credits);
+    run("busy", test_busy);
+    run("prio", test_prio);
+    run("purge", test_purge);
+    run("nested", test_nested);
+    run("txnested", test_txnested);
+    run("random", test_random);
+
+    return m_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,595 @@
+/*
+ * nustest, checks the transmit queue of ble_nus (ble_nus_data_queue) on a
+ * host against a model of the SoftDevice notification buffers
+ *
+ * the model takes notifications while it has buffers left and refuses the
+ * next one with NRF_ERROR_RESOURCES, BLE_GATTS_EVT_HVN_TX_COMPLETE gives
+ * buffers back. every notification handed over is recorded as it was at the
+ * call, the SoftDevice copies it there too.
+ *
+ * checked: joining on the join_len header bytes and up to the ATT MTU,
+ * BLE_NUS_JOIN_NEVER, a full queue, the credits learned from
+ * NRF_ERROR_RESOURCES (one refused call per time the buffers run out, no
+ * retry), TX complete counts that include notifications of other services,
+ * notifications the SoftDevice refuses for other reasons, the queue reset on
+ * connect. the "random" test queues random data and delivers TX complete at
+ * random, also from inside sd_ble_gatts_hvx as an interrupt would, and then
+ * takes the notifications apart again: every piece queued must come out
+ * once, in order, and no notification may be longer than the MTU allows.
+ * exits non zero if any check fails.
+ *
+ * usage: nustest [random rounds, default 20000] [seed]
+ *
+ * build as described in sim/README:
+ * gcc -std=gnu99 -DNRF52832_XXAA -DS132 -DSOFTDEVICE_PRESENT -DNRF_SD_BLE_API_VERSION=7 \
+ *     -DSVCALL_AS_NORMAL_FUNCTION -DNRF_LOG_ENABLED=0 $INC sim/nustest.c -o nustest
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdk_common.h"
+#include "ble.h"
+#include "ble_srv_common.h"
+#include "ble_nus.h"
+
+#define MOCK_CONN_HANDLE                    0
+#define MOCK_TX_VALUE_HANDLE                0x10
+#define MOCK_TX_CCCD_HANDLE                 0x11
+#define MOCK_MAX_NOTIFICATIONS              4096
+
+static int      m_failed;
+static int      m_app_errors;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) { printf("  " __VA_ARGS__); printf("\n"); m_failed++; }    \
+    } while (0)
+
+/*
+ * SoftDevice model
+ */
+typedef struct mock_notification
+{
+    uint16_t    length;
+    uint8_t     data[BLE_NUS_MAX_DATA_LEN];
+} mock_notification_t;
+
+static int                  m_sd_buffers;           // notification buffers of the link
+static int                  m_sd_in_flight;         // buffers taken, not yet sent
+static int                  m_sd_resources;         // calls refused with NRF_ERROR_RESOURCES
+static uint32_t             m_sd_refuse;            // NRF_ERROR_* returned instead of sending, 0 sends
+static mock_notification_t  m_sent[MOCK_MAX_NOTIFICATIONS];
+static int                  m_sent_cnt;
+static void              (* m_hvx_hook)(void);      // runs inside sd_ble_gatts_hvx, an "interrupt"
+
+uint32_t sd_ble_gatts_hvx(uint16_t conn_handle, ble_gatts_hvx_params_t const * p_hvx_params)
+{
+    if (m_hvx_hook != NULL)
+    {
+        void (* hook)(void) = m_hvx_hook;
+
+        m_hvx_hook = NULL;
+        hook();
+        m_hvx_hook = hook;
+    }
+
+    CHECK(conn_handle == MOCK_CONN_HANDLE && p_hvx_params->handle == MOCK_TX_VALUE_HANDLE &&
+          p_hvx_params->type == BLE_GATT_HVX_NOTIFICATION, "hvx params");
+
+    if (m_sd_refuse != 0)
+    {
+        return m_sd_refuse;
+    }
+    if (m_sd_in_flight >= m_sd_buffers)
+    {
+        m_sd_resources++;
+        return NRF_ERROR_RESOURCES;
+    }
+    if (m_sent_cnt < MOCK_MAX_NOTIFICATIONS)
+    {
+        m_sent[m_sent_cnt].length = *p_hvx_params->p_len;
+        memcpy(m_sent[m_sent_cnt].data, p_hvx_params->p_data, *p_hvx_params->p_len);
+    }
+    m_sent_cnt++;
+    m_sd_in_flight++;
+    return NRF_SUCCESS;
+}
+
+static uint8_t m_cccd[2] = { BLE_GATT_HVX_NOTIFICATION, 0 };
+
+uint32_t sd_ble_gatts_value_get(uint16_t conn_handle, uint16_t handle, ble_gatts_value_t * p_value)
+{
+    (void)conn_handle;
+    CHECK(handle == MOCK_TX_CCCD_HANDLE, "value_get handle 0x%x", handle);
+    memcpy(p_value->p_value, m_cccd, sizeof(m_cccd));
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_uuid_vs_add(ble_uuid128_t const * p_vs_uuid, uint8_t * p_uuid_type)
+{
+    (void)p_vs_uuid;
+    *p_uuid_type = BLE_UUID_TYPE_VENDOR_BEGIN;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_service_add(uint8_t type, ble_uuid_t const * p_uuid, uint16_t * p_handle)
+{
+    (void)type;
+    (void)p_uuid;
+    *p_handle = 0x0c;
+    return NRF_SUCCESS;
+}
+
+uint32_t characteristic_add(uint16_t                   service_handle,
+                            ble_add_char_params_t *    p_char_props,
+                            ble_gatts_char_handles_t * p_char_handle)
+{
+    (void)service_handle;
+    memset(p_char_handle, 0, sizeof(ble_gatts_char_handles_t));
+    if (p_char_props->char_props.notify)
+    {
+        p_char_handle->value_handle = MOCK_TX_VALUE_HANDLE;
+        p_char_handle->cccd_handle  = MOCK_TX_CCCD_HANDLE;
+    }
+    else
+    {
+        p_char_handle->value_handle = MOCK_TX_VALUE_HANDLE - 2;
+    }
+    return NRF_SUCCESS;
+}
+
+bool ble_srv_is_notification_enabled(uint8_t const * p_encoded_data)
+{
+    return (p_encoded_data[0] & BLE_GATT_HVX_NOTIFICATION) != 0;
+}
+
+/*
+ * one link, one client context
+ */
+static uint32_t m_ctx_data[BYTES_TO_WORDS(sizeof(ble_nus_client_context_t))];
+
+ret_code_t blcm_link_ctx_get(blcm_link_ctx_storage_t const * const p_link_ctx_storage,
+                             uint16_t                        const conn_handle,
+                             void                         ** const pp_ctx_data)
+{
+    (void)p_link_ctx_storage;
+    *pp_ctx_data = (conn_handle == MOCK_CONN_HANDLE) ? (void *)m_ctx_data : NULL;
+    return (conn_handle == MOCK_CONN_HANDLE) ? NRF_SUCCESS : NRF_ERROR_NOT_FOUND;
+}
+
+void app_util_critical_region_enter(uint8_t * p_nested)
+{
+    (void)p_nested;
+}
+
+void app_util_critical_region_exit(uint8_t nested)
+{
+    (void)nested;
+}
+
+void app_error_handler_bare(ret_code_t error_code)
+{
+    (void)error_code;
+    m_app_errors++;
+}
+
+#include "../../../../components/ble/ble_services/ble_nus/ble_nus.c"
+
+#if (BLE_NUS_TX_QUEUE_SIZE == 0)
+#error nustest checks the transmit queue, build it with BLE_NUS_TX_QUEUE_SIZE > 0.
+#endif
+
+static blcm_link_ctx_storage_t  m_link_ctx_storage;
+static ble_nus_t                m_nus = { .p_link_ctx_storage = &m_link_ctx_storage };
+static int                      m_tx_rdy;
+
+static void nus_data_handler(ble_nus_evt_t * p_evt)
+{
+    if (p_evt->type == BLE_NUS_EVT_TX_RDY)
+    {
+        m_tx_rdy++;
+    }
+}
+
+static ble_nus_client_context_t * client(void)
+{
+    return (ble_nus_client_context_t *)m_ctx_data;
+}
+
+static void connect(uint16_t mtu)
+{
+    ble_evt_t          evt  = { 0 };
+    nrf_ble_gatt_evt_t gatt = { 0 };
+
+    evt.header.evt_id                 = BLE_GAP_EVT_CONNECTED;
+    evt.evt.gap_evt.conn_handle       = MOCK_CONN_HANDLE;
+    ble_nus_on_ble_evt(&evt, &m_nus);
+
+    gatt.evt_id                       = NRF_BLE_GATT_EVT_ATT_MTU_UPDATED;
+    gatt.conn_handle                  = MOCK_CONN_HANDLE;
+    gatt.params.att_mtu_effective     = mtu;
+    ble_nus_on_gatt_evt(&m_nus, &gatt);
+}
+
+static void tx_complete(uint8_t count)
+{
+    ble_evt_t evt = { 0 };
+
+    evt.header.evt_id                                = BLE_GATTS_EVT_HVN_TX_COMPLETE;
+    evt.evt.gatts_evt.conn_handle                    = MOCK_CONN_HANDLE;
+    evt.evt.gatts_evt.params.hvn_tx_complete.count   = count;
+    ble_nus_on_ble_evt(&evt, &m_nus);
+}
+
+// the SoftDevice sends count notifications, of ble_nus and others
+static void sd_send(int count)
+{
+    count = MIN(count, m_sd_in_flight);
+    m_sd_in_flight -= count;
+    tx_complete((uint8_t)count);
+}
+
+static ble_nus_tx_stats_t stats(void)
+{
+    ble_nus_tx_stats_t s;
+
+    CHECK(ble_nus_tx_stats_get(&m_nus, MOCK_CONN_HANDLE, &s) == NRF_SUCCESS, "stats_get");
+    return s;
+}
+
+static uint32_t queue(uint8_t const * p_data, uint16_t length, uint8_t join_len)
+{
+    return ble_nus_data_queue(&m_nus, p_data, length, join_len, MOCK_CONN_HANDLE);
+}
+
+static void mock_reset(int buffers)
+{
+    m_sd_buffers   = buffers;
+    m_sd_in_flight = 0;
+    m_sd_resources = 0;
+    m_sd_refuse    = 0;
+    m_sent_cnt     = 0;
+    m_hvx_hook     = NULL;
+    m_tx_rdy       = 0;
+    m_cccd[0]      = BLE_GATT_HVX_NOTIFICATION;
+    memset(m_ctx_data, 0, sizeof(m_ctx_data));
+    m_nus.data_handler = nus_data_handler;
+    CHECK(ble_nus_init(&m_nus, &(ble_nus_init_t){ .data_handler = nus_data_handler }) == NRF_SUCCESS,
+          "init");
+}
+
+static void run(char const * name, void (*test)(void))
+{
+    int failed = m_failed;
+
+    m_app_errors = 0;
+    test();
+    CHECK(m_app_errors == 0, "%d app errors", m_app_errors);
+    printf("%-10s %s\n", name, m_failed == failed ? "ok" : "FAILED");
+}
+
+/*
+ * joining: no buffers so everything stays queued
+ */
+static void test_join(void)
+{
+    uint8_t a[] = { 0xa1, 0x01, 'a', 'b' };
+    uint8_t b[] = { 0xa1, 0x01, 'c' };
+    uint8_t c[] = { 0xa1, 0x02, 'd' };
+    uint8_t big[64];
+
+    mock_reset(0);
+    connect(23);
+
+    CHECK(queue(a, sizeof(a), 2) == NRF_SUCCESS, "queue a");
+    CHECK(m_sd_resources == 1 && client()->tx_queue.credits == 0, "credits not learned");
+    CHECK(queue(b, sizeof(b), 2) == NRF_SUCCESS, "queue b");
+    CHECK(queue(c, sizeof(c), 2) == NRF_SUCCESS, "queue c");
+    CHECK(queue(c, sizeof(c), 1) == NRF_SUCCESS, "queue c join_len 1");
+    CHECK(queue(c, sizeof(c), BLE_NUS_JOIN_NEVER) == NRF_SUCCESS, "queue c never");
+    CHECK(queue(c, sizeof(c), BLE_NUS_JOIN_NEVER) == NRF_SUCCESS, "queue c never again");
+    CHECK(m_sd_resources == 1, "%d refused calls, retried without credits", m_sd_resources);
+
+    ble_nus_tx_queue_t * p_queue = &client()->tx_queue;
+
+    CHECK(p_queue->count == 5 && stats().joined == 1, "count %d joined %u",
+          p_queue->count, (unsigned)stats().joined);
+    CHECK(p_queue->buf[0].length == 5 && memcmp(p_queue->buf[0].data, "\xa1\x01" "abc", 5) == 0,
+          "a and b not joined");
+
+    // up to the MTU, 20 bytes with 23
+    memset(big, 0xa1, sizeof(big));
+    mock_reset(0);
+    connect(23);
+    CHECK(queue(big, 20, 1) == NRF_SUCCESS, "queue 20");
+    CHECK(queue(big, 21, 1) == NRF_ERROR_INVALID_PARAM, "21 bytes taken with MTU 23");
+    CHECK(queue(big, 2, 1) == NRF_SUCCESS && client()->tx_queue.count == 2, "joined over the MTU");
+    CHECK(queue(big, 19, 1) == NRF_SUCCESS && client()->tx_queue.count == 2, "19 not joined to 2");
+    CHECK(client()->tx_queue.buf[1].length == 20, "joined length %d", client()->tx_queue.buf[1].length);
+    CHECK(queue(big, 3, 4) == NRF_ERROR_INVALID_PARAM, "join_len over the length taken");
+
+    // a bigger MTU joins more
+    connect(247);
+    CHECK(stats().max_len == 244 && client()->tx_queue.count == 0, "connect did not reset");
+    CHECK(queue(big, 64, 1) == NRF_SUCCESS && queue(big, 64, 1) == NRF_SUCCESS &&
+          queue(big, 64, 1) == NRF_SUCCESS && queue(big, 64, 1) == NRF_SUCCESS,
+          "queue 4 x 64");
+    CHECK(client()->tx_queue.count == 2 && client()->tx_queue.buf[0].length == 190,
+          "count %d length %d", client()->tx_queue.count, client()->tx_queue.buf[0].length);
+}
+
+/*
+ * credits: the buffers run out, TX complete hands over as many as were sent
+ */
+static void test_credits(void)
+{
+    uint8_t d[8] = { 0 };
+
+    mock_reset(3);
+    connect(23);
+
+    for (int i = 0; i < 3 + BLE_NUS_TX_QUEUE_SIZE; i++)
+    {
+        d[0] = (uint8_t)i;
+        CHECK(queue(d, sizeof(d), BLE_NUS_JOIN_NEVER) == NRF_SUCCESS, "queue %d", i);
+    }
+    CHECK(m_sent_cnt == 3 && m_sd_resources == 1, "sent %d refused %d", m_sent_cnt, m_sd_resources);
+    CHECK(stats().in_flight == 3 && stats().queued == BLE_NUS_TX_QUEUE_SIZE, "in flight %d queued %d",
+          stats().in_flight, stats().queued);
+
+    d[0] = 0xff;
+    CHECK(queue(d, sizeof(d), BLE_NUS_JOIN_NEVER) == NRF_ERROR_NO_MEM, "full queue took data");
+    CHECK(stats().full == 1 && m_sd_resources == 1, "full %u refused %d",
+          (unsigned)stats().full, m_sd_resources);
+
+    sd_send(2);
+    CHECK(m_sent_cnt == 5 && m_sd_resources == 1, "sent %d refused %d after 2 sent",
+          m_sent_cnt, m_sd_resources);
+    CHECK(m_tx_rdy == 1, "%d TX_RDY", m_tx_rdy);
+
+    // the count includes a notification of another service, its buffer is taken again already:
+    // one call is refused and the queue waits again
+    tx_complete(1);
+    CHECK(m_sent_cnt == 5 && m_sd_resources == 2, "sent %d refused %d after a foreign TX complete",
+          m_sent_cnt, m_sd_resources);
+
+    while ((stats().queued != 0) || (m_sd_in_flight != 0))
+    {
+        sd_send(3);
+    }
+    CHECK(m_sent_cnt == 3 + BLE_NUS_TX_QUEUE_SIZE, "sent %d", m_sent_cnt);
+    CHECK(m_sd_resources <= 2 + (m_sent_cnt + 2) / 3, "%d refused calls, retried without credits",
+          m_sd_resources);
+
+    for (int i = 0; i < m_sent_cnt; i++)
+    {
+        CHECK(m_sent[i].data[0] == i, "notification %d carries %d", i, m_sent[i].data[0]);
+    }
+
+    CHECK(stats().in_flight == 0, "%d in flight", stats().in_flight);
+    CHECK(stats().notifications == (uint32_t)m_sent_cnt && stats().bytes == 8u * m_sent_cnt,
+          "%u notifications %u bytes", (unsigned)stats().notifications, (unsigned)stats().bytes);
+}
+
+/*
+ * notifications the SoftDevice refuses for other reasons are dropped, the
+ * queue goes on; a disabled CCCD stops queueing
+ */
+static void test_refuse(void)
+{
+    uint8_t d[4] = { 0 };
+
+    mock_reset(0);
+    connect(23);
+    CHECK(queue(d, sizeof(d), BLE_NUS_JOIN_NEVER) == NRF_SUCCESS, "queue");
+    CHECK(queue(d, sizeof(d), BLE_NUS_JOIN_NEVER) == NRF_SUCCESS, "queue");
+
+    m_sd_refuse = NRF_ERROR_INVALID_STATE;
+    tx_complete(1);
+    CHECK(stats().dropped == 2 && stats().queued == 0, "dropped %u queued %d",
+          (unsigned)stats().dropped, stats().queued);
+
+    mock_reset(1);
+    m_cccd[0] = 0;
+    connect(23);
+    CHECK(queue(d, sizeof(d), BLE_NUS_JOIN_NEVER) == NRF_ERROR_INVALID_STATE, "queued, CCCD off");
+    CHECK(ble_nus_data_queue(&m_nus, d, sizeof(d), 1, 1) == NRF_ERROR_NOT_FOUND, "queued, no link");
+}
+
+/*
+ * random queueing and TX complete, also from inside sd_ble_gatts_hvx
+ *
+ * a joinable piece is [0xa0 + header][0x55][len][id...], joined pieces share
+ * the first two bytes. a piece that is never joined is [0xff][len][id...].
+ */
+#define RANDOM_PIECES                       (MOCK_MAX_NOTIFICATIONS * 2)
+
+typedef struct piece
+{
+    uint8_t     header;                     // 0xff never joined
+    uint8_t     len;                        // body length
+    uint8_t     id;
+} piece_t;
+
+static piece_t  m_pieces[RANDOM_PIECES];
+static int      m_piece_cnt;
+static uint32_t m_rng;
+
+static uint32_t rnd(void)
+{
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 17;
+    m_rng ^= m_rng << 5;
+    return m_rng;
+}
+
+static void random_queue(void)
+{
+    uint8_t   d[BLE_NUS_MAX_DATA_LEN];
+    uint16_t  max_len = stats().max_len;
+    piece_t * p;
+    uint32_t  err_code;
+
+    if (m_piece_cnt >= RANDOM_PIECES)
+    {
+        return;
+    }
+
+    // taken before queueing, pieces queued from inside sd_ble_gatts_hvx come after this one
+    p         = &m_pieces[m_piece_cnt++];
+    p->header = (rnd() % 8 == 0) ? 0xff : (uint8_t)(rnd() % 3);
+    p->id     = (uint8_t)(m_piece_cnt - 1);
+
+    if (p->header == 0xff)
+    {
+        p->len = (uint8_t)(1 + rnd() % (max_len - 1));
+        d[0]   = 0xff;
+        d[1]   = p->len;
+        memset(&d[2], p->id, p->len - 1);
+        err_code = queue(d, (uint16_t)(p->len + 1), BLE_NUS_JOIN_NEVER);
+    }
+    else
+    {
+        p->len = (uint8_t)(1 + rnd() % MIN(max_len - 2, 40));
+        d[0]   = 0xa0 + p->header;
+        d[1]   = 0x55;
+        d[2]   = p->len;
+        memset(&d[3], p->id, p->len - 1);
+        err_code = queue(d, (uint16_t)(p->len + 2), 2);
+    }
+
+    // nothing is handed to the SoftDevice when queueing fails, so this is still the last piece
+    if (err_code != NRF_SUCCESS)
+    {
+        CHECK(err_code == NRF_ERROR_NO_MEM, "queue error 0x%x", (unsigned)err_code);
+        m_piece_cnt--;
+    }
+}
+
+static void random_interrupt(void)
+{
+    switch (rnd() % 4)
+    {
+        case 0:
+            random_queue();
+            break;
+
+        case 1:
+            sd_send((int)(rnd() % 3));
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void random_check(uint16_t max_len)
+{
+    int next = 0;
+
+    for (int n = 0; n < m_sent_cnt; n++)
+    {
+        mock_notification_t const * p_n = &m_sent[n];
+        int                         pos;
+
+        CHECK(p_n->length <= max_len, "notification %d is %d bytes", n, p_n->length);
+
+        if (p_n->data[0] == 0xff)
+        {
+            piece_t const * p  = &m_pieces[next];
+            bool            ok = (next < m_piece_cnt) && (p->header == 0xff) &&
+                                 (p_n->data[1] == p->len) && (p_n->length == p->len + 1);
+
+            for (pos = 2; ok && pos < p_n->length; pos++)
+            {
+                ok = (p_n->data[pos] == p->id);
+            }
+            CHECK(ok, "notification %d is not piece %d", n, next);
+            next++;
+            continue;
+        }
+
+        CHECK(p_n->data[1] == 0x55, "notification %d header", n);
+        for (pos = 2; pos < p_n->length; pos += p_n->data[pos])
+        {
+            piece_t const * p = &m_pieces[next];
+
+            if (next >= m_piece_cnt || p->header != p_n->data[0] - 0xa0 || p->len != p_n->data[pos] ||
+                pos + p->len > p_n->length)
+            {
+                CHECK(false, "notification %d at %d is not piece %d", n, pos, next);
+                return;
+            }
+            for (int i = 1; i < p->len; i++)
+            {
+                if (p_n->data[pos + i] != p->id)
+                {
+                    CHECK(false, "piece %d torn in notification %d", next, n);
+                    return;
+                }
+            }
+            next++;
+        }
+        CHECK(pos == p_n->length, "notification %d has bytes after its last piece", n);
+    }
+    CHECK(next == m_piece_cnt, "%d pieces queued, %d sent", m_piece_cnt, next);
+}
+
+static int m_random_rounds = 20000;
+
+static void test_random(void)
+{
+    static uint16_t const mtus[] = { 23, 64, 247 };
+
+    for (size_t m = 0; m < ARRAY_SIZE(mtus); m++)
+    {
+        mock_reset((int)(1 + rnd() % 6));
+        connect(mtus[m]);
+        m_piece_cnt = 0;
+        m_hvx_hook  = random_interrupt;
+
+        for (int i = 0; i < m_random_rounds && m_piece_cnt < RANDOM_PIECES &&
+                        m_sent_cnt < MOCK_MAX_NOTIFICATIONS - BLE_NUS_TX_QUEUE_SIZE; i++)
+        {
+            if (rnd() % 3 != 0)
+            {
+                random_queue();
+            }
+            else
+            {
+                sd_send((int)(rnd() % 4));
+            }
+        }
+
+        m_hvx_hook = NULL;
+        while (stats().queued != 0 || m_sd_in_flight != 0)
+        {
+            sd_send(m_sd_in_flight);
+        }
+
+        random_check((uint16_t)MIN(mtus[m] - OPCODE_LENGTH - HANDLE_LENGTH, BLE_NUS_MAX_DATA_LEN));
+        CHECK(stats().in_flight == 0 && stats().joined > 0, "in flight %d joined %u",
+              stats().in_flight, (unsigned)stats().joined);
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc > 1)
+    {
+        m_random_rounds = atoi(argv[1]);
+    }
+    m_rng = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 1;
+    if (m_rng == 0)
+    {
+        m_rng = 1;
+    }
+
+    run("join", test_join);
+    run("credits", test_credits);
+    run("refuse", test_refuse);
+    run("random", test_random);
+
+    return m_failed == 0 ? 0 : 1;
+}
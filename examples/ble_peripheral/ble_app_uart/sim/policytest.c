@@ -0,0 +1,506 @@
+/*
+ * policytest, checks the link policy (conn_policy.c) on a host: the BULK and
+ * IDLE profiles it asks for from samples of the traffic
+ *
+ * app_timer, ble_conn_params, nrf_ble_gatt and the softdevice calls are
+ * stood in for. the test runs the sample timer by hand and feeds ble events
+ * to the observer, the stand-ins record what was asked for and can refuse
+ * it with NRF_ERROR_BUSY.
+ *
+ * checked: DEFAULT until the first decision, BULK on rate, on queued
+ * notifications and on a hint, IDLE only after CONN_POLICY_IDLE_MS without,
+ * the parameters of each profile, a profile asked for once and not again
+ * while it holds, a busy request retried at the next sample, 2M phy and
+ * data length asked for once per connection and not when the link has them
+ * already, the energy estimate of an idle and a bulk sample, counters
+ * started over on a new connection, samples ignored while disconnected,
+ * refused requests counted. exits non zero if any check fails.
+ *
+ * usage: policytest
+ *
+ * build as described in sim/README:
+ * gcc -std=gnu99 -DNRF52832_XXAA -DS132 -DSOFTDEVICE_PRESENT -DNRF_SD_BLE_API_VERSION=7 \
+ *     -DSVCALL_AS_NORMAL_FUNCTION -DNRF_LOG_ENABLED=0 $INC sim/policytest.c -o policytest
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "app_timer.h"
+#include "ble_conn_params.h"
+#include "nrf_ble_gatt.h"
+
+#include "../howland.h"
+#include "../conn_policy.h"
+
+#define MOCK_CONN_HANDLE                    3
+#define MOCK_CONNECT_INTERVAL               MSEC_TO_UNITS(30, UNIT_1_25_MS)
+
+static int      m_failed;
+static int      m_app_errors;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) { printf("  " __VA_ARGS__); printf("\n"); m_failed++; }    \
+    } while (0)
+
+/*
+ * stand-ins
+ */
+static app_timer_timeout_handler_t  m_timer_handler;
+static bool                         m_timer_running;
+static int                          m_params_asked;
+static ble_gap_conn_params_t        m_params;           // last asked for
+static ret_code_t                   m_params_err;       // returned by change_conn_params
+static int                          m_phy_requests;
+static int                          m_dle_requests;
+static uint32_t                     m_tx_bytes;         // as the nus queue counts them
+static uint8_t                      m_tx_queued;
+
+ret_code_t app_timer_create(app_timer_id_t const *      p_timer_id,
+                            app_timer_mode_t            mode,
+                            app_timer_timeout_handler_t timeout_handler)
+{
+    (void)p_timer_id;
+    CHECK(mode == APP_TIMER_MODE_REPEATED, "timer not repeated");
+    m_timer_handler = timeout_handler;
+    return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context)
+{
+    (void)timer_id;
+    (void)p_context;
+    CHECK(timeout_ticks == APP_TIMER_TICKS(CONN_POLICY_PERIOD_MS), "timer period %u", (unsigned)timeout_ticks);
+    m_timer_running = true;
+    return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id)
+{
+    (void)timer_id;
+    m_timer_running = false;
+    return NRF_SUCCESS;
+}
+
+ret_code_t ble_conn_params_change_conn_params(uint16_t conn_handle, ble_gap_conn_params_t * p_new_params)
+{
+    CHECK(conn_handle == MOCK_CONN_HANDLE, "conn params on 0x%x", conn_handle);
+    if (m_params_err != NRF_SUCCESS)
+    {
+        return m_params_err;
+    }
+    m_params = *p_new_params;
+    m_params_asked++;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_phy_update(uint16_t conn_handle, ble_gap_phys_t const * p_gap_phys)
+{
+    CHECK(conn_handle == MOCK_CONN_HANDLE && p_gap_phys->tx_phys == BLE_GAP_PHY_2MBPS, "phy update");
+    m_phy_requests++;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_ble_gatt_data_length_set(nrf_ble_gatt_t * p_gatt, uint16_t conn_handle, uint8_t data_length)
+{
+    (void)p_gatt;
+    CHECK(conn_handle == MOCK_CONN_HANDLE && data_length == NRF_SDH_BLE_GAP_DATA_LENGTH, "data length");
+    m_dle_requests++;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_opt_set(uint32_t opt_id, ble_opt_t const * p_opt)
+{
+    CHECK(opt_id == BLE_COMMON_OPT_CONN_EVT_EXT && p_opt->common_opt.conn_evt_ext.enable, "event extension");
+    return NRF_SUCCESS;
+}
+
+void app_util_critical_region_enter(uint8_t * p_nested)
+{
+    (void)p_nested;
+}
+
+void app_util_critical_region_exit(uint8_t nested)
+{
+    (void)nested;
+}
+
+void app_error_handler(ret_code_t error_code, uint32_t line_num, const uint8_t * p_file_name)
+{
+    (void)error_code;
+    (void)line_num;
+    (void)p_file_name;
+    m_app_errors++;
+}
+
+void app_error_handler_bare(ret_code_t error_code)
+{
+    (void)error_code;
+    m_app_errors++;
+}
+
+#include "../conn_policy.c"
+
+static nrf_ble_gatt_t m_gatt;
+
+static void tx_get(uint32_t * p_bytes, uint8_t * p_queued)
+{
+    *p_bytes  = m_tx_bytes;
+    *p_queued = m_tx_queued;
+}
+
+static void connect(void)
+{
+    ble_evt_t evt = { 0 };
+
+    evt.header.evt_id                                          = BLE_GAP_EVT_CONNECTED;
+    evt.evt.gap_evt.conn_handle                                = MOCK_CONN_HANDLE;
+    evt.evt.gap_evt.params.connected.role                      = BLE_GAP_ROLE_PERIPH;
+    evt.evt.gap_evt.params.connected.conn_params.max_conn_interval = MOCK_CONNECT_INTERVAL;
+    evt.evt.gap_evt.params.connected.conn_params.slave_latency = 0;
+    ble_evt_handler(&evt, NULL);
+}
+
+static void disconnect(void)
+{
+    ble_evt_t evt = { 0 };
+
+    evt.header.evt_id           = BLE_GAP_EVT_DISCONNECTED;
+    evt.evt.gap_evt.conn_handle = MOCK_CONN_HANDLE;
+    ble_evt_handler(&evt, NULL);
+}
+
+// the central follows the last request
+static void params_follow(void)
+{
+    ble_evt_t evt = { 0 };
+
+    evt.header.evt_id                                        = BLE_GAP_EVT_CONN_PARAM_UPDATE;
+    evt.evt.gap_evt.conn_handle                              = MOCK_CONN_HANDLE;
+    evt.evt.gap_evt.params.conn_param_update.conn_params     = m_params;
+    ble_evt_handler(&evt, NULL);
+}
+
+static void phy_update(uint8_t phy)
+{
+    ble_evt_t evt = { 0 };
+
+    evt.header.evt_id                            = BLE_GAP_EVT_PHY_UPDATE;
+    evt.evt.gap_evt.conn_handle                  = MOCK_CONN_HANDLE;
+    evt.evt.gap_evt.params.phy_update.status     = BLE_HCI_STATUS_CODE_SUCCESS;
+    evt.evt.gap_evt.params.phy_update.tx_phy     = phy;
+    evt.evt.gap_evt.params.phy_update.rx_phy     = phy;
+    ble_evt_handler(&evt, NULL);
+}
+
+static void data_length_update(uint8_t data_len)
+{
+    nrf_ble_gatt_evt_t evt = { 0 };
+
+    evt.evt_id             = NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED;
+    evt.conn_handle        = MOCK_CONN_HANDLE;
+    evt.params.data_length = data_len;
+    conn_policy_on_gatt_evt(&evt);
+}
+
+static void tx_complete(uint8_t count)
+{
+    ble_evt_t evt = { 0 };
+
+    evt.header.evt_id                              = BLE_GATTS_EVT_HVN_TX_COMPLETE;
+    evt.evt.gatts_evt.conn_handle                  = MOCK_CONN_HANDLE;
+    evt.evt.gatts_evt.params.hvn_tx_complete.count = count;
+    ble_evt_handler(&evt, NULL);
+}
+
+static void sample(void)
+{
+    if (m_timer_running)
+    {
+        m_timer_handler(NULL);
+    }
+}
+
+// n sample periods without traffic
+static void quiet(int n)
+{
+    while (n-- > 0)
+    {
+        sample();
+    }
+}
+
+static proto_link_stats_t stats(void)
+{
+    proto_link_stats_t s;
+
+    conn_policy_stats_get(&s);
+    return s;
+}
+
+static void mock_reset(void)
+{
+    m_timer_running = false;
+    m_params_asked  = 0;
+    m_params_err    = NRF_SUCCESS;
+    m_phy_requests     = 0;
+    m_dle_requests     = 0;
+    m_tx_bytes      = 0;
+    m_tx_queued     = 0;
+    memset(&m_params, 0, sizeof(m_params));
+    if (m_conn_handle != BLE_CONN_HANDLE_INVALID)
+    {
+        disconnect();
+    }
+    CHECK(conn_policy_init(&m_gatt, tx_get) == NRF_SUCCESS, "init");
+}
+
+static void run(char const * name, void (*test)(void))
+{
+    int failed = m_failed;
+
+    mock_reset();
+    m_app_errors = 0;
+    test();
+    CHECK(m_app_errors == 0, "%d app errors", m_app_errors);
+    printf("%-10s %s\n", name, m_failed == failed ? "ok" : "FAILED");
+}
+
+static bool is_bulk_params(void)
+{
+    return m_params.min_conn_interval == CONN_POLICY_BULK_MIN_INTERVAL &&
+           m_params.max_conn_interval == CONN_POLICY_BULK_MAX_INTERVAL &&
+           m_params.slave_latency == 0 && m_params.conn_sup_timeout == CONN_POLICY_SUP_TIMEOUT;
+}
+
+static bool is_idle_params(void)
+{
+    return m_params.min_conn_interval == CONN_POLICY_IDLE_MIN_INTERVAL &&
+           m_params.max_conn_interval == CONN_POLICY_IDLE_MAX_INTERVAL &&
+           m_params.slave_latency == CONN_POLICY_IDLE_LATENCY &&
+           m_params.conn_sup_timeout == CONN_POLICY_SUP_TIMEOUT;
+}
+
+#define IDLE_SAMPLES                        (CONN_POLICY_IDLE_MS / CONN_POLICY_PERIOD_MS)
+#define BULK_BYTES                          (CONN_POLICY_BULK_RATE * CONN_POLICY_PERIOD_MS / 1000)
+
+/*
+ * DEFAULT, then IDLE after the quiet time, asked for once
+ */
+static void test_idle(void)
+{
+    connect();
+    CHECK(m_timer_running && stats().profile == PROTO_LINK_DEFAULT, "not started in DEFAULT");
+
+    quiet(IDLE_SAMPLES - 1);
+    CHECK(m_params_asked == 0 && stats().profile == PROTO_LINK_DEFAULT, "IDLE before %d ms",
+          CONN_POLICY_IDLE_MS);
+    quiet(1);
+    CHECK(m_params_asked == 1 && is_idle_params() && stats().profile == PROTO_LINK_IDLE,
+          "not IDLE after %d ms", CONN_POLICY_IDLE_MS);
+
+    quiet(3 * IDLE_SAMPLES);
+    CHECK(m_params_asked == 1 && stats().switches == 1, "IDLE asked for %d times", m_params_asked);
+    CHECK(m_phy_requests == 0 && m_dle_requests == 0, "phy or data length asked for in IDLE");
+}
+
+/*
+ * BULK on rate, on queued notifications and on a hint, each from IDLE
+ */
+static void test_bulk(void)
+{
+    connect();
+    quiet(IDLE_SAMPLES);
+
+    // just under the rate, with gatt writes and notifications both counted
+    m_tx_bytes += BULK_BYTES / 2;
+    {
+        ble_evt_t evt = { 0 };
+
+        evt.header.evt_id                   = BLE_GATTS_EVT_WRITE;
+        evt.evt.gatts_evt.conn_handle       = MOCK_CONN_HANDLE;
+        evt.evt.gatts_evt.params.write.len  = BULK_BYTES / 2 - 1;
+        ble_evt_handler(&evt, NULL);
+    }
+    sample();
+    CHECK(stats().profile == PROTO_LINK_IDLE, "BULK under the rate, %u bytes/s", (unsigned)stats().rate);
+    CHECK(stats().rate == CONN_POLICY_BULK_RATE - 1000 / CONN_POLICY_PERIOD_MS, "rate %u",
+          (unsigned)stats().rate);
+
+    m_tx_bytes += BULK_BYTES;
+    sample();
+    CHECK(stats().profile == PROTO_LINK_BULK && is_bulk_params(), "not BULK at the rate");
+    CHECK(m_phy_requests == 1 && m_dle_requests == 1, "phy %d data length %d asked for", m_phy_requests, m_dle_requests);
+    CHECK(stats().peak_rate == CONN_POLICY_BULK_RATE, "peak rate %u", (unsigned)stats().peak_rate);
+
+    // BULK holds through the quiet time, then IDLE
+    quiet(IDLE_SAMPLES - 1);
+    CHECK(stats().profile == PROTO_LINK_BULK && m_params_asked == 2, "BULK left early");
+    quiet(1);
+    CHECK(stats().profile == PROTO_LINK_IDLE && m_params_asked == 3, "BULK not left");
+
+    // queued notifications, once per connection for phy and data length
+    m_tx_queued = CONN_POLICY_BULK_QUEUED - 1;
+    sample();
+    CHECK(stats().profile == PROTO_LINK_IDLE, "BULK with %d queued", m_tx_queued);
+    m_tx_queued = CONN_POLICY_BULK_QUEUED;
+    sample();
+    CHECK(stats().profile == PROTO_LINK_BULK && m_params_asked == 4, "not BULK with %d queued", m_tx_queued);
+    CHECK(m_phy_requests == 1 && m_dle_requests == 1, "phy or data length asked for again");
+
+    // queued notifications keep it BULK
+    quiet(2 * IDLE_SAMPLES);
+    CHECK(stats().profile == PROTO_LINK_BULK && m_params_asked == 4, "BULK left while queued");
+    m_tx_queued = 0;
+    quiet(IDLE_SAMPLES);
+
+    // a hint counts once, at the next sample
+    conn_policy_bulk_hint();
+    CHECK(stats().profile == PROTO_LINK_IDLE, "BULK before the sample");
+    sample();
+    CHECK(stats().profile == PROTO_LINK_BULK, "hint not taken");
+    quiet(IDLE_SAMPLES);
+    CHECK(stats().profile == PROTO_LINK_IDLE, "hint taken twice");
+    CHECK(stats().switches == 7 && m_params_asked == 7, "%u switches, %d asked",
+          (unsigned)stats().switches, m_params_asked);
+}
+
+/*
+ * a busy request is tried again at the next sample, not counted until asked
+ */
+static void test_busy(void)
+{
+    connect();
+
+    m_params_err = NRF_ERROR_BUSY;
+    m_tx_bytes  += BULK_BYTES;
+    sample();
+    CHECK(stats().profile == PROTO_LINK_DEFAULT && stats().switches == 0 && m_phy_requests == 0,
+          "BULK taken while busy");
+
+    m_params_err = NRF_SUCCESS;
+    m_tx_bytes  += BULK_BYTES;
+    sample();
+    CHECK(stats().profile == PROTO_LINK_BULK && stats().switches == 1, "BULK not asked again");
+
+    // the central does not follow: counted, the profile is not asked for again
+    ble_conn_params_evt_t evt = { .evt_type = BLE_CONN_PARAMS_EVT_FAILED };
+    conn_policy_on_conn_params_evt(&evt);
+    m_tx_bytes += BULK_BYTES;
+    sample();
+    CHECK(stats().refused == 1 && m_params_asked == 1, "refused %u asked %d",
+          (unsigned)stats().refused, m_params_asked);
+}
+
+/*
+ * 2M and the long data length are not asked for when the link has them
+ */
+static void test_boost(void)
+{
+    connect();
+    phy_update(BLE_GAP_PHY_2MBPS);
+    data_length_update(NRF_SDH_BLE_GAP_DATA_LENGTH);
+
+    m_tx_bytes += BULK_BYTES;
+    sample();
+    CHECK(stats().profile == PROTO_LINK_BULK && m_phy_requests == 0 && m_dle_requests == 0,
+          "phy %d data length %d asked for", m_phy_requests, m_dle_requests);
+    CHECK(stats().phy == BLE_GAP_PHY_2MBPS && stats().data_len == NRF_SDH_BLE_GAP_DATA_LENGTH,
+          "phy %d data length %d", stats().phy, stats().data_len);
+
+    // a new connection starts on 1M and asks again
+    disconnect();
+    connect();
+    m_tx_bytes = BULK_BYTES;
+    sample();
+    CHECK(m_phy_requests == 1 && m_dle_requests == 1, "phy %d data length %d after reconnect",
+          m_phy_requests, m_dle_requests);
+}
+
+/*
+ * energy: an idle period wakes once per interval x (latency + 1), a bulk
+ * period every interval plus packets and bytes on air
+ */
+static void test_energy(void)
+{
+    connect();
+    quiet(IDLE_SAMPLES);
+    params_follow();
+
+    // 200ms x 5 is past the period: one event each
+    uint32_t idle_uj = stats().idle_uj;
+    quiet(10);
+    CHECK(stats().idle_uj - idle_uj == 10 * CONN_POLICY_EVENT_NJ / 1000, "idle %u uJ in 10 periods",
+          (unsigned)(stats().idle_uj - idle_uj));
+
+    m_tx_bytes += BULK_BYTES;
+    sample();
+    params_follow();
+    CHECK(stats().profile == PROTO_LINK_BULK && stats().interval == CONN_POLICY_BULK_MAX_INTERVAL,
+          "interval %d", stats().interval);
+
+    // 30ms, 1M, 27 byte data length: 10 notifications of 100 bytes are 40 packets
+    uint32_t interval_us = CONN_POLICY_BULK_MAX_INTERVAL * 1250;
+    uint64_t events      = (CONN_POLICY_PERIOD_MS * 1000 + interval_us / 2) / interval_us;
+    uint64_t nj          = events * CONN_POLICY_EVENT_NJ + 40 * CONN_POLICY_PACKET_NJ_1M +
+                           (1000 + 40 * LL_HEADERS_LEN) * CONN_POLICY_BYTE_NJ_1M;
+
+    m_bulk_nj   = 0;
+    m_tx_bytes += 1000;
+    tx_complete(10);
+    sample();
+    CHECK(m_bulk_nj == nj, "bulk %llu nJ, expected %llu", (unsigned long long)m_bulk_nj,
+          (unsigned long long)nj);
+    // the sample that switched to BULK was moved in IDLE
+    CHECK(stats().bulk_bytes == 1000, "bulk bytes %u", (unsigned)stats().bulk_bytes);
+
+    // 2M at the longest data length costs less for the same traffic
+    phy_update(BLE_GAP_PHY_2MBPS);
+    data_length_update(NRF_SDH_BLE_GAP_DATA_LENGTH);
+    m_bulk_nj   = 0;
+    m_tx_bytes += 1000;
+    tx_complete(10);
+    sample();
+    CHECK(m_bulk_nj < nj, "2M %llu nJ, 1M %llu nJ", (unsigned long long)m_bulk_nj,
+          (unsigned long long)nj);
+}
+
+/*
+ * a new connection starts the counters over, samples stop while disconnected
+ */
+static void test_reconnect(void)
+{
+    connect();
+    m_tx_bytes = 10 * BULK_BYTES;
+    sample();
+    quiet(IDLE_SAMPLES);
+    CHECK(stats().switches == 2 && stats().idle_bytes == 10 * BULK_BYTES, "switches %u",
+          (unsigned)stats().switches);
+
+    disconnect();
+    CHECK(!m_timer_running, "timer runs while disconnected");
+    m_timer_handler(NULL);
+    CHECK(stats().profile == 0 && stats().interval == 0, "link stats while disconnected");
+
+    // the nus counters start over too, less than before is not a negative rate
+    connect();
+    m_tx_bytes = BULK_BYTES / 4;
+    sample();
+    CHECK(stats().switches == 0 && stats().bulk_bytes == 0 && stats().idle_bytes == BULK_BYTES / 4,
+          "not started over: switches %u idle bytes %u", (unsigned)stats().switches,
+          (unsigned)stats().idle_bytes);
+    CHECK(stats().profile == PROTO_LINK_DEFAULT && stats().rate < CONN_POLICY_BULK_RATE, "rate %u",
+          (unsigned)stats().rate);
+}
+
+int main(void)
+{
+    run("idle", test_idle);
+    run("bulk", test_bulk);
+    run("busy", test_busy);
+    run("boost", test_boost);
+    run("energy", test_energy);
+    run("reconnect", test_reconnect);
+
+    return m_failed == 0 ? 0 : 1;
+}
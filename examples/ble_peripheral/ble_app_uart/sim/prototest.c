@@ -0,0 +1,425 @@
+/*
+ * prototest, checks the v2 frame codec (protocol.c) on a host
+ *
+ * every record type is written with its encoder, read back through
+ * proto_reader_init / proto_next and decoded again. field values are picked
+ * so the little endian value on the wire is the bytes 1, 2, 3, .. in field
+ * order, which checks the layout as well as the round trip. decoders are
+ * also given a record of the wrong type and of every wrong length.
+ *
+ * malformed frames: no magic, v1 messages, too long, a record header or
+ * value cut at every byte of a valid frame, and random frames against a
+ * reference walk of the records. the reader must be untouched on error and
+ * proto_next must never step past the frame. exits non zero if any check
+ * fails.
+ *
+ * usage: prototest
+ *
+ * build as described in sim/README:
+ * gcc -std=gnu99 -DNRF52832_XXAA $INC sim/prototest.c protocol.c -o prototest
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../protocol.h"
+
+#define PROTOTEST_RANDOM_FRAMES             100000
+
+static int m_failed;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) { printf("  " __VA_ARGS__); printf("\n"); m_failed++; }    \
+    } while (0)
+
+/*
+ * the frame holds a single record of type and length, its value is 1, 2, ..
+ */
+static bool frame_check(proto_writer_t const * p_writer, uint8_t type, uint8_t length, proto_record_t * p_record)
+{
+    proto_reader_t reader;
+    proto_record_t end;
+    bool ok = true;
+
+    if (proto_reader_init(&reader, p_writer->p_buf, p_writer->length) != NRF_SUCCESS ||
+        proto_next(&reader, p_record) != NRF_SUCCESS)
+    {
+        return false;
+    }
+
+    ok = ok && reader.seq == 0x5A;
+    ok = ok && p_record->type == type && p_record->length == length;
+    ok = ok && p_writer->length == PROTO_HEADER_LEN + PROTO_RECORD_HEADER_LEN + length;
+    for (uint8_t i = 0; ok && i < length; i++)
+    {
+        ok = p_record->p_value[i] == i + 1;
+    }
+
+    return ok && proto_next(&reader, &end) == NRF_ERROR_NOT_FOUND;
+}
+
+/*
+ * encode src, check layout, decode into dst and compare. then the decoder
+ * must refuse the record with any other type or length.
+ */
+#define ROUNDTRIP(name, put_call, get_fn, rec_type, rec_len, val_type, src)                 \
+    do {                                                                                    \
+        static val_type dst;                                                                \
+        proto_record_t rec, bad;                                                            \
+        uint8_t buf[PROTO_MAX_FRAME_LEN];                                                   \
+        proto_writer_t writer;                                                              \
+                                                                                            \
+        memset(&dst, 0, sizeof(dst));                                                       \
+        proto_writer_init(&writer, buf, sizeof(buf), 0x5A);                                 \
+        CHECK((put_call) == NRF_SUCCESS, name " put");                                      \
+        CHECK(frame_check(&writer, rec_type, rec_len, &rec), name " layout");               \
+        CHECK(get_fn(&rec, &dst) == NRF_SUCCESS, name " get");                              \
+        CHECK(memcmp(&dst, &src, sizeof(dst)) == 0, name " differs after round trip");      \
+                                                                                            \
+        bad = rec;                                                                          \
+        bad.type ^= 0x80;                                                                   \
+        CHECK(get_fn(&bad, &dst) == NRF_ERROR_INVALID_PARAM, name " wrong type taken");     \
+        for (int len = 0; len < PROTO_MAX_FRAME_LEN - 4; len++)                             \
+        {                                                                                   \
+            bad = rec;                                                                      \
+            bad.length = (uint8_t)len;                                                      \
+            if (len != (rec_len))                                                           \
+            {                                                                               \
+                CHECK(get_fn(&bad, &dst) == NRF_ERROR_INVALID_LENGTH,                       \
+                      name " length %d taken", len);                                        \
+            }                                                                               \
+        }                                                                                   \
+    } while (0)
+
+static void test_records(void)
+{
+    static proto_start_t const start = {
+        0x0201, 0x0403, 0x05, { 6, 7, 8, 9, 10, 11, 12, 13 }
+    };
+    static proto_ack_t const ack = { 1, 2 };
+    static proto_state_t const state = {
+        1, { 0x0302, 0x0504, 6, { 7, 8, 9, 10, 11, 12, 13, 14 } }
+    };
+    static proto_status_t const status = {
+        1, 2, 0x06050403, 0x0A090807, 0x0E0D0C0B, 0x0F
+    };
+    static proto_stream_stats_t const stream_stats = {
+        0x04030201, 0x08070605, 0x0C0B0A09, 0x100F0E0D, 0x1211, 0x1413
+    };
+    static proto_timing_stats_t const timing_stats = {
+        0x04030201, 0x08070605, 0x0C0B0A09, 0x100F0E0D, 0x1211, 0x1413, 0x1615, 0x1817,
+        { 0x1C1B1A19, 0x201F1E1D, 0x24232221, 0x28272625, 0x2C2B2A29, 0x302F2E2D, 0x34333231, 0x38373635 }
+    };
+    static proto_comp_stats_t const comp_stats = {
+        1, 2, 0x0403, 0x0605, 0x0807, 0x0C0B0A09, 0x100F0E0D, 0x14131211, 0x18171615
+    };
+    static proto_log_stats_t const log_stats = {
+        0x04030201, 0x08070605, 0x0C0B0A09, 0x0E0D, 0x100F
+    };
+    static proto_nus_stats_t const nus_stats = {
+        0x04030201, 0x08070605, 0x0C0B0A09, 0x100F0E0D, 0x14131211, 0x18171615, 0x1A19, 0x1B, 0x1C, 0x1D
+    };
+    static proto_link_stats_t const link_stats = {
+        0x04030201, 0x08070605, 0x0C0B0A09, 0x100F0E0D, 0x14131211, 0x18171615, 0x1C1B1A19, 0x201F1E1D,
+        0x2221, 0x2423, 0x25, 0x26, 0x27
+    };
+
+    ROUNDTRIP("start", proto_put_start(&writer, &start), proto_get_start,
+              PROTO_REQ_START, PROTO_START_LEN, proto_start_t, start);
+    ROUNDTRIP("ack", proto_put_ack(&writer, &ack), proto_get_ack,
+              PROTO_RSP_ACK, PROTO_ACK_LEN, proto_ack_t, ack);
+    ROUNDTRIP("state", proto_put_state(&writer, &state), proto_get_state,
+              PROTO_RSP_STATE, PROTO_STATE_LEN, proto_state_t, state);
+    ROUNDTRIP("status", proto_put_status(&writer, &status), proto_get_status,
+              PROTO_RSP_STATUS, PROTO_STATUS_LEN, proto_status_t, status);
+    ROUNDTRIP("strstats", proto_put_stream_stats(&writer, &stream_stats), proto_get_stream_stats,
+              PROTO_RSP_STREAM_STATS, PROTO_STREAM_STATS_LEN, proto_stream_stats_t, stream_stats);
+    ROUNDTRIP("timstats", proto_put_timing_stats(&writer, &timing_stats), proto_get_timing_stats,
+              PROTO_RSP_TIMING_STATS, PROTO_TIMING_STATS_LEN, proto_timing_stats_t, timing_stats);
+    ROUNDTRIP("compstats", proto_put_comp_stats(&writer, &comp_stats), proto_get_comp_stats,
+              PROTO_RSP_COMP_STATS, PROTO_COMP_STATS_LEN, proto_comp_stats_t, comp_stats);
+    ROUNDTRIP("logstats", proto_put_log_stats(&writer, &log_stats), proto_get_log_stats,
+              PROTO_RSP_LOG_STATS, PROTO_LOG_STATS_LEN, proto_log_stats_t, log_stats);
+    ROUNDTRIP("nusstats", proto_put_nus_stats(&writer, &nus_stats), proto_get_nus_stats,
+              PROTO_RSP_NUS_STATS, PROTO_NUS_STATS_LEN, proto_nus_stats_t, nus_stats);
+    ROUNDTRIP("linkstats", proto_put_link_stats(&writer, &link_stats), proto_get_link_stats,
+              PROTO_RSP_LINK_STATS, PROTO_LINK_STATS_LEN, proto_link_stats_t, link_stats);
+
+    {
+        static uint16_t const rate = 0x0201;
+        ROUNDTRIP("strstart", proto_put_stream_start(&writer, rate), proto_get_stream_start,
+                  PROTO_REQ_STREAM_START, PROTO_STREAM_START_LEN, uint16_t, rate);
+    }
+}
+
+/*
+ * WAVE and STREAM_DATA have a variable length
+ */
+static void test_wave(void)
+{
+    static proto_wave_t const wave = {
+        0x0201, 3, {
+            { 3, 0x0504, { 6, 7, 8, 9, 10, 11, 12, 13 } },
+            { 14, 0x100F, { 17, 18, 19, 20, 21, 22, 23, 24 } },
+            { 25, 0x1B1A, { 28, 29, 30, 31, 32, 33, 34, 35 } },
+        }
+    };
+    uint8_t buf[PROTO_MAX_FRAME_LEN];
+    proto_writer_t writer;
+    proto_record_t rec;
+    proto_wave_t in, out;
+
+    for (uint8_t n = 1; n <= PROTO_MAX_SEGS; n++)
+    {
+        in = wave;
+        in.num_of_segs = n;
+        memset(&out, 0, sizeof(out));
+        memset(&in.segs[n], 0, (PROTO_MAX_SEGS - n) * sizeof(proto_segment_t));
+
+        proto_writer_init(&writer, buf, sizeof(buf), 0x5A);
+        CHECK(proto_put_wave(&writer, &in) == NRF_SUCCESS, "wave %u put", n);
+        CHECK(frame_check(&writer, PROTO_REQ_WAVE, PROTO_WAVE_LEN(n), &rec), "wave %u layout", n);
+        CHECK(proto_get_wave(&rec, &out) == NRF_SUCCESS, "wave %u get", n);
+        CHECK(memcmp(&in, &out, sizeof(out)) == 0, "wave %u differs after round trip", n);
+    }
+
+    for (int len = 0; len < PROTO_MAX_FRAME_LEN - 4; len++)
+    {
+        proto_record_t bad = rec;
+        bool ok = len == PROTO_WAVE_LEN(1) || len == PROTO_WAVE_LEN(2) || len == PROTO_WAVE_LEN(3);
+
+        bad.length = (uint8_t)len;
+        CHECK((proto_get_wave(&bad, &out) == NRF_SUCCESS) == ok, "wave length %d", len);
+    }
+    rec.type = PROTO_REQ_START;
+    CHECK(proto_get_wave(&rec, &out) == NRF_ERROR_INVALID_PARAM, "wave wrong type taken");
+
+    in = wave;
+    in.num_of_segs = 0;
+    CHECK(proto_put_wave(&writer, &in) == NRF_ERROR_INVALID_PARAM, "wave of 0 segments put");
+    in.num_of_segs = PROTO_MAX_SEGS + 1;
+    CHECK(proto_put_wave(&writer, &in) == NRF_ERROR_INVALID_PARAM, "wave of too many segments put");
+
+    // stream data is used in place
+    {
+        proto_sample_t samples[3];
+        proto_sample_t const * p_samples;
+        uint8_t num_of_samples;
+
+        for (int i = 0; i < (int)sizeof(samples); i++)
+        {
+            ((int8_t *)samples)[i] = (int8_t)(i + 1);
+        }
+
+        proto_writer_init(&writer, buf, sizeof(buf), 0x5A);
+        CHECK(proto_put_stream_data(&writer, samples, 3) == NRF_SUCCESS, "stream data put");
+        CHECK(frame_check(&writer, PROTO_REQ_STREAM_DATA, 3 * PROTO_SAMPLE_LEN, &rec), "stream data layout");
+        CHECK(proto_get_stream_data(&rec, &p_samples, &num_of_samples) == NRF_SUCCESS, "stream data get");
+        CHECK(num_of_samples == 3 && (uint8_t const *)p_samples == rec.p_value, "stream data not in place");
+
+        for (int len = 0; len < PROTO_MAX_FRAME_LEN - 4; len++)
+        {
+            proto_record_t bad = rec;
+            bool ok = len != 0 && len % PROTO_SAMPLE_LEN == 0;
+
+            bad.length = (uint8_t)len;
+            CHECK((proto_get_stream_data(&bad, &p_samples, &num_of_samples) == NRF_SUCCESS) == ok,
+                  "stream data length %d", len);
+        }
+        rec.type = PROTO_REQ_STREAM_START;
+        CHECK(proto_get_stream_data(&rec, &p_samples, &num_of_samples) == NRF_ERROR_INVALID_PARAM,
+              "stream data wrong type taken");
+
+        CHECK(proto_put_stream_data(&writer, samples, 0) == NRF_ERROR_INVALID_PARAM, "0 samples put");
+        CHECK(proto_put_stream_data(&writer, samples, UINT8_MAX / PROTO_SAMPLE_LEN + 1) == NRF_ERROR_INVALID_PARAM,
+              "more samples than a record takes put");
+    }
+}
+
+/*
+ * records without value, several in a frame, and a full writer
+ */
+static void test_frame(void)
+{
+    static uint8_t const requests[] = {
+        PROTO_REQ_READ, PROTO_REQ_STOP, PROTO_REQ_STATUS, PROTO_REQ_STREAM_STATS,
+        PROTO_REQ_TIMING_STATS, PROTO_REQ_COMP_STATS, PROTO_REQ_LOG_STATS,
+        PROTO_REQ_NUS_STATS, PROTO_REQ_LINK_STATS,
+    };
+    static proto_ack_t const ack = { PROTO_REQ_STOP, 0 };
+    uint8_t buf[PROTO_MAX_FRAME_LEN + 16];
+    proto_writer_t writer, before;
+    proto_reader_t reader;
+    proto_record_t rec;
+    int n;
+
+    proto_writer_init(&writer, buf, sizeof(buf), 7);
+    CHECK(writer.size == PROTO_MAX_FRAME_LEN, "writer size not capped");
+    CHECK(proto_writer_empty(&writer), "new writer not empty");
+
+    for (size_t i = 0; i < sizeof(requests); i++)
+    {
+        CHECK(proto_put(&writer, requests[i], NULL, 0) == NRF_SUCCESS, "request %02X put", requests[i]);
+    }
+    CHECK(!proto_writer_empty(&writer), "writer empty");
+
+    CHECK(proto_reader_init(&reader, buf, writer.length) == NRF_SUCCESS, "requests frame");
+    CHECK(reader.seq == 7, "seq %u", reader.seq);
+    for (n = 0; proto_next(&reader, &rec) == NRF_SUCCESS; n++)
+    {
+        CHECK(n < (int)sizeof(requests) && rec.type == requests[n] && rec.length == 0, "request %d", n);
+    }
+    CHECK(n == (int)sizeof(requests), "%d requests read", n);
+
+    // fill with acks to the last byte, the one that doesn't fit leaves the writer alone
+    proto_writer_init(&writer, buf, PROTO_MAX_FRAME_LEN, 7);
+    for (n = 0; proto_put_ack(&writer, &ack) == NRF_SUCCESS; n++);
+    CHECK(n == (PROTO_MAX_FRAME_LEN - PROTO_HEADER_LEN) / (PROTO_RECORD_HEADER_LEN + PROTO_ACK_LEN), "%d acks fit", n);
+
+    before = writer;
+    buf[writer.length] = 0xEE;
+    CHECK(proto_put_link_stats(&writer, &(proto_link_stats_t){ 0 }) == NRF_ERROR_NO_MEM, "link stats put on a full writer");
+    CHECK(memcmp(&writer, &before, sizeof(writer)) == 0 && buf[writer.length] == 0xEE, "full writer changed");
+}
+
+/*
+ * reference walk, true if records end exactly at length
+ */
+static bool ref_walk(uint8_t const * p_data, uint16_t length)
+{
+    uint32_t pos = PROTO_HEADER_LEN;
+
+    while (pos + PROTO_RECORD_HEADER_LEN <= length)
+    {
+        pos += PROTO_RECORD_HEADER_LEN + p_data[pos + 1];
+    }
+
+    return pos == length;
+}
+
+static void reader_expect(uint8_t const * p_data, uint16_t length, ret_code_t expected, char const * name)
+{
+    proto_reader_t reader, before;
+    ret_code_t err;
+
+    memset(&reader, 0xA5, sizeof(reader));
+    before = reader;
+
+    err = proto_reader_init(&reader, p_data, length);
+    CHECK(err == expected, "%s: 0x%X, want 0x%X", name, (unsigned)err, (unsigned)expected);
+
+    if (err != NRF_SUCCESS)
+    {
+        CHECK(memcmp(&reader, &before, sizeof(reader)) == 0, "%s: reader changed on error", name);
+    }
+    else
+    {
+        proto_record_t rec;
+        uint32_t end = PROTO_HEADER_LEN;
+
+        while (proto_next(&reader, &rec) == NRF_SUCCESS)
+        {
+            CHECK(rec.p_value == &p_data[end + PROTO_RECORD_HEADER_LEN], "%s: record not where it starts", name);
+            end += PROTO_RECORD_HEADER_LEN + rec.length;
+            if (end > length)
+            {
+                CHECK(false, "%s: record past the end", name);
+                break;
+            }
+        }
+        CHECK(end == length, "%s: records end at %u of %u", name, (unsigned)end, length);
+    }
+}
+
+static void test_malformed(void)
+{
+    static uint8_t const v1[] = { 0x01, 0x00, 0x32, 0x00 };
+    uint8_t frame[PROTO_MAX_FRAME_LEN + 2];
+    uint8_t buf[PROTO_MAX_FRAME_LEN];
+    proto_writer_t writer;
+    uint16_t bounds[16];
+    int num_of_bounds = 0;
+
+    reader_expect(NULL, 4, NRF_ERROR_INVALID_DATA, "null");
+    reader_expect(v1, sizeof(v1), NRF_ERROR_INVALID_DATA, "v1 message");
+    CHECK(!proto_is_frame(v1, sizeof(v1)), "v1 message taken for a frame");
+
+    frame[0] = PROTO_MAGIC;
+    frame[1] = 0;
+    reader_expect(frame, 0, NRF_ERROR_INVALID_DATA, "empty");
+    reader_expect(frame, 1, NRF_ERROR_INVALID_DATA, "magic alone");
+    reader_expect(frame, 2, NRF_SUCCESS, "header alone");
+
+    // one record filling the longest frame, and one byte more
+    frame[2] = PROTO_REQ_STREAM_DATA;
+    frame[3] = PROTO_MAX_FRAME_LEN - PROTO_HEADER_LEN - PROTO_RECORD_HEADER_LEN;
+    reader_expect(frame, PROTO_MAX_FRAME_LEN, NRF_SUCCESS, "longest frame");
+    frame[3]++;
+    reader_expect(frame, PROTO_MAX_FRAME_LEN + 1, NRF_ERROR_INVALID_LENGTH, "frame too long");
+    reader_expect(frame, PROTO_MAX_FRAME_LEN, NRF_ERROR_INVALID_LENGTH, "record past the end");
+    frame[3] = 0xFF;
+    reader_expect(frame, PROTO_MAX_FRAME_LEN, NRF_ERROR_INVALID_LENGTH, "record of 255");
+
+    // a frame of mixed records cut at every byte, only record ends are valid
+    proto_writer_init(&writer, buf, sizeof(buf), 1);
+    bounds[num_of_bounds++] = writer.length;
+    proto_put(&writer, PROTO_REQ_READ, NULL, 0);
+    bounds[num_of_bounds++] = writer.length;
+    proto_put_start(&writer, &(proto_start_t){ 100, 200, 2, { 1, -1 } });
+    bounds[num_of_bounds++] = writer.length;
+    proto_put_ack(&writer, &(proto_ack_t){ 1, 2 });
+    bounds[num_of_bounds++] = writer.length;
+    proto_put_link_stats(&writer, &(proto_link_stats_t){ 0 });
+    bounds[num_of_bounds++] = writer.length;
+
+    for (uint16_t cut = PROTO_HEADER_LEN; cut <= writer.length; cut++)
+    {
+        bool bound = false;
+        char name[32];
+
+        for (int i = 0; i < num_of_bounds; i++)
+        {
+            bound = bound || bounds[i] == cut;
+        }
+        snprintf(name, sizeof(name), "cut at %u", cut);
+        reader_expect(buf, cut, bound ? NRF_SUCCESS : NRF_ERROR_INVALID_LENGTH, name);
+    }
+
+    // random frames, mostly small lengths so records end inside now and then
+    srand(1);
+    for (int i = 0; i < PROTOTEST_RANDOM_FRAMES; i++)
+    {
+        uint16_t length = (uint16_t)(rand() % (PROTO_MAX_FRAME_LEN + 1));
+
+        for (uint16_t j = 0; j < length; j++)
+        {
+            frame[j] = (uint8_t)((j & 1) ? rand() % 24 : rand());
+        }
+        frame[0] = (rand() % 16) ? PROTO_MAGIC : (uint8_t)rand();
+
+        reader_expect(frame, length,
+                      (length < PROTO_HEADER_LEN || frame[0] != PROTO_MAGIC) ? NRF_ERROR_INVALID_DATA :
+                      ref_walk(frame, length) ? NRF_SUCCESS : NRF_ERROR_INVALID_LENGTH,
+                      "random frame");
+        if (m_failed) break;
+    }
+}
+
+static void run(char const * name, void (*test)(void))
+{
+    int failed = m_failed;
+
+    test();
+    printf("%-10s %s\n", name, m_failed == failed ? "ok" : "FAILED");
+}
+
+int main(void)
+{
+    run("records", test_records);
+    run("wave", test_wave);
+    run("frame", test_frame);
+    run("malformed", test_malformed);
+
+    return m_failed == 0 ? 0 : 1;
+}
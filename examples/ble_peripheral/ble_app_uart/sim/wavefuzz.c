@@ -0,0 +1,365 @@
+/*
+ * wavefuzz, feeds random waveforms to waveform_validate (waveform.c) and
+ * checks its verdict against a reference on a host
+ *
+ * waveforms are compiled from random segments (pulse and recycle pairs, some
+ * of them balanced, random types, amplitudes, durations and frequencies),
+ * scaled by a random factor now and then, and some get random bits of
+ * spi_words flipped, so the replay sees words the compiler never writes.
+ * limits are random as well. each one is validated with and without
+ * correction.
+ *
+ * the reference replays spi_words with its own model of DAC088S085 and
+ * integrates the outputs over the segments, from the end of each burst to
+ * the end of the next one, when the outputs change. checked:
+ * - the report matches the reference figures of the waveform as it is left
+ * - the return code matches them: INVALID_DATA if amplitude or balance is
+ *   over a limit, else INVALID_LENGTH if a burst doesn't fit, else SUCCESS
+ * - without correction the waveform is not touched
+ * - with correction only channels over the imbalance limit are changed,
+ *   their pulse amplitude is kept, and spi_words replay to seg_codes again
+ * exits non zero on the first waveform that fails, printing its seed, which
+ * alone replays it: wavefuzz 1 <seed>.
+ *
+ * usage: wavefuzz [iterations, default 200000] [seed, default 1]
+ *
+ * build as described in sim/README, the sanitizers catch out of bounds
+ * words and overflows:
+ * gcc -O1 -g -std=gnu99 -DNRF52832_XXAA -fsanitize=address,undefined $INC \
+ *     sim/wavefuzz.c waveform.c -o wavefuzz
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../waveform.h"
+
+#define WAVEFUZZ_ITERATIONS                 200000
+
+static uint32_t m_rand;
+
+static uint32_t rnd(void)
+{
+    // xorshift32
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+static uint32_t rnd_range(uint32_t lo, uint32_t hi)
+{
+    return lo + rnd() % (hi - lo + 1);
+}
+
+/*
+ * DAC088S085 as the datasheet has it, starting in WRM mode at VMID
+ */
+static void ref_replay(waveform_t const * p_wave, uint8_t out[][DAC_NUM_OF_CHANNELS])
+{
+    uint8_t reg[DAC_NUM_OF_CHANNELS];
+    uint8_t dac[DAC_NUM_OF_CHANNELS];
+    bool wtm = false;
+    uint16_t index = 0;
+
+    memset(reg, DAC_CODE_MID, sizeof(reg));
+    memset(dac, DAC_CODE_MID, sizeof(dac));
+
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+    {
+        for (uint8_t n = 0; n < p_wave->seg_words[seg]; n++, index++)
+        {
+            uint16_t w = (uint16_t)((p_wave->spi_words[index * 2] << 8) | p_wave->spi_words[index * 2 + 1]);
+            uint8_t cmd = (uint8_t)(w >> 12);
+            uint8_t code = (uint8_t)(w >> 4);
+
+            if (cmd < 8)
+            {
+                reg[cmd] = code;
+                if (wtm) dac[cmd] = code;
+            }
+            else if (cmd == 0x8 || cmd == 0x9)
+            {
+                wtm = (cmd == 0x9);
+            }
+            else if (cmd == 0xA)
+            {
+                for (int ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+                {
+                    if (w & (1 << ch)) dac[ch] = reg[ch];
+                }
+            }
+            else if (cmd == 0xB)
+            {
+                reg[0] = code;
+                memcpy(dac, reg, sizeof(dac));
+            }
+            else if (cmd == 0xC)
+            {
+                memset(reg, code, sizeof(reg));
+                memset(dac, code, sizeof(dac));
+            }
+            // 0xD - 0xF power down, output unchanged as far as charge goes
+        }
+
+        memcpy(out[seg], dac, DAC_NUM_OF_CHANNELS);
+    }
+}
+
+// outputs change at the end of the burst, the update-all is its last word
+static uint32_t ref_latch(waveform_t const * p_wave, uint8_t seg)
+{
+    return p_wave->seg_time[seg] + (uint32_t)p_wave->seg_words[seg] * WAVEFORM_WORD_US * WAVEFORM_TICKS_PER_US;
+}
+
+static uint32_t ref_duration(waveform_t const * p_wave, uint8_t seg)
+{
+    uint32_t end = (seg + 1 < p_wave->num_of_segs) ? ref_latch(p_wave, seg + 1)
+                                                   : p_wave->cycle_time + ref_latch(p_wave, 0);
+
+    return end - ref_latch(p_wave, seg);
+}
+
+static void ref_measure(waveform_t const * p_wave, waveform_report_t * p_report,
+                        uint8_t out[][DAC_NUM_OF_CHANNELS])
+{
+    memset(p_report, 0, sizeof(waveform_report_t));
+    ref_replay(p_wave, out);
+
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+    {
+        for (int ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+        {
+            int32_t a = (int32_t)out[seg][ch] - DAC_CODE_MID;
+
+            p_report->charge[ch] += a * (int32_t)ref_duration(p_wave, seg);
+            if ((uint8_t)abs(a) > p_report->peak[ch]) p_report->peak[ch] = (uint8_t)abs(a);
+        }
+    }
+}
+
+static ret_code_t ref_verdict(waveform_t const * p_wave, waveform_report_t const * p_report,
+                              waveform_limits_t const * p_limits)
+{
+    uint8_t last = p_wave->num_of_segs - 1;
+
+    for (int ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+    {
+        if (p_report->peak[ch] > p_limits->max_amplitude ||
+            (uint32_t)abs(p_report->charge[ch]) > p_limits->max_imbalance)
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+    }
+
+    if (p_wave->seg_time[0] < WAVEFORM_START_TICKS)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    for (uint8_t seg = 0; seg < last; seg++)
+    {
+        if (ref_latch(p_wave, seg) > p_wave->seg_time[seg + 1])
+        {
+            return NRF_ERROR_INVALID_LENGTH;
+        }
+    }
+
+    if (ref_latch(p_wave, last) + WAVEFORM_REWIND_US * WAVEFORM_TICKS_PER_US > p_wave->cycle_time)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    return NRF_SUCCESS;
+}
+
+/*
+ * random waveform that compiles, false if none did in a few tries
+ */
+static bool wave_make(waveform_t * p_wave)
+{
+    for (int tries = 0; tries < 50; tries++)
+    {
+        waveform_seg_desc_t segs[WAVEFORM_MAX_SEGS - 1];
+        uint8_t num_of_segs = (uint8_t)rnd_range(1, WAVEFORM_MAX_SEGS - 1);
+        uint16_t freq = (uint16_t)((rnd() & 1) ? rnd_range(WAVEFORM_MIN_FREQ, 100) : rnd_range(100, WAVEFORM_MAX_FREQ));
+        uint32_t cycle_us = 1000000UL / freq;
+
+        memset(segs, 0, sizeof(segs));
+        for (uint8_t seg = 0; seg < num_of_segs; seg++)
+        {
+            segs[seg].type = (uint8_t)rnd_range(WAVEFORM_SEG_PULSE, WAVEFORM_SEG_REST);
+            segs[seg].duration = rnd_range(WAVEFORM_WORDS_PER_SEG * WAVEFORM_WORD_US, cycle_us / (num_of_segs + 1) + 30);
+            for (int ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+            {
+                switch (rnd() % 4)
+                {
+                    case 0:  segs[seg].current[ch] = 0; break;
+                    case 1:  segs[seg].current[ch] = (int16_t)rnd_range(0, 300) - 150; break;
+                    default: segs[seg].current[ch] = (int16_t)rnd_range(0, 40) - 20; break;
+                }
+            }
+        }
+
+        // most of the time a pulse and a recycle, balanced or near
+        if (num_of_segs >= 2 && (rnd() % 4) != 0)
+        {
+            uint32_t ratio = rnd_range(1, WAVEFORM_MAX_RECYCLE_RATIO);
+
+            segs[0].type = WAVEFORM_SEG_PULSE;
+            segs[1].type = WAVEFORM_SEG_RECYCLE;
+            segs[1].duration = segs[0].duration * ratio;
+            for (int ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+            {
+                segs[1].current[ch] = (int16_t)(-segs[0].current[ch] / (int32_t)ratio + (int32_t)(rnd() % 3) - 1);
+            }
+        }
+
+        if (waveform_compile_segments(freq, segs, num_of_segs, p_wave) != NRF_SUCCESS)
+        {
+            continue;
+        }
+
+        if ((rnd() % 4) == 0)
+        {
+            waveform_scale(p_wave, (uint16_t)rnd_range(0, 2 * WAVEFORM_SCALE_ONE));
+        }
+
+        if ((rnd() % 4) == 0)
+        {
+            for (uint32_t n = rnd_range(1, 4); n > 0; n--)
+            {
+                uint16_t bit = (uint16_t)(rnd() % (p_wave->num_of_words * 16));
+                p_wave->spi_words[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+            }
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+static void limits_make(waveform_limits_t * p_limits)
+{
+    p_limits->max_amplitude = (uint8_t)((rnd() & 1) ? 0xFF : rnd_range(0, 0x80));
+    p_limits->max_imbalance = (rnd() & 1) ? rnd_range(0, 2000) : rnd_range(0, 200000);
+}
+
+static bool report_equal(waveform_report_t const * p_a, waveform_report_t const * p_b)
+{
+    return memcmp(p_a->charge, p_b->charge, sizeof(p_a->charge)) == 0 &&
+           memcmp(p_a->peak, p_b->peak, sizeof(p_a->peak)) == 0;
+}
+
+static int pulse_seg(waveform_t const * p_wave)
+{
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+    {
+        if (p_wave->seg_type[seg] == WAVEFORM_SEG_PULSE) return seg;
+    }
+    return -1;
+}
+
+/*
+ * one waveform, one set of limits, both ways. returns a message on failure.
+ */
+static uint32_t m_corrected;
+static uint32_t m_rejected;
+
+static char const * fuzz_one(void)
+{
+    static waveform_t wave, before;
+    uint8_t out_before[WAVEFORM_MAX_SEGS][DAC_NUM_OF_CHANNELS];
+    uint8_t out[WAVEFORM_MAX_SEGS][DAC_NUM_OF_CHANNELS];
+    waveform_limits_t limits;
+    waveform_report_t report, ref;
+    ret_code_t err;
+    int pulse;
+
+    if (!wave_make(&wave)) return NULL;
+    limits_make(&limits);
+    before = wave;
+
+    // as it is
+    err = waveform_validate(&wave, &limits, false, &report);
+    ref_measure(&wave, &ref, out_before);
+    if (memcmp(&wave, &before, sizeof(wave)) != 0)      return "waveform changed without correction";
+    if (!report_equal(&report, &ref))                   return "report differs from reference";
+    if (report.corrected != 0)                          return "corrected without correction";
+    if (err != ref_verdict(&wave, &ref, &limits))       return "verdict differs from reference";
+
+    // corrected
+    err = waveform_validate(&wave, &limits, true, &report);
+    ref_measure(&wave, &ref, out);
+    if (!report_equal(&report, &ref))                   return "report differs from reference after correction";
+    if (err != ref_verdict(&wave, &ref, &limits))       return "verdict differs from reference after correction";
+
+    if (err != NRF_SUCCESS) m_rejected++;
+    if (report.corrected == 0)
+    {
+        return memcmp(&wave, &before, sizeof(wave)) != 0 ? "waveform changed, none corrected" : NULL;
+    }
+
+    if (memcmp(out, wave.seg_codes, wave.num_of_segs * DAC_NUM_OF_CHANNELS) != 0)
+    {
+        return "spi_words don't replay to seg_codes after correction";
+    }
+
+    m_corrected++;
+    pulse = pulse_seg(&wave);
+    for (int ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+    {
+        int32_t a0 = (int32_t)out_before[pulse][ch] - DAC_CODE_MID;
+        int32_t a1 = (int32_t)wave.seg_codes[pulse][ch] - DAC_CODE_MID;
+
+        if (!(report.corrected & (1 << ch)))
+        {
+            for (uint8_t seg = 0; seg < wave.num_of_segs; seg++)
+            {
+                if (wave.seg_codes[seg][ch] != before.seg_codes[seg][ch]) return "channel not corrected changed";
+            }
+            continue;
+        }
+
+        if (a1 != a0)
+        {
+            return "pulse amplitude changed";
+        }
+        if ((uint32_t)abs(report.charge[ch]) > ref_duration(&wave, 1) / 2 && wave.num_of_segs == 3 &&
+            wave.seg_type[0] == WAVEFORM_SEG_PULSE && wave.seg_type[1] == WAVEFORM_SEG_RECYCLE &&
+            wave.seg_time[0] >= WAVEFORM_START_TICKS)
+        {
+            // pulse, recycle and rest at VMID, the corrected pair must cancel to half a recycle code,
+            // unless a longer first burst no longer fits before its latch
+            return "corrected channel not balanced";
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t iterations = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : WAVEFUZZ_ITERATIONS;
+    uint32_t seed = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 1;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        uint32_t s = seed + i * 0x9E3779B9U;
+        char const * msg;
+
+        m_rand = (s != 0) ? s : 1;
+        msg = fuzz_one();
+        if (msg != NULL)
+        {
+            printf("FAILED iteration %u seed 0x%08X: %s\n", (unsigned)i, (unsigned)s, msg);
+            return 1;
+        }
+    }
+
+    printf("%u waveforms ok, %u corrected, %u rejected after correction\n",
+           (unsigned)iterations, (unsigned)m_corrected, (unsigned)m_rejected);
+    return 0;
+}
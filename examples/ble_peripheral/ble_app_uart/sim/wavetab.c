@@ -0,0 +1,361 @@
+/*
+ * wavetab, checks the tables of waveform.c bit for bit on a host
+ *
+ * a few START messages, segment lists and stream waveforms are compiled and
+ * spi_words, seg_time, seg_words, seg_type and cycle_time compared with
+ * vectors worked out by hand from the DAC088S085 command set (see
+ * waveform.h). also checks the errors of the compiler and that p_wave is
+ * untouched on error. exits non zero if any check fails.
+ *
+ * usage: wavetab
+ *
+ * build as described in sim/README:
+ * gcc -std=gnu99 -DNRF52832_XXAA $INC sim/wavetab.c waveform.c -o wavetab
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "../waveform.h"
+
+#define VEC_MAX_WORDS                       (WAVEFORM_MAX_WORDS + 1)
+
+typedef struct vector
+{
+    uint32_t        cycle_time;
+    uint8_t         num_of_segs;
+    uint32_t        seg_time[WAVEFORM_MAX_SEGS];
+    uint8_t         seg_words[WAVEFORM_MAX_SEGS];
+    uint8_t         seg_type[WAVEFORM_MAX_SEGS];
+    uint16_t        num_of_words;               // park word not counted
+    uint16_t        words[VEC_MAX_WORDS];       // park word last
+} vector_t;
+
+static int m_failed;
+
+#define CHECK(cond, ...)                                                        \
+    do {                                                                        \
+        if (!(cond)) { printf("  " __VA_ARGS__); printf("\n"); m_failed++; }    \
+    } while (0)
+
+static void msg_init(ble_incomming_message_t * p_msg, uint16_t freq, uint16_t pulse_width,
+                     uint16_t recycle_ratio, int8_t const * current)
+{
+    memset(p_msg, 0, sizeof(ble_incomming_message_t));
+    p_msg->c                = 2;
+    p_msg->freq             = freq;
+    p_msg->num_of_pulses    = 1;
+    p_msg->pulse_width      = pulse_width;
+    p_msg->recycle_ratio    = recycle_ratio;
+    memcpy(p_msg->current, current, DAC_NUM_OF_CHANNELS);
+}
+
+static void wave_check(waveform_t const * p_wave, vector_t const * p_vec)
+{
+    CHECK(p_wave->cycle_time == p_vec->cycle_time, "cycle_time %u, want %u",
+          (unsigned)p_wave->cycle_time, (unsigned)p_vec->cycle_time);
+    CHECK(p_wave->num_of_segs == p_vec->num_of_segs, "num_of_segs %u, want %u",
+          p_wave->num_of_segs, p_vec->num_of_segs);
+    CHECK(p_wave->num_of_words == p_vec->num_of_words, "num_of_words %u, want %u",
+          p_wave->num_of_words, p_vec->num_of_words);
+
+    for (uint8_t seg = 0; seg < p_vec->num_of_segs; seg++)
+    {
+        CHECK(p_wave->seg_time[seg] == p_vec->seg_time[seg], "seg %u time %u, want %u",
+              seg, (unsigned)p_wave->seg_time[seg], (unsigned)p_vec->seg_time[seg]);
+        CHECK(p_wave->seg_words[seg] == p_vec->seg_words[seg], "seg %u words %u, want %u",
+              seg, p_wave->seg_words[seg], p_vec->seg_words[seg]);
+        CHECK(p_wave->seg_type[seg] == p_vec->seg_type[seg], "seg %u type %u, want %u",
+              seg, p_wave->seg_type[seg], p_vec->seg_type[seg]);
+    }
+
+    // park word included
+    for (uint16_t i = 0; i <= p_vec->num_of_words; i++)
+    {
+        uint16_t w = waveform_word_get(p_wave, i);
+
+        CHECK(w == p_vec->words[i], "word %u 0x%04X, want 0x%04X", i, w, p_vec->words[i]);
+    }
+
+    CHECK(waveform_park_offset(p_wave) == p_vec->num_of_words * 2, "park offset %u",
+          waveform_park_offset(p_wave));
+}
+
+static void run(char const * name, void (*test)(void))
+{
+    int failed = m_failed;
+
+    test();
+    printf("%-10s %s\n", name, m_failed == failed ? "ok" : "FAILED");
+}
+
+/*
+ * biphasic on C and D, 50us pulse, recycle 2x longer at half the amplitude
+ */
+static void test_biphasic(void)
+{
+    static int8_t const current[DAC_NUM_OF_CHANNELS] = { 0, 0, 10, -10, 0, 0, 0, 0 };
+    static vector_t const vec = {
+        .cycle_time     = 10000,
+        .num_of_segs    = 3,
+        .seg_time       = { 1, 51, 151 },
+        .seg_words      = { 3, 3, 3 },
+        .seg_type       = { WAVEFORM_SEG_PULSE, WAVEFORM_SEG_RECYCLE, WAVEFORM_SEG_REST },
+        .num_of_words   = 9,
+        .words          = {
+            0x28A0, 0x3760, 0xA0FF,     // C 0x8A, D 0x76
+            0x27B0, 0x3850, 0xA0FF,     // C 0x7B, D 0x85
+            0x2800, 0x3800, 0xA0FF,     // back to VMID
+            0xC800,
+        },
+    };
+    ble_incomming_message_t msg;
+    waveform_t wave;
+
+    msg_init(&msg, 100, 50, 2, current);
+    CHECK(waveform_compile(&msg, &wave) == NRF_SUCCESS, "compile");
+    wave_check(&wave, &vec);
+    CHECK(waveform_seg_offset(&wave, 1) == 6 && waveform_seg_offset(&wave, 2) == 12, "seg offset");
+    CHECK(waveform_last_burst_end(&wave) == 151 + 9, "last burst end %u",
+          (unsigned)waveform_last_burst_end(&wave));
+}
+
+/*
+ * half amplitude of the biphasic one, rounded half away from VMID
+ */
+static void test_scale(void)
+{
+    static int8_t const current[DAC_NUM_OF_CHANNELS] = { 0, 0, 10, -10, 0, 0, 0, 0 };
+    static vector_t const vec = {
+        .cycle_time     = 10000,
+        .num_of_segs    = 3,
+        .seg_time       = { 1, 51, 151 },
+        .seg_words      = { 3, 3, 3 },
+        .seg_type       = { WAVEFORM_SEG_PULSE, WAVEFORM_SEG_RECYCLE, WAVEFORM_SEG_REST },
+        .num_of_words   = 9,
+        .words          = {
+            0x2850, 0x37B0, 0xA0FF,     // +5, -5
+            0x27D0, 0x3830, 0xA0FF,     // -3, +3 (2.5 rounded away)
+            0x2800, 0x3800, 0xA0FF,
+            0xC800,
+        },
+    };
+    ble_incomming_message_t msg;
+    waveform_t wave;
+
+    msg_init(&msg, 100, 50, 2, current);
+    CHECK(waveform_compile(&msg, &wave) == NRF_SUCCESS, "compile");
+    waveform_scale(&wave, WAVEFORM_SCALE_ONE / 2);
+    wave_check(&wave, &vec);
+    CHECK(wave.seg_codes[0][2] == 0x85 && wave.seg_codes[1][3] == 0x83, "seg codes");
+}
+
+/*
+ * monophasic on all channels, every channel written
+ */
+static void test_all(void)
+{
+    static int8_t const current[DAC_NUM_OF_CHANNELS] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    static vector_t const vec = {
+        .cycle_time     = 1000,
+        .num_of_segs    = 2,
+        .seg_time       = { 1, 41 },
+        .seg_words      = { 9, 9 },
+        .seg_type       = { WAVEFORM_SEG_PULSE, WAVEFORM_SEG_REST },
+        .num_of_words   = 18,
+        .words          = {
+            0x0810, 0x1820, 0x2830, 0x3840, 0x4850, 0x5860, 0x6870, 0x7880, 0xA0FF,
+            0x0800, 0x1800, 0x2800, 0x3800, 0x4800, 0x5800, 0x6800, 0x7800, 0xA0FF,
+            0xC800,
+        },
+    };
+    ble_incomming_message_t msg;
+    waveform_t wave;
+
+    msg_init(&msg, 1000, 40, 0, current);
+    CHECK(waveform_compile(&msg, &wave) == NRF_SUCCESS, "compile");
+    wave_check(&wave, &vec);
+}
+
+/*
+ * full scale, codes clamped to 0x00 - 0xFF
+ */
+static void test_clamp(void)
+{
+    static int8_t const current[DAC_NUM_OF_CHANNELS] = { 127, 0, 0, 0, 0, 0, 0, -128 };
+    static vector_t const vec = {
+        .cycle_time     = 20000,
+        .num_of_segs    = 3,
+        .seg_time       = { 1, 31, 61 },
+        .seg_words      = { 3, 3, 3 },
+        .seg_type       = { WAVEFORM_SEG_PULSE, WAVEFORM_SEG_RECYCLE, WAVEFORM_SEG_REST },
+        .num_of_words   = 9,
+        .words          = {
+            0x0FF0, 0x7000, 0xA0FF,
+            0x0010, 0x7FF0, 0xA0FF,     // -127, +128 clamped to 0xFF
+            0x0800, 0x7800, 0xA0FF,
+            0xC800,
+        },
+    };
+    ble_incomming_message_t msg;
+    waveform_t wave;
+
+    msg_init(&msg, 50, 30, 1, current);
+    CHECK(waveform_compile(&msg, &wave) == NRF_SUCCESS, "compile");
+    wave_check(&wave, &vec);
+}
+
+/*
+ * nothing changes, segments are the update-all alone
+ */
+static void test_zero(void)
+{
+    static int8_t const current[DAC_NUM_OF_CHANNELS] = { 0 };
+    static vector_t const vec = {
+        .cycle_time     = 1000,
+        .num_of_segs    = 2,
+        .seg_time       = { 1, 11 },
+        .seg_words      = { 1, 1 },
+        .seg_type       = { WAVEFORM_SEG_PULSE, WAVEFORM_SEG_REST },
+        .num_of_words   = 2,
+        .words          = { 0xA0FF, 0xA0FF, 0xC800 },
+    };
+    ble_incomming_message_t msg;
+    waveform_t wave;
+
+    msg_init(&msg, 1000, 10, 0, current);
+    CHECK(waveform_compile(&msg, &wave) == NRF_SUCCESS, "compile");
+    wave_check(&wave, &vec);
+}
+
+/*
+ * three segments, only the channels that change from the one before.
+ * bursts are 6, 6, 12 and 12us, each one starts so that the outputs change
+ * 20, 20 and 80us after the ones before, at 7, 27, 47 and 127.
+ */
+static void test_segments(void)
+{
+    static waveform_seg_desc_t const segs[3] = {
+        { WAVEFORM_SEG_PULSE,   20, {  20,   0, 0, 0, 0, 0, 0,   0 } },
+        { WAVEFORM_SEG_PULSE,   20, {  20, -20, 0, 0, 0, 0, 0,   0 } },
+        { WAVEFORM_SEG_RECYCLE, 80, { -10,  10, 0, 0, 0, 0, 0, 300 } },
+    };
+    static vector_t const vec = {
+        .cycle_time     = 5000,
+        .num_of_segs    = 4,
+        .seg_time       = { 1, 21, 35, 115 },
+        .seg_words      = { 2, 2, 4, 4 },
+        .seg_type       = { WAVEFORM_SEG_PULSE, WAVEFORM_SEG_PULSE, WAVEFORM_SEG_RECYCLE, WAVEFORM_SEG_REST },
+        .num_of_words   = 12,
+        .words          = {
+            0x0940, 0xA0FF,                     // A 0x94
+            0x16C0, 0xA0FF,                     // B 0x6C, A unchanged
+            0x0760, 0x18A0, 0x7FF0, 0xA0FF,     // A 0x76, B 0x8A, H clamped
+            0x0800, 0x1800, 0x7800, 0xA0FF,
+            0xC800,
+        },
+    };
+    waveform_t wave;
+
+    CHECK(waveform_compile_segments(200, segs, 3, &wave) == NRF_SUCCESS, "compile");
+    wave_check(&wave, &vec);
+}
+
+/*
+ * stream table writes every channel, waveform_stream_set rewrites them
+ */
+static void test_stream(void)
+{
+    static int8_t const current[DAC_NUM_OF_CHANNELS] = { -1, 0, 1, 127, -128, 0, 0, 64 };
+    static vector_t const vec = {
+        .cycle_time     = 2000,
+        .num_of_segs    = 1,
+        .seg_time       = { 1 },
+        .seg_words      = { 9 },
+        .seg_type       = { WAVEFORM_SEG_REST },
+        .num_of_words   = 9,
+        .words          = {
+            0x0800, 0x1800, 0x2800, 0x3800, 0x4800, 0x5800, 0x6800, 0x7800, 0xA0FF,
+            0xC800,
+        },
+    };
+    static vector_t const set = {
+        .cycle_time     = 2000,
+        .num_of_segs    = 1,
+        .seg_time       = { 1 },
+        .seg_words      = { 9 },
+        .seg_type       = { WAVEFORM_SEG_REST },
+        .num_of_words   = 9,
+        .words          = {
+            0x07F0, 0x1800, 0x2810, 0x3FF0, 0x4000, 0x5800, 0x6800, 0x7C00, 0xA0FF,
+            0xC800,
+        },
+    };
+    waveform_t wave;
+
+    CHECK(waveform_compile_stream(500, &wave) == NRF_SUCCESS, "compile");
+    wave_check(&wave, &vec);
+    waveform_stream_set(&wave, current);
+    wave_check(&wave, &set);
+    CHECK(wave.seg_codes[0][0] == 0x7F && wave.seg_codes[0][4] == 0x00, "seg codes");
+}
+
+/*
+ * rejected input, p_wave left as it was
+ */
+static void test_errors(void)
+{
+    static int8_t const current[DAC_NUM_OF_CHANNELS] = { 10, 10, 0, 0, 0, 0, 0, 0 };
+    static waveform_seg_desc_t const bad_type[1] = { { 3, 20, { 0 } } };
+    struct
+    {
+        uint16_t    freq;
+        uint16_t    pulse_width;
+        uint16_t    recycle_ratio;
+        ret_code_t  err;
+    } const cases[] = {
+        { 0,    50,  0,  NRF_ERROR_INVALID_PARAM },     // freq out of range
+        { 1001, 50,  0,  NRF_ERROR_INVALID_PARAM },
+        { 100,  50,  11, NRF_ERROR_INVALID_PARAM },     // recycle ratio
+        { 100,  8,   0,  NRF_ERROR_INVALID_LENGTH },    // rest burst, 3 words, takes 9us
+        { 1000, 900, 0,  NRF_ERROR_INVALID_LENGTH },    // no room for rest and rewind
+        { 1000, 90,  10, NRF_ERROR_INVALID_LENGTH },    // recycle 900us
+    };
+    ble_incomming_message_t msg;
+    waveform_t wave, before;
+
+    memset(&wave, 0x5A, sizeof(wave));
+    before = wave;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        ret_code_t err;
+
+        msg_init(&msg, cases[i].freq, cases[i].pulse_width, cases[i].recycle_ratio, current);
+        err = waveform_compile(&msg, &wave);
+        CHECK(err == cases[i].err, "case %u err 0x%X, want 0x%X", (unsigned)i, (unsigned)err,
+              (unsigned)cases[i].err);
+    }
+
+    CHECK(waveform_compile(NULL, &wave) == NRF_ERROR_NULL, "null msg");
+    CHECK(waveform_compile(&msg, NULL) == NRF_ERROR_NULL, "null wave");
+    CHECK(waveform_compile_segments(100, bad_type, 1, &wave) == NRF_ERROR_INVALID_PARAM, "seg type");
+    CHECK(waveform_compile_segments(100, bad_type, 0, &wave) == NRF_ERROR_INVALID_PARAM, "no segs");
+    CHECK(waveform_compile_segments(100, bad_type, WAVEFORM_MAX_SEGS, &wave) == NRF_ERROR_INVALID_PARAM,
+          "too many segs");
+    CHECK(waveform_compile_stream(0, &wave) == NRF_ERROR_INVALID_PARAM, "stream rate");
+    CHECK(memcmp(&wave, &before, sizeof(wave)) == 0, "p_wave changed on error");
+}
+
+int main(void)
+{
+    run("biphasic", test_biphasic);
+    run("scale", test_scale);
+    run("all", test_all);
+    run("clamp", test_clamp);
+    run("zero", test_zero);
+    run("segments", test_segments);
+    run("stream", test_stream);
+    run("errors", test_errors);
+
+    return m_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#ifndef __STIM_CHAIN_H__
+#define __STIM_CHAIN_H__
+
+#include <stdint.h>
+#include "timing_link.h"
+
+/**
+ * Stimulation chain topology
+ *
+ * cc roles and ppi links of the stimulation engine (see howland.c). kept
+ * apart from the engine so the host simulator in sim/ runs the very same
+ * table.
+ *
+ * seg timer
+ * c0 - c3 segment start, ppi to spi timer start, no interrupt
+ * c4 end of last burst, swap tables and rewind tx pointer in isr, ppi to timing probes
+ * c5 end of cycle, clears seg timer (short), ppi to clear seg counter and count cycle
+ *
+ * seg counter
+ * c0 - c3 accumulated words at the end of each segment, ppi to stop spi timer
+ *
+ * spi timer (16MHz)
+ * c0 starts spi, c1 pulls ss low and counts, c2 timing probe.
+ * spi end pulls ss high and clears spi timer.
+ *
+ * cyc counter
+ * c0 status capture, c1 timing probe
+ */
+#define STIM_SEG_TIMER_CC_REWIND            4
+#define STIM_SEG_TIMER_CC_CYCLE             5
+#define STIM_SPI_TIMER_CC_PROBE             2
+#define STIM_CYC_COUNTER_CC_PROBE           1
+#define STIM_CC_UNUSED                      0xFFFFFFFF
+
+// spi timer ticks from start, ss goes low after spi is started
+#define STIM_SPI_TIMER_START_TICKS          1
+#define STIM_SPI_TIMER_SS_TICKS             7
+
+static timing_link_t const m_stim_links[] = {
+    { TIMING_EVT_SEG_TIMER(0),      TIMING_TASK_SPI_TIMER(TIMING_TIMER_START),  TIMING_EP_NONE },
+    { TIMING_EVT_SEG_TIMER(1),      TIMING_TASK_SPI_TIMER(TIMING_TIMER_START),  TIMING_EP_NONE },
+    { TIMING_EVT_SEG_TIMER(2),      TIMING_TASK_SPI_TIMER(TIMING_TIMER_START),  TIMING_EP_NONE },
+    { TIMING_EVT_SEG_TIMER(3),      TIMING_TASK_SPI_TIMER(TIMING_TIMER_START),  TIMING_EP_NONE },
+    { TIMING_EVT_SPI_TIMER(0),      TIMING_TASK_SPI_START,                      TIMING_EP_NONE },
+    { TIMING_EVT_SPI_TIMER(1),      TIMING_TASK_SS_TOGGLE,                      TIMING_TASK_SEG_COUNTER(TIMING_TIMER_COUNT) },
+    { TIMING_EVT_SEG_COUNTER(0),    TIMING_TASK_SPI_TIMER(TIMING_TIMER_STOP),   TIMING_EP_NONE },
+    { TIMING_EVT_SEG_COUNTER(1),    TIMING_TASK_SPI_TIMER(TIMING_TIMER_STOP),   TIMING_EP_NONE },
+    { TIMING_EVT_SEG_COUNTER(2),    TIMING_TASK_SPI_TIMER(TIMING_TIMER_STOP),   TIMING_EP_NONE },
+    { TIMING_EVT_SEG_COUNTER(3),    TIMING_TASK_SPI_TIMER(TIMING_TIMER_STOP),   TIMING_EP_NONE },
+    { TIMING_EVT_SPI_END,           TIMING_TASK_SS_TOGGLE,                      TIMING_TASK_SPI_TIMER(TIMING_TIMER_CLEAR) },
+    { TIMING_EVT_SEG_TIMER(STIM_SEG_TIMER_CC_CYCLE),
+                                    TIMING_TASK_SEG_COUNTER(TIMING_TIMER_CLEAR), TIMING_TASK_CYC_COUNTER(TIMING_TIMER_COUNT) },
+    { TIMING_EVT_SEG_TIMER(STIM_SEG_TIMER_CC_REWIND),
+                                    TIMING_TASK_SPI_TIMER(TIMING_TIMER_CAPTURE(STIM_SPI_TIMER_CC_PROBE)),
+                                                                                TIMING_TASK_CYC_COUNTER(TIMING_TIMER_CAPTURE(STIM_CYC_COUNTER_CC_PROBE)) },
+};
+
+#define STIM_NUM_OF_LINKS                   (sizeof(m_stim_links) / sizeof(m_stim_links[0]))
+
+#endif
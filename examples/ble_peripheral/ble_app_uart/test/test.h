@@ -65,8 +65,10 @@ void test7a(void);
 
 /*
  * in test8 we are going to construct a full 12-stage spi xfer.
+ * test8b replays a biphasic pulse compiled by waveform_compile.
  */
 void test8a(void);
+void test8b(void);
 
 /*
  *
@@ -10,6 +10,7 @@
 
 #include "../howland.h"
 #include "../timing.h"
+#include "../waveform.h"
 #include "test.h"
 
 static uint8_t st_regs[216] = {
@@ -158,3 +159,140 @@ void test8a(void)
     test8_spi_xfer();
     nrf_drv_timer_enable(&m_seg_timer);
 }
+
+static waveform_t st_wave;
+static uint8_t st_wave_index = 0;
+
+static void test8b_spi_xfer(void)
+{
+    uint32_t err;
+
+    static nrf_drv_spi_xfer_desc_t xfer = {
+        .p_tx_buffer = st_wave.spi_words,
+        .tx_length = 2
+    };
+
+    const uint32_t flags =
+        NRF_DRV_SPI_FLAG_HOLD_XFER |
+        NRF_DRV_SPI_FLAG_TX_POSTINC |
+        NRF_DRV_SPI_FLAG_NO_XFER_EVT_HANDLER |
+        NRF_DRV_SPI_FLAG_REPEATED_XFER;
+
+    err = nrf_drv_spi_xfer(&m_dac_spi, &xfer, flags);
+    APP_ERROR_CHECK(err);
+}
+
+/*
+ * c0 walks through seg_time, one segment behind.
+ * c1 fires when the last burst (rest) is done, the whole rest phase is left for rewinding tx pointer.
+ * c2 rewinds seg timer at cycle end, no interrupt.
+ */
+static void test8b_cycle_timer_callback(nrf_timer_event_t event_type, void * p_context)
+{
+    if (event_type == NRF_TIMER_EVENT_COMPARE0)
+    {
+        st_wave_index = (st_wave_index + 1) % st_wave.num_of_segs;
+        nrf_drv_timer_compare(&m_seg_timer,
+                              NRF_TIMER_CC_CHANNEL0,
+                              st_wave.seg_time[st_wave_index],
+                              true);
+    }
+    else if (event_type == NRF_TIMER_EVENT_COMPARE1)
+    {
+        test8b_spi_xfer();
+    }
+}
+
+/*
+ * test8b is test8a with tables generated by waveform_compile instead of hand-written st_regs/st_acctime.
+ * A biphasic pulse of +10/-10 on C and D is generated at 100Hz, 50us pulse and 200us recycle phase.
+ * Only C and D change, each segment writes them in WRM mode and latches by update-all,
+ * 3 words in every segment. The other channels are set to VMID once by broadcast.
+ */
+void test8b(void)
+{
+    uint32_t err;
+
+    static ble_incomming_message_t msg = {
+        .c              = 2,
+        .freq           = 100,
+        .num_of_pulses  = 1,
+        .pulse_width    = 50,
+        .recycle_ratio  = 4,
+        .current        = { 0, 0, 10, -10, 0, 0, 0, 0 },
+    };
+
+    err = waveform_compile(&msg, &st_wave);
+    APP_ERROR_CHECK(err);
+
+    // gpio init ss pin
+    ss_pin_init();
+
+    static uint8_t pu[2] = { 0xD0, 0x00 };  // clear powerdown on all channels
+    static uint8_t wr[2] = { 0x80, 0x00 };  // set wrm mode
+    static uint8_t mid[2] = { 0xC8, 0x00 }; // all outputs VMID
+
+    // init sensor in blocking mode
+    err = nrf_drv_spi_init(&m_dac_spi, &m_dac_spi_config_noss, NULL, NULL);
+    APP_ERROR_CHECK(err);
+
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+    nrf_drv_spi_transfer(&m_dac_spi, pu, 2, NULL, 0);
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+    nrf_drv_spi_transfer(&m_dac_spi, wr, 2, NULL, 0);
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+    nrf_drv_spi_transfer(&m_dac_spi, mid, 2, NULL, 0);
+    nrfx_gpiote_out_task_trigger(DAC_SPI_SS_PIN);
+
+    nrf_drv_spi_uninit(&m_dac_spi);
+
+    // spi reinit (non-blocking mode)
+    err = nrf_drv_spi_init(&m_dac_spi, &m_dac_spi_config_noss, NULL, NULL);
+    APP_ERROR_CHECK(err);
+
+    // cycle timer init
+    nrf_drv_timer_config_t cycle_cfg = NRF_DRV_TIMER_DEFAULT_CONFIG;
+    err = nrf_drv_timer_init(&m_seg_timer, &cycle_cfg, test8b_cycle_timer_callback);
+    APP_ERROR_CHECK(err);
+
+    nrf_drv_timer_compare(&m_seg_timer,
+                          NRF_TIMER_CC_CHANNEL0,
+                          st_wave.seg_time[0],
+                          true);
+
+    nrf_drv_timer_compare(&m_seg_timer,
+                          NRF_TIMER_CC_CHANNEL1,
+                          waveform_last_burst_end(&st_wave),
+                          true);
+
+    nrf_drv_timer_extended_compare(&m_seg_timer,
+                                   NRF_TIMER_CC_CHANNEL2,
+                                   st_wave.cycle_time,
+                                   NRF_TIMER_SHORT_COMPARE2_CLEAR_MASK,
+                                   false);
+
+    // enable timer in stopped state
+    spi_timer_init(NULL);
+    nrf_drv_timer_enable(&m_spi_timer);
+    nrf_drv_timer_pause(&m_spi_timer);
+    nrf_drv_timer_clear(&m_spi_timer);
+    spi_timer_compare2(1, 7);
+
+    // never stopped
+    count_timer_init(NULL);
+    nrf_drv_timer_enable(&m_seg_counter);
+    count_timer_compare(st_wave.seg_words[0]);
+
+    spi_timer_c0_trigger_spi_task();
+    spi_timer_c1_trigger_ss_and_count();
+    count_timer_c0_stop_spi_timer();
+    spi_end_trigger_ss_and_clear_spi_timer();
+    cycle_timer_c0_trigger_spi_timer();
+
+    test8b_spi_xfer();
+    nrf_drv_timer_enable(&m_seg_timer);
+}
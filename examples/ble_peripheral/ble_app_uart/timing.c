@@ -15,8 +15,12 @@ void ss_pin_init(void)
 {
     uint32_t err;
 
-    err = nrfx_gpiote_init();
-    APP_ERROR_CHECK(err);
+    // may be initialized by idt already
+    if (!nrfx_gpiote_is_init())
+    {
+        err = nrfx_gpiote_init();
+        APP_ERROR_CHECK(err);
+    }
 
     nrfx_gpiote_out_config_t ss_pin_config = NRFX_GPIOTE_CONFIG_OUT_TASK_TOGGLE(true); // task pin, initial high
     err = nrfx_gpiote_out_init(DAC_SPI_SS_PIN, &ss_pin_config);
@@ -46,7 +50,7 @@ void spi_timer_compare2(uint32_t c0_val, uint32_t c1_val)
     // spi timer channel 1 compare 7/16 micro seconds
     nrf_drv_timer_compare(&m_spi_timer,
                           NRF_TIMER_CC_CHANNEL1,
-                          c0_val, // 100,
+                          c1_val, // 100,
                           false);
 }
 
@@ -150,6 +154,22 @@ void count_timer_init(nrfx_timer_event_handler_t cb)
     APP_ERROR_CHECK(err);    
 }
 
+void cycle_counter_init(nrfx_timer_event_handler_t cb)
+{
+    uint32_t err;
+
+    nrf_drv_timer_config_t count_cfg =
+    {
+        .frequency          = (nrf_timer_frequency_t)NRF_TIMER_FREQ_16MHz,
+        .bit_width          = (nrf_timer_bit_width_t)NRF_TIMER_BIT_WIDTH_32,
+        .mode               = (nrf_timer_mode_t)1,
+        .interrupt_priority = NRFX_TIMER_DEFAULT_CONFIG_IRQ_PRIORITY,
+    };
+
+    err = nrf_drv_timer_init(&m_cyc_counter, &count_cfg, cb);
+    APP_ERROR_CHECK(err);
+}
+
 void count_timer_compare(uint32_t c0_val)
 {
     // count timer counts up to 9 and stop
@@ -160,254 +180,323 @@ void count_timer_compare(uint32_t c0_val)
                                    true);    
 }
 
-void spi_timer_c0_trigger_spi_task(void)
+static uint32_t timer_task_addr(nrf_drv_timer_t const * p_timer, uint8_t t)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
-    
-    event_addr = nrfx_timer_compare_event_address_get(&m_spi_timer, NRF_TIMER_CC_CHANNEL0);
-    task_addr = nrf_drv_spi_start_task_get(&m_dac_spi);
-    
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
-    
-    err = nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);    
+    switch (t)
+    {
+        case TIMING_TIMER_START:
+            return nrfx_timer_task_address_get(p_timer, NRF_TIMER_TASK_START);
+        case TIMING_TIMER_STOP:
+            return nrfx_timer_task_address_get(p_timer, NRF_TIMER_TASK_STOP);
+        case TIMING_TIMER_COUNT:
+            return nrfx_timer_task_address_get(p_timer, NRF_TIMER_TASK_COUNT);
+        case TIMING_TIMER_CLEAR:
+            return nrfx_timer_task_address_get(p_timer, NRF_TIMER_TASK_CLEAR);
+        default:
+            break;
+    }
+
+    if (t >= TIMING_TIMER_CAPTURE(0) && t < TIMING_TIMER_CAPTURE(p_timer->cc_channel_count))
+    {
+        return nrfx_timer_capture_task_address_get(p_timer, t - TIMING_TIMER_CAPTURE(0));
+    }
+
+    return 0;
 }
 
-void spi_timer_c0_trigger_spi_task_and_count(void)
+static uint32_t timer_event_addr(nrf_drv_timer_t const * p_timer, uint8_t cc)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
-    
-    event_addr = nrfx_timer_compare_event_address_get(&m_spi_timer, NRF_TIMER_CC_CHANNEL0);
-    task_addr = nrf_drv_spi_start_task_get(&m_dac_spi);
-    
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
-    
-    task_addr = nrfx_timer_task_address_get(&m_seg_counter, NRF_TIMER_TASK_COUNT);
-    err = nrfx_ppi_channel_fork_assign(ppi, task_addr);
-    APP_ERROR_CHECK(err);    
-    
-    err = nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);    
+    if (cc >= p_timer->cc_channel_count)
+    {
+        return 0;
+    }
+
+    return nrfx_timer_compare_event_address_get(p_timer, cc);
 }
 
-void spi_timer_c1_trigger_ss_and_count(void)
+/*
+ * resolve end point to event or task register address, 0 if unknown.
+ */
+static uint32_t ep_addr(timing_ep_t ep)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
+    uint8_t idx = ep & 0x0F;
 
-    event_addr = nrfx_timer_compare_event_address_get(&m_spi_timer, NRF_TIMER_CC_CHANNEL1);
-    task_addr = nrfx_gpiote_out_task_addr_get(DAC_SPI_SS_PIN);
-
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
-    
-    task_addr = nrfx_timer_task_address_get(&m_seg_counter, NRF_TIMER_TASK_COUNT);
-    err = nrfx_ppi_channel_fork_assign(ppi, task_addr);
-    APP_ERROR_CHECK(err);
+    switch (ep & 0xF0)
+    {
+        case 0x10: return timer_event_addr(&m_spi_timer, idx);
+        case 0x20: return timer_event_addr(&m_seg_timer, idx);
+        case 0x30: return timer_event_addr(&m_seg_counter, idx);
+        case 0x40: return timer_event_addr(&m_cyc_counter, idx);
+        case 0x50: return (idx == 0) ? nrf_drv_spi_end_event_get(&m_dac_spi) : 0;
+        case 0x60: return (idx == 0) ? nrf_drv_spi_start_task_get(&m_dac_spi) : 0;
+        case 0x70: return (idx == 0) ? nrfx_gpiote_out_task_addr_get(DAC_SPI_SS_PIN) : 0;
+        case 0x80: return timer_task_addr(&m_spi_timer, idx);
+        case 0x90: return timer_task_addr(&m_seg_timer, idx);
+        case 0xA0: return timer_task_addr(&m_seg_counter, idx);
+        case 0xB0: return timer_task_addr(&m_cyc_counter, idx);
+        default:   return 0;
+    }
+}
 
-    err = nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);    
+/*
+ * events are coded below TIMING_TASK_SPI_START, tasks from it on.
+ */
+static bool ep_is_task(timing_ep_t ep)
+{
+    return ep >= TIMING_TASK_SPI_START;
 }
 
-void spi_timer_c1_trigger_ss(void)
+static bool link_valid(timing_link_t const * p_link)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
+    return !ep_is_task(p_link->event) && ep_addr(p_link->event) != 0 &&
+           ep_is_task(p_link->task) && ep_addr(p_link->task) != 0 &&
+           (p_link->fork == TIMING_EP_NONE || (ep_is_task(p_link->fork) && ep_addr(p_link->fork) != 0));
+}
 
-    event_addr = nrfx_timer_compare_event_address_get(&m_spi_timer, NRF_TIMER_CC_CHANNEL1);
-    task_addr = nrfx_gpiote_out_task_addr_get(DAC_SPI_SS_PIN);
+static void link_assign(nrf_ppi_channel_t ppi, timing_link_t const * p_link)
+{
+    uint32_t err;
 
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
+    err = nrfx_ppi_channel_assign(ppi, ep_addr(p_link->event), ep_addr(p_link->task));
     APP_ERROR_CHECK(err);
 
-    err = nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);       
+    // fork end point 0 clears fork left from previous topology
+    err = nrfx_ppi_channel_fork_assign(ppi, (p_link->fork == TIMING_EP_NONE) ? 0 : ep_addr(p_link->fork));
+    APP_ERROR_CHECK(err);
 }
 
-void spi_timer_c2_trigger_ss_and_count(void)
+/*
+ * allocate a channel, assign and enable. the channel is never freed.
+ * used by bring-up tests only.
+ */
+static void link_connect(timing_link_t const * p_link)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
+    uint32_t err;
+    nrf_ppi_channel_t ppi;
+
     err = nrfx_ppi_channel_alloc(&ppi);
     APP_ERROR_CHECK(err);
 
-    event_addr = nrfx_timer_compare_event_address_get(&m_spi_timer, NRF_TIMER_CC_CHANNEL2);
-    task_addr = nrfx_gpiote_out_task_addr_get(DAC_SPI_SS_PIN);
-
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
-    
-    task_addr = nrfx_timer_task_address_get(&m_seg_counter, NRF_TIMER_TASK_COUNT);
-    err = nrfx_ppi_channel_fork_assign(ppi, task_addr);
-    APP_ERROR_CHECK(err);
+    link_assign(ppi, p_link);
 
     err = nrfx_ppi_channel_enable(ppi);
     APP_ERROR_CHECK(err);
 }
 
-void spi_timer_c2_trigger_count()
+void spi_timer_c0_trigger_spi_task(void)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
-
-    event_addr = nrfx_timer_compare_event_address_get(&m_spi_timer, NRF_TIMER_CC_CHANNEL2);
-    task_addr = nrfx_timer_task_address_get(&m_seg_counter, NRF_TIMER_TASK_COUNT);
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_TIMER(0), TIMING_TASK_SPI_START, TIMING_EP_NONE
+    };
+    link_connect(&link);
+}
 
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
+void spi_timer_c0_trigger_spi_task_and_count(void)
+{
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_TIMER(0), TIMING_TASK_SPI_START, TIMING_TASK_SEG_COUNTER(TIMING_TIMER_COUNT)
+    };
+    link_connect(&link);
+}
 
-    err = nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);    
+void spi_timer_c1_trigger_ss_and_count(void)
+{
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_TIMER(1), TIMING_TASK_SS_TOGGLE, TIMING_TASK_SEG_COUNTER(TIMING_TIMER_COUNT)
+    };
+    link_connect(&link);
 }
 
-void spi_timer_c3_trigger_ss()
+void spi_timer_c1_trigger_ss(void)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_TIMER(1), TIMING_TASK_SS_TOGGLE, TIMING_EP_NONE
+    };
+    link_connect(&link);
+}
 
-    event_addr = nrfx_timer_compare_event_address_get(&m_spi_timer, NRF_TIMER_CC_CHANNEL3);
-    task_addr = nrfx_gpiote_out_task_addr_get(DAC_SPI_SS_PIN);
+void spi_timer_c2_trigger_ss_and_count(void)
+{
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_TIMER(2), TIMING_TASK_SS_TOGGLE, TIMING_TASK_SEG_COUNTER(TIMING_TIMER_COUNT)
+    };
+    link_connect(&link);
+}
 
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
+void spi_timer_c2_trigger_count(void)
+{
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_TIMER(2), TIMING_TASK_SEG_COUNTER(TIMING_TIMER_COUNT), TIMING_EP_NONE
+    };
+    link_connect(&link);
+}
 
-    err = nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);    
+void spi_timer_c3_trigger_ss(void)
+{
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_TIMER(3), TIMING_TASK_SS_TOGGLE, TIMING_EP_NONE
+    };
+    link_connect(&link);
 }
 
 void count_timer_c0_stop_spi_timer(void)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
-    
-    event_addr = nrfx_timer_compare_event_address_get(&m_seg_counter, NRF_TIMER_CC_CHANNEL0);
-    task_addr = nrfx_timer_task_address_get(&m_spi_timer, NRF_TIMER_TASK_STOP);
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
-
-    err =nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);    
+    static timing_link_t const link = {
+        TIMING_EVT_SEG_COUNTER(0), TIMING_TASK_SPI_TIMER(TIMING_TIMER_STOP), TIMING_EP_NONE
+    };
+    link_connect(&link);
 }
 
 void count_timer_c0_stop_and_clear_spi_timer(void)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
-    
-    event_addr = nrfx_timer_compare_event_address_get(&m_seg_counter, NRF_TIMER_CC_CHANNEL0);
-    task_addr = nrfx_timer_task_address_get(&m_spi_timer, NRF_TIMER_TASK_STOP);
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
-    
-    task_addr = nrfx_timer_task_address_get(&m_spi_timer, NRF_TIMER_TASK_CLEAR);
-    err = nrfx_ppi_channel_fork_assign(ppi , task_addr);
-    APP_ERROR_CHECK(err);
-
-    err =nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);        
+    static timing_link_t const link = {
+        TIMING_EVT_SEG_COUNTER(0), TIMING_TASK_SPI_TIMER(TIMING_TIMER_STOP), TIMING_TASK_SPI_TIMER(TIMING_TIMER_CLEAR)
+    };
+    link_connect(&link);
 }
 
 void spi_end_trigger_ss(void)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
-    
-    event_addr = nrf_drv_spi_end_event_get(&m_dac_spi);
-    task_addr = nrfx_gpiote_out_task_addr_get(DAC_SPI_SS_PIN);
-
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
-    
-    err =nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);      
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_END, TIMING_TASK_SS_TOGGLE, TIMING_EP_NONE
+    };
+    link_connect(&link);
 }
 
 void spi_end_trigger_ss_and_clear_spi_timer(void)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
-    
-    event_addr = nrf_drv_spi_end_event_get(&m_dac_spi);
-    task_addr = nrfx_gpiote_out_task_addr_get(DAC_SPI_SS_PIN);
-
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
-    APP_ERROR_CHECK(err);
-    
-    task_addr = nrfx_timer_task_address_get(&m_spi_timer, NRF_TIMER_TASK_CLEAR);
-    err = nrfx_ppi_channel_fork_assign(ppi, task_addr);
-    APP_ERROR_CHECK(err);     
-    
-    err =nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);       
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_END, TIMING_TASK_SS_TOGGLE, TIMING_TASK_SPI_TIMER(TIMING_TIMER_CLEAR)
+    };
+    link_connect(&link);
 }
 
 void spi_end_count2(void)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
-    APP_ERROR_CHECK(err);
-    
-    event_addr = nrf_drv_spi_end_event_get(&m_dac_spi);
-    task_addr = nrfx_timer_task_address_get(&m_cyc_counter, NRF_TIMER_TASK_COUNT);
+    static timing_link_t const link = {
+        TIMING_EVT_SPI_END, TIMING_TASK_CYC_COUNTER(TIMING_TIMER_COUNT), TIMING_EP_NONE
+    };
+    link_connect(&link);
+}
+
+void cycle_timer_c0_trigger_spi_timer(void)
+{
+    static timing_link_t const link = {
+        TIMING_EVT_SEG_TIMER(0), TIMING_TASK_SPI_TIMER(TIMING_TIMER_START), TIMING_EP_NONE
+    };
+    link_connect(&link);
+}
+
+/**
+ * Declarative topology
+ */
+void timing_chain_release(timing_chain_t * p_chain)
+{
+    uint32_t err;
+
+    if (p_chain->has_group)
+    {
+        err = nrfx_ppi_group_disable(p_chain->group);
+        APP_ERROR_CHECK(err);
+        err = nrfx_ppi_group_free(p_chain->group);
+        APP_ERROR_CHECK(err);
+        p_chain->has_group = false;
+    }
+
+    while (p_chain->num_of_channels > 0)
+    {
+        err = nrfx_ppi_channel_free(p_chain->channels[--p_chain->num_of_channels]);
+        APP_ERROR_CHECK(err);
+    }
+
+    p_chain->num_of_links = 0;
+}
+
+ret_code_t timing_chain_apply(timing_chain_t * p_chain, timing_link_t const * p_links, uint8_t num_of_links)
+{
+    uint32_t err;
+    uint32_t mask = 0;
+
+    if (num_of_links > TIMING_MAX_LINKS)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    for (uint8_t i = 0; i < num_of_links; i++)
+    {
+        if (!link_valid(&p_links[i]))
+        {
+            return NRF_ERROR_INVALID_PARAM;
+        }
+    }
+
+    if (!p_chain->has_group)
+    {
+        err = nrfx_ppi_group_alloc(&p_chain->group);
+        if (err != NRFX_SUCCESS)
+        {
+            timing_chain_release(p_chain);
+            return err;
+        }
+        p_chain->has_group = true;
+    }
 
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
+    // stop the chain, channels stay allocated
+    err = nrfx_ppi_group_disable(p_chain->group);
     APP_ERROR_CHECK(err);
-        
-    err = nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);           
+    err = nrfx_ppi_group_clear(p_chain->group);
+    APP_ERROR_CHECK(err);
+
+    while (p_chain->num_of_channels > num_of_links)
+    {
+        err = nrfx_ppi_channel_free(p_chain->channels[--p_chain->num_of_channels]);
+        APP_ERROR_CHECK(err);
+    }
+
+    while (p_chain->num_of_channels < num_of_links)
+    {
+        err = nrfx_ppi_channel_alloc(&p_chain->channels[p_chain->num_of_channels]);
+        if (err != NRFX_SUCCESS)
+        {
+            timing_chain_release(p_chain);
+            return err;
+        }
+        p_chain->num_of_channels++;
+    }
+
+    for (uint8_t i = 0; i < num_of_links; i++)
+    {
+        link_assign(p_chain->channels[i], &p_links[i]);
+        mask |= nrfx_ppi_channel_to_mask(p_chain->channels[i]);
+    }
+
+    if (mask != 0)
+    {
+        err = nrfx_ppi_channels_include_in_group(mask, p_chain->group);
+        APP_ERROR_CHECK(err);
+    }
+
+    p_chain->num_of_links = num_of_links;
+
+    return NRF_SUCCESS;
 }
 
-void cycle_timer_c0_trigger_spi_timer(void)
+void timing_chain_enable(timing_chain_t const * p_chain)
 {
-    uint32_t err, event_addr, task_addr;
-    nrf_ppi_channel_t ppi;    
-    
-    err = nrfx_ppi_channel_alloc(&ppi);
+    uint32_t err;
+
+    if (!p_chain->has_group) return;
+
+    err = nrfx_ppi_group_enable(p_chain->group);
     APP_ERROR_CHECK(err);
-    
-    event_addr = nrfx_timer_compare_event_address_get(&m_seg_timer, NRF_TIMER_CC_CHANNEL0);
-    task_addr = nrfx_timer_task_address_get(&m_spi_timer, NRF_TIMER_TASK_START);
+}
+
+void timing_chain_disable(timing_chain_t const * p_chain)
+{
+    uint32_t err;
+
+    if (!p_chain->has_group) return;
 
-    err = nrfx_ppi_channel_assign(ppi, event_addr, task_addr);
+    err = nrfx_ppi_group_disable(p_chain->group);
     APP_ERROR_CHECK(err);
-    
-    err =nrfx_ppi_channel_enable(ppi);
-    APP_ERROR_CHECK(err);           
 }
@@ -6,6 +6,9 @@
 #include "app_util.h"
 #include "nrf_drv_spi.h"
 #include "nrf_drv_timer.h"
+#include "nrfx_ppi.h"
+#include "sdk_errors.h"
+#include "timing_link.h"
 
 extern nrf_drv_spi_t const m_dac_spi;
 extern nrf_drv_spi_config_t const m_dac_spi_config;
@@ -25,6 +28,8 @@ void spi_timer_init(nrfx_timer_event_handler_t cb);
 void count_timer_init(nrfx_timer_event_handler_t cb);
 void count_timer_compare(uint32_t c0_val);
 
+void cycle_counter_init(nrfx_timer_event_handler_t cb);
+
 void spi_timer_compare2(uint32_t c0_val, uint32_t c1_val);
 void spi_timer_compare3(uint32_t c0_val, uint32_t c1_val, uint32_t c2_val);
 void spi_timer_compare4(uint32_t c0_val, uint32_t c1_val, uint32_t c2_val, uint32_t c3_val);
@@ -43,5 +48,34 @@ void count_timer_c0_stop_and_clear_spi_timer(void);
 void spi_end_trigger_ss(void);
 void spi_end_trigger_ss_and_clear_spi_timer(void);
 void cycle_timer_c0_trigger_spi_timer(void);
+void spi_end_count2(void);
+
+// ppi channels running a link table, zero initialize before first use
+typedef struct timing_chain
+{
+    nrf_ppi_channel_t       channels[TIMING_MAX_LINKS];
+    nrf_ppi_channel_group_t group;
+    uint8_t                 num_of_channels;    // allocated
+    uint8_t                 num_of_links;       // assigned
+    bool                    has_group;
+} timing_chain_t;
+
+/**
+ * disable p_chain and rewire it to p_links. the chain is left disabled.
+ *
+ * returns NRF_ERROR_INVALID_PARAM if a link has an unknown end point or
+ * too many links are given, in which case p_chain is untouched.
+ * if ppi runs out of channels or groups, everything held by p_chain is
+ * released and the error from nrfx_ppi is returned.
+ */
+ret_code_t timing_chain_apply(timing_chain_t * p_chain, timing_link_t const * p_links, uint8_t num_of_links);
+
+void timing_chain_enable(timing_chain_t const * p_chain);
+void timing_chain_disable(timing_chain_t const * p_chain);
+
+/**
+ * free all ppi channels and the group held by p_chain.
+ */
+void timing_chain_release(timing_chain_t * p_chain);
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef __TIMING_LINK_H__
+#define __TIMING_LINK_H__
+
+#include <stdint.h>
+
+/**
+ * Declarative ppi topology
+ *
+ * A chain is described as a table of event -> task (+ fork) links between
+ * the stimulation peripherals. timing_chain_apply resolves end points to
+ * register addresses, (re)uses ppi channels held by the chain and puts them
+ * in one channel group, so the whole chain is switched on and off atomically
+ * by timing_chain_enable/disable. Applying another table to the same chain
+ * reuses the channels, no more than TIMING_MAX_LINKS are ever held.
+ *
+ * end points are encoded as (peripheral << 4) | index.
+ *
+ * This file uses nothing but stdint.h, a link table is also run by the host
+ * simulator in sim/.
+ */
+typedef uint8_t timing_ep_t;
+
+#define TIMING_EP_NONE                      0x00
+
+// events, index is cc channel
+#define TIMING_EVT_SPI_TIMER(cc)            ((timing_ep_t)(0x10 | (cc)))
+#define TIMING_EVT_SEG_TIMER(cc)            ((timing_ep_t)(0x20 | (cc)))
+#define TIMING_EVT_SEG_COUNTER(cc)          ((timing_ep_t)(0x30 | (cc)))
+#define TIMING_EVT_CYC_COUNTER(cc)          ((timing_ep_t)(0x40 | (cc)))
+#define TIMING_EVT_SPI_END                  ((timing_ep_t)(0x50))
+
+// tasks, timer index is one of TIMING_TIMER_xxx
+#define TIMING_TASK_SPI_START               ((timing_ep_t)(0x60))
+#define TIMING_TASK_SS_TOGGLE               ((timing_ep_t)(0x70))
+#define TIMING_TASK_SPI_TIMER(t)            ((timing_ep_t)(0x80 | (t)))
+#define TIMING_TASK_SEG_TIMER(t)            ((timing_ep_t)(0x90 | (t)))
+#define TIMING_TASK_SEG_COUNTER(t)          ((timing_ep_t)(0xA0 | (t)))
+#define TIMING_TASK_CYC_COUNTER(t)          ((timing_ep_t)(0xB0 | (t)))
+
+#define TIMING_TIMER_START                  0
+#define TIMING_TIMER_STOP                   1
+#define TIMING_TIMER_COUNT                  2
+#define TIMING_TIMER_CLEAR                  3
+#define TIMING_TIMER_CAPTURE(cc)            (8 + (cc))
+
+#define TIMING_MAX_LINKS                    16
+
+typedef struct timing_link
+{
+    timing_ep_t event;
+    timing_ep_t task;
+    timing_ep_t fork;                       // TIMING_EP_NONE if not forked
+} timing_link_t;
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * crcbench, checks crc32_compute and crc16_compute of the selected
+ * implementations against bitwise references and times them on a host
+ *
+ * the standard check values, every length 0..CRCBENCH_MAX_LEN at every
+ * alignment 0..7, and random buffers fed in random chunks (the p_crc
+ * chaining) are compared. exits non zero if any result differs.
+ *
+ * usage: crcbench [megabytes to time, default 16]
+ *
+ * build as described in sim/README, once per implementation
+ * (CRC32_IMPL_x / CRC16_IMPL_x values):
+ * gcc -O2 -std=gnu99 -DNRF52832_XXAA -DCRC32_ENABLED=1 -DCRC16_ENABLED=1 \
+ *     -DCRC32_CONFIG_IMPL=4 -DCRC16_CONFIG_IMPL=2 $INC \
+ *     tools/crcbench.c ../../../components/libraries/crc32/crc32.c \
+ *     ../../../components/libraries/crc16/crc16.c -o crcbench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32.h"
+#include "crc16.h"
+
+#define CRCBENCH_MAX_LEN                    300
+#define CRCBENCH_CHAINED_RUNS               2000
+#define CRCBENCH_BUF_LEN                    4096
+
+static uint8_t m_buf[CRCBENCH_BUF_LEN + 8];
+static bool m_failed;
+
+static uint32_t ref_crc32(uint8_t const * p_data, uint32_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        crc ^= p_data[i];
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320U : (crc >> 1);
+        }
+    }
+    return ~crc;
+}
+
+static uint16_t ref_crc16(uint8_t const * p_data, uint32_t size)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        crc ^= (uint16_t)(p_data[i] << 8);
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void check(bool ok, char const * p_what, uint32_t len, uint32_t align)
+{
+    if (!ok)
+    {
+        if (!m_failed)
+        {
+            printf("FAIL %s len %u align %u\n", p_what, len, align);
+        }
+        m_failed = true;
+    }
+}
+
+static void lengths_check(void)
+{
+    for (uint32_t align = 0; align < 8; align++)
+    {
+        for (uint32_t len = 0; len <= CRCBENCH_MAX_LEN; len++)
+        {
+            uint8_t const * p = &m_buf[align];
+
+            check(crc32_compute(p, len, NULL) == ref_crc32(p, len), "crc32", len, align);
+            check(crc16_compute(p, len, NULL) == ref_crc16(p, len), "crc16", len, align);
+        }
+    }
+}
+
+static void chained_check(void)
+{
+    for (int run = 0; run < CRCBENCH_CHAINED_RUNS; run++)
+    {
+        uint32_t len    = (uint32_t)rand() % CRCBENCH_BUF_LEN;
+        uint32_t align  = (uint32_t)rand() % 8;
+        uint32_t done   = 0;
+        uint32_t crc32  = 0;
+        uint16_t crc16  = 0;
+
+        while (done < len)
+        {
+            uint32_t chunk = 1 + (uint32_t)rand() % (len - done);
+
+            crc32 = crc32_compute(&m_buf[align + done], chunk, (done == 0) ? NULL : &crc32);
+            crc16 = crc16_compute(&m_buf[align + done], chunk, (done == 0) ? NULL : &crc16);
+            done += chunk;
+        }
+
+        if (len != 0)
+        {
+            check(crc32 == ref_crc32(&m_buf[align], len), "crc32 chained", len, align);
+            check(crc16 == ref_crc16(&m_buf[align], len), "crc16 chained", len, align);
+        }
+    }
+}
+
+static double seconds(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void bench(uint32_t megabytes)
+{
+    uint32_t rounds = megabytes * (1024 * 1024 / CRCBENCH_BUF_LEN);
+    volatile uint32_t sink = 0;
+    double   t;
+
+    t = seconds();
+    for (uint32_t i = 0; i < rounds; i++)
+    {
+        sink += crc32_compute(m_buf, CRCBENCH_BUF_LEN, NULL);
+    }
+    printf("crc32 impl %d: %.1f MB/s\n", CRC32_CONFIG_IMPL, megabytes / (seconds() - t));
+
+    t = seconds();
+    for (uint32_t i = 0; i < rounds; i++)
+    {
+        sink += crc16_compute(m_buf, CRCBENCH_BUF_LEN, NULL);
+    }
+    printf("crc16 impl %d: %.1f MB/s\n", CRC16_CONFIG_IMPL, megabytes / (seconds() - t));
+    (void)sink;
+}
+
+int main(int argc, char * argv[])
+{
+    uint8_t const check_str[] = "123456789";
+    uint32_t megabytes = (argc > 1) ? (uint32_t)atoi(argv[1]) : 16;
+
+    srand(1);
+    for (uint32_t i = 0; i < sizeof(m_buf); i++)
+    {
+        m_buf[i] = (uint8_t)rand();
+    }
+
+    // CRC-32 (ISO-HDLC) and CRC-16/CCITT-FALSE check values
+    check(crc32_compute(check_str, 9, NULL) == 0xCBF43926, "crc32 check value", 9, 0);
+    check(crc16_compute(check_str, 9, NULL) == 0x29B1, "crc16 check value", 9, 0);
+
+    lengths_check();
+    chained_check();
+
+    printf("%s\n", m_failed ? "results differ" : "results match");
+
+    if (megabytes > 0)
+    {
+        bench(megabytes);
+    }
+
+    return m_failed ? 1 : 0;
+}
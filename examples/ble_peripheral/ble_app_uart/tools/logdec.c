@@ -0,0 +1,550 @@
+/*
+ * logdec, host decoder for the binary log backend (nrf_log_backend_bin.h)
+ *
+ * reads records from a file or stdin, looks up format strings and module
+ * names in the ELF file the firmware was built to, formats on the host and
+ * prints lines the way nrf_log_str_formatter does.
+ *
+ * usage: logdec <elf> [stream]
+ *
+ * the stream is the raw content of the backend's RTT up channel, e.g.
+ * JLinkRTTLogger -Device NRF52832_XXAA -If SWD -Speed 4000 -RTTChannel 1 log.bin
+ * or piped from anything that reads the channel to stdout.
+ *
+ * build: gcc -std=gnu99 tools/logdec.c -o logdec
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// record format, as in nrf_log_backend_bin.h (which needs the sdk config)
+#define NRF_LOG_BIN_FLAG_MARK               0x80
+#define NRF_LOG_BIN_FLAG_MARK_MASK          0xC0
+#define NRF_LOG_BIN_FLAG_DROPPED            0x20
+#define NRF_LOG_BIN_FLAG_TIMESTAMP          0x10
+#define NRF_LOG_BIN_FLAG_HEXDUMP            0x08
+#define NRF_LOG_BIN_SEVERITY_MASK           0x07
+
+#define LOGDEC_MAX_SEGMENTS                 16
+#define LOGDEC_MAX_ARGS                     6       // NRF_LOG_MAX_NUM_OF_ARGS
+#define LOGDEC_STR_MAX                      256
+#define LOGDEC_LINE_MAX                     1024
+#define LOGDEC_HEXDUMP_BYTES_IN_LINE        8
+#define LOGDEC_SEVERITY_INFO_RAW            5
+
+typedef struct segment
+{
+    uint32_t        addr;
+    uint32_t        size;
+    uint8_t const * p_data;
+} segment_t;
+
+static uint8_t *    m_elf;
+static size_t       m_elf_size;
+static segment_t    m_segments[LOGDEC_MAX_SEGMENTS];
+static unsigned     m_segment_count;
+
+static char const * const m_severity_names[] = {
+    NULL,
+    "error",
+    "warning",
+    "info",
+    "debug",
+};
+
+static uint16_t get_u16(uint8_t const * p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(uint8_t const * p)
+{
+    return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+/*
+ * elf32 little endian, loadable program headers only. strings are const,
+ * they are where the image puts them (vaddr), not copied at startup.
+ */
+static bool elf_load(char const * p_path)
+{
+    FILE * p_file = fopen(p_path, "rb");
+    uint32_t phoff;
+    uint16_t phentsize, phnum;
+
+    if (p_file == NULL)
+    {
+        perror(p_path);
+        return false;
+    }
+
+    fseek(p_file, 0, SEEK_END);
+    m_elf_size = (size_t)ftell(p_file);
+    fseek(p_file, 0, SEEK_SET);
+
+    m_elf = malloc(m_elf_size);
+    if (m_elf == NULL || fread(m_elf, 1, m_elf_size, p_file) != m_elf_size)
+    {
+        fclose(p_file);
+        fprintf(stderr, "%s: read failed\n", p_path);
+        return false;
+    }
+    fclose(p_file);
+
+    // magic, ELFCLASS32, ELFDATA2LSB
+    if (m_elf_size < 52 || memcmp(m_elf, "\x7f" "ELF", 4) != 0 || m_elf[4] != 1 || m_elf[5] != 1)
+    {
+        fprintf(stderr, "%s: not a 32 bit little endian elf file\n", p_path);
+        return false;
+    }
+
+    phoff       = get_u32(&m_elf[28]);
+    phentsize   = get_u16(&m_elf[42]);
+    phnum       = get_u16(&m_elf[44]);
+
+    for (unsigned i = 0; i < phnum && m_segment_count < LOGDEC_MAX_SEGMENTS; i++)
+    {
+        uint8_t const * p_ph = &m_elf[phoff + i * phentsize];
+        uint32_t offset, filesz;
+
+        if (phoff + (i + 1) * phentsize > m_elf_size || get_u32(&p_ph[0]) != 1)    // PT_LOAD
+        {
+            continue;
+        }
+
+        offset = get_u32(&p_ph[4]);
+        filesz = get_u32(&p_ph[16]);
+        if (filesz == 0 || offset + filesz > m_elf_size)
+        {
+            continue;
+        }
+
+        m_segments[m_segment_count].addr    = get_u32(&p_ph[8]);
+        m_segments[m_segment_count].size    = filesz;
+        m_segments[m_segment_count].p_data  = &m_elf[offset];
+        m_segment_count++;
+    }
+
+    if (m_segment_count == 0)
+    {
+        fprintf(stderr, "%s: no loadable segments\n", p_path);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * string at a target address, NULL if it is not in the image or not
+ * terminated in it
+ */
+static char const * elf_str(uint32_t addr)
+{
+    for (unsigned i = 0; i < m_segment_count; i++)
+    {
+        segment_t const * p_seg = &m_segments[i];
+
+        if (addr >= p_seg->addr && addr - p_seg->addr < p_seg->size)
+        {
+            char const * p_str = (char const *)&p_seg->p_data[addr - p_seg->addr];
+
+            if (memchr(p_str, '\0', p_seg->size - (addr - p_seg->addr)) == NULL)
+            {
+                return NULL;
+            }
+            return p_str;
+        }
+    }
+
+    return NULL;
+}
+
+static bool addr_is_ram(uint32_t addr)
+{
+    return (addr & 0xE0000000) == 0x20000000;
+}
+
+/*
+ * stream reading, a record is only taken when all of it is there
+ */
+static bool read_bytes(FILE * p_in, uint8_t * p_buf, size_t len)
+{
+    return fread(p_buf, 1, len, p_in) == len;
+}
+
+static bool read_u32(FILE * p_in, uint32_t * p_value)
+{
+    uint8_t buf[4];
+
+    if (!read_bytes(p_in, buf, sizeof(buf)))
+    {
+        return false;
+    }
+    *p_value = get_u32(buf);
+    return true;
+}
+
+static bool read_str(FILE * p_in, char * p_buf, size_t size)
+{
+    size_t n = 0;
+    int c;
+
+    while ((c = fgetc(p_in)) != EOF)
+    {
+        if (n < size - 1)
+        {
+            p_buf[n++] = (char)c;
+        }
+        if (c == '\0')
+        {
+            p_buf[n] = '\0';
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * %s args the device found in ram were inlined after the args, in order.
+ * the format is walked the same way the backend does.
+ */
+static bool strs_read(FILE * p_in, char const * p_fmt, uint32_t const * p_args, uint32_t nargs,
+                      char (*p_strs)[LOGDEC_STR_MAX])
+{
+    uint32_t arg  = 0;
+    uint32_t nstr = 0;
+
+    while (*p_fmt != '\0' && arg < nargs)
+    {
+        if (*p_fmt++ != '%')
+        {
+            continue;
+        }
+
+        while (*p_fmt != '\0' && strchr("-+ #0123456789.*hlLqjzt", *p_fmt) != NULL)
+        {
+            if (*p_fmt == '*')
+            {
+                arg++;
+            }
+            p_fmt++;
+        }
+
+        if (*p_fmt == '\0')
+        {
+            break;
+        }
+
+        if (*p_fmt == 's' && arg < nargs && addr_is_ram(p_args[arg]))
+        {
+            if (!read_str(p_in, p_strs[nstr++], LOGDEC_STR_MAX))
+            {
+                return false;
+            }
+        }
+
+        if (*p_fmt != '%')
+        {
+            arg++;
+        }
+        p_fmt++;
+    }
+
+    return true;
+}
+
+/*
+ * printf of target format with 32 bit target args. length modifiers are
+ * dropped (args are 32 bit on the target), %s args are taken from the image
+ * or, for ram strings, from the ones inlined in the record.
+ */
+static void format(char * p_out, size_t size, char const * p_fmt,
+                   uint32_t const * p_args, uint32_t nargs,
+                   char (*p_strs)[LOGDEC_STR_MAX])
+{
+    size_t   len = 0;
+    uint32_t arg = 0;
+    uint32_t str = 0;
+
+    while (*p_fmt != '\0' && len < size - 1)
+    {
+        char    spec[32];
+        size_t  spec_len = 0;
+        int     star[2];
+        int     stars = 0;
+        int     n;
+
+        if (*p_fmt != '%')
+        {
+            p_out[len++] = *p_fmt++;
+            continue;
+        }
+
+        spec[spec_len++] = *p_fmt++;
+        while (*p_fmt != '\0' && strchr("-+ #0123456789.*hlLqjzt", *p_fmt) != NULL)
+        {
+            if (*p_fmt == '*')
+            {
+                if (stars < 2)
+                {
+                    star[stars++] = (arg < nargs) ? (int)p_args[arg] : 0;
+                }
+                arg++;
+            }
+            if (strchr("hlLqjzt", *p_fmt) == NULL && spec_len < sizeof(spec) - 2)
+            {
+                spec[spec_len++] = *p_fmt;
+            }
+            p_fmt++;
+        }
+
+        if (*p_fmt == '\0')
+        {
+            break;
+        }
+
+        spec[spec_len++] = *p_fmt;
+        spec[spec_len] = '\0';
+
+        if (*p_fmt == '%')
+        {
+            p_out[len++] = '%';
+            p_fmt++;
+            continue;
+        }
+
+        uint32_t value = (arg < nargs) ? p_args[arg] : 0;
+        char const * p_str = NULL;
+
+        switch (*p_fmt)
+        {
+            case 's':
+                if (addr_is_ram(value))
+                {
+                    p_str = (str < nargs) ? p_strs[str++] : "";
+                }
+                else
+                {
+                    p_str = elf_str(value);
+                    if (p_str == NULL)
+                    {
+                        p_str = "(?)";
+                    }
+                }
+                break;
+
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                break;
+
+            case 'p':
+                // host %p is 64 bit and implementation defined
+                strcpy(&spec[spec_len - 1], "#x");
+                break;
+
+            default:
+                // float etc, nrf_log does not pass them
+                strcpy(spec, "%s");
+                p_str = "(?)";
+                break;
+        }
+        p_fmt++;
+        arg++;
+
+        if (p_str != NULL)
+        {
+            n = (stars == 2) ? snprintf(&p_out[len], size - len, spec, star[0], star[1], p_str)
+              : (stars == 1) ? snprintf(&p_out[len], size - len, spec, star[0], p_str)
+              :                snprintf(&p_out[len], size - len, spec, p_str);
+        }
+        else if (strchr("di", spec[spec_len - 1]) != NULL)
+        {
+            n = (stars == 2) ? snprintf(&p_out[len], size - len, spec, star[0], star[1], (int32_t)value)
+              : (stars == 1) ? snprintf(&p_out[len], size - len, spec, star[0], (int32_t)value)
+              :                snprintf(&p_out[len], size - len, spec, (int32_t)value);
+        }
+        else
+        {
+            n = (stars == 2) ? snprintf(&p_out[len], size - len, spec, star[0], star[1], value)
+              : (stars == 1) ? snprintf(&p_out[len], size - len, spec, star[0], value)
+              :                snprintf(&p_out[len], size - len, spec, value);
+        }
+
+        if (n > 0)
+        {
+            len += ((size_t)n < size - len) ? (size_t)n : size - len - 1;
+        }
+    }
+
+    p_out[len] = '\0';
+}
+
+static void prefix_print(uint8_t severity, char const * p_module, bool timestamp, uint32_t ts)
+{
+    if (severity == LOGDEC_SEVERITY_INFO_RAW)
+    {
+        return;
+    }
+
+    if (timestamp)
+    {
+        printf("[%08lu] ", (unsigned long)ts);
+    }
+
+    printf("<%s> %s: ", m_severity_names[severity], p_module);
+}
+
+/*
+ * one record, false at end of stream. a byte that does not start a record
+ * is skipped (joined the stream in the middle of one).
+ */
+static bool record_decode(FILE * p_in)
+{
+    int          c;
+    uint8_t      flags, length, severity;
+    uint32_t     module_addr, ts = 0;
+    uint8_t      buf[4];
+    char const * p_module;
+    unsigned     skipped = 0;
+
+    while ((c = fgetc(p_in)) != EOF)
+    {
+        flags    = (uint8_t)c;
+        severity = flags & NRF_LOG_BIN_SEVERITY_MASK;
+        if ((flags & NRF_LOG_BIN_FLAG_MARK_MASK) == NRF_LOG_BIN_FLAG_MARK &&
+            severity >= 1 && severity <= LOGDEC_SEVERITY_INFO_RAW)
+        {
+            break;
+        }
+        skipped++;
+    }
+
+    if (skipped != 0)
+    {
+        fprintf(stderr, "logdec: skipped %u bytes\n", skipped);
+    }
+
+    if (c == EOF || (c = fgetc(p_in)) == EOF || !read_u32(p_in, &module_addr))
+    {
+        return false;
+    }
+    length = (uint8_t)c;
+
+    if (flags & NRF_LOG_BIN_FLAG_TIMESTAMP)
+    {
+        if (!read_u32(p_in, &ts)) return false;
+    }
+
+    if (flags & NRF_LOG_BIN_FLAG_DROPPED)
+    {
+        if (!read_bytes(p_in, buf, 2)) return false;
+        printf("Logs dropped (%u)\n", get_u16(buf));
+    }
+
+    p_module = elf_str(module_addr);
+    if (p_module == NULL)
+    {
+        p_module = "?";
+    }
+
+    if (flags & NRF_LOG_BIN_FLAG_HEXDUMP)
+    {
+        uint8_t data[255];
+
+        if (!read_bytes(p_in, data, length))
+        {
+            return false;
+        }
+
+        for (unsigned i = 0; i < length; i += LOGDEC_HEXDUMP_BYTES_IN_LINE)
+        {
+            prefix_print(severity, p_module, flags & NRF_LOG_BIN_FLAG_TIMESTAMP, ts);
+            for (unsigned j = 0; j < LOGDEC_HEXDUMP_BYTES_IN_LINE; j++)
+            {
+                if (i + j < length) printf(" %02x", data[i + j]);
+                else                printf("   ");
+            }
+            printf("|");
+            for (unsigned j = 0; j < LOGDEC_HEXDUMP_BYTES_IN_LINE && i + j < length; j++)
+            {
+                printf("%c", (data[i + j] >= 0x20 && data[i + j] <= 0x7E) ? data[i + j] : '.');
+            }
+            printf("\n");
+        }
+    }
+    else
+    {
+        uint32_t     fmt_addr;
+        uint32_t     args[LOGDEC_MAX_ARGS] = { 0 };
+        char         strs[LOGDEC_MAX_ARGS][LOGDEC_STR_MAX];
+        char         line[LOGDEC_LINE_MAX];
+        char const * p_fmt;
+
+        if (length > LOGDEC_MAX_ARGS)
+        {
+            fprintf(stderr, "logdec: %u args, resyncing\n", length);
+            return true;
+        }
+
+        if (!read_u32(p_in, &fmt_addr)) return false;
+        for (unsigned i = 0; i < length; i++)
+        {
+            if (!read_u32(p_in, &args[i])) return false;
+        }
+
+        p_fmt = elf_str(fmt_addr);
+        if (p_fmt == NULL)
+        {
+            // no way to know how many strings follow, skip to the next mark
+            fprintf(stderr, "logdec: format 0x%08lx not in elf\n", (unsigned long)fmt_addr);
+            return true;
+        }
+
+        if (!strs_read(p_in, p_fmt, args, length, strs))
+        {
+            return false;
+        }
+
+        format(line, sizeof(line), p_fmt, args, length, strs);
+
+        prefix_print(severity, p_module, flags & NRF_LOG_BIN_FLAG_TIMESTAMP, ts);
+        printf("%s%s", line, (severity == LOGDEC_SEVERITY_INFO_RAW) ? "" : "\n");
+    }
+
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char * argv[])
+{
+    FILE * p_in = stdin;
+
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: %s <elf> [stream]\n", argv[0]);
+        return 2;
+    }
+
+    if (!elf_load(argv[1]))
+    {
+        return 1;
+    }
+
+    if (argc == 3)
+    {
+        p_in = fopen(argv[2], "rb");
+        if (p_in == NULL)
+        {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+
+    while (record_decode(p_in))
+    {
+    }
+
+    return 0;
+}
@@ -0,0 +1,735 @@
+/*
+ * scanbench, matches advertising reports against the nrf_ble_scan filters on
+ * a host, once through the field index and filter hash tables of nrf_ble_scan
+ * and once with a ble_advdata search per filter, as nrf_ble_scan did before
+ *
+ * the reports come from a capture, one per line as the peer address and the
+ * advertising data in hex, the address in the byte order of ble_gap_addr_t:
+ *     563412efcdab 0201061aff4c000215...
+ * without a capture they are made up the way a crowded room advertises:
+ * iBeacons, Eddystone, Fast Pair and tracker service data, HID devices with
+ * their appearance, NUS devices with a name and the 128-bit NUS UUID, random
+ * manufacturer data and random, partly malformed, AD fields.
+ *
+ * each type of filter is set on its own and all of them together, with 1, 4
+ * and 16 filters of each type, in the normal and in the all filters mode. the
+ * event of nrf_ble_scan and the filters it says matched must be the same as
+ * the search gives, exits non zero if they aren't. prints the cost per report
+ * of both.
+ *
+ * usage: scanbench [rounds, default 100] [capture file]
+ *
+ * build as described in sim/README:
+ * gcc -O2 -std=gnu99 -DNRF52832_XXAA -DSVCALL_AS_NORMAL_FUNCTION -DNRF_LOG_ENABLED=0 \
+ *     $INC -I../../../components/ble/nrf_ble_scan tools/scanbench.c \
+ *     ../../../components/ble/common/ble_advdata.c -o scanbench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* nrf_ble_scan is not in the sdk_config of this app, the filters are sized here */
+#define NRF_BLE_SCAN_ENABLED                    1
+#define NRF_BLE_SCAN_FILTER_ENABLE              1
+#define NRF_BLE_SCAN_BUFFER                     31
+#define NRF_BLE_SCAN_NAME_MAX_LEN               32
+#define NRF_BLE_SCAN_SHORT_NAME_MAX_LEN         32
+#define NRF_BLE_SCAN_SCAN_INTERVAL              160
+#define NRF_BLE_SCAN_SCAN_DURATION              0
+#define NRF_BLE_SCAN_SCAN_WINDOW                80
+#define NRF_BLE_SCAN_MIN_CONNECTION_INTERVAL    7.5
+#define NRF_BLE_SCAN_MAX_CONNECTION_INTERVAL    30
+#define NRF_BLE_SCAN_SLAVE_LATENCY              0
+#define NRF_BLE_SCAN_SUPERVISION_TIMEOUT        4000
+#define NRF_BLE_SCAN_SCAN_PHY                   1
+#define NRF_BLE_SCAN_NAME_CNT                   16
+#define NRF_BLE_SCAN_SHORT_NAME_CNT             16
+#define NRF_BLE_SCAN_ADDRESS_CNT                16
+#define NRF_BLE_SCAN_UUID_CNT                   16
+#define NRF_BLE_SCAN_APPEARANCE_CNT             16
+
+#include "../../../../components/ble/nrf_ble_scan/nrf_ble_scan.c"
+
+#define SCANBENCH_MAX_REPORTS                   4096
+#define SCANBENCH_REPORTS                       2000    // made up when there is no capture
+#define SCANBENCH_MAX_FILTERS                   16
+
+typedef struct
+{
+    ble_gap_addr_t addr;
+    uint8_t        data[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+    uint16_t       len;
+} bench_report_t;
+
+/* what a report matched: the event and the filters */
+typedef struct
+{
+    nrf_ble_scan_evt_t        evt;
+    nrf_ble_scan_filter_match match;
+} bench_result_t;
+
+static bench_report_t m_reports[SCANBENCH_MAX_REPORTS];
+static uint32_t       m_report_cnt;
+static nrf_ble_scan_t m_scan;
+static bench_result_t m_result;
+static bool           m_failed;
+
+/* NUS base, bytes 12 and 13 are the 16-bit UUID */
+static uint8_t const m_nus_base[16] =
+{
+    0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0,
+    0x93, 0xF3, 0xA3, 0xB5, 0x00, 0x00, 0x40, 0x6E
+};
+
+/*
+ * the SoftDevice calls made by nrf_ble_scan and ble_advdata. one vendor
+ * specific base is known, the NUS one, any other vendor UUID can't be encoded.
+ */
+uint32_t sd_ble_uuid_encode(ble_uuid_t const * p_uuid, uint8_t * p_uuid_le_len, uint8_t * p_uuid_le)
+{
+    if (p_uuid->type == BLE_UUID_TYPE_BLE)
+    {
+        *p_uuid_le_len = 2;
+        if (p_uuid_le != NULL)
+        {
+            uint16_encode(p_uuid->uuid, p_uuid_le);
+        }
+        return NRF_SUCCESS;
+    }
+    if (p_uuid->type == BLE_UUID_TYPE_VENDOR_BEGIN)
+    {
+        *p_uuid_le_len = 16;
+        if (p_uuid_le != NULL)
+        {
+            memcpy(p_uuid_le, m_nus_base, sizeof(m_nus_base));
+            uint16_encode(p_uuid->uuid, &p_uuid_le[12]);
+        }
+        return NRF_SUCCESS;
+    }
+    return NRF_ERROR_NOT_FOUND;
+}
+
+uint32_t sd_ble_gap_scan_start(ble_gap_scan_params_t const * p_scan_params,
+                               ble_data_t const * p_adv_report_buffer)
+{
+    (void)p_scan_params;
+    (void)p_adv_report_buffer;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_scan_stop(void)
+{
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_connect(ble_gap_addr_t const * p_peer_addr,
+                            ble_gap_scan_params_t const * p_scan_params,
+                            ble_gap_conn_params_t const * p_conn_params, uint8_t conn_cfg_tag)
+{
+    (void)p_peer_addr;
+    (void)p_scan_params;
+    (void)p_conn_params;
+    (void)conn_cfg_tag;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_addr_get(ble_gap_addr_t * p_addr)
+{
+    memset(p_addr, 0, sizeof(ble_gap_addr_t));
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_device_name_get(uint8_t * p_dev_name, uint16_t * p_len)
+{
+    (void)p_dev_name;
+    *p_len = 0;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gap_appearance_get(uint16_t * p_appearance)
+{
+    *p_appearance = 0;
+    return NRF_SUCCESS;
+}
+
+void app_error_handler_bare(ret_code_t error_code)
+{
+    printf("error 0x%x\n", (unsigned)error_code);
+    exit(2);
+}
+
+static void scan_evt_handler(scan_evt_t const * p_scan_evt)
+{
+    m_result.evt   = p_scan_evt->scan_evt_id;
+    m_result.match = p_scan_evt->params.filter_match.filter_match;
+}
+
+/*
+ * the matching nrf_ble_scan did before the field index, every filter searches
+ * the advertising data with ble_advdata.
+ */
+static bool old_addr_compare(ble_gap_evt_adv_report_t const * p_adv_report)
+{
+    nrf_ble_scan_addr_filter_t const * p_filter = &m_scan.scan_filters.addr_filter;
+
+    for (uint8_t i = 0; i < p_filter->addr_cnt; i++)
+    {
+        if (memcmp(p_filter->target_addr[i].addr, p_adv_report->peer_addr.addr, BLE_GAP_ADDR_LEN) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool old_name_compare(ble_gap_evt_adv_report_t const * p_adv_report)
+{
+    nrf_ble_scan_name_filter_t const * p_filter = &m_scan.scan_filters.name_filter;
+
+    for (uint8_t i = 0; i < p_filter->name_cnt; i++)
+    {
+        if (ble_advdata_name_find(p_adv_report->data.p_data, p_adv_report->data.len,
+                                  p_filter->target_name[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool old_short_name_compare(ble_gap_evt_adv_report_t const * p_adv_report)
+{
+    nrf_ble_scan_short_name_filter_t const * p_filter = &m_scan.scan_filters.short_name_filter;
+
+    for (uint8_t i = 0; i < p_filter->name_cnt; i++)
+    {
+        if (ble_advdata_short_name_find(p_adv_report->data.p_data, p_adv_report->data.len,
+                                        p_filter->short_name[i].short_target_name,
+                                        p_filter->short_name[i].short_name_min_len))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool old_uuid_compare(ble_gap_evt_adv_report_t const * p_adv_report)
+{
+    nrf_ble_scan_uuid_filter_t const * p_filter = &m_scan.scan_filters.uuid_filter;
+    bool const                         all_mode = m_scan.scan_filters.all_filters_mode;
+    uint8_t                            matched  = 0;
+
+    for (uint8_t i = 0; i < p_filter->uuid_cnt; i++)
+    {
+        if (ble_advdata_uuid_find(p_adv_report->data.p_data, p_adv_report->data.len,
+                                  &p_filter->uuid[i]))
+        {
+            matched++;
+            if (!all_mode)
+            {
+                break;
+            }
+        }
+        else if (all_mode)
+        {
+            break;
+        }
+    }
+    return all_mode ? (matched == p_filter->uuid_cnt) : (matched > 0);
+}
+
+static bool old_appearance_compare(ble_gap_evt_adv_report_t const * p_adv_report)
+{
+    nrf_ble_scan_appearance_filter_t const * p_filter = &m_scan.scan_filters.appearance_filter;
+
+    for (uint8_t i = 0; i < p_filter->appearance_cnt; i++)
+    {
+        if (ble_advdata_appearance_find(p_adv_report->data.p_data, p_adv_report->data.len,
+                                        &p_filter->appearance[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void old_on_adv_report(ble_gap_evt_adv_report_t const * p_adv_report)
+{
+    nrf_ble_scan_filters_t const * p_filters = &m_scan.scan_filters;
+    scan_evt_t                     scan_evt;
+    uint8_t                        filter_cnt = 0;
+    uint8_t                        match_cnt  = 0;
+
+    memset(&scan_evt, 0, sizeof(scan_evt));
+
+    if (p_filters->addr_filter.addr_filter_enabled)
+    {
+        filter_cnt++;
+        if (old_addr_compare(p_adv_report))
+        {
+            match_cnt++;
+            scan_evt.params.filter_match.filter_match.address_filter_match = true;
+        }
+    }
+    if (p_filters->name_filter.name_filter_enabled)
+    {
+        filter_cnt++;
+        if (old_name_compare(p_adv_report))
+        {
+            match_cnt++;
+            scan_evt.params.filter_match.filter_match.name_filter_match = true;
+        }
+    }
+    if (p_filters->short_name_filter.short_name_filter_enabled)
+    {
+        filter_cnt++;
+        if (old_short_name_compare(p_adv_report))
+        {
+            match_cnt++;
+            scan_evt.params.filter_match.filter_match.short_name_filter_match = true;
+        }
+    }
+    if (p_filters->uuid_filter.uuid_filter_enabled)
+    {
+        filter_cnt++;
+        if (old_uuid_compare(p_adv_report))
+        {
+            match_cnt++;
+            scan_evt.params.filter_match.filter_match.uuid_filter_match = true;
+        }
+    }
+    if (p_filters->appearance_filter.appearance_filter_enabled)
+    {
+        filter_cnt++;
+        if (old_appearance_compare(p_adv_report))
+        {
+            match_cnt++;
+            scan_evt.params.filter_match.filter_match.appearance_filter_match = true;
+        }
+    }
+
+    if (p_filters->all_filters_mode ? (match_cnt == filter_cnt) : (match_cnt > 0))
+    {
+        scan_evt.scan_evt_id = NRF_BLE_SCAN_EVT_FILTER_MATCH;
+    }
+    else
+    {
+        scan_evt.scan_evt_id = NRF_BLE_SCAN_EVT_NOT_FOUND;
+    }
+    scan_evt_handler(&scan_evt);
+}
+
+/* one report through nrf_ble_scan (q 1) or through the per filter search (q 0) */
+static bench_result_t report_match(int q, bench_report_t const * p_report)
+{
+    ble_evt_t evt;
+
+    memset(&evt, 0, sizeof(evt));
+    evt.header.evt_id                             = BLE_GAP_EVT_ADV_REPORT;
+    evt.evt.gap_evt.params.adv_report.peer_addr   = p_report->addr;
+    evt.evt.gap_evt.params.adv_report.data.p_data = (uint8_t *)p_report->data;
+    evt.evt.gap_evt.params.adv_report.data.len    = p_report->len;
+
+    if (q == 0)
+    {
+        old_on_adv_report(&evt.evt.gap_evt.params.adv_report);
+    }
+    else
+    {
+        nrf_ble_scan_on_ble_evt(&evt, &m_scan);
+    }
+    return m_result;
+}
+
+static double seconds(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* builds the advertising data of a made up report, field by field */
+static void ad_add(bench_report_t * p_report, uint8_t type, void const * p_data, uint8_t len)
+{
+    if ((size_t)p_report->len + 2 + len > sizeof(p_report->data))
+    {
+        return;
+    }
+    p_report->data[p_report->len++] = len + 1;
+    p_report->data[p_report->len++] = type;
+    memcpy(&p_report->data[p_report->len], p_data, len);
+    p_report->len += len;
+}
+
+static void ad_random(uint8_t * p_data, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++)
+    {
+        p_data[i] = (uint8_t)rand();
+    }
+}
+
+static char const * const m_names[] =
+{
+    "Nordic_UART", "Keyboard K380", "MX Master 3", "Thingy", "LE-Bose QC35",
+    "Galaxy Buds", "Mi Band 4", "ThermoBeacon", "Nordic_Blinky", "HRM Pro",
+};
+
+static uint16_t const m_appearances[] = {0x03C1, 0x03C2, 0x0340, 0x0941, 0x00C0, 0x0300};
+
+static void report_make(bench_report_t * p_report)
+{
+    static uint8_t const flags[] = {BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE};
+    uint8_t              buf[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+    char const         * p_name = m_names[(uint32_t)rand() % ARRAY_SIZE(m_names)];
+
+    memset(p_report, 0, sizeof(bench_report_t));
+    // a few addresses come back often, the filters pick theirs
+    if (rand() % 4 == 0)
+    {
+        memset(p_report->addr.addr, 0xC0 | (rand() % 8), BLE_GAP_ADDR_LEN);
+    }
+    else
+    {
+        ad_random(p_report->addr.addr, BLE_GAP_ADDR_LEN);
+    }
+
+    switch (rand() % 8)
+    {
+        case 0: // iBeacon
+            ad_add(p_report, BLE_GAP_AD_TYPE_FLAGS, flags, sizeof(flags));
+            buf[0] = 0x4C;
+            buf[1] = 0x00;
+            buf[2] = 0x02;
+            buf[3] = 0x15;
+            ad_random(&buf[4], 21);
+            ad_add(p_report, BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, buf, 25);
+            break;
+
+        case 1: // Eddystone, Fast Pair and Tile service data
+            ad_add(p_report, BLE_GAP_AD_TYPE_FLAGS, flags, sizeof(flags));
+            uint16_encode((rand() % 3 == 0) ? 0xFEAA : (rand() % 2) ? 0xFE2C : 0xFEED, buf);
+            ad_add(p_report, BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE, buf, 2);
+            ad_random(&buf[2], 18);
+            ad_add(p_report, BLE_GAP_AD_TYPE_SERVICE_DATA, buf, 2 + (rand() % 19));
+            break;
+
+        case 2: // NUS device, the UUID in the advertising data and the name in the scan response
+            if (rand() % 2)
+            {
+                ad_add(p_report, BLE_GAP_AD_TYPE_FLAGS, flags, sizeof(flags));
+                memcpy(buf, m_nus_base, sizeof(m_nus_base));
+                uint16_encode(0x0001, &buf[12]);
+                ad_add(p_report, BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_COMPLETE, buf, 16);
+                ad_add(p_report, BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME, p_name, 1 + rand() % 6);
+            }
+            else
+            {
+                ad_add(p_report, BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME, p_name, strlen(p_name));
+                uint16_encode(0x180A, buf);
+                ad_add(p_report, BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE, buf, 2);
+            }
+            break;
+
+        case 3: // HID
+            ad_add(p_report, BLE_GAP_AD_TYPE_FLAGS, flags, sizeof(flags));
+            uint16_encode(m_appearances[(uint32_t)rand() % ARRAY_SIZE(m_appearances)], buf);
+            ad_add(p_report, BLE_GAP_AD_TYPE_APPEARANCE, buf, 2);
+            uint16_encode(0x1812, buf);
+            uint16_encode(0x180F, &buf[2]);
+            ad_add(p_report, BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE, buf, 4);
+            ad_add(p_report, BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME, p_name, strlen(p_name));
+            break;
+
+        case 4: // name only
+            ad_add(p_report, BLE_GAP_AD_TYPE_FLAGS, flags, sizeof(flags));
+            ad_add(p_report, (rand() % 2) ? BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME
+                                          : BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME,
+                   p_name, 1 + rand() % strlen(p_name));
+            break;
+
+        case 5:
+        case 6: // manufacturer data
+            ad_add(p_report, BLE_GAP_AD_TYPE_FLAGS, flags, sizeof(flags));
+            ad_random(buf, 26);
+            ad_add(p_report, BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, buf, 2 + rand() % 25);
+            break;
+
+        default: // random fields, the last one may run past the data
+        {
+            static uint8_t const types[] =
+            {
+                BLE_GAP_AD_TYPE_FLAGS,
+                BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE,
+                BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE,
+                BLE_GAP_AD_TYPE_32BIT_SERVICE_UUID_COMPLETE,
+                BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE,
+                BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME,
+                BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME,
+                BLE_GAP_AD_TYPE_APPEARANCE,
+                BLE_GAP_AD_TYPE_SERVICE_DATA,
+            };
+
+            while (p_report->len < sizeof(p_report->data))
+            {
+                uint8_t const type = types[(uint32_t)rand() % ARRAY_SIZE(types)];
+                uint8_t       len  = (uint8_t)(rand() % 8);
+
+                // UUID lists hold whole UUIDs and an appearance is two bytes, the old search
+                // reads past the field otherwise
+                if ((type == BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE) ||
+                    (type == BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_COMPLETE) ||
+                    (type == BLE_GAP_AD_TYPE_APPEARANCE))
+                {
+                    len &= ~1;
+                    uint16_encode((rand() % 2) ? 0xFEAA : 0x1812, buf);
+                    uint16_encode(0x03C1, &buf[2]);
+                }
+                else if (type == BLE_GAP_AD_TYPE_32BIT_SERVICE_UUID_COMPLETE)
+                {
+                    len &= ~3;
+                    ad_random(buf, len);
+                }
+                else if (type == BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE)
+                {
+                    len = 16;
+                    memcpy(buf, m_nus_base, sizeof(m_nus_base));
+                }
+                else
+                {
+                    memcpy(buf, p_name, MIN(len, strlen(p_name)));
+                }
+
+                if ((size_t)p_report->len + 2 + len > sizeof(p_report->data))
+                {
+                    // a field which doesn't fit, the length says more than there is
+                    p_report->data[p_report->len++] = len + 1;
+                    if (p_report->len < sizeof(p_report->data))
+                    {
+                        p_report->data[p_report->len++] = type;
+                    }
+                    break;
+                }
+                if (rand() % 16 == 0)
+                {
+                    // an empty field, its length byte is 0
+                    p_report->data[p_report->len++] = 0;
+                    continue;
+                }
+                ad_add(p_report, type, buf, len);
+            }
+            break;
+        }
+    }
+}
+
+static int hex_value(char c)
+{
+    return (c >= '0' && c <= '9') ? c - '0' :
+           (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+           (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+}
+
+static uint16_t hex_parse(char const ** pp_text, uint8_t * p_out, uint16_t max_len)
+{
+    char const * p = *pp_text;
+    uint16_t     len = 0;
+
+    while (*p == ' ' || *p == '\t')
+    {
+        p++;
+    }
+    while ((hex_value(p[0]) >= 0) && (hex_value(p[1]) >= 0) && (len < max_len))
+    {
+        p_out[len++] = (uint8_t)(hex_value(p[0]) << 4 | hex_value(p[1]));
+        p += 2;
+    }
+    *pp_text = p;
+    return len;
+}
+
+static bool capture_read(char const * p_path)
+{
+    FILE * p_file = fopen(p_path, "r");
+    char   line[256];
+
+    if (p_file == NULL)
+    {
+        perror(p_path);
+        return false;
+    }
+    while ((m_report_cnt < SCANBENCH_MAX_REPORTS) && (fgets(line, sizeof(line), p_file) != NULL))
+    {
+        bench_report_t * p_report = &m_reports[m_report_cnt];
+        char const     * p        = line;
+
+        memset(p_report, 0, sizeof(bench_report_t));
+        if (hex_parse(&p, p_report->addr.addr, BLE_GAP_ADDR_LEN) != BLE_GAP_ADDR_LEN)
+        {
+            continue;
+        }
+        p_report->len = hex_parse(&p, p_report->data, sizeof(p_report->data));
+        m_report_cnt++;
+    }
+    fclose(p_file);
+    return m_report_cnt > 0;
+}
+
+/* the first n filters of each type, some of them seen in the reports and some not */
+static void filters_set(uint32_t n)
+{
+    static uint16_t const uuids[] = {0xFEAA, 0x1812, 0xFE2C, 0x0001, 0x180F, 0xFEED, 0x180A};
+    char                  names[SCANBENCH_MAX_FILTERS][NRF_BLE_SCAN_NAME_MAX_LEN];
+
+    UNUSED_RETURN_VALUE(nrf_ble_scan_all_filter_remove(&m_scan));
+    srand(n);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        ble_uuid_t                uuid;
+        nrf_ble_scan_short_name_t short_name;
+        uint8_t                   addr[BLE_GAP_ADDR_LEN];
+        uint16_t                  appearance;
+
+        // the names are tried from the last one, so the first filters don't always match
+        if (i < ARRAY_SIZE(m_names))
+        {
+            strcpy(names[i], m_names[ARRAY_SIZE(m_names) - 1 - i]);
+        }
+        else
+        {
+            sprintf(names[i], "Device %02X%02X", rand() % 256, rand() % 256);
+        }
+        APP_ERROR_CHECK(nrf_ble_scan_filter_set(&m_scan, SCAN_NAME_FILTER, names[i]));
+
+        short_name.p_short_name       = names[i];
+        short_name.short_name_min_len = (uint8_t)(rand() % 5);
+        APP_ERROR_CHECK(nrf_ble_scan_filter_set(&m_scan, SCAN_SHORT_NAME_FILTER, &short_name));
+
+        if (i % 2 == 0)
+        {
+            memset(addr, 0xC0 | (rand() % 8), sizeof(addr));
+        }
+        else
+        {
+            ad_random(addr, sizeof(addr));
+        }
+        APP_ERROR_CHECK(nrf_ble_scan_filter_set(&m_scan, SCAN_ADDR_FILTER, addr));
+
+        // the NUS UUID with its base, also one whose base is not known
+        uuid.uuid = (i < ARRAY_SIZE(uuids)) ? uuids[(i + 2) % ARRAY_SIZE(uuids)]
+                                            : (uint16_t)(0x2000 + rand() % 0x1000);
+        uuid.type = (uuid.uuid == 0x0001) ? BLE_UUID_TYPE_VENDOR_BEGIN :
+                    (i == 9)              ? BLE_UUID_TYPE_VENDOR_BEGIN + 1 : BLE_UUID_TYPE_BLE;
+        APP_ERROR_CHECK(nrf_ble_scan_filter_set(&m_scan, SCAN_UUID_FILTER, &uuid));
+
+        appearance = (i < ARRAY_SIZE(m_appearances)) ?
+                     m_appearances[ARRAY_SIZE(m_appearances) - 1 - i] : (uint16_t)rand();
+        APP_ERROR_CHECK(nrf_ble_scan_filter_set(&m_scan, SCAN_APPEARANCE_FILTER, &appearance));
+    }
+}
+
+/* compares both on every report and times them, returns the matches */
+static uint32_t config_run(uint8_t mode, bool match_all, uint32_t rounds, double ns[2])
+{
+    uint32_t matches = 0;
+
+    APP_ERROR_CHECK(nrf_ble_scan_filters_enable(&m_scan, mode, match_all));
+
+    for (uint32_t i = 0; i < m_report_cnt; i++)
+    {
+        bench_result_t old_result = report_match(0, &m_reports[i]);
+        bench_result_t new_result = report_match(1, &m_reports[i]);
+
+        if ((old_result.evt != new_result.evt) ||
+            (memcmp(&old_result.match, &new_result.match, sizeof(old_result.match)) != 0))
+        {
+            if (!m_failed)
+            {
+                printf("FAIL filters 0x%02x%s, report %u:", mode, match_all ? " all" : "", i);
+                for (uint16_t j = 0; j < m_reports[i].len; j++)
+                {
+                    printf(" %02x", m_reports[i].data[j]);
+                }
+                printf("\n");
+            }
+            m_failed = true;
+        }
+        matches += (new_result.evt == NRF_BLE_SCAN_EVT_FILTER_MATCH);
+    }
+
+    for (int q = 0; q < 2; q++)
+    {
+        double t = seconds();
+
+        for (uint32_t r = 0; r < rounds; r++)
+        {
+            for (uint32_t i = 0; i < m_report_cnt; i++)
+            {
+                (void)report_match(q, &m_reports[i]);
+            }
+        }
+        ns[q] = (seconds() - t) * 1e9 / ((double)rounds * m_report_cnt);
+    }
+
+    return matches;
+}
+
+int main(int argc, char * argv[])
+{
+    static const uint32_t counts[] = {1, 4, SCANBENCH_MAX_FILTERS};
+    static const struct
+    {
+        char const * p_name;
+        uint8_t      mode;
+    } configs[] =
+    {
+        {"address",    NRF_BLE_SCAN_ADDR_FILTER},
+        {"name",       NRF_BLE_SCAN_NAME_FILTER},
+        {"short name", NRF_BLE_SCAN_SHORT_NAME_FILTER},
+        {"uuid",       NRF_BLE_SCAN_UUID_FILTER},
+        {"appearance", NRF_BLE_SCAN_APPEARANCE_FILTER},
+        {"all types",  NRF_BLE_SCAN_ALL_FILTER},
+    };
+    uint32_t rounds = (argc > 1) ? (uint32_t)atoi(argv[1]) : 100;
+
+    if (argc > 2)
+    {
+        if (!capture_read(argv[2]))
+        {
+            return 2;
+        }
+    }
+    else
+    {
+        srand(1);
+        for (m_report_cnt = 0; m_report_cnt < SCANBENCH_REPORTS; m_report_cnt++)
+        {
+            report_make(&m_reports[m_report_cnt]);
+        }
+    }
+    APP_ERROR_CHECK(nrf_ble_scan_init(&m_scan, NULL, scan_evt_handler));
+
+    printf("%u reports\n", m_report_cnt);
+    printf("%7s %-10s %26s %26s\n", "", "", "one filter ns (matches)", "all filters ns (matches)");
+    for (uint32_t c = 0; c < ARRAY_SIZE(counts); c++)
+    {
+        filters_set(counts[c]);
+        for (uint32_t k = 0; k < ARRAY_SIZE(configs); k++)
+        {
+            double   any_ns[2];
+            double   all_ns[2];
+            uint32_t any_cnt = config_run(configs[k].mode, false, rounds, any_ns);
+            uint32_t all_cnt = config_run(configs[k].mode, true, rounds, all_ns);
+
+            printf("%4u x  %-10s %8.1f %8.1f (%5u)  %8.1f %8.1f (%5u)\n",
+                   counts[c], configs[k].p_name,
+                   any_ns[0], any_ns[1], any_cnt, all_ns[0], all_ns[1], all_cnt);
+        }
+    }
+
+    printf("%s\n", m_failed ? "results differ" : "results match");
+    return m_failed ? 1 : 0;
+}
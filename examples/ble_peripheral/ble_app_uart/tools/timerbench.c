@@ -0,0 +1,269 @@
+/*
+ * timerbench, compares the two app_timer queues (nrf_sortlist and nrf_pheap)
+ * on a host, at 8, 64 and 512 running timers
+ *
+ * insert:  N timers started into an empty queue, cost per start
+ * expire:  N repeating timers, the first one is popped and started again
+ *          with its next period, cost per expiry
+ * restart: a random timer is stopped and started again, cost per pair
+ *
+ * the expiry order of both queues is compared with each other, exits non
+ * zero if the times differ or go backwards.
+ *
+ * usage: timerbench [rounds, default 20000]
+ *
+ * build as described in sim/README:
+ * gcc -O2 -std=gnu99 -DNRF52832_XXAA -DNRF_SORTLIST_ENABLED=1 -DNRF_PHEAP_ENABLED=1 \
+ *     $INC tools/timerbench.c ../../../components/libraries/sortlist/nrf_sortlist.c \
+ *     ../../../components/libraries/pheap/nrf_pheap.c -o timerbench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "app_util.h"
+#include "nrf_sortlist.h"
+#include "nrf_pheap.h"
+
+#define TIMERBENCH_MAX_TIMERS               512
+#define TIMERBENCH_PERIOD_MAX               32768   // ticks, up to a second at 32768 Hz
+
+typedef struct
+{
+    nrf_sortlist_item_t list_item;
+    nrf_pheap_item_t    heap_item;
+    uint64_t            end_val;
+    uint32_t            period;
+} bench_timer_t;
+
+static bench_timer_t m_timers[TIMERBENCH_MAX_TIMERS];
+static uint64_t      m_order[2][TIMERBENCH_MAX_TIMERS * 4];
+static bool          m_failed;
+
+static bool list_compare(nrf_sortlist_item_t * p_item0, nrf_sortlist_item_t * p_item1)
+{
+    bench_timer_t * p0 = CONTAINER_OF(p_item0, bench_timer_t, list_item);
+    bench_timer_t * p1 = CONTAINER_OF(p_item1, bench_timer_t, list_item);
+
+    return p0->end_val <= p1->end_val;
+}
+
+static bool heap_compare(nrf_pheap_item_t * p_item0, nrf_pheap_item_t * p_item1)
+{
+    bench_timer_t * p0 = CONTAINER_OF(p_item0, bench_timer_t, heap_item);
+    bench_timer_t * p1 = CONTAINER_OF(p_item1, bench_timer_t, heap_item);
+
+    return p0->end_val <= p1->end_val;
+}
+
+NRF_SORTLIST_DEF(m_list, list_compare);
+NRF_PHEAP_DEF(m_heap, heap_compare);
+
+/* the two queues behind one interface, q 0 is the list, 1 the heap */
+static void q_add(int q, bench_timer_t * p_timer)
+{
+    if (q == 0)
+    {
+        nrf_sortlist_add(&m_list, &p_timer->list_item);
+    }
+    else
+    {
+        nrf_pheap_add(&m_heap, &p_timer->heap_item);
+    }
+}
+
+static bool q_remove(int q, bench_timer_t * p_timer)
+{
+    return (q == 0) ? nrf_sortlist_remove(&m_list, &p_timer->list_item)
+                    : nrf_pheap_remove(&m_heap, &p_timer->heap_item);
+}
+
+static bench_timer_t * q_pop(int q)
+{
+    if (q == 0)
+    {
+        nrf_sortlist_item_t * p_item = nrf_sortlist_pop(&m_list);
+        return p_item ? CONTAINER_OF(p_item, bench_timer_t, list_item) : NULL;
+    }
+    else
+    {
+        nrf_pheap_item_t * p_item = nrf_pheap_pop(&m_heap);
+        return p_item ? CONTAINER_OF(p_item, bench_timer_t, heap_item) : NULL;
+    }
+}
+
+static void q_clear(int q)
+{
+    while (q_pop(q) != NULL)
+    {
+    }
+}
+
+static double seconds(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* same timers, periods and start times for both queues */
+static void timers_init(uint32_t n, unsigned seed)
+{
+    srand(seed);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        m_timers[i].period  = 5 + (uint32_t)rand() % TIMERBENCH_PERIOD_MAX;
+        m_timers[i].end_val = m_timers[i].period;
+    }
+}
+
+static double insert_bench(int q, uint32_t n, uint32_t rounds)
+{
+    double t = 0;
+
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        double t0;
+
+        timers_init(n, r);
+        t0 = seconds();
+        for (uint32_t i = 0; i < n; i++)
+        {
+            q_add(q, &m_timers[i]);
+        }
+        t += seconds() - t0;
+        q_clear(q);
+    }
+
+    return t * 1e9 / ((double)rounds * n);
+}
+
+static double expire_bench(int q, uint32_t n, uint32_t rounds)
+{
+    uint32_t ops = rounds * 8;
+    uint64_t now = 0;
+    double   t;
+
+    timers_init(n, 1);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        q_add(q, &m_timers[i]);
+    }
+
+    t = seconds();
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        bench_timer_t * p_timer = q_pop(q);
+
+        if (p_timer->end_val < now)
+        {
+            m_failed = true;
+        }
+        now = p_timer->end_val;
+        if (i < ARRAY_SIZE(m_order[0]))
+        {
+            m_order[q][i] = now;
+        }
+        p_timer->end_val += p_timer->period;
+        q_add(q, p_timer);
+    }
+    t = seconds() - t;
+
+    q_clear(q);
+    return t * 1e9 / ops;
+}
+
+static double restart_bench(int q, uint32_t n, uint32_t rounds)
+{
+    uint32_t ops = rounds * 8;
+    double   t;
+
+    timers_init(n, 2);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        q_add(q, &m_timers[i]);
+    }
+
+    t = seconds();
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        bench_timer_t * p_timer = &m_timers[(uint32_t)rand() % n];
+
+        if (!q_remove(q, p_timer))
+        {
+            m_failed = true;
+        }
+        p_timer->end_val += (uint32_t)rand() % TIMERBENCH_PERIOD_MAX;
+        q_add(q, p_timer);
+    }
+    t = seconds() - t;
+
+    // whatever the history, the queue must still come out in order
+    for (uint32_t i = 0; i < n; i++)
+    {
+        m_order[q][i] = q_pop(q)->end_val;
+        if (i > 0 && m_order[q][i] < m_order[q][i - 1])
+        {
+            m_failed = true;
+        }
+    }
+    if (q_pop(q) != NULL)
+    {
+        m_failed = true;
+    }
+
+    return t * 1e9 / ops;
+}
+
+static void order_check(uint32_t n, char const * p_what)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (m_order[0][i] != m_order[1][i])
+        {
+            if (!m_failed)
+            {
+                printf("FAIL %s order, %u timers, at %u\n", p_what, n, i);
+            }
+            m_failed = true;
+            return;
+        }
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    static const uint32_t counts[] = {8, 64, 512};
+    uint32_t rounds = (argc > 1) ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("%8s %9s %17s %17s %17s\n", "", "", "insert ns", "expire ns", "restart ns");
+    for (uint32_t c = 0; c < ARRAY_SIZE(counts); c++)
+    {
+        uint32_t n = counts[c];
+        uint32_t r = MAX(rounds * 8 / n, 1);
+        double   ins[2];
+        double   exp[2];
+        double   rst[2];
+
+        for (int q = 0; q < 2; q++)
+        {
+            ins[q] = insert_bench(q, n, r);
+            exp[q] = expire_bench(q, n, rounds);
+        }
+        order_check(MIN(rounds * 8, ARRAY_SIZE(m_order[0])), "expire");
+
+        for (int q = 0; q < 2; q++)
+        {
+            rst[q] = restart_bench(q, n, rounds);
+        }
+        order_check(n, "restart");
+
+        printf("%4u timers %9s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+               n, "list/heap", ins[0], ins[1], exp[0], exp[1], rst[0], rst[1]);
+    }
+
+    printf("%s\n", m_failed ? "results differ" : "results match");
+    return m_failed ? 1 : 0;
+}
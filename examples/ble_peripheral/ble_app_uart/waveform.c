@@ -0,0 +1,548 @@
+#include <string.h>
+
+#include "waveform.h"
+
+static uint8_t dac_code(int32_t current)
+{
+    int32_t code = DAC_CODE_MID + current;
+
+    if (code < 0) return 0;
+    if (code > 0xFF) return 0xFF;
+    return (uint8_t)code;
+}
+
+static uint8_t const m_vmid[DAC_NUM_OF_CHANNELS] = {
+    DAC_CODE_MID, DAC_CODE_MID, DAC_CODE_MID, DAC_CODE_MID,
+    DAC_CODE_MID, DAC_CODE_MID, DAC_CODE_MID, DAC_CODE_MID,
+};
+
+/*
+ * spi burst of a segment going from prev to codes, in ticks
+ */
+static uint32_t seg_burst(uint8_t const * codes, uint8_t const * prev)
+{
+    uint32_t words = 1;
+
+    for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+    {
+        if (prev == NULL || codes[i] != prev[i]) words++;
+    }
+
+    return words * WAVEFORM_WORD_US * WAVEFORM_TICKS_PER_US;
+}
+
+static void seg_set(waveform_t * p_wave, waveform_seg_type_t type, uint32_t time, uint8_t const * codes)
+{
+    uint8_t seg = p_wave->num_of_segs;
+
+    memcpy(p_wave->seg_codes[seg], codes, DAC_NUM_OF_CHANNELS);
+    p_wave->seg_time[seg]   = time;
+    p_wave->seg_type[seg]   = (uint8_t)type;
+    p_wave->num_of_segs++;
+}
+
+static uint8_t * word_put(uint8_t * p, uint16_t w)
+{
+    *p++ = (uint8_t)(w >> 8);
+    *p++ = (uint8_t)(w);
+    return p;
+}
+
+/*
+ * append the words of seg, the channels that differ from prev (all if prev
+ * is NULL) then update-all.
+ */
+static void seg_encode(waveform_t * p_wave, uint8_t seg, uint8_t const * prev)
+{
+    uint8_t const * codes = p_wave->seg_codes[seg];
+    uint8_t * p = &p_wave->spi_words[p_wave->num_of_words * 2];
+    uint8_t words = 1;
+
+    for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+    {
+        if (prev == NULL || codes[i] != prev[i])
+        {
+            p = word_put(p, DAC_CMD_WRITE(i, codes[i]));
+            words++;
+        }
+    }
+
+    p = word_put(p, DAC_CMD_UPDATE_ALL);
+
+    p_wave->seg_words[seg]  = words;
+    p_wave->num_of_words   += words;
+}
+
+/*
+ * one word after the table, not part of the cycle, setting all channels to
+ * VMID at once. played alone to park the outputs on stop.
+ */
+static void park_put(waveform_t * p_wave)
+{
+    (void)word_put(&p_wave->spi_words[p_wave->num_of_words * 2], DAC_CMD_BROADCAST(DAC_CODE_MID));
+}
+
+/*
+ * outputs of seg change when its update-all is done, at the end of its burst
+ */
+static uint32_t seg_latch(waveform_t const * p_wave, uint8_t seg)
+{
+    return p_wave->seg_time[seg] + p_wave->seg_words[seg] * WAVEFORM_WORD_US * WAVEFORM_TICKS_PER_US;
+}
+
+/*
+ * (re)build spi_words from seg_codes. the first segment starts from VMID,
+ * where the rest segment of the previous cycle leaves all channels. each
+ * burst is started so that it ends at latch[seg], a burst that would start
+ * before the cycle does is left at 0 for wave_fits to reject.
+ */
+static void wave_encode(waveform_t * p_wave, uint32_t const * latch)
+{
+    p_wave->num_of_words = 0;
+
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+    {
+        uint32_t burst;
+
+        seg_encode(p_wave, seg, seg == 0 ? m_vmid : p_wave->seg_codes[seg - 1]);
+
+        burst = p_wave->seg_words[seg] * WAVEFORM_WORD_US * WAVEFORM_TICKS_PER_US;
+        p_wave->seg_time[seg] = (latch[seg] >= burst) ? latch[seg] - burst : 0;
+    }
+
+    park_put(p_wave);
+}
+
+ret_code_t waveform_compile_segments(uint16_t freq,
+                                     waveform_seg_desc_t const * p_segs,
+                                     uint8_t num_of_segs,
+                                     waveform_t * p_wave)
+{
+    uint8_t codes[WAVEFORM_MAX_SEGS][DAC_NUM_OF_CHANNELS];
+    uint32_t latch[WAVEFORM_MAX_SEGS];
+    uint32_t cycle;
+
+    if (p_segs == NULL || p_wave == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (freq < WAVEFORM_MIN_FREQ || freq > WAVEFORM_MAX_FREQ ||
+        num_of_segs == 0 || num_of_segs >= WAVEFORM_MAX_SEGS)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    cycle   = (1000000UL / freq) * WAVEFORM_TICKS_PER_US;
+
+    for (uint8_t seg = 0; seg < num_of_segs; seg++)
+    {
+        if (p_segs[seg].type > WAVEFORM_SEG_REST)
+        {
+            return NRF_ERROR_INVALID_PARAM;
+        }
+
+        for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+        {
+            codes[seg][i] = dac_code(p_segs[seg].current[i]);
+        }
+    }
+    memset(codes[num_of_segs], DAC_CODE_MID, DAC_NUM_OF_CHANNELS);
+
+    /*
+     * a segment lasts its duration from its latch to the next one, so the
+     * burst of the next segment (rest after the last) has to fit in it.
+     * rest needs its burst done, and time to rewind, before the cycle ends.
+     */
+    latch[0] = WAVEFORM_START_TICKS + seg_burst(codes[0], m_vmid);
+
+    for (uint8_t seg = 0; seg < num_of_segs; seg++)
+    {
+        uint32_t d = p_segs[seg].duration * WAVEFORM_TICKS_PER_US;
+
+        if (d > cycle || d < seg_burst(codes[seg + 1], codes[seg]))
+        {
+            return NRF_ERROR_INVALID_LENGTH;
+        }
+
+        latch[seg + 1] = latch[seg] + d;
+    }
+
+    if (latch[num_of_segs] + WAVEFORM_REWIND_US * WAVEFORM_TICKS_PER_US > cycle)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    memset(p_wave, 0, sizeof(waveform_t));
+    p_wave->cycle_time = cycle;
+
+    for (uint8_t seg = 0; seg < num_of_segs; seg++)
+    {
+        seg_set(p_wave, (waveform_seg_type_t)p_segs[seg].type, 0, codes[seg]);
+    }
+    seg_set(p_wave, WAVEFORM_SEG_REST, 0, codes[num_of_segs]);
+
+    wave_encode(p_wave, latch);
+
+    return NRF_SUCCESS;
+}
+
+ret_code_t waveform_compile(ble_incomming_message_t const * p_msg, waveform_t * p_wave)
+{
+    waveform_seg_desc_t segs[2];
+    uint8_t num_of_segs = 1;
+
+    if (p_msg == NULL || p_wave == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (p_msg->recycle_ratio > WAVEFORM_MAX_RECYCLE_RATIO)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    segs[0].type        = WAVEFORM_SEG_PULSE;
+    segs[0].duration    = p_msg->pulse_width;
+    for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+    {
+        segs[0].current[i] = p_msg->current[i];
+    }
+
+    if (p_msg->recycle_ratio != 0)
+    {
+        segs[1].type        = WAVEFORM_SEG_RECYCLE;
+        segs[1].duration    = (uint32_t)p_msg->pulse_width * p_msg->recycle_ratio;
+        for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+        {
+            segs[1].current[i] = (int16_t)(-p_msg->current[i] / (int16_t)p_msg->recycle_ratio);
+        }
+        num_of_segs++;
+    }
+
+    return waveform_compile_segments(p_msg->freq, segs, num_of_segs, p_wave);
+}
+
+ret_code_t waveform_compile_stream(uint16_t rate, waveform_t * p_wave)
+{
+    uint32_t cycle;
+
+    if (p_wave == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (rate < WAVEFORM_MIN_FREQ || rate > WAVEFORM_MAX_FREQ)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    cycle   = (1000000UL / rate) * WAVEFORM_TICKS_PER_US;
+
+    if (WAVEFORM_START_TICKS + seg_burst(m_vmid, NULL) + WAVEFORM_REWIND_US * WAVEFORM_TICKS_PER_US > cycle)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    memset(p_wave, 0, sizeof(waveform_t));
+    p_wave->cycle_time = cycle;
+
+    // all channels written, waveform_stream_set rewrites them in place
+    seg_set(p_wave, WAVEFORM_SEG_REST, WAVEFORM_START_TICKS, m_vmid);
+    seg_encode(p_wave, 0, NULL);
+    park_put(p_wave);
+
+    return NRF_SUCCESS;
+}
+
+void waveform_stream_set(waveform_t * p_wave, int8_t const * current)
+{
+    uint8_t * p = p_wave->spi_words;
+
+    for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+    {
+        uint8_t code = dac_code(current[i]);
+        uint16_t w = DAC_CMD_WRITE(i, code);
+
+        *p++ = (uint8_t)(w >> 8);
+        *p++ = (uint8_t)(w);
+        p_wave->seg_codes[0][i] = code;
+    }
+}
+
+/*
+ * VMID + (code - VMID) * scale, rounded half away from VMID
+ */
+static uint8_t code_scale(uint8_t code, uint16_t scale)
+{
+    int32_t delta = ((int32_t)code - DAC_CODE_MID) * scale;
+
+    delta = (delta + (delta < 0 ? -(WAVEFORM_SCALE_ONE / 2) : (WAVEFORM_SCALE_ONE / 2))) / WAVEFORM_SCALE_ONE;
+
+    return dac_code(delta);
+}
+
+void waveform_scale(waveform_t * p_wave, uint16_t scale)
+{
+    for (uint16_t i = 0; i < p_wave->num_of_words; i++)
+    {
+        uint16_t w = waveform_word_get(p_wave, i);
+
+        if (w & DAC_CMD_WRM_MODE) continue;  // not a channel write
+
+        w = DAC_CMD_WRITE(w >> 12, code_scale((uint8_t)(w >> 4), scale));
+        p_wave->spi_words[i * 2] = (uint8_t)(w >> 8);
+        p_wave->spi_words[i * 2 + 1] = (uint8_t)(w);
+    }
+
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+    {
+        for (int ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+        {
+            p_wave->seg_codes[seg][ch] = code_scale(p_wave->seg_codes[seg][ch], scale);
+        }
+    }
+}
+
+uint16_t waveform_word_get(waveform_t const * p_wave, uint16_t index)
+{
+    return (uint16_t)((p_wave->spi_words[index * 2] << 8) | p_wave->spi_words[index * 2 + 1]);
+}
+
+uint16_t waveform_seg_offset(waveform_t const * p_wave, uint8_t seg)
+{
+    uint16_t words = 0;
+
+    for (uint8_t i = 0; i < seg && i < p_wave->num_of_segs; i++)
+    {
+        words += p_wave->seg_words[i];
+    }
+
+    return words * 2;
+}
+
+uint16_t waveform_park_offset(waveform_t const * p_wave)
+{
+    return p_wave->num_of_words * 2;
+}
+
+uint32_t waveform_last_burst_end(waveform_t const * p_wave)
+{
+    return seg_latch(p_wave, p_wave->num_of_segs - 1);
+}
+
+/*
+ * replay all segments, leave output of each segment in out[seg][ch].
+ * dac is in WRM mode when the table starts, as set up by the engine.
+ */
+static void wave_replay(waveform_t const * p_wave, uint8_t out[][DAC_NUM_OF_CHANNELS])
+{
+    uint8_t reg[DAC_NUM_OF_CHANNELS];
+    uint8_t dac[DAC_NUM_OF_CHANNELS];
+    bool wtm = false;
+    uint16_t index = 0;
+
+    memset(reg, DAC_CODE_MID, sizeof(reg));
+    memset(dac, DAC_CODE_MID, sizeof(dac));
+
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+    {
+        for (uint8_t n = 0; n < p_wave->seg_words[seg]; n++, index++)
+        {
+            uint16_t w = waveform_word_get(p_wave, index);
+            uint8_t code = (uint8_t)(w >> 4);
+
+            switch (w >> 12)
+            {
+                case 0x8:
+                    wtm = false;
+                    break;
+                case 0x9:
+                    wtm = true;
+                    break;
+                case 0xA:
+                    for (int i = 0; i < DAC_NUM_OF_CHANNELS; i++)
+                    {
+                        if (w & (1 << i)) dac[i] = reg[i];
+                    }
+                    break;
+                case 0xB:   // write A and update all
+                    reg[0] = code;
+                    memcpy(dac, reg, sizeof(dac));
+                    break;
+                case 0xC:
+                    memset(reg, code, sizeof(reg));
+                    memset(dac, code, sizeof(dac));
+                    break;
+                case 0xD: case 0xE: case 0xF:
+                    break;
+                default:    // 0x0 - 0x7 channel write
+                    reg[w >> 12] = code;
+                    if (wtm) dac[w >> 12] = code;
+                    break;
+            }
+        }
+
+        memcpy(out[seg], dac, DAC_NUM_OF_CHANNELS);
+    }
+}
+
+/*
+ * from the latch of seg to the next one, the last one wraps to the first
+ * in next cycle
+ */
+static uint32_t seg_duration(waveform_t const * p_wave, uint8_t seg)
+{
+    if (seg + 1 < p_wave->num_of_segs)
+    {
+        return seg_latch(p_wave, seg + 1) - seg_latch(p_wave, seg);
+    }
+
+    return p_wave->cycle_time - seg_latch(p_wave, seg) + seg_latch(p_wave, 0);
+}
+
+/*
+ * balance ch using pulse and recycle segment. returns false if not possible.
+ * the pulse is left as the host asked for it, recycle is set to the code
+ * closest to cancelling it, what is left over is up to the imbalance limit.
+ * only seg_codes is changed, spi_words has to be encoded again after.
+ */
+static bool channel_balance(waveform_t * p_wave, uint8_t ch, uint8_t out[][DAC_NUM_OF_CHANNELS])
+{
+    int pulse = -1, recycle = -1;
+    int32_t a, r;
+    int64_t q;
+    uint32_t dp, dr;
+
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+    {
+        if (p_wave->seg_type[seg] == WAVEFORM_SEG_PULSE && pulse < 0) pulse = seg;
+        if (p_wave->seg_type[seg] == WAVEFORM_SEG_RECYCLE && recycle < 0) recycle = seg;
+    }
+
+    if (pulse < 0 || recycle < 0) return false;
+
+    a  = (int32_t)out[pulse][ch] - DAC_CODE_MID;
+    dp = seg_duration(p_wave, pulse);
+    dr = seg_duration(p_wave, recycle);
+
+    // a * dp + r * dr == 0, r rounded half away from VMID
+    q = -(int64_t)a * dp;
+    r = (int32_t)((q < 0 ? q - dr / 2 : q + dr / 2) / dr);
+
+    if (r < -DAC_CODE_MID || r > 0xFF - DAC_CODE_MID) return false;
+
+    p_wave->seg_codes[pulse][ch]    = (uint8_t)(DAC_CODE_MID + a);
+    p_wave->seg_codes[recycle][ch]  = (uint8_t)(DAC_CODE_MID + r);
+
+    return true;
+}
+
+/*
+ * first burst started after cycle start, every burst done before the next
+ * segment starts, and the last one WAVEFORM_REWIND_US before the cycle ends
+ */
+static bool wave_fits(waveform_t const * p_wave)
+{
+    if (p_wave->seg_time[0] < WAVEFORM_START_TICKS)
+    {
+        return false;
+    }
+
+    for (uint8_t seg = 0; seg + 1 < p_wave->num_of_segs; seg++)
+    {
+        if (seg_latch(p_wave, seg) > p_wave->seg_time[seg + 1])
+        {
+            return false;
+        }
+    }
+
+    return waveform_last_burst_end(p_wave) + WAVEFORM_REWIND_US * WAVEFORM_TICKS_PER_US <= p_wave->cycle_time;
+}
+
+static void wave_measure(waveform_t const * p_wave, uint8_t out[][DAC_NUM_OF_CHANNELS], waveform_report_t * p_report)
+{
+    memset(p_report, 0, sizeof(waveform_report_t));
+
+    for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+    {
+        uint32_t d = seg_duration(p_wave, seg);
+
+        for (uint8_t ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+        {
+            int32_t a = (int32_t)out[seg][ch] - DAC_CODE_MID;
+            uint8_t m = (uint8_t)(a < 0 ? -a : a);
+
+            p_report->charge[ch] += a * (int32_t)d;
+            if (m > p_report->peak[ch]) p_report->peak[ch] = m;
+        }
+    }
+}
+
+ret_code_t waveform_validate(waveform_t * p_wave,
+                             waveform_limits_t const * p_limits,
+                             bool correct,
+                             waveform_report_t * p_report)
+{
+    uint8_t out[WAVEFORM_MAX_SEGS][DAC_NUM_OF_CHANNELS];
+    uint32_t latch[WAVEFORM_MAX_SEGS];
+    waveform_report_t report;
+    ret_code_t err = NRF_SUCCESS;
+
+    if (p_wave == NULL || p_limits == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    wave_replay(p_wave, out);
+    wave_measure(p_wave, out, &report);
+
+    if (correct)
+    {
+        uint8_t corrected = 0;
+
+        for (uint8_t ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+        {
+            if ((uint32_t)(report.charge[ch] < 0 ? -report.charge[ch] : report.charge[ch]) > p_limits->max_imbalance &&
+                channel_balance(p_wave, ch, out))
+            {
+                corrected |= (uint8_t)(1 << ch);
+            }
+        }
+
+        // burst lengths may change, outputs keep changing when they did
+        if (corrected)
+        {
+            for (uint8_t seg = 0; seg < p_wave->num_of_segs; seg++)
+            {
+                latch[seg] = seg_latch(p_wave, seg);
+            }
+            wave_encode(p_wave, latch);
+            wave_replay(p_wave, out);
+            wave_measure(p_wave, out, &report);
+            report.corrected = corrected;
+        }
+    }
+
+    for (uint8_t ch = 0; ch < DAC_NUM_OF_CHANNELS; ch++)
+    {
+        uint32_t q = (uint32_t)(report.charge[ch] < 0 ? -report.charge[ch] : report.charge[ch]);
+
+        if (report.peak[ch] > p_limits->max_amplitude || q > p_limits->max_imbalance)
+        {
+            err = NRF_ERROR_INVALID_DATA;
+        }
+    }
+
+    if (err == NRF_SUCCESS && !wave_fits(p_wave))
+    {
+        err = NRF_ERROR_INVALID_LENGTH;
+    }
+
+    if (p_report != NULL)
+    {
+        *p_report = report;
+    }
+
+    return err;
+}
@@ -0,0 +1,223 @@
+#ifndef __WAVEFORM_H__
+#define __WAVEFORM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+#include "howland.h"
+
+/**
+ * Waveform compiler
+ *
+ * translates a ble_incomming_message_t into the buffers consumed by the
+ * timer/ppi/spi chain (see test8a):
+ * 1. spi_words, a packed table of DAC088S085 commands (MSB first), sent one
+ *    word per spi xfer with NRF_DRV_SPI_FLAG_TX_POSTINC | NRF_DRV_SPI_FLAG_REPEATED_XFER
+ * 2. seg_time, m_seg_timer compare values (from cycle start) at which each
+ *    segment's spi burst is kicked off via ppi.
+ * 3. seg_words, words in each segment's burst, m_seg_counter compares are
+ *    their running sums.
+ *
+ * No hardware is touched, waveform.c can be built on a host for checking
+ * tables bit for bit.
+ */
+
+/**
+ * DAC088S085 command words, 16bit, MSB first.
+ * channel write is 0xN dd x, where N is channel (0 for A, 7 for H), dd the 8bit data
+ */
+#define DAC_CMD_WRITE(ch, code)             ((uint16_t)((((ch) & 0x07) << 12) | (((code) & 0xFF) << 4)))
+#define DAC_CMD_WRM_MODE                    0x8000
+#define DAC_CMD_WTM_MODE                    0x9000
+#define DAC_CMD_UPDATE_SELECT(mask)         ((uint16_t)(0xA000 | ((mask) & 0xFF)))
+#define DAC_CMD_UPDATE_ALL                  0xA0FF
+#define DAC_CMD_BROADCAST(code)             ((uint16_t)(0xC000 | (((code) & 0xFF) << 4)))
+#define DAC_CMD_POWER_DOWN_HIZ(mask)        ((uint16_t)(0xD000 | ((mask) & 0xFF)))
+
+#define DAC_NUM_OF_CHANNELS                 8
+#define DAC_CODE_MID                        0x80    // VMID, zero current in howland pump
+
+/**
+ * Each segment writes the channels that change from the segment before (the
+ * first one from VMID) in WRM mode, then latches them with a single
+ * update-all, so all outputs change at the same time, when the update-all
+ * is done, words spi xfers after the burst starts. Bursts are started that
+ * far ahead, so a segment lasts its duration from its update to the next.
+ * A segment with no change is the update-all alone. Stream tables always
+ * write all channels.
+ * WAVEFORM_WORDS_PER_SEG is the most a segment takes.
+ */
+#define WAVEFORM_WORDS_PER_SEG              (DAC_NUM_OF_CHANNELS + 1)
+
+#define WAVEFORM_MAX_SEGS                   4       // pulse, recycle, rest, spare
+#define WAVEFORM_MAX_WORDS                  (WAVEFORM_MAX_SEGS * WAVEFORM_WORDS_PER_SEG)
+
+/**
+ * m_seg_timer runs with NRF_DRV_TIMER_DEFAULT_CONFIG (1MHz).
+ * The first segment can not start at 0 since compare event is not generated
+ * when timer is cleared into the compare value.
+ */
+#define WAVEFORM_TICKS_PER_US               1
+#define WAVEFORM_START_TICKS                1
+
+/**
+ * One spi xfer in the spi timer chain takes 48 ticks @ 16MHz (see test6e),
+ * round up to 3us. A segment shorter than the spi burst of the one after it
+ * is rejected.
+ */
+#define WAVEFORM_WORD_US                    3
+
+/**
+ * idle time left after the last burst of a cycle, for the once-per-cycle
+ * isr to rewind tx pointer (and swap tables) before next cycle starts.
+ */
+#define WAVEFORM_REWIND_US                  100
+
+#define WAVEFORM_MIN_FREQ                   1
+#define WAVEFORM_MAX_FREQ                   1000
+#define WAVEFORM_MAX_RECYCLE_RATIO          10
+
+typedef enum {
+    WAVEFORM_SEG_PULSE = 0,
+    WAVEFORM_SEG_RECYCLE,
+    WAVEFORM_SEG_REST,
+} waveform_seg_type_t;
+
+typedef struct waveform
+{
+    uint8_t     spi_words[(WAVEFORM_MAX_WORDS + 1) * 2];    // dma buffer, must be in RAM, park word last
+    uint32_t    seg_time[WAVEFORM_MAX_SEGS];        // seg timer compare, in ticks from cycle start
+    uint8_t     seg_words[WAVEFORM_MAX_SEGS];       // seg counter compare
+    uint8_t     seg_type[WAVEFORM_MAX_SEGS];        // waveform_seg_type_t
+    uint8_t     seg_codes[WAVEFORM_MAX_SEGS][DAC_NUM_OF_CHANNELS]; // dac output during segment
+    uint8_t     num_of_segs;
+    uint16_t    num_of_words;
+    uint32_t    cycle_time;                         // seg timer period, in ticks
+} waveform_t;
+
+/**
+ * one segment of a waveform description, current is dac code from VMID
+ * (clamped to 0 - 0xFF after adding VMID).
+ */
+typedef struct waveform_seg_desc
+{
+    uint8_t     type;                           // waveform_seg_type_t, used by charge balance
+    uint32_t    duration;                       // us
+    int16_t     current[DAC_NUM_OF_CHANNELS];
+} waveform_seg_desc_t;
+
+/**
+ * compile num_of_segs segments played back to back from cycle start,
+ * followed by a rest segment (all channels VMID) until the end of cycle.
+ * up to WAVEFORM_MAX_SEGS - 1 segments, the last one is taken by rest.
+ *
+ * errors as waveform_compile, p_wave is untouched on error.
+ */
+ret_code_t waveform_compile_segments(uint16_t freq,
+                                     waveform_seg_desc_t const * p_segs,
+                                     uint8_t num_of_segs,
+                                     waveform_t * p_wave);
+
+/**
+ * compile a START message into p_wave.
+ *
+ * pulse phase lasts pulse_width (us) with dac code VMID + current[i].
+ * recycle phase lasts pulse_width * recycle_ratio with VMID - current[i] / recycle_ratio.
+ * recycle_ratio 0 means no recycle phase.
+ * then all channels rest at VMID until the end of cycle (1 / freq).
+ *
+ * returns NRF_ERROR_NULL, NRF_ERROR_INVALID_PARAM if freq or recycle_ratio out of range,
+ * or NRF_ERROR_INVALID_LENGTH if segments don't fit in the cycle (with WAVEFORM_REWIND_US left)
+ * or are shorter than the spi burst of the next one.
+ * p_wave is untouched on error.
+ */
+ret_code_t waveform_compile(ble_incomming_message_t const * p_msg, waveform_t * p_wave);
+
+/**
+ * compile a stream waveform, a single segment at cycle start holding all
+ * channels for the whole cycle (1 / rate), VMID until set.
+ * errors as waveform_compile.
+ */
+ret_code_t waveform_compile_stream(uint16_t rate, waveform_t * p_wave);
+
+/**
+ * rewrite the channel words of a stream waveform in place, O(channels),
+ * safe from isr while spi_words is not being sent.
+ */
+void waveform_stream_set(waveform_t * p_wave, int8_t const * current);
+
+/**
+ * scale the amplitude of all channel writes (and seg_codes) of a compiled
+ * waveform in place, code = VMID + (code - VMID) * scale / WAVEFORM_SCALE_ONE.
+ * rounding may leave charge out of balance, validate after scaling.
+ */
+#define WAVEFORM_SCALE_ONE                  256
+
+void waveform_scale(waveform_t * p_wave, uint16_t scale);
+
+/**
+ * return the 16bit command word at index from a compiled waveform
+ */
+uint16_t waveform_word_get(waveform_t const * p_wave, uint16_t index);
+
+/**
+ * offset (in bytes) of segment's first word in spi_words
+ */
+uint16_t waveform_seg_offset(waveform_t const * p_wave, uint8_t seg);
+
+/**
+ * offset (in bytes) of the park word, a broadcast of VMID after the last
+ * segment. it is not played in the cycle, sent alone it sets all outputs
+ * to VMID at once.
+ */
+uint16_t waveform_park_offset(waveform_t const * p_wave);
+
+/**
+ * seg timer ticks from cycle start when the last spi burst is done.
+ * from here to the end of cycle nothing is read from spi_words.
+ */
+uint32_t waveform_last_burst_end(waveform_t const * p_wave);
+
+/**
+ * Safety check
+ *
+ * waveform_validate replays spi_words the way DAC088S085 would (WRM/WTM mode,
+ * update select, broadcast), so it checks what is actually sent, not what
+ * the message asked for. Output of each segment is integrated over its
+ * duration (from the end of its burst till the end of the next one, the last
+ * one wraps to the first in next cycle) per channel, in dac code (from VMID)
+ * x ticks.
+ */
+typedef struct waveform_limits
+{
+    uint8_t     max_amplitude;              // max |code - VMID| of any channel in any segment
+    uint32_t    max_imbalance;              // max |net charge| per cycle, code x tick
+} waveform_limits_t;
+
+typedef struct waveform_report
+{
+    int32_t     charge[DAC_NUM_OF_CHANNELS];    // net charge per cycle, code x tick
+    uint8_t     peak[DAC_NUM_OF_CHANNELS];      // max |code - VMID|
+    uint8_t     corrected;                      // bit mask of channels corrected
+} waveform_report_t;
+
+/**
+ * validate p_wave against p_limits, time linear in number of words.
+ *
+ * if correct is true, a channel out of balance is fixed when p_wave has a
+ * pulse and a recycle segment: recycle code is recomputed from the pulse
+ * charge, rounded to the closest code, and spi_words are encoded again. the
+ * pulse is never changed, if the rounding leaves more than max_imbalance
+ * the waveform is rejected. amplitude violations are never corrected.
+ *
+ * returns NRF_ERROR_INVALID_DATA if a limit is exceeded (after correction),
+ * NRF_ERROR_INVALID_LENGTH if a burst no longer fits before the next one starts.
+ * p_report (optional) holds the figures after correction.
+ */
+ret_code_t waveform_validate(waveform_t * p_wave,
+                             waveform_limits_t const * p_limits,
+                             bool correct,
+                             waveform_report_t * p_report);
+
+#endif